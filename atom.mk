@@ -10,10 +10,90 @@ LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/include
 LOCAL_CFLAGS := -DTPKT_API_EXPORTS -fvisibility=hidden -std=gnu99
 LOCAL_SRC_FILES := \
 	src/tpkt.c \
-	src/tpkt_list.c
+	src/tpkt_aggr.c \
+	src/tpkt_arena.c \
+	src/tpkt_capture.c \
+	src/tpkt_csum.c \
+	src/tpkt_demux.c \
+	src/tpkt_fec.c \
+	src/tpkt_frag.c \
+	src/tpkt_history.c \
+	src/tpkt_jitter.c \
+	src/tpkt_leak.c \
+	src/tpkt_list.c \
+	src/tpkt_mem.c \
+	src/tpkt_netem.c \
+	src/tpkt_pool.c \
+	src/tpkt_replay.c \
+	src/tpkt_stats.c \
+	src/tpkt_trace.c
+ifeq ("$(TARGET_OS)","linux")
+LOCAL_SRC_FILES += \
+	src/tpkt_io.c \
+	src/tpkt_pipeline.c \
+	src/tpkt_rx_engine.c
+endif
 LOCAL_LIBRARIES := \
 	libfutils \
 	libpomp \
 	libulog
 
+# Compile out the argument checks of the per-packet functions
+# (e.g. make TPKT_DISABLE_ARG_CHECKS=1 for release builds)
+ifeq ("$(TPKT_DISABLE_ARG_CHECKS)","1")
+LOCAL_CFLAGS += -DTPKT_DISABLE_ARG_CHECKS
+endif
+
+# Packet lifecycle tracing (e.g. make TPKT_TRACE=1), see
+# transport-packet/tpkt_trace.h
+ifeq ("$(TPKT_TRACE)","1")
+LOCAL_CFLAGS += -DTPKT_TRACE
+endif
+
+# USDT static tracepoints (e.g. make TPKT_USDT=1, requires <sys/sdt.h>),
+# see src/tpkt_probes.h and tools/bpftrace
+ifeq ("$(TPKT_USDT)","1")
+LOCAL_CFLAGS += -DTPKT_USDT
+endif
+
+# Live packet leak tracker (e.g. make TPKT_LEAK_TRACKER=1), see
+# transport-packet/tpkt_leak.h
+ifeq ("$(TPKT_LEAK_TRACKER)","1")
+LOCAL_CFLAGS += -DTPKT_LEAK_TRACKER
+ifeq ("$(TARGET_OS)","linux")
+LOCAL_LDLIBS += -ldl
+endif
+endif
+
 include $(BUILD_LIBRARY)
+
+
+ifeq ("$(TARGET_OS)","linux")
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := tpkt-bench
+LOCAL_CATEGORY_PATH := libs/transport-packet
+LOCAL_DESCRIPTION := Transport packet library benchmarks
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	bench/tpkt_bench.c \
+	bench/tpkt_bench_access.c \
+	bench/tpkt_bench_alloc.c \
+	bench/tpkt_bench_arena.c \
+	bench/tpkt_bench_csum.c \
+	bench/tpkt_bench_e2e.c \
+	bench/tpkt_bench_fec.c \
+	bench/tpkt_bench_list.c \
+	bench/tpkt_bench_ops.c \
+	bench/tpkt_bench_pool.c \
+	bench/tpkt_bench_ref.c \
+	bench/tpkt_bench_rx.c
+LOCAL_LIBRARIES := \
+	libpomp \
+	libtransport-packet
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_EXECUTABLE)
+
+endif
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_bench.h"
+
+
+static const struct tpkt_bench *const benches[] = {
+	&tpkt_bench_rx,
+	&tpkt_bench_fec,
+	&tpkt_bench_csum,
+	&tpkt_bench_pool,
+	&tpkt_bench_arena,
+	&tpkt_bench_ref,
+	&tpkt_bench_access,
+	&tpkt_bench_list,
+	&tpkt_bench_ops,
+	&tpkt_bench_e2e,
+};
+
+
+void tpkt_bench_result_print(const struct tpkt_bench_result *result)
+{
+	printf("{\"bench\":\"%s\",\"op\":\"%s\",\"size\":%zu,"
+	       "\"ops\":%" PRIu64 ",\"ns_per_op\":%.2f,",
+	       result->bench,
+	       result->op,
+	       result->size,
+	       result->ops,
+	       result->ns_per_op);
+	if (result->allocs_per_op < 0)
+		printf("\"allocs_per_op\":null}\n");
+	else
+		printf("\"allocs_per_op\":%.2f}\n", result->allocs_per_op);
+}
+
+
+static void usage(const char *progname)
+{
+	size_t i;
+
+	printf("Usage: %s <benchmark> [options]\n\n", progname);
+	printf("Benchmarks:\n");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		printf("  %-12s %s\n", benches[i]->name, benches[i]->desc);
+	printf("\nUse '%s <benchmark> -h' for the benchmark options\n",
+	       progname);
+}
+
+
+int main(int argc, char **argv)
+{
+	int res;
+	size_t i;
+
+	if (argc < 2 || strcmp(argv[1], "-h") == 0 ||
+	    strcmp(argv[1], "--help") == 0) {
+		usage(argv[0]);
+		return (argc < 2) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (strcmp(argv[1], benches[i]->name) != 0)
+			continue;
+		res = benches[i]->run(argc - 1, argv + 1);
+		if (res < 0) {
+			fprintf(stderr,
+				"%s: %s (%d)\n",
+				benches[i]->name,
+				strerror(-res),
+				res);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	fprintf(stderr, "unknown benchmark '%s'\n", argv[1]);
+	usage(argv[0]);
+	return EXIT_FAILURE;
+}
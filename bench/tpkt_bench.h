@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_BENCH_H_
+#define _TPKT_BENCH_H_
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/* Benchmark description */
+struct tpkt_bench {
+	/* Benchmark name (command line sub-command) */
+	const char *name;
+
+	/* Short description */
+	const char *desc;
+
+	/* Benchmark entry point; argv[0] is the benchmark name;
+	 * returns 0 on success, negative errno value in case of error */
+	int (*run)(int argc, char **argv);
+};
+
+
+extern const struct tpkt_bench tpkt_bench_rx;
+extern const struct tpkt_bench tpkt_bench_fec;
+extern const struct tpkt_bench tpkt_bench_csum;
+extern const struct tpkt_bench tpkt_bench_pool;
+extern const struct tpkt_bench tpkt_bench_arena;
+extern const struct tpkt_bench tpkt_bench_ref;
+extern const struct tpkt_bench tpkt_bench_access;
+extern const struct tpkt_bench tpkt_bench_list;
+extern const struct tpkt_bench tpkt_bench_ops;
+extern const struct tpkt_bench tpkt_bench_e2e;
+
+
+/* Machine-readable benchmark result */
+struct tpkt_bench_result {
+	/* Benchmark name */
+	const char *bench;
+
+	/* Measured operation */
+	const char *op;
+
+	/* Operation size parameter (packet capacity, list length...),
+	 * 0 if not applicable */
+	size_t size;
+
+	/* Number of measured operations */
+	uint64_t ops;
+
+	/* Time per operation in nanoseconds */
+	double ns_per_op;
+
+	/* Allocations per operation, negative if not available */
+	double allocs_per_op;
+};
+
+
+/* Print a benchmark result as a JSON object on a single line */
+void tpkt_bench_result_print(const struct tpkt_bench_result *result);
+
+
+/* Number of allocations made so far by the calling thread,
+ * -1 if allocation counting is not available */
+int64_t tpkt_bench_alloc_count(void);
+
+
+/* Monotonic clock in nanoseconds */
+static inline uint64_t tpkt_bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+#endif /* !_TPKT_BENCH_H_ */
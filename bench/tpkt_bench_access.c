@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+#include <transport-packet/tpkt_inline.h>
+
+
+/* Keeps the getter results from being optimized out */
+static volatile uint64_t access_bench_sink;
+
+
+static double access_bench_exported(struct tpkt_packet **pkts,
+				    size_t count,
+				    unsigned int passes)
+{
+	size_t i, len;
+	unsigned int p;
+	uint64_t start, sum = 0;
+	const void *data;
+
+	start = tpkt_bench_now_ns();
+	for (p = 0; p < passes; p++) {
+		for (i = 0; i < count; i++) {
+			tpkt_get_cdata(pkts[i], &data, &len, NULL);
+			sum += tpkt_get_timestamp(pkts[i]) +
+			       tpkt_get_priority(pkts[i]) +
+			       tpkt_get_addr(pkts[i])->sin_port + len;
+		}
+	}
+	access_bench_sink = sum;
+	return (double)(tpkt_bench_now_ns() - start) /
+	       ((double)count * passes);
+}
+
+
+static double access_bench_inline(struct tpkt_packet **pkts,
+				  size_t count,
+				  unsigned int passes)
+{
+	size_t i, len;
+	unsigned int p;
+	uint64_t start, sum = 0;
+	const void *data;
+
+	start = tpkt_bench_now_ns();
+	for (p = 0; p < passes; p++) {
+		for (i = 0; i < count; i++) {
+			tpkt_fast_get_cdata(pkts[i], &data, &len, NULL);
+			sum += tpkt_fast_get_timestamp(pkts[i]) +
+			       tpkt_fast_get_priority(pkts[i]) +
+			       tpkt_fast_get_addr(pkts[i])->sin_port + len;
+		}
+	}
+	access_bench_sink = sum;
+	return (double)(tpkt_bench_now_ns() - start) /
+	       ((double)count * passes);
+}
+
+
+static void access_bench_usage(void)
+{
+	printf("Exported vs inline packet getters\n\n"
+	       "Options:\n"
+	       "  -c <count>  packet count (default: 1024)\n"
+	       "  -p <count>  passes over the packets (default: 10000)\n");
+}
+
+
+static int access_bench_run(int argc, char **argv)
+{
+	int res, c;
+	size_t i, count = 1024;
+	unsigned int passes = 10000;
+	struct tpkt_pool *pool = NULL;
+	struct tpkt_packet **pkts = NULL;
+	double exported, inlined;
+
+	while ((c = getopt(argc, argv, "c:p:h")) != -1) {
+		switch (c) {
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		case 'h':
+			access_bench_usage();
+			return 0;
+		default:
+			access_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (count == 0 || passes == 0)
+		return -EINVAL;
+
+	if (tpkt_get_packet_abi_version() != TPKT_PACKET_ABI_VERSION) {
+		fprintf(stderr,
+			"packet ABI version mismatch: %u (library) vs %u\n",
+			tpkt_get_packet_abi_version(),
+			TPKT_PACKET_ABI_VERSION);
+		return -EPROTO;
+	}
+
+	res = tpkt_pool_new(count, 256, &pool);
+	if (res < 0)
+		return res;
+	pkts = calloc(count, sizeof(*pkts));
+	if (pkts == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		res = tpkt_pool_get(pool, &pkts[i]);
+		if (res < 0)
+			goto out;
+		tpkt_set_len(pkts[i], i & 255);
+		tpkt_set_timestamp(pkts[i], i);
+		tpkt_set_priority(pkts[i], i & 7);
+	}
+
+	exported = access_bench_exported(pkts, count, passes);
+	inlined = access_bench_inline(pkts, count, passes);
+	printf("%-10s %10s\n", "getters", "ns/pkt");
+	printf("%-10s %10.2f\n", "exported", exported);
+	printf("%-10s %10.2f\n", "inline", inlined);
+	printf("speedup %.1fx\n", exported / inlined);
+
+out:
+	if (pkts != NULL) {
+		for (i = 0; i < count; i++) {
+			if (pkts[i] != NULL)
+				tpkt_unref(pkts[i]);
+		}
+	}
+	free(pkts);
+	tpkt_pool_destroy(pool);
+	return res;
+}
+
+
+const struct tpkt_bench tpkt_bench_access = {
+	.name = "access",
+	.desc = "Exported vs inline packet getters",
+	.run = access_bench_run,
+};
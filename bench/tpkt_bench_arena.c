@@ -0,0 +1,303 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+#include <transport-packet/tpkt_arena.h>
+
+
+/* Upper bound of the per-packet arena overhead (packet object and
+ * alignment) used to size the arenas */
+#define ARENA_PKT_OVERHEAD 512
+
+
+/* Keeps the payload reads from being optimized out */
+static volatile uint64_t arena_bench_sink;
+
+
+enum arena_bench_mode {
+	ARENA_BENCH_HEAP = 0,
+	ARENA_BENCH_NORMAL,
+	ARENA_BENCH_AUTO,
+};
+
+
+static const char *const arena_bench_mode_names[] = {
+	[ARENA_BENCH_HEAP] = "heap",
+	[ARENA_BENCH_NORMAL] = "arena-normal",
+	[ARENA_BENCH_AUTO] = "arena-auto",
+};
+
+
+/* Open a dTLB read miss counter for the calling thread; returns -1 if
+ * perf counters are not available */
+static int arena_bench_perf_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/* Anonymous memory backed by transparent huge pages in kB */
+static long arena_bench_thp_kb(void)
+{
+	FILE *f;
+	char line[128];
+	long kb = -1;
+
+	f = fopen("/proc/self/smaps_rollup", "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+			break;
+	}
+	fclose(f);
+	return kb;
+}
+
+
+static int arena_bench_run_mode(enum arena_bench_mode mode,
+				size_t count,
+				size_t cap,
+				unsigned int passes)
+{
+	int res, perf_fd;
+	size_t i, j, len;
+	uint64_t start, elapsed, misses = 0, sum = 0;
+	long thp_kb;
+	const char *page_type;
+	struct tpkt_arena *arena = NULL;
+	struct tpkt_pool *pool = NULL;
+	struct tpkt_list *list = NULL;
+	struct tpkt_packet **pkts = NULL, *pkt, *tmp;
+	struct tpkt_arena_cfg arena_cfg;
+	struct tpkt_pool_cfg pool_cfg = {
+		.count = count,
+		.cap = cap,
+	};
+	const uint8_t *cdata;
+	void *data;
+
+	if (mode != ARENA_BENCH_HEAP) {
+		memset(&arena_cfg, 0, sizeof(arena_cfg));
+		arena_cfg.size = count * (cap + ARENA_PKT_OVERHEAD);
+		arena_cfg.page_type = (mode == ARENA_BENCH_AUTO)
+					      ? TPKT_ARENA_PAGE_AUTO
+					      : TPKT_ARENA_PAGE_NORMAL;
+		res = tpkt_arena_new(&arena_cfg, &arena);
+		if (res < 0)
+			return res;
+		pool_cfg.arena = arena;
+		page_type = tpkt_arena_page_type_to_str(
+			tpkt_arena_get_page_type(arena));
+	} else {
+		page_type = "-";
+	}
+
+	res = tpkt_pool_new_with_cfg(&pool_cfg, &pool);
+	if (res < 0)
+		goto out;
+	res = tpkt_list_new(&list);
+	if (res < 0)
+		goto out;
+	pkts = calloc(count, sizeof(*pkts));
+	if (pkts == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		res = tpkt_pool_get(pool, &pkts[i]);
+		if (res < 0)
+			goto out;
+		res = tpkt_get_data(pkts[i], &data, NULL, NULL);
+		if (res < 0)
+			goto out;
+		memset(data, (int)i, cap);
+		tpkt_set_len(pkts[i], cap);
+	}
+
+	/* Queue the packets in random order, as after some time of
+	 * operation of a relay with many flows */
+	srand(1);
+	for (i = count - 1; i > 0; i--) {
+		j = (((size_t)rand() << 16) ^ rand()) % (i + 1);
+		tmp = pkts[i];
+		pkts[i] = pkts[j];
+		pkts[j] = tmp;
+	}
+	for (i = 0; i < count; i++) {
+		res = tpkt_list_add_last(list, pkts[i]);
+		if (res < 0)
+			goto out;
+		tpkt_unref(pkts[i]);
+		pkts[i] = NULL;
+	}
+
+	perf_fd = arena_bench_perf_open();
+	if (perf_fd >= 0) {
+		ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = tpkt_bench_now_ns();
+	for (i = 0; i < passes; i++) {
+		/* Walk the queue, reading the packet headers and the first
+		 * and last byte of each payload */
+		for (pkt = tpkt_list_first(list); pkt != NULL;
+		     pkt = tpkt_list_next(list, pkt)) {
+			tpkt_get_cdata(pkt, (const void **)&cdata, &len, NULL);
+			sum += cdata[0] + cdata[len - 1];
+		}
+	}
+	elapsed = tpkt_bench_now_ns() - start;
+	if (perf_fd >= 0) {
+		ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perf_fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = 0;
+		close(perf_fd);
+	}
+	thp_kb = arena_bench_thp_kb();
+
+	printf("%-14s %-8s %10.2f",
+	       arena_bench_mode_names[mode],
+	       page_type,
+	       (double)elapsed / ((double)count * passes));
+	if (perf_fd >= 0)
+		printf(" %14.3f", (double)misses / ((double)count * passes));
+	else
+		printf(" %14s", "n/a");
+	if (thp_kb >= 0)
+		printf(" %10ld", thp_kb / 1024);
+	else
+		printf(" %10s", "n/a");
+	printf("\n");
+	arena_bench_sink = sum;
+	res = 0;
+
+out:
+	if (pkts != NULL) {
+		for (i = 0; i < count; i++) {
+			if (pkts[i] != NULL)
+				tpkt_unref(pkts[i]);
+		}
+	}
+	free(pkts);
+	if (list != NULL) {
+		tpkt_list_flush(list);
+		tpkt_list_destroy(list);
+	}
+	tpkt_pool_destroy(pool);
+	tpkt_arena_destroy(arena);
+	return res;
+}
+
+
+static void arena_bench_usage(void)
+{
+	printf("Packet queue walk with heap and arena backed pools\n\n"
+	       "Options:\n"
+	       "  -m <MB>     payload memory in MB (default: 256)\n"
+	       "  -l <bytes>  packet capacity (default: 1500)\n"
+	       "  -p <count>  passes over the queue (default: 5)\n");
+}
+
+
+static int arena_bench_run(int argc, char **argv)
+{
+	int res, c;
+	size_t mem_mb = 256, cap = 1500, count;
+	unsigned int passes = 5;
+	enum arena_bench_mode mode;
+
+	while ((c = getopt(argc, argv, "m:l:p:h")) != -1) {
+		switch (c) {
+		case 'm':
+			mem_mb = atoi(optarg);
+			break;
+		case 'l':
+			cap = atoi(optarg);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		case 'h':
+			arena_bench_usage();
+			return 0;
+		default:
+			arena_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (mem_mb == 0 || cap == 0 || passes == 0)
+		return -EINVAL;
+	count = mem_mb * 1024 * 1024 / cap;
+
+	printf("%zu packets of %zu bytes, %u passes\n", count, cap, passes);
+	printf("%-14s %-8s %10s %14s %10s\n",
+	       "pool",
+	       "pages",
+	       "ns/pkt",
+	       "dTLB-miss/pkt",
+	       "THP MB");
+	for (mode = ARENA_BENCH_HEAP; mode <= ARENA_BENCH_AUTO; mode++) {
+		res = arena_bench_run_mode(mode, count, cap, passes);
+		if (res < 0) {
+			fprintf(stderr,
+				"%s: %s\n",
+				arena_bench_mode_names[mode],
+				strerror(-res));
+			return res;
+		}
+	}
+
+	return 0;
+}
+
+
+const struct tpkt_bench tpkt_bench_arena = {
+	.name = "arena",
+	.desc = "Packet queue walk TLB misses with huge page arenas",
+	.run = arena_bench_run,
+};
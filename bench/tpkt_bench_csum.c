@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <getopt.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+#include <transport-packet/tpkt_csum.h>
+
+
+static const size_t csum_bench_sizes[] = {64, 256, 1500, 9000, 65536};
+
+
+static void csum_bench_usage(void)
+{
+	printf("Internet checksum and CRC32C throughput\n\n"
+	       "Options:\n"
+	       "  -t <msec>   duration per measurement in ms (default: 200)\n");
+}
+
+
+/* Returns the throughput in GB/s */
+static double csum_bench_inet(const uint8_t *data, size_t len, uint64_t dur)
+{
+	uint64_t start, elapsed, iters = 0;
+	volatile uint16_t csum;
+
+	start = tpkt_bench_now_ns();
+	do {
+		csum = tpkt_csum_inet(data, len);
+		iters++;
+		elapsed = tpkt_bench_now_ns() - start;
+	} while (elapsed < dur);
+	(void)csum;
+
+	return (double)iters * len / elapsed;
+}
+
+
+/* Returns the throughput in GB/s */
+static double csum_bench_crc32c(const uint8_t *data, size_t len, uint64_t dur)
+{
+	uint64_t start, elapsed, iters = 0;
+	volatile uint32_t crc;
+
+	start = tpkt_bench_now_ns();
+	do {
+		crc = tpkt_crc32c(0, data, len);
+		iters++;
+		elapsed = tpkt_bench_now_ns() - start;
+	} while (elapsed < dur);
+	(void)crc;
+
+	return (double)iters * len / elapsed;
+}
+
+
+static int csum_bench_run(int argc, char **argv)
+{
+	int c;
+	size_t i, max_len = 0;
+	uint64_t duration = 200;
+	uint8_t *data;
+	double inet[2], crc[2];
+
+	while ((c = getopt(argc, argv, "t:h")) != -1) {
+		switch (c) {
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'h':
+			csum_bench_usage();
+			return 0;
+		default:
+			csum_bench_usage();
+			return -EINVAL;
+		}
+	}
+	duration *= 1000000;
+
+	for (i = 0; i < sizeof(csum_bench_sizes) / sizeof(csum_bench_sizes[0]);
+	     i++) {
+		if (csum_bench_sizes[i] > max_len)
+			max_len = csum_bench_sizes[i];
+	}
+	data = malloc(max_len);
+	if (data == NULL)
+		return -ENOMEM;
+	srand(1);
+	for (i = 0; i < max_len; i++)
+		data[i] = rand();
+
+	tpkt_csum_set_impl(TPKT_CSUM_IMPL_AUTO);
+	printf("inet: %s, crc32c: %s (GB/s, scalar reference in parentheses)\n",
+	       tpkt_csum_inet_get_impl_name(),
+	       tpkt_crc32c_get_impl_name());
+	printf("%-8s %20s %20s\n", "bytes", "inet", "crc32c");
+	for (i = 0; i < sizeof(csum_bench_sizes) / sizeof(csum_bench_sizes[0]);
+	     i++) {
+		tpkt_csum_set_impl(TPKT_CSUM_IMPL_SCALAR);
+		inet[0] = csum_bench_inet(data, csum_bench_sizes[i], duration);
+		crc[0] = csum_bench_crc32c(data, csum_bench_sizes[i], duration);
+		tpkt_csum_set_impl(TPKT_CSUM_IMPL_AUTO);
+		inet[1] = csum_bench_inet(data, csum_bench_sizes[i], duration);
+		crc[1] = csum_bench_crc32c(data, csum_bench_sizes[i], duration);
+		printf("%-8zu %10.2f (%7.2f) %10.2f (%7.2f)\n",
+		       csum_bench_sizes[i],
+		       inet[1],
+		       inet[0],
+		       crc[1],
+		       crc[0]);
+	}
+
+	free(data);
+	return 0;
+}
+
+
+const struct tpkt_bench tpkt_bench_csum = {
+	.name = "csum",
+	.desc = "Internet checksum and CRC32C throughput vs scalar reference",
+	.run = csum_bench_run,
+};
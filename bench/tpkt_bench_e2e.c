@@ -0,0 +1,558 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+#include <transport-packet/tpkt_io.h>
+#include <transport-packet/tpkt_rx_engine.h>
+
+
+/* Latency histogram: 1 microsecond buckets up to 100 ms */
+#define E2E_LAT_BUCKETS 100000
+
+#define E2E_POOL_SIZE 1024
+#define E2E_PACKET_CAP 2048
+
+
+/* Header written at the beginning of each payload */
+struct e2e_hdr {
+	uint64_t seq;
+	uint64_t timestamp;
+};
+
+
+enum e2e_mode {
+	/* One sendmsg() / recvmsg() call per packet */
+	E2E_MODE_SINGLE = 0,
+
+	/* tpkt_send_list() and the receive engine (recvmmsg()) */
+	E2E_MODE_BATCH,
+};
+
+
+struct e2e_bench {
+	enum e2e_mode mode;
+	size_t payload_len;
+	unsigned int batch_size;
+	uint64_t rate;
+	struct sockaddr_in addr;
+	int fd;
+	int stop;
+	int rx_stop;
+
+	/* Sender statistics */
+	uint64_t sent;
+	uint64_t send_errors;
+
+	/* Receiver statistics (updated by the receiver thread only) */
+	uint64_t received;
+	uint64_t bytes;
+	uint64_t lat_overflow;
+	uint64_t lat_max;
+	uint64_t *lat;
+};
+
+
+static const char *e2e_mode_str(enum e2e_mode mode)
+{
+	switch (mode) {
+	case E2E_MODE_SINGLE:
+		return "single";
+	case E2E_MODE_BATCH:
+		return "batch";
+	default:
+		return "unknown";
+	}
+}
+
+
+static uint64_t e2e_now_us(void)
+{
+	return tpkt_bench_now_ns() / 1000;
+}
+
+
+/* Account a received packet; its timestamp is the receive time */
+static void e2e_bench_account(struct e2e_bench *bench, struct tpkt_packet *pkt)
+{
+	int res;
+	const void *data;
+	size_t len;
+	struct e2e_hdr hdr;
+	uint64_t lat;
+
+	res = tpkt_get_cdata(pkt, &data, &len, NULL);
+	if (res < 0 || len < sizeof(hdr))
+		return;
+	memcpy(&hdr, data, sizeof(hdr));
+
+	bench->received++;
+	bench->bytes += len;
+	lat = tpkt_get_timestamp(pkt) - hdr.timestamp;
+	if (lat > bench->lat_max)
+		bench->lat_max = lat;
+	if (lat < E2E_LAT_BUCKETS)
+		bench->lat[lat]++;
+	else
+		bench->lat_overflow++;
+}
+
+
+/* Latency percentile in microseconds */
+static uint64_t e2e_bench_percentile(struct e2e_bench *bench, double pct)
+{
+	uint64_t i, sum = 0, target;
+
+	if (bench->received == 0)
+		return 0;
+	target = (uint64_t)(bench->received * pct / 100.);
+	if (target == 0)
+		target = 1;
+	for (i = 0; i < E2E_LAT_BUCKETS; i++) {
+		sum += bench->lat[i];
+		if (sum >= target)
+			return i;
+	}
+	return bench->lat_max;
+}
+
+
+static void *e2e_bench_receiver(void *userdata)
+{
+	int res;
+	ssize_t len;
+	struct e2e_bench *bench = userdata;
+	struct tpkt_pool *pool = NULL;
+	struct tpkt_packet *pkt;
+	struct msghdr msg;
+	struct iovec *iov;
+	size_t iov_len;
+
+	res = tpkt_pool_new(E2E_POOL_SIZE, E2E_PACKET_CAP, &pool);
+	if (res < 0) {
+		fprintf(stderr, "tpkt_pool_new: %s\n", strerror(-res));
+		return NULL;
+	}
+
+	while (!__atomic_load_n(&bench->rx_stop, __ATOMIC_RELAXED)) {
+		res = tpkt_pool_get(pool, &pkt);
+		if (res < 0)
+			break;
+		res = tpkt_get_iov_read(pkt, &iov, &iov_len);
+		if (res < 0) {
+			tpkt_unref(pkt);
+			break;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov_len;
+		len = recvmsg(bench->fd, &msg, 0);
+		if (len >= 0) {
+			tpkt_set_len(pkt, len);
+			tpkt_set_timestamp(pkt, e2e_now_us());
+			e2e_bench_account(bench, pkt);
+		}
+		tpkt_unref(pkt);
+	}
+
+	tpkt_pool_destroy(pool);
+	return NULL;
+}
+
+
+static void e2e_bench_recv_cb(struct tpkt_rx_engine *engine,
+			      unsigned int worker,
+			      struct tpkt_list *list,
+			      void *userdata)
+{
+	struct e2e_bench *bench = userdata;
+	struct tpkt_packet *pkt;
+
+	(void)engine;
+	(void)worker;
+
+	for (pkt = tpkt_list_first(list); pkt != NULL;
+	     pkt = tpkt_list_next(list, pkt))
+		e2e_bench_account(bench, pkt);
+}
+
+
+/* Wait until the time at which the given packet count should have been
+ * sent at the configured rate */
+static void e2e_bench_pace(struct e2e_bench *bench, uint64_t start, uint64_t n)
+{
+	uint64_t target, now;
+	struct timespec ts;
+
+	if (bench->rate == 0)
+		return;
+	target = start + n * 1000000000 / bench->rate;
+	now = tpkt_bench_now_ns();
+	if (now >= target)
+		return;
+	ts.tv_sec = (target - now) / 1000000000;
+	ts.tv_nsec = (target - now) % 1000000000;
+	nanosleep(&ts, NULL);
+}
+
+
+/* Fill a packet from the sender pool with the payload header */
+static int
+e2e_bench_fill(struct e2e_bench *bench, struct tpkt_pool *pool, uint64_t seq,
+	       struct tpkt_packet **ret_pkt)
+{
+	int res;
+	void *data;
+	struct e2e_hdr hdr;
+	struct tpkt_packet *pkt;
+
+	res = tpkt_pool_get(pool, &pkt);
+	if (res < 0)
+		return res;
+	res = tpkt_get_data(pkt, &data, NULL, NULL);
+	if (res < 0)
+		goto error;
+	res = tpkt_set_len(pkt, bench->payload_len);
+	if (res < 0)
+		goto error;
+	res = tpkt_set_timestamp(pkt, e2e_now_us());
+	if (res < 0)
+		goto error;
+	hdr.seq = seq;
+	hdr.timestamp = tpkt_get_timestamp(pkt);
+	memcpy(data, &hdr, sizeof(hdr));
+
+	*ret_pkt = pkt;
+	return 0;
+
+error:
+	tpkt_unref(pkt);
+	return res;
+}
+
+
+static void *e2e_bench_sender(void *userdata)
+{
+	int res, fd;
+	uint64_t seq = 0, start;
+	unsigned int i;
+	struct e2e_bench *bench = userdata;
+	struct tpkt_pool *pool = NULL;
+	struct tpkt_list *list = NULL;
+	struct tpkt_packet *pkt;
+	struct msghdr msg;
+	struct iovec *iov;
+	size_t iov_len;
+
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0)
+		return NULL;
+	if (connect(fd, (struct sockaddr *)&bench->addr, sizeof(bench->addr)) <
+	    0)
+		goto out;
+	res = tpkt_pool_new(E2E_POOL_SIZE, E2E_PACKET_CAP, &pool);
+	if (res < 0)
+		goto out;
+	res = tpkt_list_new(&list);
+	if (res < 0)
+		goto out;
+
+	start = tpkt_bench_now_ns();
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		e2e_bench_pace(bench, start, seq);
+		if (bench->mode == E2E_MODE_SINGLE) {
+			res = e2e_bench_fill(bench, pool, seq++, &pkt);
+			if (res < 0)
+				break;
+			res = tpkt_get_iov_write(pkt, &iov, &iov_len);
+			if (res == 0) {
+				memset(&msg, 0, sizeof(msg));
+				msg.msg_iov = iov;
+				msg.msg_iovlen = iov_len;
+				if (sendmsg(fd, &msg, 0) < 0)
+					bench->send_errors++;
+				else
+					bench->sent++;
+			}
+			tpkt_unref(pkt);
+			continue;
+		}
+		for (i = 0; i < bench->batch_size; i++) {
+			res = e2e_bench_fill(bench, pool, seq++, &pkt);
+			if (res < 0)
+				break;
+			tpkt_list_add_last(list, pkt);
+			tpkt_unref(pkt);
+		}
+		res = tpkt_send_list(fd, list, NULL);
+		if (res > 0)
+			bench->sent += res;
+		bench->send_errors += tpkt_list_get_count(list);
+		tpkt_list_flush(list);
+	}
+
+out:
+	tpkt_list_destroy(list);
+	tpkt_pool_destroy(pool);
+	close(fd);
+	return NULL;
+}
+
+
+static uint64_t e2e_cpu_time_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+		       1000000000 +
+	       ((uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+
+static int e2e_bench_run_mode(struct e2e_bench *bench, unsigned int duration)
+{
+	int res;
+	int rcvbuf = 4 * 1024 * 1024;
+	struct timeval tv = {.tv_usec = 100000};
+	uint64_t start, elapsed, cpu_start, cpu;
+	double secs;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(bench->addr);
+	pthread_t sender, receiver;
+	struct tpkt_rx_engine *engine = NULL;
+	struct tpkt_rx_engine_cfg cfg;
+	struct tpkt_rx_engine_cbs cbs = {
+		.recv = e2e_bench_recv_cb,
+	};
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bench->mode == E2E_MODE_BATCH) {
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.addr = (const struct sockaddr *)&addr;
+		cfg.addrlen = sizeof(addr);
+		cfg.worker_count = 1;
+		cfg.cpu_offset = -1;
+		cfg.pool_size = E2E_POOL_SIZE;
+		cfg.packet_cap = E2E_PACKET_CAP;
+		cfg.batch_size = bench->batch_size;
+		cfg.rcvbuf_size = rcvbuf;
+		res = tpkt_rx_engine_new(&cfg, &cbs, bench, &engine);
+		if (res < 0)
+			return res;
+		res = tpkt_rx_engine_get_local_addr(
+			engine, (struct sockaddr *)&bench->addr, &addrlen);
+		if (res < 0)
+			goto out;
+	} else {
+		bench->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (bench->fd < 0)
+			return -errno;
+		setsockopt(bench->fd,
+			   SOL_SOCKET,
+			   SO_RCVBUF,
+			   &rcvbuf,
+			   sizeof(rcvbuf));
+		setsockopt(bench->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		if (bind(bench->fd, (struct sockaddr *)&addr, sizeof(addr)) <
+			    0 ||
+		    getsockname(bench->fd,
+				(struct sockaddr *)&bench->addr,
+				&addrlen) < 0) {
+			res = -errno;
+			goto out;
+		}
+	}
+
+	cpu_start = e2e_cpu_time_ns();
+	start = tpkt_bench_now_ns();
+	if (bench->mode == E2E_MODE_BATCH) {
+		res = tpkt_rx_engine_start(engine);
+		if (res < 0)
+			goto out;
+	} else {
+		pthread_create(&receiver, NULL, e2e_bench_receiver, bench);
+	}
+	pthread_create(&sender, NULL, e2e_bench_sender, bench);
+	sleep(duration);
+	__atomic_store_n(&bench->stop, 1, __ATOMIC_RELAXED);
+	pthread_join(sender, NULL);
+	/* Let the in-flight packets be received */
+	usleep(100000);
+	if (bench->mode == E2E_MODE_BATCH) {
+		tpkt_rx_engine_stop(engine);
+	} else {
+		__atomic_store_n(&bench->rx_stop, 1, __ATOMIC_RELAXED);
+		pthread_join(receiver, NULL);
+	}
+	elapsed = tpkt_bench_now_ns() - start;
+	cpu = e2e_cpu_time_ns() - cpu_start;
+
+	secs = elapsed / 1e9;
+	printf("%-7s %10" PRIu64 " %10" PRIu64 " %6.2f %10.0f %7.3f %7.0f "
+	       "%6" PRIu64 " %6" PRIu64 " %6" PRIu64 " %6" PRIu64
+	       " %7" PRIu64 "\n",
+	       e2e_mode_str(bench->mode),
+	       bench->sent,
+	       bench->received,
+	       bench->sent ? 100. * (bench->sent - bench->received) /
+				     bench->sent
+			   : 0.,
+	       bench->received / secs,
+	       bench->bytes * 8 / secs / 1e9,
+	       bench->received ? (double)cpu / bench->received : 0.,
+	       e2e_bench_percentile(bench, 50),
+	       e2e_bench_percentile(bench, 90),
+	       e2e_bench_percentile(bench, 99),
+	       e2e_bench_percentile(bench, 99.9),
+	       bench->lat_max);
+	res = 0;
+
+out:
+	tpkt_rx_engine_destroy(engine);
+	if (bench->mode == E2E_MODE_SINGLE && bench->fd >= 0)
+		close(bench->fd);
+	return res;
+}
+
+
+static void e2e_bench_usage(void)
+{
+	printf("Loopback end-to-end throughput and latency\n\n"
+	       "Options:\n"
+	       "  -m <mode>   single, batch or all (default: all)\n"
+	       "  -t <sec>    duration per mode in seconds (default: 5)\n"
+	       "  -l <bytes>  payload length (default: 1200)\n"
+	       "  -b <count>  batch size (default: 32)\n"
+	       "  -r <pps>    send rate in packets per second "
+	       "(default: 0, unlimited)\n");
+}
+
+
+static int e2e_bench_run(int argc, char **argv)
+{
+	int res = 0, c, mode = -1;
+	unsigned int duration = 5;
+	struct e2e_bench bench;
+	uint64_t *lat;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.payload_len = 1200;
+	bench.batch_size = 32;
+
+	while ((c = getopt(argc, argv, "m:t:l:b:r:h")) != -1) {
+		switch (c) {
+		case 'm':
+			if (strcmp(optarg, "single") == 0)
+				mode = E2E_MODE_SINGLE;
+			else if (strcmp(optarg, "batch") == 0)
+				mode = E2E_MODE_BATCH;
+			else if (strcmp(optarg, "all") == 0)
+				mode = -1;
+			else
+				return -EINVAL;
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'l':
+			bench.payload_len = atoi(optarg);
+			break;
+		case 'b':
+			bench.batch_size = atoi(optarg);
+			break;
+		case 'r':
+			bench.rate = strtoull(optarg, NULL, 10);
+			break;
+		case 'h':
+			e2e_bench_usage();
+			return 0;
+		default:
+			e2e_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (bench.payload_len < sizeof(struct e2e_hdr) ||
+	    bench.payload_len > E2E_PACKET_CAP || bench.batch_size == 0 ||
+	    bench.batch_size > E2E_POOL_SIZE)
+		return -EINVAL;
+
+	lat = calloc(E2E_LAT_BUCKETS, sizeof(*lat));
+	if (lat == NULL)
+		return -ENOMEM;
+
+	printf("%-7s %10s %10s %6s %10s %7s %7s %6s %6s %6s %6s %7s\n",
+	       "mode",
+	       "sent",
+	       "received",
+	       "loss%",
+	       "pkt/s",
+	       "Gbit/s",
+	       "cpu ns",
+	       "p50us",
+	       "p90us",
+	       "p99us",
+	       "p999us",
+	       "max us");
+	for (c = E2E_MODE_SINGLE; c <= E2E_MODE_BATCH; c++) {
+		if (mode >= 0 && c != mode)
+			continue;
+		memset(lat, 0, E2E_LAT_BUCKETS * sizeof(*lat));
+		memset(&bench.sent,
+		       0,
+		       sizeof(bench) - offsetof(struct e2e_bench, sent));
+		bench.lat = lat;
+		bench.mode = c;
+		bench.fd = -1;
+		bench.stop = 0;
+		bench.rx_stop = 0;
+		res = e2e_bench_run_mode(&bench, duration);
+		if (res < 0)
+			break;
+	}
+
+	free(lat);
+	return res;
+}
+
+
+const struct tpkt_bench tpkt_bench_e2e = {
+	.name = "e2e",
+	.desc = "Loopback end-to-end throughput and latency",
+	.run = e2e_bench_run,
+};
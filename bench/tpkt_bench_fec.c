@@ -0,0 +1,219 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <getopt.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+#include <transport-packet/tpkt_fec.h>
+
+
+static const struct {
+	enum tpkt_fec_impl impl;
+	const char *name;
+} fec_bench_impls[] = {
+	{TPKT_FEC_IMPL_SCALAR, "scalar"},
+	{TPKT_FEC_IMPL_SSSE3, "ssse3"},
+	{TPKT_FEC_IMPL_AVX2, "avx2"},
+	{TPKT_FEC_IMPL_NEON, "neon"},
+};
+
+
+static void fec_bench_usage(void)
+{
+	printf("Reed-Solomon FEC encoding and decoding throughput\n\n"
+	       "Options:\n"
+	       "  -k <count>  source packet count (default: 20)\n"
+	       "  -m <count>  repair packet count (default: 4)\n"
+	       "  -l <bytes>  packet length (default: 1200)\n"
+	       "  -t <msec>   duration per measurement in ms (default: 1000)\n");
+}
+
+
+/* Returns the source data throughput in GB/s */
+static double fec_bench_encode(struct tpkt_packet **src,
+			       unsigned int k,
+			       struct tpkt_packet **repair,
+			       unsigned int m,
+			       size_t len,
+			       uint64_t duration)
+{
+	int res;
+	unsigned int i;
+	uint64_t start, elapsed, iters = 0;
+
+	start = tpkt_bench_now_ns();
+	do {
+		res = tpkt_fec_rs_encode(src, k, repair, m, NULL);
+		if (res < 0)
+			return 0.;
+		for (i = 0; i < m; i++)
+			tpkt_unref(repair[i]);
+		iters++;
+		elapsed = tpkt_bench_now_ns() - start;
+	} while (elapsed < duration);
+
+	return (double)iters * k * len / elapsed;
+}
+
+
+/* Decode with the first m source packets missing;
+ * returns the source data throughput in GB/s */
+static double fec_bench_decode(struct tpkt_packet **src,
+			       unsigned int k,
+			       struct tpkt_packet **repair,
+			       unsigned int m,
+			       size_t len,
+			       uint64_t duration)
+{
+	int res;
+	unsigned int i, lost = (m < k) ? m : k;
+	uint64_t start, elapsed, iters = 0;
+	struct tpkt_packet **work;
+
+	work = calloc(k, sizeof(*work));
+	if (work == NULL)
+		return 0.;
+
+	start = tpkt_bench_now_ns();
+	do {
+		memcpy(work, src, k * sizeof(*work));
+		for (i = 0; i < lost; i++)
+			work[i] = NULL;
+		res = tpkt_fec_rs_decode(work, k, repair, m, NULL);
+		if (res < 0) {
+			free(work);
+			return 0.;
+		}
+		for (i = 0; i < lost; i++)
+			tpkt_unref(work[i]);
+		iters++;
+		elapsed = tpkt_bench_now_ns() - start;
+	} while (elapsed < duration);
+
+	free(work);
+	return (double)iters * k * len / elapsed;
+}
+
+
+static int fec_bench_run(int argc, char **argv)
+{
+	int res = 0, c;
+	unsigned int i, j, k = 20, m = 4;
+	size_t len = 1200;
+	uint64_t duration = 1000;
+	void *data;
+	struct tpkt_packet **src = NULL, **repair = NULL;
+	double enc, dec;
+
+	while ((c = getopt(argc, argv, "k:m:l:t:h")) != -1) {
+		switch (c) {
+		case 'k':
+			k = atoi(optarg);
+			break;
+		case 'm':
+			m = atoi(optarg);
+			break;
+		case 'l':
+			len = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'h':
+			fec_bench_usage();
+			return 0;
+		default:
+			fec_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (k == 0 || m == 0 || k + m > TPKT_FEC_RS_MAX_PACKETS || len == 0 ||
+	    len > UINT16_MAX)
+		return -EINVAL;
+	duration *= 1000000;
+
+	src = calloc(k, sizeof(*src));
+	repair = calloc(m, sizeof(*repair));
+	if (src == NULL || repair == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	srand(1);
+	for (i = 0; i < k; i++) {
+		res = tpkt_new(len, &src[i]);
+		if (res < 0)
+			goto out;
+		tpkt_get_data(src[i], &data, NULL, NULL);
+		for (j = 0; j < len; j++)
+			((uint8_t *)data)[j] = rand();
+		tpkt_set_len(src[i], len);
+	}
+
+	printf("k=%u m=%u len=%zu\n", k, m, len);
+	printf("%-8s %14s %14s\n", "impl", "encode GB/s", "decode GB/s");
+	for (i = 0; i < sizeof(fec_bench_impls) / sizeof(fec_bench_impls[0]);
+	     i++) {
+		if (tpkt_fec_set_impl(fec_bench_impls[i].impl) < 0) {
+			printf("%-8s %14s %14s\n",
+			       fec_bench_impls[i].name,
+			       "-",
+			       "-");
+			continue;
+		}
+		enc = fec_bench_encode(src, k, repair, m, len, duration);
+		res = tpkt_fec_rs_encode(src, k, repair, m, NULL);
+		if (res < 0)
+			goto out;
+		dec = fec_bench_decode(src, k, repair, m, len, duration);
+		for (j = 0; j < m; j++) {
+			tpkt_unref(repair[j]);
+			repair[j] = NULL;
+		}
+		printf("%-8s %14.2f %14.2f\n",
+		       fec_bench_impls[i].name,
+		       enc,
+		       dec);
+	}
+	tpkt_fec_set_impl(TPKT_FEC_IMPL_AUTO);
+	res = 0;
+
+out:
+	if (src != NULL) {
+		for (i = 0; i < k; i++)
+			tpkt_unref(src[i]);
+	}
+	free(src);
+	free(repair);
+	return res;
+}
+
+
+const struct tpkt_bench tpkt_bench_fec = {
+	.name = "fec",
+	.desc = "Reed-Solomon FEC throughput per SIMD implementation",
+	.run = fec_bench_run,
+};
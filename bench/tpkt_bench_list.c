@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+
+
+/* Keeps the getter results from being optimized out */
+static volatile uint64_t list_bench_sink;
+
+
+/* Walk a list of count packets queued in random order, reading the
+ * packet length, timestamp and priority; ns is the time per packet in
+ * nanoseconds */
+static int list_bench_walk(size_t count, size_t total, double *ns)
+{
+	int res;
+	size_t i, j, len, passes;
+	uint64_t start, sum = 0;
+	struct tpkt_pool *pool = NULL;
+	struct tpkt_list *list = NULL;
+	struct tpkt_packet **pkts = NULL, *pkt, *tmp;
+
+	res = tpkt_pool_new(count, 64, &pool);
+	if (res < 0)
+		return res;
+	res = tpkt_list_new(&list);
+	if (res < 0)
+		goto out;
+	pkts = calloc(count, sizeof(*pkts));
+	if (pkts == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		res = tpkt_pool_get(pool, &pkts[i]);
+		if (res < 0)
+			goto out;
+		tpkt_set_len(pkts[i], i & 63);
+		tpkt_set_timestamp(pkts[i], i);
+	}
+	srand(1);
+	for (i = count - 1; i > 0; i--) {
+		j = (((size_t)rand() << 16) ^ rand()) % (i + 1);
+		tmp = pkts[i];
+		pkts[i] = pkts[j];
+		pkts[j] = tmp;
+	}
+	for (i = 0; i < count; i++) {
+		res = tpkt_list_add_last(list, pkts[i]);
+		if (res < 0)
+			goto out;
+		tpkt_unref(pkts[i]);
+		pkts[i] = NULL;
+	}
+
+	passes = (total + count - 1) / count;
+	start = tpkt_bench_now_ns();
+	for (i = 0; i < passes; i++) {
+		for (pkt = tpkt_list_first(list); pkt != NULL;
+		     pkt = tpkt_list_next(list, pkt)) {
+			tpkt_get_cdata(pkt, NULL, &len, NULL);
+			sum += len + tpkt_get_timestamp(pkt) +
+			       tpkt_get_priority(pkt);
+		}
+	}
+	*ns = (double)(tpkt_bench_now_ns() - start) / ((double)count * passes);
+	list_bench_sink = sum;
+	res = 0;
+
+out:
+	if (pkts != NULL) {
+		for (i = 0; i < count; i++) {
+			if (pkts[i] != NULL)
+				tpkt_unref(pkts[i]);
+		}
+	}
+	free(pkts);
+	if (list != NULL) {
+		tpkt_list_flush(list);
+		tpkt_list_destroy(list);
+	}
+	tpkt_pool_destroy(pool);
+	return res;
+}
+
+
+static void list_bench_usage(void)
+{
+	printf("Packet list walk with per-packet getters\n\n"
+	       "Options:\n"
+	       "  -n <count>  largest list size (default: 1048576)\n"
+	       "  -t <count>  packets walked per size in millions "
+	       "(default: 20)\n");
+}
+
+
+static int list_bench_run(int argc, char **argv)
+{
+	int res, c;
+	size_t count, max_count = 1048576, total = 20;
+	double ns = 0;
+
+	while ((c = getopt(argc, argv, "n:t:h")) != -1) {
+		switch (c) {
+		case 'n':
+			max_count = atoi(optarg);
+			break;
+		case 't':
+			total = atoi(optarg);
+			break;
+		case 'h':
+			list_bench_usage();
+			return 0;
+		default:
+			list_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (max_count == 0 || total == 0)
+		return -EINVAL;
+	total *= 1000000;
+
+	printf("%-10s %10s\n", "packets", "ns/pkt");
+	for (count = 256; count <= max_count; count *= 4) {
+		res = list_bench_walk(count, total, &ns);
+		if (res < 0) {
+			fprintf(stderr, "%zu: %s\n", count, strerror(-res));
+			return res;
+		}
+		printf("%-10zu %10.2f\n", count, ns);
+	}
+
+	return 0;
+}
+
+
+const struct tpkt_bench tpkt_bench_list = {
+	.name = "list",
+	.desc = "Packet list walk with per-packet getters",
+	.run = list_bench_run,
+};
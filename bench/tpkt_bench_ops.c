@@ -0,0 +1,412 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include "tpkt_bench.h"
+#include <libpomp.h>
+#include <transport-packet/tpkt.h>
+
+
+/* Number of packets created before being released in the allocation
+ * benchmarks, so that the creation and release costs are measured
+ * separately */
+#define OPS_BENCH_BATCH 1024
+
+
+/* Packet capacities for the allocation benchmarks */
+static const size_t ops_bench_caps[] = {64, 1500, 65536};
+
+
+/* List lengths for the list benchmarks */
+static const size_t ops_bench_list_lens[] = {16, 256, 4096, 65536};
+
+
+/* Accumulated measurement of an operation */
+struct ops_bench_meas {
+	uint64_t ops;
+	uint64_t ns;
+	int64_t allocs;
+	uint64_t start_ns;
+	int64_t start_allocs;
+};
+
+
+static void ops_bench_start(struct ops_bench_meas *meas)
+{
+	meas->start_allocs = tpkt_bench_alloc_count();
+	meas->start_ns = tpkt_bench_now_ns();
+}
+
+
+static void ops_bench_stop(struct ops_bench_meas *meas, uint64_t ops)
+{
+	meas->ns += tpkt_bench_now_ns() - meas->start_ns;
+	meas->allocs += tpkt_bench_alloc_count() - meas->start_allocs;
+	meas->ops += ops;
+}
+
+
+static void
+ops_bench_report(const char *op, size_t size, const struct ops_bench_meas *meas)
+{
+	struct tpkt_bench_result result = {
+		.bench = "ops",
+		.op = op,
+		.size = size,
+		.ops = meas->ops,
+		.allocs_per_op = -1,
+	};
+
+	if (meas->ops == 0)
+		return;
+	result.ns_per_op = (double)meas->ns / meas->ops;
+	if (tpkt_bench_alloc_count() >= 0)
+		result.allocs_per_op = (double)meas->allocs / meas->ops;
+	tpkt_bench_result_print(&result);
+}
+
+
+static void ops_bench_unref_all(struct tpkt_packet **pkts, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		tpkt_unref(pkts[i]);
+		pkts[i] = NULL;
+	}
+}
+
+
+/* tpkt_new() and tpkt_unref() of packets of the given capacity */
+static int ops_bench_new(struct tpkt_packet **pkts, size_t cap, uint64_t iters)
+{
+	int res = 0;
+	size_t i;
+	uint64_t n;
+	struct ops_bench_meas new_meas = {0}, unref_meas = {0};
+
+	for (n = 0; n < iters; n += OPS_BENCH_BATCH) {
+		ops_bench_start(&new_meas);
+		for (i = 0; i < OPS_BENCH_BATCH; i++) {
+			res = tpkt_new(cap, &pkts[i]);
+			if (res < 0)
+				break;
+		}
+		ops_bench_stop(&new_meas, i);
+		ops_bench_start(&unref_meas);
+		ops_bench_unref_all(pkts, i);
+		ops_bench_stop(&unref_meas, i);
+		if (res < 0)
+			return res;
+	}
+
+	ops_bench_report("new", cap, &new_meas);
+	ops_bench_report("unref", cap, &unref_meas);
+	return 0;
+}
+
+
+/* tpkt_new_from_buffer() on an existing buffer of the given capacity */
+static int
+ops_bench_new_from_buffer(struct tpkt_packet **pkts, size_t cap, uint64_t iters)
+{
+	int res = 0;
+	size_t i;
+	uint64_t n;
+	struct pomp_buffer *buf;
+	struct ops_bench_meas meas = {0};
+
+	buf = pomp_buffer_new(cap);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	for (n = 0; n < iters; n += OPS_BENCH_BATCH) {
+		ops_bench_start(&meas);
+		for (i = 0; i < OPS_BENCH_BATCH; i++) {
+			res = tpkt_new_from_buffer(buf, &pkts[i]);
+			if (res < 0)
+				break;
+		}
+		ops_bench_stop(&meas, i);
+		ops_bench_unref_all(pkts, i);
+		if (res < 0)
+			goto out;
+	}
+
+	ops_bench_report("new_from_buffer", cap, &meas);
+
+out:
+	pomp_buffer_unref(buf);
+	return res;
+}
+
+
+/* tpkt_clone() of a packet of the given capacity */
+static int
+ops_bench_clone(struct tpkt_packet **pkts, size_t cap, uint64_t iters)
+{
+	int res = 0;
+	size_t i;
+	uint64_t n;
+	struct tpkt_packet *pkt;
+	struct ops_bench_meas meas = {0};
+
+	res = tpkt_new(cap, &pkt);
+	if (res < 0)
+		return res;
+
+	for (n = 0; n < iters; n += OPS_BENCH_BATCH) {
+		ops_bench_start(&meas);
+		for (i = 0; i < OPS_BENCH_BATCH; i++) {
+			res = tpkt_clone(pkt, &pkts[i]);
+			if (res < 0)
+				break;
+		}
+		ops_bench_stop(&meas, i);
+		ops_bench_unref_all(pkts, i);
+		if (res < 0)
+			goto out;
+	}
+
+	ops_bench_report("clone", cap, &meas);
+
+out:
+	tpkt_unref(pkt);
+	return res;
+}
+
+
+/* Reference counting and scatter-gather I/O array extraction on a single
+ * packet */
+static int ops_bench_packet(uint64_t iters)
+{
+	int res;
+	uint64_t n;
+	size_t iov_len;
+	struct iovec *iov;
+	struct tpkt_packet *pkt;
+	struct ops_bench_meas meas = {0};
+
+	res = tpkt_new(1500, &pkt);
+	if (res < 0)
+		return res;
+	res = tpkt_set_len(pkt, 1000);
+	if (res < 0)
+		goto out;
+
+	ops_bench_start(&meas);
+	for (n = 0; n < iters; n++) {
+		tpkt_ref(pkt);
+		tpkt_unref(pkt);
+	}
+	ops_bench_stop(&meas, iters);
+	ops_bench_report("ref_unref", 0, &meas);
+
+	memset(&meas, 0, sizeof(meas));
+	ops_bench_start(&meas);
+	for (n = 0; n < iters; n++)
+		tpkt_get_ref_count(pkt);
+	ops_bench_stop(&meas, iters);
+	ops_bench_report("get_ref_count", 0, &meas);
+
+	memset(&meas, 0, sizeof(meas));
+	ops_bench_start(&meas);
+	for (n = 0; n < iters; n++) {
+		res = tpkt_get_iov_read(pkt, &iov, &iov_len);
+		if (res < 0)
+			goto out;
+	}
+	ops_bench_stop(&meas, iters);
+	ops_bench_report("get_iov_read", 0, &meas);
+
+	memset(&meas, 0, sizeof(meas));
+	ops_bench_start(&meas);
+	for (n = 0; n < iters; n++) {
+		res = tpkt_get_iov_write(pkt, &iov, &iov_len);
+		if (res < 0)
+			goto out;
+	}
+	ops_bench_stop(&meas, iters);
+	ops_bench_report("get_iov_write", 0, &meas);
+
+out:
+	tpkt_unref(pkt);
+	return res;
+}
+
+
+/* List add, iteration, removal and flush on a list of the given length */
+static int
+ops_bench_list(struct tpkt_packet **pkts, size_t len, uint64_t iters)
+{
+	int res;
+	size_t i, count = 0;
+	uint64_t n;
+	struct tpkt_list *list;
+	struct tpkt_packet *pkt;
+	struct ops_bench_meas add = {0}, iter = {0}, remove = {0}, flush = {0};
+
+	res = tpkt_list_new(&list);
+	if (res < 0)
+		return res;
+	for (count = 0; count < len; count++) {
+		res = tpkt_new(64, &pkts[count]);
+		if (res < 0)
+			goto out;
+	}
+
+	for (n = 0; n < iters; n += len) {
+		ops_bench_start(&add);
+		for (i = 0; i < len; i++) {
+			res = tpkt_list_add_last(list, pkts[i]);
+			if (res < 0)
+				goto out;
+		}
+		ops_bench_stop(&add, len);
+
+		ops_bench_start(&iter);
+		i = 0;
+		for (pkt = tpkt_list_first(list); pkt != NULL;
+		     pkt = tpkt_list_next(list, pkt))
+			i++;
+		ops_bench_stop(&iter, i);
+
+		/* Removal does not unreference the packets, the list
+		 * references are released after the measurement */
+		ops_bench_start(&remove);
+		while ((pkt = tpkt_list_first(list)) != NULL) {
+			res = tpkt_list_remove(list, pkt);
+			if (res < 0)
+				goto out;
+		}
+		ops_bench_stop(&remove, len);
+		for (i = 0; i < len; i++)
+			tpkt_unref(pkts[i]);
+
+		for (i = 0; i < len; i++) {
+			res = tpkt_list_add_last(list, pkts[i]);
+			if (res < 0)
+				goto out;
+		}
+		ops_bench_start(&flush);
+		res = tpkt_list_flush(list);
+		if (res < 0)
+			goto out;
+		ops_bench_stop(&flush, len);
+	}
+
+	ops_bench_report("list_add_last", len, &add);
+	ops_bench_report("list_iterate", len, &iter);
+	ops_bench_report("list_remove", len, &remove);
+	ops_bench_report("list_flush", len, &flush);
+
+out:
+	tpkt_list_flush(list);
+	tpkt_list_destroy(list);
+	ops_bench_unref_all(pkts, count);
+	return res;
+}
+
+
+static void ops_bench_usage(void)
+{
+	printf("Per-operation cost of the packet and list functions, as JSON "
+	       "lines\n\n"
+	       "Options:\n"
+	       "  -n <count>  operations per measurement in thousands "
+	       "(default: 1000)\n");
+}
+
+
+static int ops_bench_run(int argc, char **argv)
+{
+	int res = 0, c;
+	size_t i, max_len = 0;
+	uint64_t iters = 1000;
+	struct tpkt_packet **pkts;
+
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'h':
+			ops_bench_usage();
+			return 0;
+		default:
+			ops_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (iters == 0)
+		return -EINVAL;
+	iters *= 1000;
+
+	for (i = 0; i < sizeof(ops_bench_list_lens) / sizeof(size_t); i++) {
+		if (ops_bench_list_lens[i] > max_len)
+			max_len = ops_bench_list_lens[i];
+	}
+	if (max_len < OPS_BENCH_BATCH)
+		max_len = OPS_BENCH_BATCH;
+	pkts = calloc(max_len, sizeof(*pkts));
+	if (pkts == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < sizeof(ops_bench_caps) / sizeof(size_t); i++) {
+		res = ops_bench_new(pkts, ops_bench_caps[i], iters);
+		if (res < 0)
+			goto out;
+		res = ops_bench_new_from_buffer(pkts, ops_bench_caps[i], iters);
+		if (res < 0)
+			goto out;
+		res = ops_bench_clone(pkts, ops_bench_caps[i], iters);
+		if (res < 0)
+			goto out;
+	}
+
+	res = ops_bench_packet(iters);
+	if (res < 0)
+		goto out;
+
+	for (i = 0; i < sizeof(ops_bench_list_lens) / sizeof(size_t); i++) {
+		res = ops_bench_list(pkts, ops_bench_list_lens[i], iters);
+		if (res < 0)
+			goto out;
+	}
+
+out:
+	free(pkts);
+	return res;
+}
+
+
+const struct tpkt_bench tpkt_bench_ops = {
+	.name = "ops",
+	.desc = "Packet and list operations cost (JSON lines)",
+	.run = ops_bench_run,
+};
@@ -0,0 +1,318 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+
+
+/* Single producer single consumer ring size (power of 2) */
+#define RING_SIZE 1024
+
+
+struct pool_bench_ring {
+	struct tpkt_packet *pkts[RING_SIZE];
+	__attribute__((aligned(64))) unsigned int head;
+	__attribute__((aligned(64))) unsigned int tail;
+};
+
+
+struct pool_bench_pair {
+	struct tpkt_pool *pool;
+	struct pool_bench_ring *ring;
+	int *stop;
+	uint64_t count;
+};
+
+
+static void *pool_bench_producer(void *userdata)
+{
+	struct pool_bench_pair *pair = userdata;
+	struct pool_bench_ring *ring = pair->ring;
+	struct tpkt_packet *pkt;
+	unsigned int head = 0, tail;
+	uint64_t count = 0;
+
+	while (!__atomic_load_n(pair->stop, __ATOMIC_RELAXED)) {
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (head - tail == RING_SIZE) {
+			sched_yield();
+			continue;
+		}
+		if (tpkt_pool_get(pair->pool, &pkt) < 0) {
+			sched_yield();
+			continue;
+		}
+		ring->pkts[head % RING_SIZE] = pkt;
+		__atomic_store_n(&ring->head, ++head, __ATOMIC_RELEASE);
+		count++;
+	}
+	/* End marker */
+	while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) + RING_SIZE ==
+	       head)
+		sched_yield();
+	ring->pkts[head % RING_SIZE] = NULL;
+	__atomic_store_n(&ring->head, ++head, __ATOMIC_RELEASE);
+
+	pair->count = count;
+	return NULL;
+}
+
+
+static void *pool_bench_consumer(void *userdata)
+{
+	struct pool_bench_pair *pair = userdata;
+	struct pool_bench_ring *ring = pair->ring;
+	struct tpkt_packet *pkt;
+	unsigned int tail = 0;
+
+	for (;;) {
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+			sched_yield();
+			continue;
+		}
+		pkt = ring->pkts[tail % RING_SIZE];
+		__atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELEASE);
+		if (pkt == NULL)
+			break;
+		tpkt_unref(pkt);
+	}
+
+	return NULL;
+}
+
+
+/* Get and release all the packets of a cached pool through the magazines
+ * of the calling thread and destroy the pool from the same thread, checking
+ * the free count at each step */
+static int pool_bench_check(size_t pool_size, size_t cache_size)
+{
+	int res = 0, round;
+	size_t i, got = 0;
+	struct tpkt_pool *pool = NULL;
+	struct tpkt_pool_cfg cfg = {
+		.count = pool_size,
+		.cap = 64,
+		.cache_size = cache_size,
+	};
+	struct tpkt_packet **pkts;
+
+	pkts = calloc(pool_size, sizeof(*pkts));
+	if (pkts == NULL)
+		return -ENOMEM;
+	res = tpkt_pool_new_with_cfg(&cfg, &pool);
+	if (res < 0)
+		goto out;
+
+	for (round = 0; round < 2; round++) {
+		for (i = 0; i < pool_size; i++) {
+			res = tpkt_pool_get(pool, &pkts[i]);
+			if (res < 0) {
+				fprintf(stderr,
+					"pool check: get %zu failed\n",
+					i);
+				goto out;
+			}
+			got++;
+		}
+		if (tpkt_pool_get_free_count(pool) != 0) {
+			fprintf(stderr,
+				"pool check: free count %d, expected 0\n",
+				tpkt_pool_get_free_count(pool));
+			res = -EPROTO;
+			goto out;
+		}
+		for (; got > 0; got--)
+			tpkt_unref(pkts[got - 1]);
+		if (tpkt_pool_get_free_count(pool) != (int)pool_size) {
+			fprintf(stderr,
+				"pool check: free count %d, expected %zu\n",
+				tpkt_pool_get_free_count(pool),
+				pool_size);
+			res = -EPROTO;
+			goto out;
+		}
+	}
+
+	res = tpkt_pool_destroy(pool);
+	if (res < 0)
+		fprintf(stderr, "pool check: destroy failed\n");
+	pool = NULL;
+
+out:
+	if (pool != NULL) {
+		/* Release the packets that were obtained */
+		for (; got > 0; got--)
+			tpkt_unref(pkts[got - 1]);
+		tpkt_pool_destroy(pool);
+	}
+	free(pkts);
+	return res;
+}
+
+
+/* Returns the packet rate in millions of packets per second */
+static double pool_bench_measure(unsigned int pairs,
+				 size_t pool_size,
+				 size_t cache_size,
+				 unsigned int duration)
+{
+	unsigned int i;
+	int stop = 0;
+	uint64_t start, elapsed, count = 0;
+	double rate = 0.;
+	struct tpkt_pool *pool = NULL;
+	struct tpkt_pool_cfg cfg = {
+		.count = pool_size,
+		.cap = 64,
+		.cache_size = cache_size,
+	};
+	struct pool_bench_pair *pair = NULL;
+	pthread_t *threads = NULL;
+
+	pair = calloc(pairs, sizeof(*pair));
+	threads = calloc(2 * pairs, sizeof(*threads));
+	if (pair == NULL || threads == NULL)
+		goto out;
+	if (tpkt_pool_new_with_cfg(&cfg, &pool) < 0)
+		goto out;
+
+	for (i = 0; i < pairs; i++) {
+		pair[i].pool = pool;
+		pair[i].stop = &stop;
+		if (posix_memalign((void **)&pair[i].ring,
+				   64,
+				   sizeof(*pair[i].ring)) != 0)
+			goto out;
+		memset(pair[i].ring, 0, sizeof(*pair[i].ring));
+	}
+
+	start = tpkt_bench_now_ns();
+	for (i = 0; i < pairs; i++) {
+		pthread_create(
+			&threads[2 * i], NULL, pool_bench_producer, &pair[i]);
+		pthread_create(&threads[2 * i + 1],
+			       NULL,
+			       pool_bench_consumer,
+			       &pair[i]);
+	}
+	usleep(duration * 1000);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < 2 * pairs; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = tpkt_bench_now_ns() - start;
+
+	for (i = 0; i < pairs; i++)
+		count += pair[i].count;
+	rate = count * 1e3 / elapsed;
+
+out:
+	if (pair != NULL) {
+		for (i = 0; i < pairs; i++)
+			free(pair[i].ring);
+	}
+	free(pair);
+	free(threads);
+	if (pool != NULL && tpkt_pool_destroy(pool) < 0)
+		fprintf(stderr, "pool packets leaked\n");
+	return rate;
+}
+
+
+static void pool_bench_usage(void)
+{
+	printf("Cross-thread pool producer/consumer throughput\n\n"
+	       "Options:\n"
+	       "  -p <count>  maximum producer/consumer pair count "
+	       "(default: CPU count / 2)\n"
+	       "  -c <count>  per-thread cache magazine size (default: 32)\n"
+	       "  -n <count>  pool packet count (default: 8192)\n"
+	       "  -t <msec>   duration per measurement in ms (default: 500)\n");
+}
+
+
+static int pool_bench_run(int argc, char **argv)
+{
+	int c;
+	unsigned int pairs, max_pairs = 0, duration = 500;
+	size_t cache_size = 32, pool_size = 8192;
+	double locked, cached;
+	long cpus;
+
+	while ((c = getopt(argc, argv, "p:c:n:t:h")) != -1) {
+		switch (c) {
+		case 'p':
+			max_pairs = atoi(optarg);
+			break;
+		case 'c':
+			cache_size = atoi(optarg);
+			break;
+		case 'n':
+			pool_size = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'h':
+			pool_bench_usage();
+			return 0;
+		default:
+			pool_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (max_pairs == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		max_pairs = (cpus > 2) ? cpus / 2 : 1;
+	}
+	if (cache_size == 0 || pool_size == 0)
+		return -EINVAL;
+
+	if (pool_bench_check(pool_size, cache_size) < 0)
+		return -EPROTO;
+
+	printf("%-6s %16s %16s\n", "pairs", "shared Mpkt/s", "cached Mpkt/s");
+	for (pairs = 1; pairs <= max_pairs; pairs++) {
+		locked = pool_bench_measure(pairs, pool_size, 0, duration);
+		cached = pool_bench_measure(
+			pairs, pool_size, cache_size, duration);
+		printf("%-6u %16.2f %16.2f\n", pairs, locked, cached);
+	}
+
+	return 0;
+}
+
+
+const struct tpkt_bench tpkt_bench_pool = {
+	.name = "pool",
+	.desc = "Cross-thread pool get/release with and without thread caches",
+	.run = pool_bench_run,
+};
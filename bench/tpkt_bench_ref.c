@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+
+
+/* Previous reference counting scheme (sequentially consistent atomic
+ * operations and a separate load for the underflow check), reproduced on
+ * a plain counter for comparison */
+static __attribute__((noinline)) int
+ref_bench_seq_cst_ref(unsigned int *cnt)
+{
+	__atomic_add_fetch(cnt, 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+
+static __attribute__((noinline)) int
+ref_bench_seq_cst_unref(unsigned int *cnt)
+{
+	if (__atomic_load_n(cnt, __ATOMIC_ACQUIRE) < 1)
+		return -ENOENT;
+	return __atomic_sub_fetch(cnt, 1, __ATOMIC_SEQ_CST) == 0;
+}
+
+
+static double ref_bench_seq_cst(uint64_t iters)
+{
+	uint64_t i, start;
+	unsigned int cnt = 1;
+
+	start = tpkt_bench_now_ns();
+	for (i = 0; i < iters; i++) {
+		ref_bench_seq_cst_ref(&cnt);
+		ref_bench_seq_cst_unref(&cnt);
+	}
+	return (double)(tpkt_bench_now_ns() - start) / iters;
+}
+
+
+static double ref_bench_ref_unref(struct tpkt_packet *pkt, uint64_t iters)
+{
+	uint64_t i, start;
+
+	start = tpkt_bench_now_ns();
+	for (i = 0; i < iters; i++) {
+		tpkt_ref(pkt);
+		tpkt_unref(pkt);
+	}
+	return (double)(tpkt_bench_now_ns() - start) / iters;
+}
+
+
+static double ref_bench_setters(struct tpkt_packet *pkt, uint64_t iters)
+{
+	uint64_t i, start;
+
+	start = tpkt_bench_now_ns();
+	for (i = 0; i < iters; i++) {
+		tpkt_set_timestamp(pkt, i);
+		tpkt_set_priority(pkt, i & 7);
+		tpkt_set_len(pkt, i & 63);
+	}
+	return (double)(tpkt_bench_now_ns() - start) / iters;
+}
+
+
+static void ref_bench_usage(void)
+{
+	printf("Packet reference counting and setters cost\n\n"
+	       "Options:\n"
+	       "  -n <count>  iterations in millions (default: 50)\n");
+}
+
+
+static int ref_bench_run(int argc, char **argv)
+{
+	int res, c;
+	uint64_t iters = 50;
+	struct tpkt_packet *pkt;
+
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'h':
+			ref_bench_usage();
+			return 0;
+		default:
+			ref_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (iters == 0)
+		return -EINVAL;
+	iters *= 1000000;
+
+	res = tpkt_new(64, &pkt);
+	if (res < 0)
+		return res;
+
+	printf("%-28s %10s\n", "operation", "ns/op");
+	printf("%-28s %10.2f\n",
+	       "ref+unref seq_cst (previous)",
+	       ref_bench_seq_cst(iters));
+	printf("%-28s %10.2f\n",
+	       "ref+unref atomic",
+	       ref_bench_ref_unref(pkt, iters));
+	printf("%-28s %10.2f\n",
+	       "3 setters atomic",
+	       ref_bench_setters(pkt, iters));
+	tpkt_set_local(pkt, 1);
+	printf("%-28s %10.2f\n",
+	       "ref+unref local",
+	       ref_bench_ref_unref(pkt, iters));
+	printf("%-28s %10.2f\n",
+	       "3 setters local",
+	       ref_bench_setters(pkt, iters));
+
+	tpkt_unref(pkt);
+	return 0;
+}
+
+
+const struct tpkt_bench tpkt_bench_ref = {
+	.name = "ref",
+	.desc = "Packet reference counting and setters cost",
+	.run = ref_bench_run,
+};
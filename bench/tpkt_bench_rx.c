@@ -0,0 +1,249 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tpkt_bench.h"
+#include <transport-packet/tpkt.h>
+#include <transport-packet/tpkt_rx_engine.h>
+
+
+#define SEND_BATCH 32
+
+
+struct rx_bench {
+	struct sockaddr_in addr;
+	size_t payload_len;
+	int stop;
+	uint64_t sent;
+};
+
+
+static void rx_bench_recv_cb(struct tpkt_rx_engine *engine,
+			     unsigned int worker,
+			     struct tpkt_list *list,
+			     void *userdata)
+{
+	(void)engine;
+	(void)worker;
+	(void)list;
+	(void)userdata;
+
+	/* Nothing to do, the packets are released by the engine */
+}
+
+
+static void *rx_bench_sender(void *userdata)
+{
+	struct rx_bench *bench = userdata;
+	struct mmsghdr msgs[SEND_BATCH];
+	struct iovec iov;
+	uint8_t *payload;
+	uint64_t sent = 0;
+	int fd, res, i;
+
+	payload = calloc(1, bench->payload_len);
+	if (payload == NULL)
+		return NULL;
+
+	/* Each sender uses its own socket (and source port) so that the
+	 * SO_REUSEPORT hash spreads the senders across the workers */
+	fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0)
+		goto out;
+	if (connect(fd, (struct sockaddr *)&bench->addr, sizeof(bench->addr)) <
+	    0)
+		goto out;
+
+	iov.iov_base = payload;
+	iov.iov_len = bench->payload_len;
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < SEND_BATCH; i++) {
+		msgs[i].msg_hdr.msg_iov = &iov;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		res = sendmmsg(fd, msgs, SEND_BATCH, 0);
+		if (res > 0)
+			sent += res;
+	}
+
+out:
+	__atomic_add_fetch(&bench->sent, sent, __ATOMIC_RELAXED);
+	if (fd >= 0)
+		close(fd);
+	free(payload);
+	return NULL;
+}
+
+
+static void rx_bench_usage(void)
+{
+	printf("Loopback receive engine load generator\n\n"
+	       "Options:\n"
+	       "  -w <count>  worker count (default: 0, one per CPU)\n"
+	       "  -s <count>  sender thread count (default: 4)\n"
+	       "  -t <sec>    duration in seconds (default: 5)\n"
+	       "  -l <bytes>  payload length (default: 1200)\n"
+	       "  -b <count>  receive batch size (default: 32)\n"
+	       "  -n          disable CPU pinning\n");
+}
+
+
+static int rx_bench_run(int argc, char **argv)
+{
+	int res, c;
+	unsigned int i, worker_count;
+	unsigned int sender_count = 4;
+	unsigned int duration = 5;
+	uint64_t start, elapsed, packets = 0, bytes = 0;
+	double secs;
+	struct rx_bench bench;
+	struct tpkt_rx_engine *engine = NULL;
+	struct tpkt_rx_engine_cfg cfg;
+	struct tpkt_rx_engine_stats stats;
+	struct tpkt_rx_engine_cbs cbs = {
+		.recv = rx_bench_recv_cb,
+	};
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(bench.addr);
+	pthread_t *senders = NULL;
+
+	memset(&bench, 0, sizeof(bench));
+	memset(&cfg, 0, sizeof(cfg));
+	bench.payload_len = 1200;
+
+	while ((c = getopt(argc, argv, "w:s:t:l:b:nh")) != -1) {
+		switch (c) {
+		case 'w':
+			cfg.worker_count = atoi(optarg);
+			break;
+		case 's':
+			sender_count = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'l':
+			bench.payload_len = atoi(optarg);
+			break;
+		case 'b':
+			cfg.batch_size = atoi(optarg);
+			break;
+		case 'n':
+			cfg.cpu_offset = -1;
+			break;
+		case 'h':
+			rx_bench_usage();
+			return 0;
+		default:
+			rx_bench_usage();
+			return -EINVAL;
+		}
+	}
+	if (sender_count == 0 || bench.payload_len == 0)
+		return -EINVAL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	cfg.addr = (const struct sockaddr *)&addr;
+	cfg.addrlen = sizeof(addr);
+	cfg.rcvbuf_size = 4 * 1024 * 1024;
+
+	res = tpkt_rx_engine_new(&cfg, &cbs, &bench, &engine);
+	if (res < 0)
+		return res;
+	res = tpkt_rx_engine_get_local_addr(
+		engine, (struct sockaddr *)&bench.addr, &addrlen);
+	if (res < 0)
+		goto out;
+	worker_count = tpkt_rx_engine_get_worker_count(engine);
+
+	res = tpkt_rx_engine_start(engine);
+	if (res < 0)
+		goto out;
+
+	senders = calloc(sender_count, sizeof(*senders));
+	if (senders == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	start = tpkt_bench_now_ns();
+	for (i = 0; i < sender_count; i++)
+		pthread_create(&senders[i], NULL, rx_bench_sender, &bench);
+	sleep(duration);
+	__atomic_store_n(&bench.stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < sender_count; i++)
+		pthread_join(senders[i], NULL);
+	elapsed = tpkt_bench_now_ns() - start;
+	tpkt_rx_engine_stop(engine);
+
+	secs = elapsed / 1e9;
+	printf("%-8s %14s %12s %12s %10s\n",
+	       "worker",
+	       "packets",
+	       "pkt/s",
+	       "Mbit/s",
+	       "drops");
+	for (i = 0; i < worker_count; i++) {
+		tpkt_rx_engine_get_stats(engine, i, &stats);
+		packets += stats.packets;
+		bytes += stats.bytes;
+		printf("%-8u %14" PRIu64 " %12.0f %12.1f %10" PRIu64 "\n",
+		       i,
+		       stats.packets,
+		       stats.packets / secs,
+		       stats.bytes * 8 / secs / 1e6,
+		       stats.drops);
+	}
+	printf("%-8s %14" PRIu64 " %12.0f %12.1f\n",
+	       "total",
+	       packets,
+	       packets / secs,
+	       bytes * 8 / secs / 1e6);
+	printf("sent %" PRIu64 " packets (%.1f%% received)\n",
+	       bench.sent,
+	       bench.sent ? 100. * packets / bench.sent : 0.);
+
+out:
+	free(senders);
+	tpkt_rx_engine_destroy(engine);
+	return res;
+}
+
+
+const struct tpkt_bench tpkt_bench_rx = {
+	.name = "rx",
+	.desc = "Multi-core receive engine loopback throughput",
+	.run = rx_bench_run,
+};
@@ -66,6 +66,8 @@ extern "C" {
 /* Forward declarations */
 struct tpkt_packet;
 struct tpkt_list;
+struct tpkt_pool;
+struct tpkt_arena;
 
 
 /**
@@ -151,7 +153,9 @@ tpkt_new_with_data(const void *data, size_t cap, struct tpkt_packet **ret_obj);
  * If the paket was created from a pomp_buffer object, its refererence counter
  * is incremented. If the packet was created from plain data, the pointer is
  * simply copied and it's the application's responsibility to handle the life
- * cycle of the allocated memory.
+ * cycle of the allocated memory. If the packet was obtained from a pool, the
+ * clone keeps the pool packet data alive and the data becomes read-only for
+ * both packets until the clone is destroyed.
  * @param pkt: object handle of the packet to clone
  * @param ret_obj: pointer to the created packet object pointer (output)
  * @return 0 on success, negative errno value in case of error
@@ -159,6 +163,47 @@ tpkt_new_with_data(const void *data, size_t cap, struct tpkt_packet **ret_obj);
 TPKT_API int tpkt_clone(struct tpkt_packet *pkt, struct tpkt_packet **ret_obj);
 
 
+/**
+ * Create a packet referencing a range of the data of another packet.
+ * The slice packet does not copy the data: it keeps the data of the
+ * original packet alive (pomp_buffer or pool packet data) and is
+ * read-only; while slices exist, the original packet data is read-only as
+ * well. If the original packet was created from plain data, it's the
+ * application's responsibility to handle the life cycle of the allocated
+ * memory. The address, timestamp and priority of the original packet are
+ * copied to the slice.
+ * A packet is created with a reference count of 1. When no longer needed,
+ * the packet must be unreferenced using the tpkt_unref() function.
+ * @param pkt: object handle of the original packet
+ * @param offset: offset of the range in the original packet data
+ * @param len: length of the range in bytes
+ * @param ret_obj: pointer to the created packet object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_new_slice(struct tpkt_packet *pkt,
+			    size_t offset,
+			    size_t len,
+			    struct tpkt_packet **ret_obj);
+
+
+/**
+ * Create a packet referencing a range of the data of a buffer.
+ * The slice packet does not copy the data: it adds a reference to the
+ * pomp_buffer and is read-only (tpkt_get_buffer() returns NULL).
+ * A packet is created with a reference count of 1. When no longer needed,
+ * the packet must be unreferenced using the tpkt_unref() function.
+ * @param buf: pointer on a pomp_buffer object
+ * @param offset: offset of the range in the buffer data
+ * @param len: length of the range in bytes
+ * @param ret_obj: pointer to the created packet object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_new_from_buffer_slice(struct pomp_buffer *buf,
+					size_t offset,
+					size_t len,
+					struct tpkt_packet **ret_obj);
+
+
 /**
  * Reference a packet.
  * This function increments the reference counter of a packet.
@@ -187,6 +232,24 @@ TPKT_API int tpkt_unref(struct tpkt_packet *pkt);
 TPKT_API int tpkt_get_ref_count(struct tpkt_packet *pkt);
 
 
+/**
+ * Set the packet thread-local mode.
+ * By default, the packet reference counter is updated with atomic
+ * operations so that references can be taken and released on any thread.
+ * In thread-local mode, it is updated with plain operations, which is
+ * cheaper for packets that never leave a thread. The mode can only be
+ * enabled while all references to the packet are held by the calling
+ * thread, and must be disabled before a reference is passed to another
+ * thread (the hand-off itself, e.g. a queue, must synchronize both
+ * threads). Clones and slices of a thread-local packet are not
+ * thread-local.
+ * @param pkt: packet object handle
+ * @param local: 1 to enable the thread-local mode, 0 to disable it
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_set_local(struct tpkt_packet *pkt, int local);
+
+
 /**
  * Get the packet associated buffer.
  * If the packet is not associated with a pomp_buffer, NULL is returned.
@@ -428,10 +491,333 @@ TPKT_API int tpkt_get_importance(struct tpkt_packet *pkt, uint32_t *importance);
 TPKT_API int tpkt_set_importance(struct tpkt_packet *pkt, uint32_t importance);
 
 
+/**
+ * Pool API
+ */
+
+/* Pool configuration */
+struct tpkt_pool_cfg {
+	/* Number of packets in the pool (mandatory) */
+	size_t count;
+
+	/* Packet data buffer capacity in bytes (mandatory) */
+	size_t cap;
+
+	/* Per-thread cache magazine size in packets (0 disables the
+	 * per-thread caches); see tpkt_pool_new_with_cfg() */
+	size_t cache_size;
+
+	/* Arena to allocate the packets and data buffers from (optional,
+	 * can be NULL); see transport-packet/tpkt_arena.h */
+	struct tpkt_arena *arena;
+};
+
+
+/**
+ * Create a packet pool.
+ * The pool pre-allocates count packets along with their data buffers of
+ * cap bytes each. Packets obtained from the pool are not associated to a
+ * pomp_buffer (tpkt_get_buffer() returns NULL); they are returned to the
+ * pool when the packet and all of its clones are no longer referenced.
+ * The pool can be used from multiple threads.
+ * The created pool object is returned through the ret_obj parameter.
+ * When no longer needed, the pool must be freed using the
+ * tpkt_pool_destroy() function.
+ * @param count: number of packets in the pool
+ * @param cap: packet data buffer capacity in bytes
+ * @param ret_obj: pointer to the created pool object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int
+tpkt_pool_new(size_t count, size_t cap, struct tpkt_pool **ret_obj);
+
+
+/**
+ * Create a packet pool from a configuration.
+ * See tpkt_pool_new(). If cache_size is not 0, each thread that gets or
+ * releases pool packets uses its own cache of up to two magazines of
+ * cache_size packets, so that getting and releasing packets does not
+ * access shared data in the steady state; full and empty magazines are
+ * exchanged in a single operation with a shared depot. Packets cached by
+ * a thread are not available to the other threads; they are returned to
+ * the pool when the thread exits.
+ * If arena is not NULL, the packets and their data buffers are allocated
+ * from the arena (e.g. in huge pages) instead of the heap; the arena must
+ * outlive the pool, and the arena memory is not reclaimed when the pool is
+ * destroyed.
+ * @param cfg: pool configuration
+ * @param ret_obj: pointer to the created pool object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pool_new_with_cfg(const struct tpkt_pool_cfg *cfg,
+				    struct tpkt_pool **ret_obj);
+
+
+/**
+ * Free a packet pool.
+ * All packets must have been returned to the pool, otherwise -EBUSY is
+ * returned and the pool is not freed. The pool must no longer be used by
+ * any thread.
+ * @param pool: pool object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pool_destroy(struct tpkt_pool *pool);
+
+
+/**
+ * Get a packet from a pool.
+ * The packet is returned with a reference count of 1 and an empty data
+ * buffer of the pool capacity. When no longer needed, the packet must be
+ * unreferenced using the tpkt_unref() function.
+ * If the pool is empty, -EAGAIN is returned; if a process-wide or pool
+ * memory hard limit would be exceeded in fail-fast mode, -ENOBUFS is
+ * returned (see tpkt_mem_set_limits()).
+ * @param pool: pool object handle
+ * @param ret_obj: pointer to the packet object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pool_get(struct tpkt_pool *pool,
+			   struct tpkt_packet **ret_obj);
+
+
+/**
+ * Get the number of packets currently available in a pool.
+ * With per-thread caches, the count includes the packets cached by all
+ * threads and is approximate while other threads use the pool.
+ * @param pool: pool object handle
+ * @return the free packet count on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_pool_get_free_count(struct tpkt_pool *pool);
+
+
+/**
+ * Memory accounting API
+ * The library keeps process-wide and per-pool counts of the live packets
+ * and of the payload bytes they hold. The payload bytes are the data
+ * buffers allocated by the library: tpkt_new() and tpkt_new_with_data()
+ * buffers, and pool data buffers (until the pool packet and all of its
+ * clones are released); packets referencing caller-provided or shared
+ * memory (tpkt_new_from_buffer(), tpkt_new_from_data(), clones, slices...)
+ * only count as packets. Pool packets are accounted both in the pool and
+ * in the process-wide counters.
+ * Soft and hard limits can be set on both counts: a callback is called
+ * when the usage level changes, and in fail-fast mode the allocations that
+ * would exceed a hard limit fail with -ENOBUFS, so that senders can shed
+ * load before the process runs out of memory.
+ * The accounting is only active while limits or a callback are set, or
+ * when requested with the accounting flag of the limits, so that it costs
+ * nothing otherwise; the counters only include the packets allocated
+ * while it is active.
+ */
+
+/* Memory usage levels */
+enum tpkt_mem_level {
+	/* Below the soft limits */
+	TPKT_MEM_LEVEL_NORMAL = 0,
+
+	/* At or above a soft limit */
+	TPKT_MEM_LEVEL_SOFT,
+
+	/* At or above a hard limit */
+	TPKT_MEM_LEVEL_HARD,
+};
+
+
+/**
+ * Memory usage level change callback function.
+ * The callback is called on the thread that allocated or released the
+ * packet that caused the level change, with an internal lock held so that
+ * the level changes are reported in order; it must not change the limits
+ * (-EBUSY is returned). Level changes caused by allocations in the
+ * callback are reported after it returns.
+ * @param pool: pool object handle (NULL for the process-wide limits)
+ * @param level: new usage level
+ * @param userdata: user data pointer
+ */
+typedef void (*tpkt_mem_level_cb_t)(struct tpkt_pool *pool,
+				    enum tpkt_mem_level level,
+				    void *userdata);
+
+
+/* Memory limits; 0 means no limit */
+struct tpkt_mem_limits {
+	/* Soft limits in payload bytes and packets */
+	uint64_t soft_bytes;
+	uint64_t soft_packets;
+
+	/* Hard limits in payload bytes and packets */
+	uint64_t hard_bytes;
+	uint64_t hard_packets;
+
+	/* If not 0, allocations that would exceed a hard limit fail with
+	 * -ENOBUFS; otherwise the hard limits are only reported */
+	int fail_fast;
+
+	/* If not 0, the counters are maintained even if no limit and no
+	 * callback are set */
+	int accounting;
+
+	/* Usage level change callback (optional, can be NULL) */
+	tpkt_mem_level_cb_t cb;
+
+	/* User data pointer passed to the callback */
+	void *userdata;
+};
+
+
+/* Memory accounting counters */
+struct tpkt_mem_stats {
+	/* Live packets */
+	uint64_t packets;
+
+	/* Live payload bytes */
+	uint64_t bytes;
+
+	/* Highest packet count */
+	uint64_t peak_packets;
+
+	/* Highest payload byte count */
+	uint64_t peak_bytes;
+
+	/* Allocations refused in fail-fast mode */
+	uint64_t failures;
+
+	/* Current usage level */
+	enum tpkt_mem_level level;
+};
+
+
+/**
+ * Set the process-wide memory limits.
+ * The limits apply to all packets allocated afterwards; the usage level is
+ * updated (and the callback called if it changes) on the next allocation
+ * or release.
+ * @param limits: memory limits (NULL to remove all limits)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_mem_set_limits(const struct tpkt_mem_limits *limits);
+
+
+/**
+ * Get the process-wide memory accounting counters.
+ * @param stats: pointer on the counters structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_mem_get_stats(struct tpkt_mem_stats *stats);
+
+
+/**
+ * Set the memory limits of a pool.
+ * See tpkt_mem_set_limits(); in fail-fast mode, tpkt_pool_get() fails with
+ * -ENOBUFS instead of -EAGAIN when a pool hard limit would be exceeded.
+ * @param pool: pool object handle
+ * @param limits: memory limits (NULL to remove all limits)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pool_set_mem_limits(struct tpkt_pool *pool,
+				      const struct tpkt_mem_limits *limits);
+
+
+/**
+ * Get the memory accounting counters of a pool.
+ * @param pool: pool object handle
+ * @param stats: pointer on the counters structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pool_get_mem_stats(struct tpkt_pool *pool,
+				     struct tpkt_mem_stats *stats);
+
+
+/**
+ * Statistics API
+ * The library counts the packet creations per constructor, the packet
+ * releases, the list insertions and removals and the setter calls rejected
+ * with -EPERM. The counters are kept per thread without locked
+ * instructions and summed when a snapshot is taken, so that they can be
+ * polled periodically in production. The counters of exited threads are
+ * kept in the totals.
+ */
+
+/* Library statistics (totals since the library was loaded) */
+struct tpkt_stats {
+	/* Live packets (created and not yet released, including the pool
+	 * packets in use) */
+	uint64_t packets;
+
+	/* Packets created by tpkt_new() */
+	uint64_t created_new;
+
+	/* Packets created by tpkt_new_from_buffer() */
+	uint64_t created_from_buffer;
+
+	/* Packets created by tpkt_new_from_data() */
+	uint64_t created_from_data;
+
+	/* Packets created by tpkt_new_from_cdata() */
+	uint64_t created_from_cdata;
+
+	/* Packets created by tpkt_new_with_data() */
+	uint64_t created_with_data;
+
+	/* Packets created by tpkt_new_slice() and
+	 * tpkt_new_from_buffer_slice() */
+	uint64_t created_slice;
+
+	/* Packets obtained from pools by tpkt_pool_get() */
+	uint64_t created_pool;
+
+	/* Packets created by tpkt_clone() */
+	uint64_t cloned;
+
+	/* Packets released (destroyed or returned to their pool) */
+	uint64_t released;
+
+	/* Packets added to lists */
+	uint64_t list_added;
+
+	/* Packets removed from lists (including flushes) */
+	uint64_t list_removed;
+
+	/* Calls rejected with -EPERM because the packet was shared or its
+	 * data read-only */
+	uint64_t eperm;
+};
+
+
+/**
+ * Get a snapshot of the library statistics.
+ * The snapshot only takes an internal lock and sums the per-thread
+ * counters; it is cheap enough to be called periodically. The counters
+ * updated concurrently by other threads may be slightly behind.
+ * @param stats: pointer on the statistics structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_get_stats(struct tpkt_stats *stats);
+
+
 /**
  * List API
  */
 
+/* Packet list statistics */
+struct tpkt_list_stats {
+	/* Current packet count */
+	size_t count;
+
+	/* Highest packet count (high-water mark) */
+	size_t max_count;
+
+	/* Packets added to the list */
+	uint64_t added_packets;
+
+	/* Payload bytes of the packets added to the list (packet length
+	 * when added; only counted while enabled with
+	 * tpkt_list_enable_byte_stats(), 0 otherwise) */
+	uint64_t added_bytes;
+};
+
+
 /**
  * Create a packet list.
  * The created packet list object is returned through the ret_obj parameter.
@@ -633,6 +1019,38 @@ TPKT_API int tpkt_list_remove(struct tpkt_list *list, struct tpkt_packet *pkt);
 TPKT_API int tpkt_list_flush(struct tpkt_list *list);
 
 
+/**
+ * Get the statistics of a packet list.
+ * @param list: packet list object handle
+ * @param stats: pointer on the statistics structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_list_get_stats(struct tpkt_list *list,
+				 struct tpkt_list_stats *stats);
+
+
+/**
+ * Enable or disable the count of the bytes added to a packet list
+ * (added_bytes in struct tpkt_list_stats). It is disabled by default, as
+ * reading the length of buffer-backed packets on each insertion is not free.
+ * Enabling or disabling the count resets the byte total.
+ * @param list: packet list object handle
+ * @param enable: 1 to enable the byte count, 0 to disable it
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_list_enable_byte_stats(struct tpkt_list *list, int enable);
+
+
+/**
+ * Reset the statistics of a packet list.
+ * The high-water mark is set to the current packet count and the added
+ * packets and bytes totals are cleared, e.g. at each monitoring period.
+ * @param list: packet list object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_list_reset_stats(struct tpkt_list *list);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_AGGR_H_
+#define _TPKT_AGGR_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Small packet aggregation.
+ * The aggregator buffers the packets destined to the same peer (packet
+ * address) and emits them as a single aggregated datagram when the
+ * datagram size limit or the maximum delay is reached, or immediately when
+ * an urgent packet (priority at or above a threshold) is added.
+ * An aggregated datagram is a sequence of sub-packets, each made of a
+ * 16-bit big-endian length followed by the sub-packet data.
+ * The de-aggregator splits a received aggregated datagram into packets
+ * referencing ranges of the datagram data (no copy, see tpkt_new_slice()).
+ * The aggregator is not thread safe; time is provided by the caller.
+ */
+
+
+/* Forward declarations */
+struct tpkt_aggr;
+
+
+/* Aggregator configuration */
+struct tpkt_aggr_cfg {
+	/* Maximum aggregated datagram size in bytes (mandatory); a packet
+	 * that does not fit alone in a datagram of this size is emitted
+	 * alone in a larger datagram */
+	size_t max_size;
+
+	/* Maximum time in microseconds a packet can be buffered; 0 means
+	 * that the packets are only aggregated within a tpkt_aggr_push()
+	 * call */
+	uint64_t max_delay;
+
+	/* Packets with a priority greater than or equal to this value cause
+	 * the immediate emission of the datagram of their peer, including
+	 * the packets buffered before them (0 means no urgent priority) */
+	int urgent_priority;
+
+	/* Maximum number of peers with a datagram being built (0 means the
+	 * default value: 64); a peer is forgotten when its datagram is
+	 * emitted. When the peer table is full, the packets of new peers
+	 * are emitted immediately */
+	unsigned int max_peers;
+
+	/* Pool to get the aggregated datagrams from (optional, can be NULL;
+	 * its capacity must be at least max_size) */
+	struct tpkt_pool *pool;
+};
+
+
+/* Aggregator counters */
+struct tpkt_aggr_stats {
+	/* Packets aggregated */
+	uint64_t packets;
+
+	/* Aggregated datagrams emitted */
+	uint64_t datagrams;
+
+	/* Datagrams emitted because the size limit was reached */
+	uint64_t size_flushes;
+
+	/* Datagrams emitted because the maximum delay was reached */
+	uint64_t delay_flushes;
+
+	/* Datagrams emitted because of an urgent packet */
+	uint64_t urgent_flushes;
+};
+
+
+/**
+ * Create an aggregator.
+ * The created aggregator object is returned through the ret_obj parameter.
+ * When no longer needed, the aggregator must be freed using the
+ * tpkt_aggr_destroy() function.
+ * @param cfg: aggregator configuration
+ * @param ret_obj: pointer to the created object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_aggr_new(const struct tpkt_aggr_cfg *cfg,
+			   struct tpkt_aggr **ret_obj);
+
+
+/**
+ * Free an aggregator.
+ * The buffered packets are dropped.
+ * @param aggr: aggregator object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_aggr_destroy(struct tpkt_aggr *aggr);
+
+
+/**
+ * Add packets to the aggregator.
+ * The packets are removed from the input list and their data is copied in
+ * the aggregated datagram of their peer. The datagrams that are ready
+ * (size limit, urgent packet or maximum delay reached) are added at the
+ * end of the output list. The input packets must be at most 65535 bytes
+ * long, otherwise -E2BIG is returned. In case of error, the packets that
+ * were not processed remain in the input list.
+ * @param aggr: aggregator object handle
+ * @param list: input packet list
+ * @param ts: current time in microseconds on the monotonic clock
+ * @param out: output datagram list
+ * @return the number of emitted datagrams on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_aggr_push(struct tpkt_aggr *aggr,
+			    struct tpkt_list *list,
+			    uint64_t ts,
+			    struct tpkt_list *out);
+
+
+/**
+ * Emit the aggregated datagrams whose maximum delay is reached.
+ * The datagrams are added at the end of the output list.
+ * @param aggr: aggregator object handle
+ * @param ts: current time in microseconds on the monotonic clock
+ * @param out: output datagram list
+ * @return the number of emitted datagrams on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int
+tpkt_aggr_pop(struct tpkt_aggr *aggr, uint64_t ts, struct tpkt_list *out);
+
+
+/**
+ * Get the time at which tpkt_aggr_pop() should next be called.
+ * If no packet is buffered, -ENOENT is returned.
+ * @param aggr: aggregator object handle
+ * @param ts: pointer on the time in microseconds on the monotonic clock
+ *            (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_aggr_get_next_deadline(struct tpkt_aggr *aggr,
+					 uint64_t *ts);
+
+
+/**
+ * Emit all the aggregated datagrams, regardless of their delay.
+ * The datagrams are added at the end of the output list.
+ * @param aggr: aggregator object handle
+ * @param out: output datagram list
+ * @return the number of emitted datagrams on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_aggr_flush(struct tpkt_aggr *aggr, struct tpkt_list *out);
+
+
+/**
+ * Get the aggregator counters.
+ * @param aggr: aggregator object handle
+ * @param stats: pointer on the counters structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_aggr_get_stats(struct tpkt_aggr *aggr,
+				 struct tpkt_aggr_stats *stats);
+
+
+/**
+ * Split an aggregated datagram into packets.
+ * The packets reference ranges of the datagram data (see tpkt_new_slice())
+ * and are added in order at the end of the output list (the list holds
+ * the only reference). If the datagram is malformed, -EPROTO is returned
+ * and no packet is added.
+ * @param pkt: aggregated datagram packet object handle
+ * @param out: output packet list
+ * @return the number of packets on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_aggr_split(struct tpkt_packet *pkt, struct tpkt_list *out);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_AGGR_H_ */
@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_ARENA_H_
+#define _TPKT_ARENA_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Packet memory arenas.
+ * An arena reserves a large memory region, backed by 2MB huge pages when
+ * possible, from which packet pools carve their packets and data buffers
+ * (see the arena field of struct tpkt_pool_cfg). Huge pages reduce the TLB
+ * misses when walking large packet queues.
+ * On Linux, the arena first tries explicit huge pages (MAP_HUGETLB, which
+ * requires huge pages to be reserved by the system), then transparent huge
+ * pages (madvise(MADV_HUGEPAGE) on a 2MB-aligned region), then falls back to
+ * normal pages. On other platforms, normal pages are used.
+ * Memory is allocated from the arena with a bump allocator: it is only
+ * released when the arena is destroyed.
+ */
+
+
+/* Forward declarations */
+struct tpkt_arena;
+
+
+/* Arena page types */
+enum tpkt_arena_page_type {
+	/* Best available page type (huge pages if possible) */
+	TPKT_ARENA_PAGE_AUTO = 0,
+
+	/* Normal pages */
+	TPKT_ARENA_PAGE_NORMAL,
+
+	/* Transparent huge pages (Linux only) */
+	TPKT_ARENA_PAGE_THP,
+
+	/* Explicit huge pages (Linux only) */
+	TPKT_ARENA_PAGE_HUGETLB,
+};
+
+
+/* Arena configuration */
+struct tpkt_arena_cfg {
+	/* Arena size in bytes (mandatory); rounded up to a multiple of the
+	 * huge page size */
+	size_t size;
+
+	/* Requested page type; with TPKT_ARENA_PAGE_AUTO, the fallbacks
+	 * described above are used, otherwise the creation fails with
+	 * -ENOTSUP if the page type is not available */
+	enum tpkt_arena_page_type page_type;
+
+	/* If not 0, the memory is touched at creation so that no page
+	 * fault occurs afterwards */
+	int populate;
+};
+
+
+/**
+ * Create an arena.
+ * The created arena object is returned through the ret_obj parameter.
+ * When no longer needed, the arena must be freed using the
+ * tpkt_arena_destroy() function.
+ * @param cfg: arena configuration
+ * @param ret_obj: pointer to the created object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_arena_new(const struct tpkt_arena_cfg *cfg,
+			    struct tpkt_arena **ret_obj);
+
+
+/**
+ * Free an arena.
+ * All pools created from the arena must have been destroyed, otherwise
+ * -EBUSY is returned and the arena is not freed.
+ * @param arena: arena object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_arena_destroy(struct tpkt_arena *arena);
+
+
+/**
+ * Allocate memory from an arena.
+ * If the arena does not have enough memory left, -ENOMEM is returned.
+ * This function is thread safe.
+ * @param arena: arena object handle
+ * @param size: size in bytes
+ * @param align: alignment in bytes (power of 2, 0 means no alignment)
+ * @param ptr: pointer to the allocated memory (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int
+tpkt_arena_alloc(struct tpkt_arena *arena, size_t size, size_t align, void **ptr);
+
+
+/**
+ * Get the page type actually used by an arena.
+ * @param arena: arena object handle
+ * @return the page type on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_arena_get_page_type(struct tpkt_arena *arena);
+
+
+/**
+ * Get a page type name.
+ * @param type: page type
+ * @return the page type name
+ */
+TPKT_API const char *
+tpkt_arena_page_type_to_str(enum tpkt_arena_page_type type);
+
+
+/**
+ * Get the arena size and the allocated size.
+ * @param arena: arena object handle
+ * @param size: pointer on the arena size in bytes
+ *              (output; optional, can be NULL)
+ * @param used: pointer on the allocated size in bytes
+ *              (output; optional, can be NULL)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int
+tpkt_arena_get_size(struct tpkt_arena *arena, size_t *size, size_t *used);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_ARENA_H_ */
@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_CAPTURE_H_
+#define _TPKT_CAPTURE_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Packet capture.
+ * A capture writes the packets passed to tpkt_capture_packet() or
+ * tpkt_capture_list() to a pcapng file (link type LINKTYPE_RAW), each
+ * packet payload being prefixed by a synthesized IPv4 or IPv6 and UDP
+ * header built from the packet peer address and the configured local
+ * address. The capture direction is stored in the packet flags and the
+ * packet priority and timestamp in the packet comment.
+ * Capturing a packet only takes a reference on it and adds it to a
+ * bounded lock-free queue; the packets are written and unreferenced by a
+ * background writer thread. When the queue is full, the packets are not
+ * captured and counted as dropped: capturing never blocks the caller.
+ * As captured packets are shared until written, they cannot be modified
+ * (see tpkt_clone()); packets in thread-local mode cannot be captured.
+ * The capture functions can be called from any thread.
+ */
+
+
+/* Forward declarations */
+struct tpkt_capture;
+
+
+/* Capture direction */
+enum tpkt_capture_dir {
+	/* Received packet: the peer address is the source address */
+	TPKT_CAPTURE_DIR_IN = 0,
+
+	/* Sent packet: the peer address is the destination address */
+	TPKT_CAPTURE_DIR_OUT,
+};
+
+
+/* Capture configuration */
+struct tpkt_capture_cfg {
+	/* Path of the pcapng file to create (mandatory); an existing file
+	 * is truncated */
+	const char *path;
+
+	/* Local address (IPv4 or IPv6) of the synthesized headers
+	 * (optional, can be NULL: unspecified address and port 0) */
+	const struct sockaddr *local_addr;
+
+	/* Local address size in bytes */
+	socklen_t local_addrlen;
+
+	/* Maximum number of queued packets (0 means default); rounded up
+	 * to a power of 2 */
+	size_t queue_size;
+
+	/* Maximum number of payload bytes written per packet
+	 * (0 means no limit) */
+	size_t snaplen;
+
+	/* Interface name written in the capture file (optional, can be
+	 * NULL) */
+	const char *name;
+};
+
+
+/* Capture statistics */
+struct tpkt_capture_stats {
+	/* Packets queued for capture */
+	uint64_t queued;
+
+	/* Packets not captured because the queue was full */
+	uint64_t dropped;
+
+	/* Packets written to the capture file */
+	uint64_t written;
+
+	/* Packets not written because of a write error */
+	uint64_t errors;
+};
+
+
+/**
+ * Create a packet capture.
+ * The capture file is created with its header and the writer thread is
+ * started. The created capture object is returned through the ret_obj
+ * parameter. When no longer needed, the capture must be freed using the
+ * tpkt_capture_destroy() function.
+ * @param cfg: capture configuration
+ * @param ret_obj: pointer to the created capture object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_capture_new(const struct tpkt_capture_cfg *cfg,
+			      struct tpkt_capture **ret_obj);
+
+
+/**
+ * Free a packet capture.
+ * The queued packets are written, the dropped packet count is written in
+ * the capture file statistics and the file is closed. No capture function
+ * must be called concurrently or afterwards.
+ * @param capture: capture object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_capture_destroy(struct tpkt_capture *capture);
+
+
+/**
+ * Capture a packet.
+ * The packet reference counter is incremented until the packet is
+ * written. If the queue is full, the packet is dropped and -ENOBUFS is
+ * returned.
+ * @param capture: capture object handle
+ * @param pkt: packet object handle
+ * @param dir: capture direction
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_capture_packet(struct tpkt_capture *capture,
+				 struct tpkt_packet *pkt,
+				 enum tpkt_capture_dir dir);
+
+
+/**
+ * Capture all the packets of a list.
+ * The list is not modified. Packets that do not fit in the queue are
+ * dropped (see tpkt_capture_get_stats()).
+ * @param capture: capture object handle
+ * @param list: packet list handle
+ * @param dir: capture direction
+ * @return the number of packets queued on success, negative errno value in
+ *         case of error
+ */
+TPKT_API int tpkt_capture_list(struct tpkt_capture *capture,
+			       struct tpkt_list *list,
+			       enum tpkt_capture_dir dir);
+
+
+/**
+ * Get the capture statistics.
+ * The statistics can be read from any thread.
+ * @param capture: capture object handle
+ * @param stats: pointer on the statistics structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_capture_get_stats(struct tpkt_capture *capture,
+				    struct tpkt_capture_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_CAPTURE_H_ */
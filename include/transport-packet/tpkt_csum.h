@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_CSUM_H_
+#define _TPKT_CSUM_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Checksums.
+ * Internet checksum (RFC 1071) and CRC32C (Castagnoli) computation over
+ * raw buffers, packets, multi-segment packets (arrays of packets checksummed
+ * as a single message) and packet lists.
+ * The computation kernels use SIMD instructions (SSE2 and AVX2 on x86,
+ * NEON on arm64) for the Internet checksum and the CRC32C instructions
+ * (SSE4.2 on x86, ARMv8 CRC extension on arm64) when available, selected at
+ * runtime, with a scalar fallback.
+ *
+ * Internet checksum values (partial sums and final checksums) are in the
+ * byte order of the data: a final checksum can be stored as is in a
+ * protocol header (e.g. with memcpy()) without byte order conversion.
+ *
+ * CRC32C values follow the usual convention (initial value and final XOR
+ * of 0xffffffff applied internally): the CRC of a message is obtained by
+ * passing 0 as the initial CRC value, and the CRC of consecutive buffers can
+ * be computed by passing the previous result as the initial value.
+ */
+
+
+/* Computation kernels implementation */
+enum tpkt_csum_impl {
+	/* Best available implementation (default) */
+	TPKT_CSUM_IMPL_AUTO = 0,
+
+	/* Portable scalar implementation */
+	TPKT_CSUM_IMPL_SCALAR,
+};
+
+
+/**
+ * Select the computation kernels implementation.
+ * This function is intended for testing and benchmarking; it is not
+ * thread safe and must not be called while checksum computations are
+ * running.
+ * @param impl: implementation to use
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_csum_set_impl(enum tpkt_csum_impl impl);
+
+
+/**
+ * Get the name of the Internet checksum implementation in use.
+ * @return the implementation name
+ */
+TPKT_API const char *tpkt_csum_inet_get_impl_name(void);
+
+
+/**
+ * Get the name of the CRC32C implementation in use.
+ * @return the implementation name
+ */
+TPKT_API const char *tpkt_crc32c_get_impl_name(void);
+
+
+/**
+ * Internet checksum API
+ */
+
+
+/**
+ * Compute the Internet checksum partial sum of a buffer.
+ * The partial sum is a 32-bit one's complement sum that can be combined
+ * with other partial sums (see tpkt_csum_inet_combine()) and must be
+ * folded to obtain the final checksum (see tpkt_csum_inet_fold()).
+ * @param data: pointer on the data
+ * @param len: data length in bytes
+ * @param sum: initial partial sum (0 for a new computation)
+ * @return the partial sum
+ */
+TPKT_API uint32_t tpkt_csum_inet_partial(const void *data,
+					 size_t len,
+					 uint32_t sum);
+
+
+/**
+ * Combine two Internet checksum partial sums of consecutive buffers.
+ * @param sum1: partial sum of the first buffer
+ * @param sum2: partial sum of the second buffer
+ * @param len1: length of the first buffer in bytes
+ * @return the partial sum of the concatenation of both buffers
+ */
+TPKT_API uint32_t tpkt_csum_inet_combine(uint32_t sum1,
+					 uint32_t sum2,
+					 size_t len1);
+
+
+/**
+ * Fold an Internet checksum partial sum into the final checksum.
+ * @param sum: partial sum
+ * @return the final checksum (one's complement of the folded sum)
+ */
+TPKT_API uint16_t tpkt_csum_inet_fold(uint32_t sum);
+
+
+/**
+ * Compute the Internet checksum of a buffer.
+ * @param data: pointer on the data
+ * @param len: data length in bytes
+ * @return the checksum
+ */
+TPKT_API uint16_t tpkt_csum_inet(const void *data, size_t len);
+
+
+/**
+ * Incrementally update an Internet checksum after a 16-bit field of the
+ * checksummed data has been modified (RFC 1624).
+ * The field must be at an even offset in the checksummed data; the old and
+ * new values are in the byte order of the data.
+ * @param csum: checksum before the modification
+ * @param old_val: old field value
+ * @param new_val: new field value
+ * @return the updated checksum
+ */
+TPKT_API uint16_t tpkt_csum_inet_update16(uint16_t csum,
+					  uint16_t old_val,
+					  uint16_t new_val);
+
+
+/**
+ * Incrementally update an Internet checksum after a header has been pushed
+ * in front of the checksummed data.
+ * @param csum: checksum of the data before the header was pushed
+ * @param hdr: pointer on the header
+ * @param hdr_len: header length in bytes
+ * @return the checksum of the header followed by the data
+ */
+TPKT_API uint16_t
+tpkt_csum_inet_push(uint16_t csum, const void *hdr, size_t hdr_len);
+
+
+/**
+ * Compute the Internet checksum of a packet data.
+ * @param pkt: packet object handle
+ * @param offset: offset of the checksummed data in the packet data
+ * @param csum: pointer to the checksum (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int
+tpkt_csum_inet_packet(struct tpkt_packet *pkt, size_t offset, uint16_t *csum);
+
+
+/**
+ * Compute the Internet checksum of a multi-segment packet.
+ * The data of the packets is checksummed as a single message, in the array
+ * order.
+ * @param pkts: array of packets
+ * @param count: packet count
+ * @param csum: pointer to the checksum (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_csum_inet_segments(struct tpkt_packet *const *pkts,
+				     unsigned int count,
+				     uint16_t *csum);
+
+
+/**
+ * Compute the Internet checksums of all the packets of a list.
+ * @param list: packet list
+ * @param offset: offset of the checksummed data in each packet data
+ * @param csums: array of checksums (output), in the list order
+ * @param count: size of the checksum array (must be at least the list
+ *               packet count)
+ * @return the number of computed checksums on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_csum_inet_list(struct tpkt_list *list,
+				 size_t offset,
+				 uint16_t *csums,
+				 size_t count);
+
+
+/**
+ * CRC32C API
+ */
+
+
+/**
+ * Compute the CRC32C of a buffer.
+ * @param crc: initial CRC (0 for a new computation, or the CRC of the
+ *             preceding data)
+ * @param data: pointer on the data
+ * @param len: data length in bytes
+ * @return the CRC
+ */
+TPKT_API uint32_t tpkt_crc32c(uint32_t crc, const void *data, size_t len);
+
+
+/**
+ * Combine the CRC32C of two consecutive buffers.
+ * This is typically used to update a CRC after a header has been pushed in
+ * front of the data without reading the data again: the CRC of the header
+ * and data is tpkt_crc32c_combine(tpkt_crc32c(0, hdr, hdr_len), data_crc,
+ * data_len).
+ * @param crc1: CRC of the first buffer
+ * @param crc2: CRC of the second buffer
+ * @param len2: length of the second buffer in bytes
+ * @return the CRC of the concatenation of both buffers
+ */
+TPKT_API uint32_t tpkt_crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+
+/**
+ * Compute the CRC32C of a packet data.
+ * @param pkt: packet object handle
+ * @param offset: offset of the CRC data in the packet data
+ * @param crc: pointer to the CRC (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int
+tpkt_crc32c_packet(struct tpkt_packet *pkt, size_t offset, uint32_t *crc);
+
+
+/**
+ * Compute the CRC32C of a multi-segment packet.
+ * The data of the packets is processed as a single message, in the array
+ * order.
+ * @param pkts: array of packets
+ * @param count: packet count
+ * @param crc: pointer to the CRC (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_crc32c_segments(struct tpkt_packet *const *pkts,
+				  unsigned int count,
+				  uint32_t *crc);
+
+
+/**
+ * Compute the CRC32C of all the packets of a list.
+ * @param list: packet list
+ * @param offset: offset of the CRC data in each packet data
+ * @param crcs: array of CRCs (output), in the list order
+ * @param count: size of the CRC array (must be at least the list packet
+ *               count)
+ * @return the number of computed CRCs on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_crc32c_list(struct tpkt_list *list,
+			      size_t offset,
+			      uint32_t *crcs,
+			      size_t count);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_CSUM_H_ */
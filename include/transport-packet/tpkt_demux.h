@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_DEMUX_H_
+#define _TPKT_DEMUX_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Per-flow demultiplexer.
+ * The demultiplexer maps the packets to flows using a hash table keyed on
+ * the peer address and port, optionally combined with an extra key
+ * extracted from the packet by the application (e.g. an RTP SSRC).
+ * Each flow owns a packet list that is filled by tpkt_demux_process().
+ *
+ * Threading model: flow lookups (tpkt_demux_lookup() and
+ * tpkt_demux_lookup_packet()) are lock-free and can be called from any
+ * thread. Adding and removing flows can be done from any thread (they are
+ * serialized internally). tpkt_demux_process() and the flow packet lists
+ * must be used from a single thread (the data thread). Removed flows are
+ * not freed immediately, as a concurrent lookup may still be using them:
+ * they are freed by tpkt_demux_reclaim(), which must be called when no
+ * lookup or processing can be in progress (e.g. from the data thread
+ * between two batches), or when the demultiplexer is destroyed.
+ */
+
+
+/* Forward declarations */
+struct tpkt_demux;
+struct tpkt_demux_flow;
+
+
+/**
+ * Extra key extraction function.
+ * @param pkt: packet object handle
+ * @param key: pointer on the extra key (output)
+ * @param userdata: user data pointer
+ * @return 0 on success, negative errno value in case of error; packets for
+ *         which no key can be extracted are considered unmatched
+ */
+typedef int (*tpkt_demux_key_t)(struct tpkt_packet *pkt,
+				uint32_t *key,
+				void *userdata);
+
+
+/* Demultiplexer configuration */
+struct tpkt_demux_cfg {
+	/* Expected number of flows (0 means default); the table grows
+	 * automatically */
+	size_t size_hint;
+
+	/* Extra key extraction function (optional, can be NULL);
+	 * if NULL, the extra key is always 0 */
+	tpkt_demux_key_t key_fn;
+
+	/* Extra key extraction function user data pointer */
+	void *key_userdata;
+};
+
+
+/**
+ * Create a demultiplexer.
+ * The created demultiplexer object is returned through the ret_obj
+ * parameter. When no longer needed, the demultiplexer must be freed using
+ * the tpkt_demux_destroy() function.
+ * @param cfg: demultiplexer configuration (optional, can be NULL)
+ * @param ret_obj: pointer to the created object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_demux_new(const struct tpkt_demux_cfg *cfg,
+			    struct tpkt_demux **ret_obj);
+
+
+/**
+ * Free a demultiplexer.
+ * All flows are freed and their packet lists are flushed.
+ * @param demux: demultiplexer object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_demux_destroy(struct tpkt_demux *demux);
+
+
+/**
+ * Add a flow.
+ * If a flow already exists for the address and extra key, -EEXIST is
+ * returned.
+ * @param demux: demultiplexer object handle
+ * @param addr: peer address (IPv4 or IPv6)
+ * @param key: extra key (0 if no extra key function is used)
+ * @param userdata: flow user data pointer (optional, can be NULL)
+ * @param ret_obj: pointer to the created flow object pointer
+ *                 (output; optional, can be NULL)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_demux_add_flow(struct tpkt_demux *demux,
+				 const struct sockaddr *addr,
+				 uint32_t key,
+				 void *userdata,
+				 struct tpkt_demux_flow **ret_obj);
+
+
+/**
+ * Remove a flow.
+ * The flow is no longer returned by lookups; it is freed (and its packet
+ * list flushed) by the next call to tpkt_demux_reclaim().
+ * @param demux: demultiplexer object handle
+ * @param flow: flow object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_demux_remove_flow(struct tpkt_demux *demux,
+				    struct tpkt_demux_flow *flow);
+
+
+/**
+ * Free the removed flows and the retired hash tables.
+ * See the threading model above for when this function can be called.
+ * @param demux: demultiplexer object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_demux_reclaim(struct tpkt_demux *demux);
+
+
+/**
+ * Get the flow count.
+ * @param demux: demultiplexer object handle
+ * @return the flow count on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_demux_get_flow_count(struct tpkt_demux *demux);
+
+
+/**
+ * Look up a flow by address and extra key (lock-free).
+ * @param demux: demultiplexer object handle
+ * @param addr: peer address (IPv4 or IPv6)
+ * @param key: extra key
+ * @return the flow on success, NULL if not found or in case of error
+ */
+TPKT_API struct tpkt_demux_flow *
+tpkt_demux_lookup(struct tpkt_demux *demux,
+		  const struct sockaddr *addr,
+		  uint32_t key);
+
+
+/**
+ * Look up the flow of a packet (lock-free).
+ * The packet peer address is used along with the extra key returned by the
+ * extra key extraction function, if any.
+ * @param demux: demultiplexer object handle
+ * @param pkt: packet object handle
+ * @return the flow on success, NULL if not found or in case of error
+ */
+TPKT_API struct tpkt_demux_flow *
+tpkt_demux_lookup_packet(struct tpkt_demux *demux, struct tpkt_packet *pkt);
+
+
+/**
+ * Demultiplex a list of packets.
+ * In a single pass, each packet of the list that matches a flow is moved
+ * to the end of the flow packet list. Unmatched packets are left in the
+ * input list, in their original order.
+ * @param demux: demultiplexer object handle
+ * @param list: list of packets to demultiplex
+ * @return the number of matched packets on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_demux_process(struct tpkt_demux *demux,
+				struct tpkt_list *list);
+
+
+/**
+ * Get a flow packet list.
+ * The list is filled by tpkt_demux_process(); the application is
+ * responsible for removing the packets from it.
+ * @param flow: flow object handle
+ * @return the flow packet list on success, NULL in case of error
+ */
+TPKT_API struct tpkt_list *
+tpkt_demux_flow_get_list(struct tpkt_demux_flow *flow);
+
+
+/**
+ * Get a flow user data pointer.
+ * @param flow: flow object handle
+ * @return the flow user data pointer on success, NULL in case of error
+ */
+TPKT_API void *tpkt_demux_flow_get_userdata(struct tpkt_demux_flow *flow);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_DEMUX_H_ */
@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_FEC_H_
+#define _TPKT_FEC_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Forward error correction.
+ * Repair packets are computed over a group of source packets, either as
+ * a single XOR parity packet (recovers one missing packet) or as m
+ * Reed-Solomon repair packets (systematic Cauchy code over GF(2^8),
+ * recovers up to m missing packets).
+ * Source packets may have different lengths: each source packet is
+ * protected as its 16-bit big-endian length followed by its data, padded
+ * with zeros to the longest packet; repair packets are therefore 2 bytes
+ * longer than the longest source packet.
+ * The group parameters (group size, repair count and packet indexes) must
+ * be carried by the application protocol.
+ * The computation kernels use SIMD instructions when available (SSSE3 and
+ * AVX2 on x86, NEON on arm64), selected at runtime, with a scalar fallback.
+ */
+
+
+/* Maximum number of source plus repair packets in a Reed-Solomon group */
+#define TPKT_FEC_RS_MAX_PACKETS 256
+
+
+/* Computation kernels implementation */
+enum tpkt_fec_impl {
+	/* Best available implementation (default) */
+	TPKT_FEC_IMPL_AUTO = 0,
+
+	/* Portable scalar implementation */
+	TPKT_FEC_IMPL_SCALAR,
+
+	/* x86 SSSE3 implementation */
+	TPKT_FEC_IMPL_SSSE3,
+
+	/* x86 AVX2 implementation */
+	TPKT_FEC_IMPL_AVX2,
+
+	/* arm64 NEON implementation */
+	TPKT_FEC_IMPL_NEON,
+};
+
+
+/**
+ * Select the computation kernels implementation.
+ * This function is intended for testing and benchmarking; it is not
+ * thread safe and must not be called while FEC computations are running.
+ * @param impl: implementation to use
+ * @return 0 on success, -ENOTSUP if the implementation is not available
+ *         on this platform, negative errno value in case of error
+ */
+TPKT_API int tpkt_fec_set_impl(enum tpkt_fec_impl impl);
+
+
+/**
+ * Get the name of the computation kernels implementation in use.
+ * @return the implementation name
+ */
+TPKT_API const char *tpkt_fec_get_impl_name(void);
+
+
+/**
+ * Compute the XOR parity packet of a group of source packets.
+ * The repair packet is obtained from the pool if one is given (its
+ * capacity must be large enough, otherwise -ENOBUFS is returned), or
+ * allocated otherwise. It is returned with a reference count of 1.
+ * @param src: array of source packets
+ * @param count: source packet count
+ * @param pool: pool to get the repair packet from (optional, can be NULL)
+ * @param ret_obj: pointer to the repair packet object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_fec_xor_encode(struct tpkt_packet *const *src,
+				 unsigned int count,
+				 struct tpkt_pool *pool,
+				 struct tpkt_packet **ret_obj);
+
+
+/**
+ * Recover a missing source packet from the XOR parity packet.
+ * Exactly one entry of the src array must be NULL; the recovered packet is
+ * stored in this entry with a reference count of 1 (the caller must
+ * unreference it). The packet is obtained from the pool if one is given,
+ * or allocated otherwise.
+ * @param src: array of source packets (input/output)
+ * @param count: source packet count
+ * @param repair: XOR parity packet
+ * @param pool: pool to get the recovered packet from
+ *              (optional, can be NULL)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_fec_xor_decode(struct tpkt_packet **src,
+				 unsigned int count,
+				 struct tpkt_packet *repair,
+				 struct tpkt_pool *pool);
+
+
+/**
+ * Compute the Reed-Solomon repair packets of a group of source packets.
+ * The k + m total must not exceed TPKT_FEC_RS_MAX_PACKETS. The repair
+ * packets are obtained from the pool if one is given (their capacity must
+ * be large enough, otherwise -ENOBUFS is returned), or allocated
+ * otherwise. They are returned with a reference count of 1.
+ * @param src: array of source packets (k entries)
+ * @param k: source packet count
+ * @param repair: array of repair packets (m entries, output)
+ * @param m: repair packet count
+ * @param pool: pool to get the repair packets from (optional, can be NULL)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_fec_rs_encode(struct tpkt_packet *const *src,
+				unsigned int k,
+				struct tpkt_packet **repair,
+				unsigned int m,
+				struct tpkt_pool *pool);
+
+
+/**
+ * Recover missing source packets from Reed-Solomon repair packets.
+ * Missing source and repair packets are NULL entries in the arrays. At
+ * least k packets (source and repair) must be available, otherwise
+ * -EPROTO is returned. The recovered packets are stored in the src array
+ * with a reference count of 1 (the caller must unreference them). The
+ * packets are obtained from the pool if one is given, or allocated
+ * otherwise.
+ * @param src: array of source packets (k entries, input/output)
+ * @param k: source packet count
+ * @param repair: array of repair packets (m entries)
+ * @param m: repair packet count
+ * @param pool: pool to get the recovered packets from
+ *              (optional, can be NULL)
+ * @return the number of recovered packets on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_fec_rs_decode(struct tpkt_packet **src,
+				unsigned int k,
+				struct tpkt_packet *const *repair,
+				unsigned int m,
+				struct tpkt_pool *pool);
+
+
+/**
+ * Compute the Reed-Solomon repair packets of a list of source packets.
+ * The m repair packets are added at the end of the output list.
+ * See tpkt_fec_rs_encode().
+ * @param list: list of source packets
+ * @param m: repair packet count
+ * @param pool: pool to get the repair packets from (optional, can be NULL)
+ * @param repair_list: output repair packet list
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_fec_rs_encode_list(struct tpkt_list *list,
+				     unsigned int m,
+				     struct tpkt_pool *pool,
+				     struct tpkt_list *repair_list);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_FEC_H_ */
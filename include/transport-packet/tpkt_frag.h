@@ -0,0 +1,266 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_FRAG_H_
+#define _TPKT_FRAG_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Fragmentation and reassembly.
+ * The fragmenter splits a large buffer or packet into fragment packets of
+ * at most a given size that reference ranges of the original data (no
+ * copy, see tpkt_new_slice()).
+ * The reassembler collects the fragments of frames identified by a frame
+ * id, a fragment index and a fragment count, and outputs the fragments of
+ * each complete frame in order. The fragment header format is left to the
+ * application protocol: the application parses its header and pushes the
+ * fragment payload (typically a slice of the received packet).
+ * Incomplete frames are dropped after a timeout, and the oldest incomplete
+ * frames are dropped when the memory budget or the maximum frame count is
+ * reached. The reassembler is not thread safe; time is provided by the
+ * caller.
+ */
+
+
+/* Forward declarations */
+struct tpkt_reasm;
+
+
+/**
+ * Fragmenter API
+ */
+
+
+/**
+ * Split a buffer into fragment packets.
+ * The fragments reference ranges of the buffer data (the buffer reference
+ * counter is incremented for each fragment) and are added in order at the
+ * end of the output list (the list holds the only reference).
+ * @param buf: pointer on a pomp_buffer object
+ * @param max_size: maximum fragment size in bytes
+ * @param list: output packet list
+ * @return the number of fragments on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_frag_split_buffer(struct pomp_buffer *buf,
+				    size_t max_size,
+				    struct tpkt_list *list);
+
+
+/**
+ * Split a packet into fragment packets.
+ * The fragments reference ranges of the packet data (see
+ * tpkt_new_slice()) and are added in order at the end of the output list
+ * (the list holds the only reference).
+ * @param pkt: packet object handle
+ * @param max_size: maximum fragment size in bytes
+ * @param list: output packet list
+ * @return the number of fragments on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_frag_split_packet(struct tpkt_packet *pkt,
+				    size_t max_size,
+				    struct tpkt_list *list);
+
+
+/**
+ * Join the data of a list of packets into a new buffer.
+ * This is intended for consumers that need the reassembled frame data to
+ * be contiguous. The created buffer is returned through the ret_obj
+ * parameter; when no longer needed, it must be unreferenced using the
+ * pomp_buffer_unref() function.
+ * @param list: packet list
+ * @param ret_obj: pointer to the created buffer object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_frag_join(struct tpkt_list *list,
+			    struct pomp_buffer **ret_obj);
+
+
+/**
+ * Reassembler API
+ */
+
+
+/* Reassembler configuration */
+struct tpkt_reasm_cfg {
+	/* Maximum time in microseconds between the first fragment of a
+	 * frame and its completion (0 means no timeout) */
+	uint64_t timeout;
+
+	/* Memory budget: maximum total data length in bytes of the
+	 * fragments held by the reassembler (0 means no limit) */
+	size_t max_bytes;
+
+	/* Maximum number of frames being reassembled at the same time
+	 * (0 means the default value: 16) */
+	unsigned int max_frames;
+
+	/* Maximum fragment count of a frame
+	 * (0 means the default value: 64) */
+	unsigned int max_fragments;
+};
+
+
+/* Reassembler counters */
+struct tpkt_reasm_stats {
+	/* Complete frames output */
+	uint64_t frames;
+
+	/* Incomplete frames dropped on timeout */
+	uint64_t timeouts;
+
+	/* Incomplete frames dropped to respect the memory budget or the
+	 * maximum frame count */
+	uint64_t evictions;
+
+	/* Fragments received for a frame that was already completed or
+	 * dropped (not inserted) */
+	uint64_t late;
+
+	/* Duplicate fragments (not inserted) */
+	uint64_t duplicate;
+
+	/* Invalid fragments: bad index or count, count inconsistent with
+	 * the other fragments of the frame (not inserted) */
+	uint64_t invalid;
+};
+
+
+/**
+ * Create a reassembler.
+ * The created reassembler object is returned through the ret_obj
+ * parameter. When no longer needed, the reassembler must be freed using
+ * the tpkt_reasm_destroy() function.
+ * @param cfg: reassembler configuration
+ * @param ret_obj: pointer to the created object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_new(const struct tpkt_reasm_cfg *cfg,
+			    struct tpkt_reasm **ret_obj);
+
+
+/**
+ * Free a reassembler.
+ * All fragments held by the reassembler are unreferenced.
+ * @param reasm: reassembler object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_destroy(struct tpkt_reasm *reasm);
+
+
+/**
+ * Insert a fragment in the reassembler.
+ * The packet reference counter is incremented. When the fragment completes
+ * its frame, the fragments of the frame are added in order at the end of
+ * the output list (the reassembler reference is transferred to the list)
+ * and 1 is returned. Otherwise 0 is returned. The packet must not be in a
+ * list, otherwise -EBUSY is returned.
+ * If the fragment belongs to a recently completed or dropped frame,
+ * -EALREADY is returned; if the fragment was already received, -EEXIST is
+ * returned; if the fragment index or count is invalid, -EPROTO is
+ * returned; if the fragment alone exceeds the memory budget, -ENOBUFS is
+ * returned. In all these cases the packet is not inserted.
+ * @param reasm: reassembler object handle
+ * @param frame_id: frame identifier
+ * @param index: fragment index in the frame
+ * @param count: fragment count of the frame
+ * @param pkt: fragment packet object handle
+ * @param ts: current time in microseconds on the monotonic clock
+ * @param list: output packet list
+ * @return 1 if a frame was completed, 0 if not,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_push(struct tpkt_reasm *reasm,
+			     uint32_t frame_id,
+			     unsigned int index,
+			     unsigned int count,
+			     struct tpkt_packet *pkt,
+			     uint64_t ts,
+			     struct tpkt_list *list);
+
+
+/**
+ * Drop the incomplete frames that timed out.
+ * @param reasm: reassembler object handle
+ * @param ts: current time in microseconds on the monotonic clock
+ * @return the number of dropped frames on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_evict(struct tpkt_reasm *reasm, uint64_t ts);
+
+
+/**
+ * Get the time at which tpkt_reasm_evict() should next be called.
+ * If there is no incomplete frame or no timeout, -ENOENT is returned.
+ * @param reasm: reassembler object handle
+ * @param ts: pointer on the time in microseconds on the monotonic clock
+ *            (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_get_next_deadline(struct tpkt_reasm *reasm,
+					  uint64_t *ts);
+
+
+/**
+ * Drop all the incomplete frames.
+ * The fragments are unreferenced; the counters are kept.
+ * @param reasm: reassembler object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_flush(struct tpkt_reasm *reasm);
+
+
+/**
+ * Get the total data length of the fragments held by the reassembler.
+ * @param reasm: reassembler object handle
+ * @param bytes: pointer on the length in bytes (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_get_bytes(struct tpkt_reasm *reasm, size_t *bytes);
+
+
+/**
+ * Get the reassembler counters.
+ * @param reasm: reassembler object handle
+ * @param stats: pointer on the counters structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_reasm_get_stats(struct tpkt_reasm *reasm,
+				  struct tpkt_reasm_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_FRAG_H_ */
@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_HISTORY_H_
+#define _TPKT_HISTORY_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Retransmission history.
+ * The history keeps references to sent packets indexed by a 16-bit
+ * sequence number (e.g. RTP sequence number) so that packets can be
+ * retrieved in constant time for retransmission. Sequence number
+ * wraparound is handled by extending the sequence numbers internally.
+ * The history is bounded in packet count, and optionally in age and
+ * total bytes; the oldest packets are evicted first.
+ * The history is not thread safe.
+ */
+
+
+/* Forward declarations */
+struct tpkt_history;
+
+
+/* History configuration */
+struct tpkt_history_cfg {
+	/* Maximum number of packets (mandatory); rounded up to a power of 2,
+	 * at most 32768 so that the sequence numbers are not ambiguous */
+	size_t max_count;
+
+	/* Maximum packet age in microseconds (0 means no age limit) */
+	uint64_t max_age;
+
+	/* Maximum total packet size in bytes (0 means no size limit) */
+	size_t max_bytes;
+};
+
+
+/**
+ * Create a retransmission history.
+ * The created history object is returned through the ret_obj parameter.
+ * When no longer needed, the history must be freed using the
+ * tpkt_history_destroy() function.
+ * @param cfg: history configuration
+ * @param ret_obj: pointer to the created history object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_history_new(const struct tpkt_history_cfg *cfg,
+			      struct tpkt_history **ret_obj);
+
+
+/**
+ * Free a retransmission history.
+ * All packets in the history are unreferenced.
+ * @param history: history object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_history_destroy(struct tpkt_history *history);
+
+
+/**
+ * Add a packet to the history.
+ * The packet reference counter is incremented. Sequence numbers must be
+ * increasing (gaps are allowed); if the sequence number is not newer than
+ * the last added packet, -EALREADY is returned. Packets older than the
+ * maximum age relative to ts, and the oldest packets exceeding the count
+ * and size limits are evicted.
+ * @param history: history object handle
+ * @param seq: packet sequence number
+ * @param pkt: packet object handle
+ * @param ts: current time in microseconds on the monotonic clock; if 0,
+ *            the packet timestamp is used
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_history_add(struct tpkt_history *history,
+			      uint16_t seq,
+			      struct tpkt_packet *pkt,
+			      uint64_t ts);
+
+
+/**
+ * Get a packet from the history.
+ * The packet is not removed from the history; its reference counter is
+ * incremented and the caller must unreference it when no longer needed.
+ * As the packet is shared, it cannot be modified (see tpkt_clone()).
+ * If no packet is found for the sequence number, -ENOENT is returned.
+ * @param history: history object handle
+ * @param seq: packet sequence number
+ * @param ret_obj: pointer to the packet object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_history_get(struct tpkt_history *history,
+			      uint16_t seq,
+			      struct tpkt_packet **ret_obj);
+
+
+/**
+ * Evict the packets older than the maximum age.
+ * @param history: history object handle
+ * @param ts: current time in microseconds on the monotonic clock
+ * @return the number of evicted packets on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_history_evict(struct tpkt_history *history, uint64_t ts);
+
+
+/**
+ * Remove all packets from the history.
+ * The packets are unreferenced and the sequence number tracking is reset.
+ * @param history: history object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_history_flush(struct tpkt_history *history);
+
+
+/**
+ * Get the history packet count.
+ * @param history: history object handle
+ * @return the packet count on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_history_get_count(struct tpkt_history *history);
+
+
+/**
+ * Get the history total packet size.
+ * @param history: history object handle
+ * @param bytes: pointer on the total size in bytes (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_history_get_bytes(struct tpkt_history *history,
+				    size_t *bytes);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_HISTORY_H_ */
@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_INLINE_H_
+#define _TPKT_INLINE_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Inline packet accessors.
+ * The functions of this optional header are static inline equivalents of
+ * the trivial packet getters, for use in per-packet loops. They access the
+ * packet object through struct tpkt_packet_abi, a public and versioned
+ * copy of the beginning of the packet structure; the rest of the packet
+ * structure remains private.
+ * Contrary to the exported functions, the inline accessors do not check
+ * their arguments: the packet must not be NULL.
+ * An application built with this header must check at initialization that
+ * the library it runs with uses the same packet ABI version, i.e. that
+ * tpkt_get_packet_abi_version() returns TPKT_PACKET_ABI_VERSION, and must
+ * otherwise use the exported functions only.
+ */
+
+
+/* Packet ABI version; incremented each time the public prefix of the
+ * packet structure changes */
+#define TPKT_PACKET_ABI_VERSION 2
+
+
+/* Public prefix of the packet structure; the application must only
+ * access it through the accessors below */
+struct tpkt_packet_abi {
+	/* Packet current reference count */
+	unsigned int ref_count;
+
+	/* QoS priority */
+	uint8_t priority;
+
+	/* Reserved */
+	uint8_t reserved1;
+
+	/* 1: data buffer is read-only; 0: data buffer is read/write */
+	uint8_t data_cst;
+
+	/* Buffer associated with the packet (can be NULL) */
+	struct pomp_buffer *buf;
+
+	/* Packet data (only if buf is NULL, undefined otherwise) */
+	struct {
+		union {
+			void *data;
+			const void *cdata;
+		};
+		size_t cap;
+		size_t len;
+	} data;
+
+	/* Reserved */
+	void *reserved2[2];
+
+	/* Packet timestamp in microseconds on the monotonic clock */
+	uint64_t timestamp;
+
+	/* Peer address */
+	union {
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} addr;
+};
+
+
+/**
+ * Get the packet ABI version of the library.
+ * @return the packet ABI version (see TPKT_PACKET_ABI_VERSION)
+ */
+TPKT_API unsigned int tpkt_get_packet_abi_version(void);
+
+
+static inline const struct tpkt_packet_abi *
+tpkt_packet_abi(const struct tpkt_packet *pkt)
+{
+	return (const struct tpkt_packet_abi *)pkt;
+}
+
+
+/**
+ * Get the packet data for read-only.
+ * Inline equivalent of tpkt_get_cdata(); packets associated to a
+ * pomp_buffer use the exported function.
+ * @param pkt: packet object handle
+ * @param data: pointer on the data (output; optional, can be NULL)
+ * @param len: pointer on the data length in bytes
+ *             (output; optional, can be NULL)
+ * @param cap: pointer on the buffer capacity in bytes
+ *             (output; optional, can be NULL)
+ * @return 0 on success, negative errno value in case of error
+ */
+static inline int tpkt_fast_get_cdata(struct tpkt_packet *pkt,
+				      const void **data,
+				      size_t *len,
+				      size_t *cap)
+{
+	const struct tpkt_packet_abi *abi = tpkt_packet_abi(pkt);
+
+	if (abi->buf != NULL)
+		return tpkt_get_cdata(pkt, data, len, cap);
+	if (data)
+		*data = abi->data.cdata;
+	if (len)
+		*len = abi->data.len;
+	if (cap)
+		*cap = abi->data.cap;
+	return 0;
+}
+
+
+/**
+ * Get the packet IPv4 peer address.
+ * Inline equivalent of tpkt_get_addr().
+ * @param pkt: packet object handle
+ * @return a pointer on the peer address
+ */
+static inline struct sockaddr_in *tpkt_fast_get_addr(struct tpkt_packet *pkt)
+{
+	return (struct sockaddr_in *)&tpkt_packet_abi(pkt)->addr.in;
+}
+
+
+/**
+ * Get the packet IPv6 peer address.
+ * Inline equivalent of tpkt_get_addr6().
+ * @param pkt: packet object handle
+ * @return a pointer on the peer address
+ */
+static inline struct sockaddr_in6 *
+tpkt_fast_get_addr6(struct tpkt_packet *pkt)
+{
+	return (struct sockaddr_in6 *)&tpkt_packet_abi(pkt)->addr.in6;
+}
+
+
+/**
+ * Get the packet timestamp.
+ * Inline equivalent of tpkt_get_timestamp().
+ * @param pkt: packet object handle
+ * @return the packet timestamp in microseconds on the monotonic clock
+ */
+static inline uint64_t tpkt_fast_get_timestamp(struct tpkt_packet *pkt)
+{
+	return tpkt_packet_abi(pkt)->timestamp;
+}
+
+
+/**
+ * Get the packet QoS priority.
+ * Inline equivalent of tpkt_get_priority().
+ * @param pkt: packet object handle
+ * @return the packet priority
+ */
+static inline int tpkt_fast_get_priority(struct tpkt_packet *pkt)
+{
+	return tpkt_packet_abi(pkt)->priority;
+}
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_INLINE_H_ */
@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_IO_H_
+#define _TPKT_IO_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Socket I/O helpers.
+ * This API is only available on Linux.
+ */
+
+
+/* Packet priority to QoS mapping */
+struct tpkt_qos_map {
+	/* DSCP value (0 to 63) for each packet priority; -1 means that
+	 * the IPv4 TOS / IPv6 traffic class is not set for packets of this
+	 * priority (the socket value is used) */
+	int dscp[QOS_PRIORITY_MAX + 1];
+
+	/* ECN codepoint (0 to 3) set along with the DSCP value */
+	int ecn;
+
+	/* Socket priority (SO_PRIORITY) for each packet priority; a negative
+	 * value means that the socket priority is not set for packets of
+	 * this priority; note: per-packet SO_PRIORITY requires a recent
+	 * kernel (6.6 or later), sendmsg() fails with EINVAL otherwise */
+	int so_priority[QOS_PRIORITY_MAX + 1];
+};
+
+
+/**
+ * Get the default priority to QoS mapping.
+ * The default mapping uses the following DSCP values, without ECN and
+ * without setting the socket priority:
+ *   priority   DSCP
+ *   0          BE (0)
+ *   1          AF11 (10)
+ *   2          AF21 (18)
+ *   3          AF31 (26)
+ *   4          AF41 (34)
+ *   5          CS5 (40)
+ *   6          EF (46)
+ *   7          CS6 (48)
+ * @param map: pointer on the mapping structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_qos_map_get_default(struct tpkt_qos_map *map);
+
+
+/**
+ * Send a list of packets on a UDP socket.
+ * The packets are sent in order with as few sendmmsg() calls as possible.
+ * Each packet is sent to its peer address if the address family is set
+ * (AF_INET or AF_INET6), otherwise the socket must be connected.
+ * If a QoS mapping is given, the IPv4 TOS / IPv6 traffic class and the
+ * socket priority are set for each packet from its priority using control
+ * messages, so that a batch of packets with mixed priorities is sent
+ * without any setsockopt() call.
+ * The packets that were sent are removed from the list and unreferenced;
+ * if an error occurs (e.g. -EAGAIN on a non-blocking socket), the
+ * remaining packets are left in the list.
+ * @param fd: socket file descriptor
+ * @param list: list of packets to send
+ * @param map: priority to QoS mapping (optional, can be NULL)
+ * @return the number of packets sent on success (if at least one packet
+ *         was sent), negative errno value in case of error (-EINVAL if a
+ *         DSCP or ECN value of the mapping is out of range)
+ */
+TPKT_API int tpkt_send_list(int fd,
+			    struct tpkt_list *list,
+			    const struct tpkt_qos_map *map);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_IO_H_ */
@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_JITTER_H_
+#define _TPKT_JITTER_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Reorder / jitter buffer.
+ * Packets are inserted in constant time in a circular slot array indexed
+ * by their 16-bit sequence number (with wraparound handling) and released
+ * in sequence order, either as soon as they are in order or after a
+ * playout delay relative to the packet timestamp (receive time).
+ * When a packet is missing, the following packets are held until the
+ * first of them is due (timestamp plus the largest of the playout delay
+ * and the reorder timeout); the missing packets are then counted as lost.
+ * The jitter buffer is not thread safe.
+ */
+
+
+/* Forward declarations */
+struct tpkt_jitter;
+
+
+/* Jitter buffer configuration */
+struct tpkt_jitter_cfg {
+	/* Slot count (mandatory); rounded up to a power of 2, at most
+	 * 32768; packets too far ahead of the next expected packet cause
+	 * the oldest packets to be dropped */
+	size_t slot_count;
+
+	/* Playout delay in microseconds relative to the packet timestamp;
+	 * 0 means that packets are released as soon as they are in order */
+	uint64_t playout_delay;
+
+	/* Time in microseconds to wait for a missing packet, relative to the
+	 * timestamp of the next available packet, when it is longer than the
+	 * playout delay */
+	uint64_t reorder_timeout;
+};
+
+
+/* Jitter buffer counters */
+struct tpkt_jitter_stats {
+	/* Packets inserted in the buffer */
+	uint64_t received;
+
+	/* Packets released in order */
+	uint64_t released;
+
+	/* Missing packets given up */
+	uint64_t lost;
+
+	/* Packets received after their sequence number was released or
+	 * given up (not inserted) */
+	uint64_t late;
+
+	/* Duplicate packets (not inserted) */
+	uint64_t duplicate;
+
+	/* Packets dropped because the buffer was full */
+	uint64_t overflow;
+};
+
+
+/**
+ * Create a jitter buffer.
+ * The created jitter buffer object is returned through the ret_obj
+ * parameter. When no longer needed, the jitter buffer must be freed using
+ * the tpkt_jitter_destroy() function.
+ * @param cfg: jitter buffer configuration
+ * @param ret_obj: pointer to the created object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_new(const struct tpkt_jitter_cfg *cfg,
+			     struct tpkt_jitter **ret_obj);
+
+
+/**
+ * Free a jitter buffer.
+ * All packets in the buffer are unreferenced.
+ * @param jitter: jitter buffer object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_destroy(struct tpkt_jitter *jitter);
+
+
+/**
+ * Insert a packet in the jitter buffer.
+ * The packet reference counter is incremented. If the sequence number was
+ * already released or given up, -ETIMEDOUT is returned; if a packet with
+ * the same sequence number is already in the buffer, -EEXIST is returned.
+ * In both cases the packet is not inserted.
+ * @param jitter: jitter buffer object handle
+ * @param seq: packet sequence number
+ * @param pkt: packet object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_push(struct tpkt_jitter *jitter,
+			      uint16_t seq,
+			      struct tpkt_packet *pkt);
+
+
+/**
+ * Release the packets that are due.
+ * The released packets are added in sequence order at the end of the
+ * output list (the jitter buffer reference is transferred to the list).
+ * @param jitter: jitter buffer object handle
+ * @param ts: current time in microseconds on the monotonic clock
+ * @param list: output packet list
+ * @return the number of released packets on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_pop(struct tpkt_jitter *jitter,
+			     uint64_t ts,
+			     struct tpkt_list *list);
+
+
+/**
+ * Get the time at which tpkt_jitter_pop() should next be called.
+ * If the buffer is empty, -ENOENT is returned.
+ * @param jitter: jitter buffer object handle
+ * @param ts: pointer on the time in microseconds on the monotonic clock
+ *            (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_get_next_deadline(struct tpkt_jitter *jitter,
+					   uint64_t *ts);
+
+
+/**
+ * Remove all packets from the jitter buffer.
+ * The packets are unreferenced and the sequence number tracking is reset;
+ * the counters are kept.
+ * @param jitter: jitter buffer object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_flush(struct tpkt_jitter *jitter);
+
+
+/**
+ * Get the jitter buffer packet count.
+ * @param jitter: jitter buffer object handle
+ * @return the packet count on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_get_count(struct tpkt_jitter *jitter);
+
+
+/**
+ * Get the jitter buffer counters.
+ * @param jitter: jitter buffer object handle
+ * @param stats: pointer on the counters structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_jitter_get_stats(struct tpkt_jitter *jitter,
+				   struct tpkt_jitter_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_JITTER_H_ */
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_LEAK_H_
+#define _TPKT_LEAK_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Packet leak tracker.
+ * When the library is built with TPKT_LEAK_TRACKER defined, every live
+ * packet is registered with the call site of the function that created it
+ * (tpkt_new(), tpkt_clone(), tpkt_pool_get()...) and its creation time, in
+ * a registry sharded by packet address to limit the lock contention. The
+ * oldest live packets and the live packet counts aggregated by call site
+ * can be retrieved or logged at any time, e.g. periodically during soak
+ * tests: a packet that is never released shows up as an old packet and as
+ * a growing call site.
+ * Without TPKT_LEAK_TRACKER, the packets are not registered and these
+ * functions return -ENOSYS.
+ */
+
+
+/* Live packet information */
+struct tpkt_leak_packet {
+	/* Packet handle; only to identify the packet, it may be released
+	 * concurrently and must not be dereferenced */
+	const struct tpkt_packet *pkt;
+
+	/* Address in the caller of the function that created the packet */
+	const void *site;
+
+	/* Packet age in microseconds */
+	uint64_t age_us;
+};
+
+
+/* Live packets created from a call site */
+struct tpkt_leak_site {
+	/* Address in the caller of the function that created the packets */
+	const void *site;
+
+	/* Number of live packets */
+	size_t count;
+
+	/* Age of the oldest live packet in microseconds */
+	uint64_t max_age_us;
+};
+
+
+/**
+ * Check whether the library was built with the leak tracker.
+ * @return 1 if the leak tracker is available, 0 otherwise
+ */
+TPKT_API int tpkt_leak_is_available(void);
+
+
+/**
+ * Get the number of live packets.
+ * @return the number of live packets on success, negative errno value in
+ *         case of error
+ */
+TPKT_API int tpkt_leak_get_count(void);
+
+
+/**
+ * Get the oldest live packets, oldest first.
+ * @param pkts: array of packet information (output)
+ * @param max_count: size of the pkts array
+ * @param count: pointer on the number of packets filled (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_leak_get_oldest(struct tpkt_leak_packet *pkts,
+				  size_t max_count,
+				  size_t *count);
+
+
+/**
+ * Get the live packets aggregated by call site, the call sites with the
+ * most live packets first.
+ * @param sites: array of call site information (output)
+ * @param max_count: size of the sites array
+ * @param count: pointer on the number of call sites filled (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_leak_get_sites(struct tpkt_leak_site *sites,
+				 size_t max_count,
+				 size_t *count);
+
+
+/**
+ * Log the live packets aggregated by call site and the oldest live
+ * packets (with the symbol names of the call sites when available).
+ * @param max_count: maximum number of call sites and of packets to log
+ * @param min_age_us: only log the packets older than this age
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_leak_dump(size_t max_count, uint64_t min_age_us);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_LEAK_H_ */
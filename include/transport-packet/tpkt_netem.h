@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_NETEM_H_
+#define _TPKT_NETEM_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Network impairment emulator.
+ * The emulator takes batches of packets and delivers them later, after
+ * applying loss (independent or bursty with a Gilbert-Elliott model),
+ * duplication, delay with jitter, reordering and a bandwidth limit. The
+ * arrival time of a packet is its timestamp, and the timestamp of a
+ * delivered packet is set to its delivery time (shared packets are cloned
+ * on input for this purpose).
+ * The emulator does not read the clock: the caller provides the current
+ * time, so that it can run on a simulated time base. All the random
+ * decisions come from a pseudo-random generator initialized with the
+ * configured seed: the same input sequence and seed always give the same
+ * output.
+ * Probabilities are in parts per million (1000000 means always).
+ * The emulator is not thread safe.
+ */
+
+
+/* Forward declarations */
+struct tpkt_netem;
+
+
+/* Loss model */
+enum tpkt_netem_loss_model {
+	/* No loss */
+	TPKT_NETEM_LOSS_NONE = 0,
+
+	/* Independent loss with a fixed probability (loss) */
+	TPKT_NETEM_LOSS_BERNOULLI,
+
+	/* Gilbert-Elliott two-state model (gilbert) */
+	TPKT_NETEM_LOSS_GILBERT_ELLIOTT,
+};
+
+
+/* Emulator configuration */
+struct tpkt_netem_cfg {
+	/* Seed of the pseudo-random generator */
+	uint64_t seed;
+
+	/* Base delay in microseconds */
+	uint64_t delay;
+
+	/* Delay jitter in microseconds: a uniformly distributed value in
+	 * [-jitter, jitter] is added to the delay of each packet (the delay
+	 * is at least 0); packets may then be reordered */
+	uint64_t jitter;
+
+	/* Loss model */
+	enum tpkt_netem_loss_model loss_model;
+
+	/* Loss probability (TPKT_NETEM_LOSS_BERNOULLI) */
+	uint32_t loss;
+
+	/* Gilbert-Elliott model parameters (TPKT_NETEM_LOSS_GILBERT_ELLIOTT);
+	 * the model starts in the good state */
+	struct {
+		/* Probability of the transition from the good state to the
+		 * bad state */
+		uint32_t p;
+
+		/* Probability of the transition from the bad state to the
+		 * good state */
+		uint32_t r;
+
+		/* Loss probability in the good state (1 - k) */
+		uint32_t loss_good;
+
+		/* Loss probability in the bad state (1 - h) */
+		uint32_t loss_bad;
+	} gilbert;
+
+	/* Duplication probability; the duplicate is delayed independently */
+	uint32_t duplicate;
+
+	/* Reordering probability: the packet is delivered without delay
+	 * nor bandwidth limit, ahead of the delayed packets */
+	uint32_t reorder;
+
+	/* Bandwidth limit in bits per second (0 means no limit): packets
+	 * are serialized after their delay */
+	uint64_t rate;
+
+	/* Per-packet overhead in bytes added to the payload size for the
+	 * bandwidth limit (e.g. 28 for IPv4 and UDP headers) */
+	size_t overhead;
+
+	/* Maximum number of queued packets (0 means default); packets
+	 * arriving when the queue is full are dropped */
+	size_t limit;
+};
+
+
+/* Emulator statistics */
+struct tpkt_netem_stats {
+	/* Pushed packet count */
+	uint64_t pushed;
+
+	/* Released packet count (including duplicates) */
+	uint64_t released;
+
+	/* Packets lost by the loss model */
+	uint64_t lost;
+
+	/* Packets dropped because the queue was full */
+	uint64_t overflow;
+
+	/* Duplicated packets */
+	uint64_t duplicated;
+
+	/* Reordered packets */
+	uint64_t reordered;
+
+	/* Currently queued packets */
+	size_t queued;
+};
+
+
+/**
+ * Create a network impairment emulator.
+ * The created emulator object is returned through the ret_obj parameter.
+ * When no longer needed, the emulator must be freed using the
+ * tpkt_netem_destroy() function.
+ * @param cfg: emulator configuration
+ * @param ret_obj: pointer to the created emulator object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_netem_new(const struct tpkt_netem_cfg *cfg,
+			    struct tpkt_netem **ret_obj);
+
+
+/**
+ * Free a network impairment emulator.
+ * The queued packets are unreferenced.
+ * @param netem: emulator object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_netem_destroy(struct tpkt_netem *netem);
+
+
+/**
+ * Push packets into the emulator.
+ * All the packets are removed from the list (the list references are
+ * transferred to the emulator) and either dropped or queued for delivery.
+ * @param netem: emulator object handle
+ * @param list: input packet list
+ * @param ts: current time in microseconds, used as arrival time of the
+ *            packets with a null timestamp
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_netem_push(struct tpkt_netem *netem,
+			     struct tpkt_list *list,
+			     uint64_t ts);
+
+
+/**
+ * Release the packets that are due.
+ * The packets whose delivery time is not after ts are added in delivery
+ * order at the end of the output list (the emulator reference is
+ * transferred to the list).
+ * @param netem: emulator object handle
+ * @param ts: current time in microseconds
+ * @param list: output packet list
+ * @return the number of released packets on success,
+ *         negative errno value in case of error
+ */
+TPKT_API int tpkt_netem_pop(struct tpkt_netem *netem,
+			    uint64_t ts,
+			    struct tpkt_list *list);
+
+
+/**
+ * Get the time at which tpkt_netem_pop() should next be called.
+ * If the emulator is empty, -ENOENT is returned.
+ * @param netem: emulator object handle
+ * @param ts: pointer on the time in microseconds (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_netem_get_next_deadline(struct tpkt_netem *netem,
+					  uint64_t *ts);
+
+
+/**
+ * Get the emulator statistics.
+ * @param netem: emulator object handle
+ * @param stats: pointer on the statistics structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_netem_get_stats(struct tpkt_netem *netem,
+				  struct tpkt_netem_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_NETEM_H_ */
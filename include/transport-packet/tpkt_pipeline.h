@@ -0,0 +1,247 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_PIPELINE_H_
+#define _TPKT_PIPELINE_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Packet pipeline.
+ * A pipeline is a chain of stages (e.g. receive, process, send), each
+ * stage being a callback called with batches of packets, either on its own
+ * thread or on a pomp loop. Consecutive stages are connected by bounded
+ * lock-free single-producer single-consumer queues; a stage sleeps on an
+ * eventfd when it has nothing to do and is only woken up by the stage that
+ * makes work available, so that no system call is made while the stages
+ * are busy.
+ * The packets left in the list by a stage callback are passed to the next
+ * stage (and unreferenced after the last stage). When the queue to the next
+ * stage is full, the stage stops processing until the next stage makes
+ * room: the backpressure propagates up to tpkt_pipeline_push(), which
+ * either waits or drops the packets, according to the configuration.
+ * The pipeline is configured, started and stopped from a single thread,
+ * which must be the thread of the pomp loops used by stages, if any.
+ * This API is only available on Linux.
+ */
+
+
+/* Forward declarations */
+struct tpkt_pipeline;
+
+
+/* Input backpressure policy (see tpkt_pipeline_push()) */
+enum tpkt_pipeline_backpressure {
+	/* Wait until the first stage queue has room */
+	TPKT_PIPELINE_BACKPRESSURE_BLOCK = 0,
+
+	/* Drop the packets that do not fit in the first stage queue */
+	TPKT_PIPELINE_BACKPRESSURE_DROP,
+};
+
+
+/**
+ * Stage callback function.
+ * Called with a batch of packets; the packets left in the list when the
+ * function returns are passed to the next stage. The callback can remove
+ * packets from the list (in which case the list reference is transferred
+ * to the application) or add packets to it.
+ * @param pipeline: pipeline handle
+ * @param stage: stage index
+ * @param list: list of packets
+ * @param userdata: stage user data pointer
+ */
+typedef void (*tpkt_pipeline_stage_cb_t)(struct tpkt_pipeline *pipeline,
+					 unsigned int stage,
+					 struct tpkt_list *list,
+					 void *userdata);
+
+
+/* Pipeline configuration */
+struct tpkt_pipeline_cfg {
+	/* Number of packets of each stage input queue (0 means default);
+	 * rounded up to a power of 2 */
+	size_t queue_size;
+
+	/* Maximum number of packets passed to a stage callback
+	 * (0 means default) */
+	size_t batch_size;
+
+	/* Input backpressure policy */
+	enum tpkt_pipeline_backpressure backpressure;
+};
+
+
+/* Stage configuration */
+struct tpkt_pipeline_stage_cfg {
+	/* Stage name, used as thread name (optional, can be NULL) */
+	const char *name;
+
+	/* Stage callback (mandatory) */
+	tpkt_pipeline_stage_cb_t cb;
+
+	/* Callback user data pointer (optional, can be NULL) */
+	void *userdata;
+
+	/* Loop to run the stage on (optional); if NULL, the stage runs on
+	 * its own thread */
+	struct pomp_loop *loop;
+
+	/* 1 to pin the stage thread to the cpu below, 0 to let it run on
+	 * any CPU (not used for loop stages) */
+	int pin;
+
+	/* CPU to pin the stage thread to (only used if pin is set) */
+	int cpu;
+
+	/* Maximum number of packets passed to the callback (0 means the
+	 * pipeline batch size) */
+	size_t batch_size;
+};
+
+
+/* Stage statistics */
+struct tpkt_pipeline_stage_stats {
+	/* Callback calls */
+	uint64_t batches;
+
+	/* Packets passed to the callback */
+	uint64_t packets;
+
+	/* Times the stage waited for the next stage queue to have room */
+	uint64_t blocked;
+
+	/* Times the stage went to sleep with an empty input queue */
+	uint64_t idle;
+};
+
+
+/**
+ * Create a packet pipeline.
+ * The created pipeline object is returned through the ret_obj parameter.
+ * When no longer needed, the pipeline must be freed using the
+ * tpkt_pipeline_destroy() function.
+ * @param cfg: pipeline configuration
+ * @param ret_obj: pointer to the created pipeline object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pipeline_new(const struct tpkt_pipeline_cfg *cfg,
+			       struct tpkt_pipeline **ret_obj);
+
+
+/**
+ * Free a packet pipeline.
+ * The pipeline is stopped if needed and the queued packets are
+ * unreferenced.
+ * @param pipeline: pipeline object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pipeline_destroy(struct tpkt_pipeline *pipeline);
+
+
+/**
+ * Add a stage at the end of the pipeline.
+ * Stages can only be added while the pipeline is stopped.
+ * @param pipeline: pipeline object handle
+ * @param cfg: stage configuration
+ * @return the stage index on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pipeline_add_stage(struct tpkt_pipeline *pipeline,
+				     const struct tpkt_pipeline_stage_cfg *cfg);
+
+
+/**
+ * Start the pipeline.
+ * The stage threads are created and the loop stages are registered in
+ * their loops.
+ * @param pipeline: pipeline object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pipeline_start(struct tpkt_pipeline *pipeline);
+
+
+/**
+ * Stop the pipeline.
+ * This function waits for the stage threads to exit; the packets in the
+ * queues are kept until the pipeline is started again or freed.
+ * @param pipeline: pipeline object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pipeline_stop(struct tpkt_pipeline *pipeline);
+
+
+/**
+ * Push packets into the first stage.
+ * The packets are removed from the list (the list references are
+ * transferred to the pipeline). If the first stage queue is full, the
+ * function either waits for room or drops the remaining packets, according
+ * to the backpressure policy; while the pipeline is stopped, the packets
+ * that do not fit are always dropped. This function must not be called from
+ * multiple threads concurrently, nor from the first stage itself.
+ * @param pipeline: pipeline object handle
+ * @param list: list of packets
+ * @return the number of packets queued on success, negative errno value in
+ *         case of error
+ */
+TPKT_API int tpkt_pipeline_push(struct tpkt_pipeline *pipeline,
+				struct tpkt_list *list);
+
+
+/**
+ * Get the statistics of a stage.
+ * The statistics can be read from any thread while the pipeline is
+ * running.
+ * @param pipeline: pipeline object handle
+ * @param stage: stage index
+ * @param stats: pointer on the statistics structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int
+tpkt_pipeline_get_stage_stats(struct tpkt_pipeline *pipeline,
+			      unsigned int stage,
+			      struct tpkt_pipeline_stage_stats *stats);
+
+
+/**
+ * Get the number of packets dropped by tpkt_pipeline_push().
+ * @param pipeline: pipeline object handle
+ * @param dropped: pointer on the dropped packet count (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_pipeline_get_dropped(struct tpkt_pipeline *pipeline,
+				       uint64_t *dropped);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_PIPELINE_H_ */
@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_REPLAY_H_
+#define _TPKT_REPLAY_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Capture file replay.
+ * A replay reads the UDP datagrams of a pcap or pcapng capture file
+ * (Ethernet, Linux cooked, loopback and raw IP link types, IPv4 and IPv6)
+ * and produces packets whose data references the memory-mapped file
+ * directly, without copying: the packets are read-only and keep the file
+ * mapped until they are released, even after the replay is freed. Each
+ * packet has the source address of the datagram as peer address and its
+ * capture time as timestamp. Other packets (non-UDP, IP fragments,
+ * truncated datagrams) are skipped.
+ * Packets are read either as fast as possible or paced in real time
+ * according to their capture times; reading never blocks, the caller
+ * waits for the time returned by tpkt_replay_read() (e.g. with a timer)
+ * before reading again.
+ * The replay is not thread safe.
+ */
+
+
+/* Forward declarations */
+struct tpkt_replay;
+
+
+/* Replay pacing mode */
+enum tpkt_replay_mode {
+	/* Packets are read as fast as possible */
+	TPKT_REPLAY_MODE_FAST = 0,
+
+	/* Packets are read when their capture time, relative to the first
+	 * packet, is reached (see speed) */
+	TPKT_REPLAY_MODE_REALTIME,
+};
+
+
+/* Replay configuration */
+struct tpkt_replay_cfg {
+	/* Path of the pcap or pcapng file (mandatory) */
+	const char *path;
+
+	/* Pacing mode */
+	enum tpkt_replay_mode mode;
+
+	/* Replay speed in real time mode, in percent of the original rate
+	 * (0 means 100; 200 is twice as fast) */
+	unsigned int speed;
+
+	/* If not 0, restart from the beginning of the file at the end */
+	int loop;
+
+	/* If not 0, the packet timestamps are rebased on the monotonic
+	 * clock: they are the time at which the packet is due in real time
+	 * mode, and the replay start time plus the packet capture time
+	 * relative to the first packet in fast mode; otherwise the packet
+	 * timestamps are the original capture times in microseconds since
+	 * the Epoch */
+	int rebase_timestamps;
+};
+
+
+/* Replay statistics */
+struct tpkt_replay_stats {
+	/* Produced packet count */
+	uint64_t packets;
+
+	/* Produced payload bytes count */
+	uint64_t bytes;
+
+	/* Skipped capture records (not UDP datagrams) */
+	uint64_t skipped;
+
+	/* Number of restarts from the beginning of the file (loop mode) */
+	uint64_t loops;
+};
+
+
+/**
+ * Create a capture file replay.
+ * The file is mapped and its header is checked. The created replay object
+ * is returned through the ret_obj parameter. When no longer needed, the
+ * replay must be freed using the tpkt_replay_destroy() function.
+ * @param cfg: replay configuration
+ * @param ret_obj: pointer to the created replay object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_replay_new(const struct tpkt_replay_cfg *cfg,
+			     struct tpkt_replay **ret_obj);
+
+
+/**
+ * Free a capture file replay.
+ * The file stays mapped until all the packets produced by the replay are
+ * released.
+ * @param replay: replay object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_replay_destroy(struct tpkt_replay *replay);
+
+
+/**
+ * Read the next packets.
+ * Up to max_count packets are added at the end of the list: in real time
+ * mode, only the packets that are due. The pacing starts at the first
+ * call. At the end of the file (if not looping), -ENOENT is returned.
+ * @param replay: replay object handle
+ * @param list: packet list handle
+ * @param max_count: maximum number of packets to read
+ * @param wait_us: pointer on the time in microseconds until the next packet
+ *                 is due, 0 if it can be read immediately
+ *                 (output; optional, can be NULL)
+ * @return the number of packets added to the list on success, negative
+ *         errno value in case of error
+ */
+TPKT_API int tpkt_replay_read(struct tpkt_replay *replay,
+			      struct tpkt_list *list,
+			      size_t max_count,
+			      uint64_t *wait_us);
+
+
+/**
+ * Restart the replay from the beginning of the file.
+ * The pacing restarts at the next tpkt_replay_read() call.
+ * @param replay: replay object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_replay_rewind(struct tpkt_replay *replay);
+
+
+/**
+ * Get the replay statistics.
+ * @param replay: replay object handle
+ * @param stats: pointer on the statistics structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_replay_get_stats(struct tpkt_replay *replay,
+				   struct tpkt_replay_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_REPLAY_H_ */
@@ -0,0 +1,209 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_RX_ENGINE_H_
+#define _TPKT_RX_ENGINE_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Multi-core receive engine.
+ * The engine opens one UDP socket per worker, all bound to the same local
+ * address with SO_REUSEPORT so that the kernel spreads the incoming flows
+ * across the sockets. Each worker runs on its own thread, optionally pinned
+ * to a CPU, receives packets in batches into its own packet pool and
+ * delivers them to the application on that thread.
+ * This API is only available on Linux.
+ */
+
+
+/* Forward declarations */
+struct tpkt_rx_engine;
+
+
+/* Receive engine configuration */
+struct tpkt_rx_engine_cfg {
+	/* Local address to bind the sockets to (IPv4 or IPv6); if the port
+	 * is 0, an ephemeral port is chosen and shared by all sockets */
+	const struct sockaddr *addr;
+
+	/* Local address size in bytes */
+	socklen_t addrlen;
+
+	/* Number of workers (0 means one worker per CPU the process is
+	 * allowed to run on) */
+	unsigned int worker_count;
+
+	/* CPU of the first worker, as an index in the CPUs the process is
+	 * allowed to run on (sched_getaffinity()); worker n is pinned to the
+	 * CPU at index (cpu_offset + n) modulo the allowed CPU count;
+	 * a negative value disables the pinning */
+	int cpu_offset;
+
+	/* Number of packets in each worker pool (0 means default) */
+	size_t pool_size;
+
+	/* Packet data capacity in bytes (0 means default) */
+	size_t packet_cap;
+
+	/* Maximum number of packets received in a batch (0 means default) */
+	unsigned int batch_size;
+
+	/* Socket receive buffer size in bytes (0 means system default) */
+	int rcvbuf_size;
+};
+
+
+/* Receive engine callbacks */
+struct tpkt_rx_engine_cbs {
+	/* Packets received callback (mandatory); called on the worker
+	 * thread with a batch of packets. The packets are unreferenced
+	 * when the function returns: the application must either reference
+	 * the packets it wants to keep or remove them from the list (in
+	 * which case the list reference is transferred to the application).
+	 * Packets come from the worker pool: when no packets are available
+	 * the incoming datagrams are dropped.
+	 * @param engine: receive engine handle
+	 * @param worker: worker index
+	 * @param list: list of received packets
+	 * @param userdata: user data pointer */
+	void (*recv)(struct tpkt_rx_engine *engine,
+		     unsigned int worker,
+		     struct tpkt_list *list,
+		     void *userdata);
+};
+
+
+/* Receive engine worker statistics */
+struct tpkt_rx_engine_stats {
+	/* Received packet count */
+	uint64_t packets;
+
+	/* Received bytes count */
+	uint64_t bytes;
+
+	/* Delivered batch count */
+	uint64_t batches;
+
+	/* Datagrams dropped because the worker pool was empty */
+	uint64_t drops;
+
+	/* Receive errors (including truncated datagrams) */
+	uint64_t errors;
+};
+
+
+/**
+ * Create a receive engine.
+ * The sockets are created and bound, but the workers are not started.
+ * The created engine object is returned through the ret_obj parameter.
+ * When no longer needed, the engine must be freed using the
+ * tpkt_rx_engine_destroy() function.
+ * @param cfg: engine configuration
+ * @param cbs: engine callbacks
+ * @param userdata: callbacks user data pointer (optional, can be NULL)
+ * @param ret_obj: pointer to the created engine object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_rx_engine_new(const struct tpkt_rx_engine_cfg *cfg,
+				const struct tpkt_rx_engine_cbs *cbs,
+				void *userdata,
+				struct tpkt_rx_engine **ret_obj);
+
+
+/**
+ * Free a receive engine.
+ * The engine is stopped if needed. All packets delivered by the engine must
+ * have been unreferenced, otherwise -EBUSY is returned and the engine is
+ * not freed.
+ * @param engine: engine object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_rx_engine_destroy(struct tpkt_rx_engine *engine);
+
+
+/**
+ * Start the receive engine workers.
+ * @param engine: engine object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_rx_engine_start(struct tpkt_rx_engine *engine);
+
+
+/**
+ * Stop the receive engine workers.
+ * This function waits for the workers to exit; it must not be called from
+ * the receive callback.
+ * @param engine: engine object handle
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_rx_engine_stop(struct tpkt_rx_engine *engine);
+
+
+/**
+ * Get the receive engine worker count.
+ * @param engine: engine object handle
+ * @return the worker count on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_rx_engine_get_worker_count(struct tpkt_rx_engine *engine);
+
+
+/**
+ * Get the local address the engine sockets are bound to.
+ * @param engine: engine object handle
+ * @param addr: pointer on the address structure (output)
+ * @param addrlen: pointer on the address size in bytes (input: size of the
+ *                 addr structure; output: actual address size)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_rx_engine_get_local_addr(struct tpkt_rx_engine *engine,
+					   struct sockaddr *addr,
+					   socklen_t *addrlen);
+
+
+/**
+ * Get the statistics of a receive engine worker.
+ * The statistics can be read from any thread while the engine is running.
+ * @param engine: engine object handle
+ * @param worker: worker index
+ * @param stats: pointer on the statistics structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_rx_engine_get_stats(struct tpkt_rx_engine *engine,
+				      unsigned int worker,
+				      struct tpkt_rx_engine_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_RX_ENGINE_H_ */
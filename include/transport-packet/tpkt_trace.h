@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_TRACE_H_
+#define _TPKT_TRACE_H_
+
+#include <transport-packet/tpkt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/**
+ * Packet lifecycle tracing.
+ * When the library is built with TPKT_TRACE defined, each packet records the
+ * time at which it reaches the lifecycle checkpoints: creation (including
+ * tpkt_pool_get()), insertion in a list, removal from a list, send
+ * (tpkt_send_list(), or tpkt_trace_mark() for other send paths) and release.
+ * When a packet is released, the latencies between its consecutive
+ * checkpoints are aggregated in process-wide log-linear (HDR-style)
+ * histograms, one per stage, with a relative precision of about 6%.
+ * A histogram of the time spent by the packets in a list can also be
+ * enabled per list.
+ * Without TPKT_TRACE, the checkpoints are compiled out, the packets do not
+ * carry the timestamps, and these functions return -ENOSYS.
+ * Times are in nanoseconds on the monotonic clock.
+ */
+
+
+/* Packet lifecycle checkpoints */
+enum tpkt_trace_point {
+	/* Packet created or obtained from a pool */
+	TPKT_TRACE_POINT_CREATED = 0,
+
+	/* Packet added to a list */
+	TPKT_TRACE_POINT_ENQUEUED,
+
+	/* Packet removed from a list */
+	TPKT_TRACE_POINT_DEQUEUED,
+
+	/* Packet sent */
+	TPKT_TRACE_POINT_SENT,
+
+	/* Packet released (destroyed or returned to its pool) */
+	TPKT_TRACE_POINT_RELEASED,
+
+	/* Number of checkpoints */
+	TPKT_TRACE_POINT_COUNT,
+};
+
+
+/* Latency stages; a stage is only accounted for the packets that reached
+ * both of its checkpoints, in order */
+enum tpkt_trace_stage {
+	/* From CREATED to ENQUEUED */
+	TPKT_TRACE_STAGE_CREATED_ENQUEUED = 0,
+
+	/* From ENQUEUED to DEQUEUED */
+	TPKT_TRACE_STAGE_ENQUEUED_DEQUEUED,
+
+	/* From DEQUEUED to SENT */
+	TPKT_TRACE_STAGE_DEQUEUED_SENT,
+
+	/* From SENT to RELEASED */
+	TPKT_TRACE_STAGE_SENT_RELEASED,
+
+	/* From CREATED to RELEASED */
+	TPKT_TRACE_STAGE_LIFETIME,
+
+	/* Number of stages */
+	TPKT_TRACE_STAGE_COUNT,
+};
+
+
+/* Latency histogram summary (nanoseconds); the percentiles are the upper
+ * bound of the histogram bucket */
+struct tpkt_trace_stats {
+	/* Number of samples */
+	uint64_t count;
+
+	/* Minimum, maximum and mean latency */
+	uint64_t min;
+	uint64_t max;
+	uint64_t mean;
+
+	/* Latency percentiles */
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+
+/**
+ * Check whether the library was built with tracing support.
+ * @return 1 if tracing is available, 0 otherwise
+ */
+TPKT_API int tpkt_trace_is_available(void);
+
+
+/**
+ * Record a checkpoint on a packet at the current time.
+ * The library records the checkpoints of its own functions; this function
+ * is for the application paths the library does not see (e.g. a packet
+ * sent with the application own send function). A checkpoint recorded
+ * again overwrites the previous time.
+ * @param pkt: packet object handle
+ * @param point: checkpoint
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_trace_mark(struct tpkt_packet *pkt,
+			     enum tpkt_trace_point point);
+
+
+/**
+ * Get the time at which a packet reached a checkpoint.
+ * @param pkt: packet object handle
+ * @param point: checkpoint
+ * @param time_ns: pointer on the time in nanoseconds on the monotonic
+ *                 clock, 0 if the checkpoint was not reached (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_trace_get_time(struct tpkt_packet *pkt,
+				 enum tpkt_trace_point point,
+				 uint64_t *time_ns);
+
+
+/**
+ * Get the process-wide latency summary of a stage.
+ * @param stage: latency stage
+ * @param stats: pointer on the summary structure (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_trace_get_stage_stats(enum tpkt_trace_stage stage,
+					struct tpkt_trace_stats *stats);
+
+
+/**
+ * Reset the process-wide stage histograms.
+ * The samples recorded concurrently by other threads may be lost.
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_trace_reset(void);
+
+
+/**
+ * Enable or disable the histogram of the time spent by the packets in a
+ * list (from insertion to removal; packets flushed from the list are not
+ * accounted). Enabling the histogram again resets it.
+ * @param list: packet list object handle
+ * @param enable: 1 to enable the histogram, 0 to disable it
+ * @return 0 on success, negative errno value in case of error
+ */
+TPKT_API int tpkt_trace_list_enable(struct tpkt_list *list, int enable);
+
+
+/**
+ * Get the latency summary of the time spent by the packets in a list.
+ * @param list: packet list object handle
+ * @param stats: pointer on the summary structure (output)
+ * @return 0 on success, negative errno value in case of error
+ *         (-ENOENT if the list histogram is not enabled)
+ */
+TPKT_API int tpkt_trace_list_get_stats(struct tpkt_list *list,
+				       struct tpkt_trace_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_TPKT_TRACE_H_ */
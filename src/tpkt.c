@@ -25,10 +25,70 @@
  */
 
 #include "tpkt_priv.h"
+#include "tpkt_probes.h"
+#include <transport-packet/tpkt_inline.h>
 
 ULOG_DECLARE_TAG(tpkt);
 
 
+TPKT_PROBES(TPKT_PROBE_DEFINE)
+
+
+/* The packet structure must start with the public prefix */
+#define TPKT_ABI_CHECK(_field)                                                 \
+	_Static_assert(offsetof(struct tpkt_packet, _field) ==                 \
+			       offsetof(struct tpkt_packet_abi, _field),       \
+		       "packet ABI mismatch: " #_field)
+
+TPKT_ABI_CHECK(ref_count);
+TPKT_ABI_CHECK(priority);
+TPKT_ABI_CHECK(data_cst);
+TPKT_ABI_CHECK(buf);
+TPKT_ABI_CHECK(data);
+TPKT_ABI_CHECK(data.cdata);
+TPKT_ABI_CHECK(data.cap);
+TPKT_ABI_CHECK(data.len);
+TPKT_ABI_CHECK(timestamp);
+TPKT_ABI_CHECK(addr);
+_Static_assert(sizeof(((struct tpkt_packet *)0)->addr) ==
+		       sizeof(((struct tpkt_packet_abi *)0)->addr),
+	       "packet ABI mismatch: addr size");
+
+
+/* Packet layout: the fields accessed on list walks and by the getters and
+ * setters must be in the first cache line, the fields accessed on send /
+ * receive and release in the first two */
+#define TPKT_FIELD_END(_field)                                                 \
+	(offsetof(struct tpkt_packet, _field) +                                \
+	 sizeof(((struct tpkt_packet *)0)->_field))
+#define TPKT_LAYOUT_CHECK(_field, _lines)                                      \
+	_Static_assert(TPKT_FIELD_END(_field) <=                               \
+			       (_lines) * TPKT_CACHE_LINE_SIZE,                \
+		       "packet layout: " #_field " not in the first " #_lines \
+		       " cache line(s)")
+
+TPKT_LAYOUT_CHECK(ref_count, 1);
+TPKT_LAYOUT_CHECK(priority, 1);
+TPKT_LAYOUT_CHECK(local, 1);
+TPKT_LAYOUT_CHECK(data_cst, 1);
+TPKT_LAYOUT_CHECK(buf, 1);
+TPKT_LAYOUT_CHECK(data, 1);
+TPKT_LAYOUT_CHECK(node, 1);
+TPKT_LAYOUT_CHECK(timestamp, 1);
+TPKT_LAYOUT_CHECK(addr, 2);
+TPKT_LAYOUT_CHECK(pool_hold, 2);
+#ifdef _WIN32
+TPKT_LAYOUT_CHECK(wsabuf, 2);
+#else /* _WIN32 */
+TPKT_LAYOUT_CHECK(iov, 2);
+#endif /* _WIN32 */
+TPKT_LAYOUT_CHECK(backing, 2);
+#if !defined(TPKT_TRACE) && !defined(TPKT_LEAK_TRACKER)
+_Static_assert(sizeof(struct tpkt_packet) <= 3 * TPKT_CACHE_LINE_SIZE,
+	       "packet layout: structure larger than 3 cache lines");
+#endif /* !TPKT_TRACE && !TPKT_LEAK_TRACKER */
+
+
 static int tpkt_destroy(struct tpkt_packet *pkt)
 {
 	int ref;
@@ -43,6 +103,11 @@ static int tpkt_destroy(struct tpkt_packet *pkt)
 	if (ref > 0)
 		ULOGW("%s: ref count is not null! (%d)", __func__, ref);
 
+	tpkt_stats_inc(TPKT_STAT_RELEASE);
+	TPKT_TRACE_RELEASE(pkt);
+	TPKT_LEAK_UNREGISTER(pkt);
+	TPKT_PROBE_PACKET(destroy, pkt);
+
 	if (pkt->buf != NULL)
 		pomp_buffer_unref(pkt->buf);
 
@@ -50,29 +115,86 @@ static int tpkt_destroy(struct tpkt_packet *pkt)
 		ULOGW("%s: packet was still in a list!", __func__);
 		list_del(&pkt->node);
 	}
+
+	/* Pool packets are returned to the pool when the last reference
+	 * to the backing storage is released; the packet must not be
+	 * accessed afterwards */
+	if (pkt->pool != NULL) {
+		if (pkt->mem_accts & TPKT_MEM_ACCT_POOL)
+			tpkt_mem_uncharge(&pkt->pool->mem_acct, 1, 0);
+		if (pkt->mem_accts & TPKT_MEM_ACCT_GLOBAL)
+			tpkt_mem_uncharge(&tpkt_mem_global, 1, 0);
+		pkt->backing.ops->unref(pkt->backing.obj);
+		return 0;
+	}
+
+	if (pkt->backing.ops != NULL)
+		pkt->backing.ops->unref(pkt->backing.obj);
+	if (pkt->mem_accts & TPKT_MEM_ACCT_GLOBAL)
+		tpkt_mem_uncharge(&tpkt_mem_global, 1, pkt->mem_charge);
 	free(pkt);
 
 	return 0;
 }
 
 
-static int tpkt_create(struct tpkt_packet **ret_obj)
+void tpkt_init(struct tpkt_packet *pkt)
 {
-	int res = 0;
+	list_node_unref(&pkt->node);
+
+	/* The packet is not visible to other threads yet */
+	pkt->ref_count = 1;
+
+	TPKT_TRACE_POINT(pkt, CREATED);
+	TPKT_PROBE_PACKET(create, pkt);
+}
+
+
+int tpkt_data_is_writable(struct tpkt_packet *pkt)
+{
+	if (pkt->data_cst)
+		return 0;
+	if (pkt->backing.ops != NULL &&
+	    pkt->backing.ops->is_shared(pkt->backing.obj))
+		return 0;
+	return 1;
+}
+
+
+/* The packet is charged to the memory accounting with mem_charge payload
+ * bytes (data buffer allocated for the packet) and its creation is counted
+ * in the given statistics counter */
+static int tpkt_create(enum tpkt_stat stat,
+		       size_t mem_charge,
+		       struct tpkt_packet **ret_obj)
+{
+	int res = 0, charged;
 	struct tpkt_packet *pkt;
 
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
-	pkt = calloc(1, sizeof(*pkt));
-	if (pkt == NULL) {
-		res = -ENOMEM;
-		ULOG_ERRNO("calloc", -res);
+	/* Do not log, exceeding the hard limit in fail-fast mode is an
+	 * expected condition */
+	charged = tpkt_mem_charge(&tpkt_mem_global, 1, mem_charge);
+	if (charged < 0)
+		return charged;
+
+	res = posix_memalign((void **)&pkt, TPKT_CACHE_LINE_SIZE, sizeof(*pkt));
+	if (res != 0) {
+		res = -res;
+		ULOG_ERRNO("posix_memalign", -res);
+		if (charged)
+			tpkt_mem_uncharge(&tpkt_mem_global, 1, mem_charge);
 		return res;
 	}
-	list_node_unref(&pkt->node);
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->mem_charge = mem_charge;
+	if (charged)
+		pkt->mem_accts = TPKT_MEM_ACCT_GLOBAL;
+	tpkt_stats_inc(stat);
 
 	/* Success */
-	tpkt_ref(pkt);
+	tpkt_init(pkt);
 	*ret_obj = pkt;
 	return 0;
 }
@@ -83,9 +205,10 @@ int tpkt_new(size_t cap, struct tpkt_packet **ret_obj)
 	int res;
 	struct tpkt_packet *pkt;
 
-	res = tpkt_create(&pkt);
+	res = tpkt_create(TPKT_STAT_NEW, cap, &pkt);
 	if (res < 0)
 		return res;
+	TPKT_LEAK_REGISTER(pkt);
 
 	pkt->buf = pomp_buffer_new(cap);
 	if (!pkt->buf) {
@@ -104,13 +227,14 @@ int tpkt_new_from_buffer(struct pomp_buffer *buf, struct tpkt_packet **ret_obj)
 	int res;
 	struct tpkt_packet *pkt;
 
-	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(buf == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
-	res = tpkt_create(ret_obj);
+	res = tpkt_create(TPKT_STAT_NEW_FROM_BUFFER, 0, ret_obj);
 	if (res < 0)
 		return res;
 	pkt = *ret_obj;
+	TPKT_LEAK_REGISTER(pkt);
 
 	/* Add a reference to the pomp_buffer */
 	pomp_buffer_ref(buf);
@@ -125,14 +249,15 @@ int tpkt_new_from_data(void *data, size_t cap, struct tpkt_packet **ret_obj)
 	int res;
 	struct tpkt_packet *pkt;
 
-	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(data == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(cap == 0, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
-	res = tpkt_create(ret_obj);
+	res = tpkt_create(TPKT_STAT_NEW_FROM_DATA, 0, ret_obj);
 	if (res < 0)
 		return res;
 	pkt = *ret_obj;
+	TPKT_LEAK_REGISTER(pkt);
 
 	pkt->data.data = data;
 	pkt->data.cap = cap;
@@ -148,18 +273,19 @@ int tpkt_new_from_cdata(const void *data,
 	int res;
 	struct tpkt_packet *pkt;
 
-	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(data == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(cap == 0, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
-	res = tpkt_create(ret_obj);
+	res = tpkt_create(TPKT_STAT_NEW_FROM_CDATA, 0, ret_obj);
 	if (res < 0)
 		return res;
 	pkt = *ret_obj;
+	TPKT_LEAK_REGISTER(pkt);
 
 	pkt->data.cdata = data;
 	pkt->data.cap = cap;
-	pkt->data.cst = 1;
+	pkt->data_cst = 1;
 
 	return 0;
 }
@@ -172,13 +298,14 @@ int tpkt_new_with_data(const void *data,
 	int res;
 	struct tpkt_packet *pkt;
 
-	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(data == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(cap == 0, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
-	res = tpkt_create(&pkt);
+	res = tpkt_create(TPKT_STAT_NEW_WITH_DATA, cap, &pkt);
 	if (res < 0)
 		return res;
+	TPKT_LEAK_REGISTER(pkt);
 
 	pkt->buf = pomp_buffer_new_with_data(data, cap);
 	if (!pkt->buf) {
@@ -197,13 +324,14 @@ int tpkt_clone(struct tpkt_packet *pkt, struct tpkt_packet **ret_obj)
 	int res;
 	struct tpkt_packet *new_pkt;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
-	res = tpkt_create(ret_obj);
+	res = tpkt_create(TPKT_STAT_CLONE, 0, ret_obj);
 	if (res < 0)
 		return res;
 	new_pkt = *ret_obj;
+	TPKT_LEAK_REGISTER(new_pkt);
 
 	if (pkt->buf != NULL) {
 		/* Add a reference to the pomp_buffer */
@@ -211,11 +339,131 @@ int tpkt_clone(struct tpkt_packet *pkt, struct tpkt_packet **ret_obj)
 		pomp_buffer_ref(new_pkt->buf);
 	} else {
 		new_pkt->data = pkt->data;
+		new_pkt->data_cst = pkt->data_cst;
+	}
+	if (pkt->backing.ops != NULL) {
+		/* Add a reference to the backing storage; the data is
+		 * shared and therefore read-only for the clone */
+		new_pkt->backing = pkt->backing;
+		new_pkt->backing.ops->ref(new_pkt->backing.obj);
+		new_pkt->data_cst = 1;
 	}
 	new_pkt->addr = pkt->addr;
 	new_pkt->timestamp = pkt->timestamp;
 	new_pkt->priority = pkt->priority;
 	new_pkt->user_data = pkt->user_data;
+	TPKT_PROBE_PACKET_ARG(clone, pkt, new_pkt);
+
+	return 0;
+}
+
+
+static void tpkt_buffer_backing_ref(void *obj)
+{
+	pomp_buffer_ref(obj);
+}
+
+
+static void tpkt_buffer_backing_unref(void *obj)
+{
+	pomp_buffer_unref(obj);
+}
+
+
+static int tpkt_buffer_backing_is_shared(void *obj)
+{
+	(void)obj;
+
+	/* Slices are read-only views of the buffer */
+	return 1;
+}
+
+
+static const struct tpkt_backing_ops tpkt_buffer_backing_ops = {
+	.ref = tpkt_buffer_backing_ref,
+	.unref = tpkt_buffer_backing_unref,
+	.is_shared = tpkt_buffer_backing_is_shared,
+};
+
+
+int tpkt_new_slice(struct tpkt_packet *pkt,
+		   size_t offset,
+		   size_t len,
+		   struct tpkt_packet **ret_obj)
+{
+	int res;
+	const uint8_t *data;
+	size_t data_len;
+	struct tpkt_packet *new_pkt;
+
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	res = tpkt_get_cdata(pkt, (const void **)&data, &data_len, NULL);
+	if (res < 0)
+		return res;
+	ULOG_ERRNO_RETURN_ERR_IF(offset > data_len, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len > data_len - offset, EINVAL);
+
+	res = tpkt_create(TPKT_STAT_NEW_SLICE, 0, ret_obj);
+	if (res < 0)
+		return res;
+	new_pkt = *ret_obj;
+	TPKT_LEAK_REGISTER(new_pkt);
+
+	if (pkt->buf != NULL) {
+		/* Reference the pomp_buffer so that it becomes read-only */
+		new_pkt->backing.ops = &tpkt_buffer_backing_ops;
+		new_pkt->backing.obj = pkt->buf;
+		new_pkt->backing.ops->ref(new_pkt->backing.obj);
+	} else if (pkt->backing.ops != NULL) {
+		new_pkt->backing = pkt->backing;
+		new_pkt->backing.ops->ref(new_pkt->backing.obj);
+	}
+	new_pkt->data.cdata = data + offset;
+	new_pkt->data.cap = len;
+	new_pkt->data.len = len;
+	new_pkt->data_cst = 1;
+	new_pkt->addr = pkt->addr;
+	new_pkt->timestamp = pkt->timestamp;
+	new_pkt->priority = pkt->priority;
+
+	return 0;
+}
+
+
+int tpkt_new_from_buffer_slice(struct pomp_buffer *buf,
+			       size_t offset,
+			       size_t len,
+			       struct tpkt_packet **ret_obj)
+{
+	int res;
+	const uint8_t *data;
+	size_t data_len;
+	struct tpkt_packet *pkt;
+
+	TPKT_ARG_RETURN_ERR_IF(buf == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	res = pomp_buffer_get_cdata(buf, (const void **)&data, &data_len, NULL);
+	if (res < 0)
+		return res;
+	ULOG_ERRNO_RETURN_ERR_IF(offset > data_len, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len > data_len - offset, EINVAL);
+
+	res = tpkt_create(TPKT_STAT_NEW_SLICE, 0, ret_obj);
+	if (res < 0)
+		return res;
+	pkt = *ret_obj;
+	TPKT_LEAK_REGISTER(pkt);
+
+	pkt->backing.ops = &tpkt_buffer_backing_ops;
+	pkt->backing.obj = buf;
+	pkt->backing.ops->ref(pkt->backing.obj);
+	pkt->data.cdata = data + offset;
+	pkt->data.cap = len;
+	pkt->data.len = len;
+	pkt->data_cst = 1;
 
 	return 0;
 }
@@ -223,10 +471,17 @@ int tpkt_clone(struct tpkt_packet *pkt, struct tpkt_packet **ret_obj)
 
 int tpkt_ref(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+
+	if (pkt->local) {
+		pkt->ref_count++;
+		return 0;
+	}
 
 #if defined(__GNUC__)
-	__atomic_add_fetch(&pkt->ref_count, 1, __ATOMIC_SEQ_CST);
+	/* Taking a reference requires an existing one: no ordering is
+	 * needed */
+	__atomic_add_fetch(&pkt->ref_count, 1, __ATOMIC_RELAXED);
 #else
 #	error no atomic increment function found on this platform
 #endif
@@ -237,19 +492,28 @@ int tpkt_ref(struct tpkt_packet *pkt)
 
 int tpkt_unref(struct tpkt_packet *pkt)
 {
-	int ref = 0;
+	unsigned int ref = 0;
 	int res = 0;
 
 	if (pkt == NULL)
 		return 0;
 
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) < 1, ENOENT);
-
+	if (pkt->local) {
+		ULOG_ERRNO_RETURN_ERR_IF(pkt->ref_count < 1, ENOENT);
+		ref = --pkt->ref_count;
+	} else {
+		ULOG_ERRNO_RETURN_ERR_IF(
+			__atomic_load_n(&pkt->ref_count, __ATOMIC_RELAXED) < 1,
+			ENOENT);
 #if defined(__GNUC__)
-	ref = __atomic_sub_fetch(&pkt->ref_count, 1, __ATOMIC_SEQ_CST);
+		/* Release the accesses to the packet made by this thread to
+		 * the thread that destroys it (acquire) */
+		ref = __atomic_sub_fetch(
+			&pkt->ref_count, 1, __ATOMIC_ACQ_REL);
 #else
 #	error no atomic decrement function found on this platform
 #endif
+	}
 
 	if (ref == 0)
 		res = tpkt_destroy(pkt);
@@ -260,7 +524,7 @@ int tpkt_unref(struct tpkt_packet *pkt)
 
 int tpkt_get_ref_count(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 
 #if defined(__GNUC__)
 	int ref_count = __atomic_load_n(&pkt->ref_count, __ATOMIC_ACQUIRE);
@@ -272,9 +536,25 @@ int tpkt_get_ref_count(struct tpkt_packet *pkt)
 }
 
 
+unsigned int tpkt_get_packet_abi_version(void)
+{
+	return TPKT_PACKET_ABI_VERSION;
+}
+
+
+int tpkt_set_local(struct tpkt_packet *pkt, int local)
+{
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+
+	/* All references are held by the calling thread in both modes */
+	pkt->local = !!local;
+	return 0;
+}
+
+
 struct pomp_buffer *tpkt_get_buffer(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
+	TPKT_ARG_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
 
 	return pkt->buf;
 }
@@ -287,12 +567,12 @@ int tpkt_get_data(struct tpkt_packet *pkt,
 {
 	int res;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 
 	if (pkt->buf != NULL) {
 		res = pomp_buffer_get_data(pkt->buf, data, len, cap);
 	} else {
-		ULOG_ERRNO_RETURN_ERR_IF(pkt->data.cst, EPERM);
+		TPKT_EPERM_RETURN_ERR_IF(!tpkt_data_is_writable(pkt));
 		if (data)
 			*data = pkt->data.data;
 		if (len)
@@ -313,7 +593,7 @@ int tpkt_get_cdata(struct tpkt_packet *pkt,
 {
 	int res;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 
 	if (pkt->buf != NULL) {
 		res = pomp_buffer_get_cdata(pkt->buf, data, len, cap);
@@ -335,8 +615,8 @@ int tpkt_set_len(struct tpkt_packet *pkt, size_t len)
 {
 	int res;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) > 1, EPERM);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_EPERM_RETURN_ERR_IF(tpkt_ref_count(pkt) > 1);
 
 	if (pkt->buf != NULL) {
 		res = pomp_buffer_set_len(pkt->buf, len);
@@ -359,15 +639,15 @@ int tpkt_get_wsabufs_read(struct tpkt_packet *pkt,
 	int res;
 	size_t len = 0;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) > 1, EPERM);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_EPERM_RETURN_ERR_IF(tpkt_ref_count(pkt) > 1);
 
 	if (pkt->buf != NULL) {
 		res = pomp_buffer_get_data(
 			pkt->buf, (void **)&pkt->wsabuf.buf, NULL, &len);
 		pkt->wsabuf.len = len;
 	} else {
-		ULOG_ERRNO_RETURN_ERR_IF(pkt->data.cst, EPERM);
+		TPKT_EPERM_RETURN_ERR_IF(!tpkt_data_is_writable(pkt));
 		pkt->wsabuf.buf = pkt->data.data;
 		pkt->wsabuf.len = pkt->data.cap;
 		res = 0;
@@ -393,14 +673,14 @@ int tpkt_get_iov_read(struct tpkt_packet *pkt,
 {
 	int res;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) > 1, EPERM);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_EPERM_RETURN_ERR_IF(tpkt_ref_count(pkt) > 1);
 
 	if (pkt->buf != NULL) {
 		res = pomp_buffer_get_data(
 			pkt->buf, &pkt->iov.iov_base, NULL, &pkt->iov.iov_len);
 	} else {
-		ULOG_ERRNO_RETURN_ERR_IF(pkt->data.cst, EPERM);
+		TPKT_EPERM_RETURN_ERR_IF(!tpkt_data_is_writable(pkt));
 		pkt->iov.iov_base = pkt->data.data;
 		pkt->iov.iov_len = pkt->data.cap;
 		res = 0;
@@ -429,7 +709,7 @@ int tpkt_get_wsabufs_write(struct tpkt_packet *pkt,
 	int res;
 	size_t len = 0;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 
 	if (pkt->buf != NULL) {
 		res = pomp_buffer_get_cdata(
@@ -461,7 +741,7 @@ int tpkt_get_iov_write(struct tpkt_packet *pkt,
 {
 	int res;
 
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 
 	if (pkt->buf != NULL) {
 		res = pomp_buffer_get_cdata(pkt->buf,
@@ -490,7 +770,7 @@ int tpkt_get_iov_write(struct tpkt_packet *pkt,
 
 struct sockaddr_in *tpkt_get_addr(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
+	TPKT_ARG_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
 
 	return &pkt->addr.in;
 }
@@ -498,7 +778,7 @@ struct sockaddr_in *tpkt_get_addr(struct tpkt_packet *pkt)
 
 struct sockaddr_in6 *tpkt_get_addr6(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
+	TPKT_ARG_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
 
 	return &pkt->addr.in6;
 }
@@ -506,7 +786,7 @@ struct sockaddr_in6 *tpkt_get_addr6(struct tpkt_packet *pkt)
 
 uint64_t tpkt_get_timestamp(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_VAL_IF(pkt == NULL, EINVAL, 0);
+	TPKT_ARG_RETURN_VAL_IF(pkt == NULL, EINVAL, 0);
 
 	return pkt->timestamp;
 }
@@ -514,8 +794,8 @@ uint64_t tpkt_get_timestamp(struct tpkt_packet *pkt)
 
 int tpkt_set_timestamp(struct tpkt_packet *pkt, uint64_t ts)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) > 1, EPERM);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_EPERM_RETURN_ERR_IF(tpkt_ref_count(pkt) > 1);
 
 	pkt->timestamp = ts;
 	return 0;
@@ -524,7 +804,7 @@ int tpkt_set_timestamp(struct tpkt_packet *pkt, uint64_t ts)
 
 int tpkt_get_priority(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 
 	return pkt->priority;
 }
@@ -532,10 +812,10 @@ int tpkt_get_priority(struct tpkt_packet *pkt)
 
 int tpkt_set_priority(struct tpkt_packet *pkt, int priority)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(priority < 0, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(priority > QOS_PRIORITY_MAX, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) > 1, EPERM);
+	TPKT_EPERM_RETURN_ERR_IF(tpkt_ref_count(pkt) > 1);
 
 	pkt->priority = priority;
 	return 0;
@@ -544,8 +824,8 @@ int tpkt_set_priority(struct tpkt_packet *pkt, int priority)
 
 int tpkt_get_importance(struct tpkt_packet *pkt, uint32_t *importance)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(importance == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(importance == NULL, EINVAL);
 
 	*importance = pkt->importance;
 	return 0;
@@ -554,8 +834,8 @@ int tpkt_get_importance(struct tpkt_packet *pkt, uint32_t *importance)
 
 int tpkt_set_importance(struct tpkt_packet *pkt, uint32_t importance)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) > 1, EPERM);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_EPERM_RETURN_ERR_IF(tpkt_ref_count(pkt) > 1);
 
 	pkt->importance = importance;
 	return 0;
@@ -564,7 +844,7 @@ int tpkt_set_importance(struct tpkt_packet *pkt, uint32_t importance)
 
 void *tpkt_get_user_data(struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
+	TPKT_ARG_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
 
 	return pkt->user_data.data;
 }
@@ -574,8 +854,8 @@ int tpkt_set_user_data(struct tpkt_packet *pkt,
 		       tpkt_user_data_release_t release,
 		       void *user_data)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(tpkt_get_ref_count(pkt) > 1, EPERM);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_EPERM_RETURN_ERR_IF(tpkt_ref_count(pkt) > 1);
 
 	pkt->user_data.release = release;
 	pkt->user_data.data = user_data;
@@ -0,0 +1,565 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_aggr.h>
+
+
+#define TPKT_AGGR_DEFAULT_MAX_PEERS 64
+
+/* Size of the sub-packet length field */
+#define TPKT_AGGR_LEN_SIZE 2
+
+
+enum tpkt_aggr_peer_state {
+	TPKT_AGGR_PEER_EMPTY = 0,
+	TPKT_AGGR_PEER_USED,
+	/* Released entry (tombstone), kept so that the lookups of the
+	 * entries placed after it still find them */
+	TPKT_AGGR_PEER_DELETED,
+};
+
+
+struct tpkt_aggr_peer {
+	enum tpkt_aggr_peer_state state;
+	struct tpkt_addr_key key;
+
+	/* Aggregated datagram being built (NULL if no packet is buffered) */
+	struct tpkt_packet *pkt;
+	uint8_t *data;
+	size_t len;
+	size_t cap;
+	int priority;
+
+	/* Emission deadline */
+	uint64_t deadline;
+
+	/* Pending peers list, in deadline order */
+	struct list_node node;
+};
+
+
+struct tpkt_aggr {
+	struct tpkt_aggr_cfg cfg;
+
+	/* Peers table: open addressing with linear probing, at most half
+	 * full (size entries, power of 2); a peer entry only exists while
+	 * its datagram is being built */
+	struct tpkt_aggr_peer *peers;
+	size_t size;
+	size_t mask;
+	unsigned int peer_count;
+	size_t deleted_count;
+
+	struct list_node pending;
+
+	struct tpkt_aggr_stats stats;
+};
+
+
+/* Get a datagram packet with a data capacity of at least cap bytes */
+static int tpkt_aggr_alloc(struct tpkt_aggr *aggr,
+			   size_t cap,
+			   struct tpkt_packet **ret_obj,
+			   uint8_t **data,
+			   size_t *data_cap)
+{
+	int res;
+	struct tpkt_packet *pkt;
+
+	if (aggr->cfg.pool != NULL && cap <= aggr->cfg.pool->cap)
+		res = tpkt_pool_get(aggr->cfg.pool, &pkt);
+	else
+		res = tpkt_new(cap, &pkt);
+	if (res < 0)
+		return res;
+
+	res = tpkt_get_data(pkt, (void **)data, NULL, data_cap);
+	if (res < 0) {
+		tpkt_unref(pkt);
+		return res;
+	}
+
+	*ret_obj = pkt;
+	return 0;
+}
+
+
+static inline void tpkt_aggr_write(uint8_t *dst, const void *src, size_t len)
+{
+	dst[0] = len >> 8;
+	dst[1] = len & 0xff;
+	memcpy(dst + TPKT_AGGR_LEN_SIZE, src, len);
+}
+
+
+/* Find the entry of a key: the used entry if any, else the first deleted
+ * or empty entry of the probe sequence */
+static struct tpkt_aggr_peer *
+tpkt_aggr_find_peer(struct tpkt_aggr_peer *peers,
+		    size_t mask,
+		    const struct tpkt_addr_key *key)
+{
+	size_t i, n;
+	struct tpkt_aggr_peer *peer, *free_peer = NULL;
+
+	for (i = tpkt_addr_key_hash(key) & mask, n = 0; n <= mask;
+	     i = (i + 1) & mask, n++) {
+		peer = &peers[i];
+		if (peer->state == TPKT_AGGR_PEER_EMPTY)
+			return (free_peer != NULL) ? free_peer : peer;
+		if (peer->state == TPKT_AGGR_PEER_DELETED) {
+			if (free_peer == NULL)
+				free_peer = peer;
+		} else if (tpkt_addr_key_equal(&peer->key, key)) {
+			return peer;
+		}
+	}
+
+	return free_peer;
+}
+
+
+/* Rebuild the peers table without the deleted entries; all the used
+ * entries have a pending datagram */
+static int tpkt_aggr_rehash(struct tpkt_aggr *aggr)
+{
+	int res;
+	struct list_node pending;
+	struct tpkt_aggr_peer *peers, *peer, *tmp, *dst;
+
+	peers = calloc(aggr->size, sizeof(*peers));
+	if (peers == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+
+	/* Copy the peers in the deadline order and rebuild the pending
+	 * list on the copies */
+	list_init(&pending);
+	list_walk_entry_forward(&aggr->pending, peer, node)
+	{
+		dst = tpkt_aggr_find_peer(peers, aggr->mask, &peer->key);
+		*dst = *peer;
+		list_add_before(&pending, &dst->node);
+	}
+	list_init(&aggr->pending);
+	list_walk_entry_forward_safe(&pending, peer, tmp, node)
+	{
+		list_del(&peer->node);
+		list_add_before(&aggr->pending, &peer->node);
+	}
+
+	free(aggr->peers);
+	aggr->peers = peers;
+	aggr->deleted_count = 0;
+
+	return 0;
+}
+
+
+static struct tpkt_aggr_peer *
+tpkt_aggr_get_peer(struct tpkt_aggr *aggr, struct tpkt_packet *pkt)
+{
+	struct tpkt_addr_key key;
+	struct tpkt_aggr_peer *peer;
+
+	/* Packets without a valid address (e.g. on a connected socket)
+	 * share the same peer */
+	if (tpkt_addr_key_set(&key, (const struct sockaddr *)&pkt->addr, 0) <
+	    0)
+		memset(&key, 0, sizeof(key));
+
+	/* Keep empty entries to end the probe sequences early; on rehash
+	 * failure the lookup is bounded and reuses the deleted entries */
+	if (aggr->deleted_count > aggr->size / 4)
+		(void)tpkt_aggr_rehash(aggr);
+
+	peer = tpkt_aggr_find_peer(aggr->peers, aggr->mask, &key);
+	if (peer == NULL)
+		return NULL;
+	if (peer->state == TPKT_AGGR_PEER_USED)
+		return peer;
+
+	if (aggr->peer_count >= aggr->cfg.max_peers)
+		return NULL;
+	if (peer->state == TPKT_AGGR_PEER_DELETED)
+		aggr->deleted_count--;
+	peer->state = TPKT_AGGR_PEER_USED;
+	peer->key = key;
+	peer->pkt = NULL;
+	aggr->peer_count++;
+
+	return peer;
+}
+
+
+/* Release the entry of a peer without pending datagram, so that the
+ * peer table only holds the peers being aggregated */
+static void tpkt_aggr_put_peer(struct tpkt_aggr *aggr,
+			       struct tpkt_aggr_peer *peer)
+{
+	if (peer->pkt != NULL)
+		return;
+	peer->state = TPKT_AGGR_PEER_DELETED;
+	aggr->peer_count--;
+	aggr->deleted_count++;
+}
+
+
+/* Emit the datagram of a peer */
+static void tpkt_aggr_emit(struct tpkt_aggr *aggr,
+			   struct tpkt_aggr_peer *peer,
+			   struct tpkt_list *out)
+{
+	tpkt_set_len(peer->pkt, peer->len);
+	peer->pkt->priority = peer->priority;
+	tpkt_list_add_last(out, peer->pkt);
+	tpkt_unref(peer->pkt);
+	peer->pkt = NULL;
+	list_del(&peer->node);
+	aggr->stats.datagrams++;
+}
+
+
+/* Emit a packet alone in a datagram */
+static int tpkt_aggr_emit_single(struct tpkt_aggr *aggr,
+				 struct tpkt_packet *pkt,
+				 const void *data,
+				 size_t len,
+				 struct tpkt_list *out)
+{
+	int res;
+	uint8_t *dst;
+	struct tpkt_packet *dgram;
+
+	res = tpkt_aggr_alloc(
+		aggr, TPKT_AGGR_LEN_SIZE + len, &dgram, &dst, NULL);
+	if (res < 0)
+		return res;
+	tpkt_aggr_write(dst, data, len);
+	tpkt_set_len(dgram, TPKT_AGGR_LEN_SIZE + len);
+	dgram->addr = pkt->addr;
+	dgram->priority = pkt->priority;
+	tpkt_list_add_last(out, dgram);
+	tpkt_unref(dgram);
+	aggr->stats.packets++;
+	aggr->stats.datagrams++;
+
+	return 0;
+}
+
+
+/* Add a packet to the datagram of its peer; returns the number of
+ * emitted datagrams */
+static int tpkt_aggr_add(struct tpkt_aggr *aggr,
+			 struct tpkt_packet *pkt,
+			 uint64_t ts,
+			 struct tpkt_list *out)
+{
+	int res, count = 0;
+	const void *data;
+	size_t len, need;
+	struct tpkt_aggr_peer *peer;
+
+	res = tpkt_get_cdata(pkt, &data, &len, NULL);
+	if (res < 0)
+		return res;
+	ULOG_ERRNO_RETURN_ERR_IF(len > UINT16_MAX, E2BIG);
+	need = TPKT_AGGR_LEN_SIZE + len;
+
+	peer = tpkt_aggr_get_peer(aggr, pkt);
+	if (peer == NULL) {
+		/* Peer table full */
+		res = tpkt_aggr_emit_single(aggr, pkt, data, len, out);
+		return (res < 0) ? res : 1;
+	}
+
+	if (peer->pkt != NULL && peer->len + need > peer->cap) {
+		tpkt_aggr_emit(aggr, peer, out);
+		aggr->stats.size_flushes++;
+		count++;
+	}
+
+	if (need > aggr->cfg.max_size) {
+		/* Oversized packet */
+		tpkt_aggr_put_peer(aggr, peer);
+		res = tpkt_aggr_emit_single(aggr, pkt, data, len, out);
+		return (res < 0) ? res : count + 1;
+	}
+
+	if (peer->pkt == NULL) {
+		res = tpkt_aggr_alloc(aggr,
+				      aggr->cfg.max_size,
+				      &peer->pkt,
+				      &peer->data,
+				      &peer->cap);
+		if (res < 0) {
+			tpkt_aggr_put_peer(aggr, peer);
+			return res;
+		}
+		if (peer->cap > aggr->cfg.max_size)
+			peer->cap = aggr->cfg.max_size;
+		peer->len = 0;
+		peer->priority = pkt->priority;
+		peer->deadline = ts + aggr->cfg.max_delay;
+		peer->pkt->addr = pkt->addr;
+		list_add_before(&aggr->pending, &peer->node);
+	}
+
+	tpkt_aggr_write(peer->data + peer->len, data, len);
+	peer->len += need;
+	if (pkt->priority > peer->priority)
+		peer->priority = pkt->priority;
+	aggr->stats.packets++;
+
+	if (aggr->cfg.urgent_priority > 0 &&
+	    pkt->priority >= aggr->cfg.urgent_priority) {
+		tpkt_aggr_emit(aggr, peer, out);
+		aggr->stats.urgent_flushes++;
+		count++;
+	} else if (peer->len + TPKT_AGGR_LEN_SIZE + 1 > peer->cap) {
+		/* No room left for another sub-packet */
+		tpkt_aggr_emit(aggr, peer, out);
+		aggr->stats.size_flushes++;
+		count++;
+	}
+	tpkt_aggr_put_peer(aggr, peer);
+
+	return count;
+}
+
+
+int tpkt_aggr_new(const struct tpkt_aggr_cfg *cfg, struct tpkt_aggr **ret_obj)
+{
+	int res;
+	struct tpkt_aggr *aggr;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->max_size <= TPKT_AGGR_LEN_SIZE, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->pool != NULL &&
+					 cfg->pool->cap < cfg->max_size,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	aggr = calloc(1, sizeof(*aggr));
+	if (aggr == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	aggr->cfg = *cfg;
+	if (aggr->cfg.max_peers == 0)
+		aggr->cfg.max_peers = TPKT_AGGR_DEFAULT_MAX_PEERS;
+	list_init(&aggr->pending);
+
+	aggr->size = 1;
+	while (aggr->size < 2 * (size_t)aggr->cfg.max_peers)
+		aggr->size *= 2;
+	aggr->mask = aggr->size - 1;
+	aggr->peers = calloc(aggr->size, sizeof(*aggr->peers));
+	if (aggr->peers == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		free(aggr);
+		return res;
+	}
+
+	*ret_obj = aggr;
+	return 0;
+}
+
+
+int tpkt_aggr_destroy(struct tpkt_aggr *aggr)
+{
+	struct tpkt_aggr_peer *peer, *tmp;
+
+	if (aggr == NULL)
+		return 0;
+
+	list_walk_entry_forward_safe(&aggr->pending, peer, tmp, node)
+	{
+		tpkt_unref(peer->pkt);
+		list_del(&peer->node);
+	}
+	free(aggr->peers);
+	free(aggr);
+
+	return 0;
+}
+
+
+int tpkt_aggr_push(struct tpkt_aggr *aggr,
+		   struct tpkt_list *list,
+		   uint64_t ts,
+		   struct tpkt_list *out)
+{
+	int res, count = 0;
+	struct tpkt_packet *pkt, *tmp;
+
+	ULOG_ERRNO_RETURN_ERR_IF(aggr == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(out == NULL, EINVAL);
+
+	list_walk_entry_forward_safe(&list->packets, pkt, tmp, node)
+	{
+		res = tpkt_aggr_add(aggr, pkt, ts, out);
+		if (res < 0)
+			return res;
+		count += res;
+		tpkt_list_remove(list, pkt);
+		tpkt_unref(pkt);
+	}
+
+	res = tpkt_aggr_pop(aggr, ts, out);
+	if (res < 0)
+		return res;
+
+	return count + res;
+}
+
+
+int tpkt_aggr_pop(struct tpkt_aggr *aggr, uint64_t ts, struct tpkt_list *out)
+{
+	int count = 0;
+	struct tpkt_aggr_peer *peer, *tmp;
+
+	ULOG_ERRNO_RETURN_ERR_IF(aggr == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(out == NULL, EINVAL);
+
+	list_walk_entry_forward_safe(&aggr->pending, peer, tmp, node)
+	{
+		if (peer->deadline > ts)
+			break;
+		tpkt_aggr_emit(aggr, peer, out);
+		tpkt_aggr_put_peer(aggr, peer);
+		aggr->stats.delay_flushes++;
+		count++;
+	}
+
+	return count;
+}
+
+
+int tpkt_aggr_get_next_deadline(struct tpkt_aggr *aggr, uint64_t *ts)
+{
+	struct tpkt_aggr_peer *peer;
+
+	ULOG_ERRNO_RETURN_ERR_IF(aggr == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ts == NULL, EINVAL);
+
+	if (list_is_empty(&aggr->pending))
+		return -ENOENT;
+
+	peer = list_head(&aggr->pending, struct tpkt_aggr_peer, node);
+	*ts = peer->deadline;
+
+	return 0;
+}
+
+
+int tpkt_aggr_flush(struct tpkt_aggr *aggr, struct tpkt_list *out)
+{
+	int count = 0;
+	struct tpkt_aggr_peer *peer, *tmp;
+
+	ULOG_ERRNO_RETURN_ERR_IF(aggr == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(out == NULL, EINVAL);
+
+	list_walk_entry_forward_safe(&aggr->pending, peer, tmp, node)
+	{
+		tpkt_aggr_emit(aggr, peer, out);
+		count++;
+	}
+
+	/* Forget the peers, including the deleted entries */
+	memset(aggr->peers, 0, aggr->size * sizeof(*aggr->peers));
+	aggr->peer_count = 0;
+	aggr->deleted_count = 0;
+
+	return count;
+}
+
+
+int tpkt_aggr_get_stats(struct tpkt_aggr *aggr, struct tpkt_aggr_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(aggr == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = aggr->stats;
+
+	return 0;
+}
+
+
+int tpkt_aggr_split(struct tpkt_packet *pkt, struct tpkt_list *out)
+{
+	int res, count = 0;
+	const uint8_t *data;
+	size_t len, offset, sub_len;
+	struct tpkt_packet *sub;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(out == NULL, EINVAL);
+
+	res = tpkt_get_cdata(pkt, (const void **)&data, &len, NULL);
+	if (res < 0)
+		return res;
+
+	/* Validate the whole datagram first */
+	for (offset = 0; offset < len; offset += sub_len) {
+		if (len - offset < TPKT_AGGR_LEN_SIZE)
+			return -EPROTO;
+		sub_len = (data[offset] << 8) | data[offset + 1];
+		offset += TPKT_AGGR_LEN_SIZE;
+		if (sub_len > len - offset)
+			return -EPROTO;
+	}
+
+	for (offset = 0; offset < len; offset += sub_len) {
+		sub_len = (data[offset] << 8) | data[offset + 1];
+		offset += TPKT_AGGR_LEN_SIZE;
+		res = tpkt_new_slice(pkt, offset, sub_len, &sub);
+		if (res < 0)
+			goto error;
+		res = tpkt_list_add_last(out, sub);
+		tpkt_unref(sub);
+		if (res < 0)
+			goto error;
+		count++;
+	}
+
+	return count;
+
+error:
+	for (; count > 0; count--) {
+		sub = tpkt_list_last(out);
+		tpkt_list_remove(out, sub);
+		tpkt_unref(sub);
+	}
+	return res;
+}
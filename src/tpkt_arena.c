@@ -0,0 +1,355 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_arena.h>
+
+#ifndef _WIN32
+#	include <sys/mman.h>
+#endif /* !_WIN32 */
+
+
+/* Huge page size in bytes */
+#define TPKT_ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+struct tpkt_arena {
+	/* Mapped memory */
+	uint8_t *base;
+	size_t size;
+
+	/* Page type in use */
+	enum tpkt_arena_page_type page_type;
+
+	/* Allocated size in bytes */
+	size_t used;
+
+	/* Number of pools using the arena */
+	unsigned int users;
+
+	pthread_mutex_t mutex;
+};
+
+
+#ifdef __linux__
+
+static int tpkt_arena_map_hugetlb(struct tpkt_arena *arena)
+{
+	void *p;
+
+#	ifdef MAP_HUGETLB
+	p = mmap(NULL,
+		 arena->size,
+		 PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+		 -1,
+		 0);
+	if (p == MAP_FAILED)
+		return -errno;
+	arena->base = p;
+	arena->page_type = TPKT_ARENA_PAGE_HUGETLB;
+	return 0;
+#	else /* MAP_HUGETLB */
+	return -ENOTSUP;
+#	endif /* MAP_HUGETLB */
+}
+
+
+static int tpkt_arena_map_thp(struct tpkt_arena *arena)
+{
+	int res;
+	uint8_t *p, *base;
+	size_t len, head, tail;
+
+#	ifdef MADV_HUGEPAGE
+	/* Over-allocate so that the region can be aligned on a huge page
+	 * boundary, then trim the unaligned head and tail */
+	len = arena->size + TPKT_ARENA_HUGE_PAGE_SIZE;
+	p = mmap(NULL,
+		 len,
+		 PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS,
+		 -1,
+		 0);
+	if (p == MAP_FAILED)
+		return -errno;
+	base = (uint8_t *)(((uintptr_t)p + TPKT_ARENA_HUGE_PAGE_SIZE - 1) &
+			   ~((uintptr_t)TPKT_ARENA_HUGE_PAGE_SIZE - 1));
+	head = base - p;
+	tail = len - head - arena->size;
+	if (head > 0)
+		munmap(p, head);
+	if (tail > 0)
+		munmap(base + arena->size, tail);
+
+	if (madvise(base, arena->size, MADV_HUGEPAGE) < 0) {
+		/* Transparent huge pages not supported or disabled */
+		res = -errno;
+		munmap(base, arena->size);
+		return res;
+	}
+	arena->base = base;
+	arena->page_type = TPKT_ARENA_PAGE_THP;
+	return 0;
+#	else /* MADV_HUGEPAGE */
+	return -ENOTSUP;
+#	endif /* MADV_HUGEPAGE */
+}
+
+#endif /* __linux__ */
+
+
+static int tpkt_arena_map_normal(struct tpkt_arena *arena)
+{
+#ifdef _WIN32
+	arena->base = VirtualAlloc(
+		NULL, arena->size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (arena->base == NULL)
+		return -ENOMEM;
+#else /* _WIN32 */
+	void *p;
+
+	p = mmap(NULL,
+		 arena->size,
+		 PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS,
+		 -1,
+		 0);
+	if (p == MAP_FAILED)
+		return -errno;
+	arena->base = p;
+#endif /* _WIN32 */
+	arena->page_type = TPKT_ARENA_PAGE_NORMAL;
+	return 0;
+}
+
+
+static int tpkt_arena_map(struct tpkt_arena *arena,
+			  enum tpkt_arena_page_type page_type)
+{
+	int res = -ENOTSUP;
+
+	switch (page_type) {
+	case TPKT_ARENA_PAGE_AUTO:
+#ifdef __linux__
+		res = tpkt_arena_map_hugetlb(arena);
+		if (res == 0)
+			return 0;
+		ULOGD("%s: explicit huge pages not available (%s), "
+		      "trying transparent huge pages",
+		      __func__,
+		      strerror(-res));
+		res = tpkt_arena_map_thp(arena);
+		if (res == 0)
+			return 0;
+		ULOGD("%s: transparent huge pages not available (%s), "
+		      "falling back to normal pages",
+		      __func__,
+		      strerror(-res));
+#endif /* __linux__ */
+		return tpkt_arena_map_normal(arena);
+	case TPKT_ARENA_PAGE_NORMAL:
+		return tpkt_arena_map_normal(arena);
+	case TPKT_ARENA_PAGE_THP:
+#ifdef __linux__
+		res = tpkt_arena_map_thp(arena);
+#endif /* __linux__ */
+		return res;
+	case TPKT_ARENA_PAGE_HUGETLB:
+#ifdef __linux__
+		res = tpkt_arena_map_hugetlb(arena);
+#endif /* __linux__ */
+		return res;
+	default:
+		return -EINVAL;
+	}
+}
+
+
+static void tpkt_arena_unmap(struct tpkt_arena *arena)
+{
+	if (arena->base == NULL)
+		return;
+#ifdef _WIN32
+	VirtualFree(arena->base, 0, MEM_RELEASE);
+#else /* _WIN32 */
+	munmap(arena->base, arena->size);
+#endif /* _WIN32 */
+	arena->base = NULL;
+}
+
+
+int tpkt_arena_new(const struct tpkt_arena_cfg *cfg,
+		   struct tpkt_arena **ret_obj)
+{
+	int res;
+	size_t i;
+	struct tpkt_arena *arena;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->size > SIZE_MAX - TPKT_ARENA_HUGE_PAGE_SIZE, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	arena = calloc(1, sizeof(*arena));
+	if (arena == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	arena->size = (cfg->size + TPKT_ARENA_HUGE_PAGE_SIZE - 1) &
+		      ~((size_t)TPKT_ARENA_HUGE_PAGE_SIZE - 1);
+	pthread_mutex_init(&arena->mutex, NULL);
+
+	res = tpkt_arena_map(arena, cfg->page_type);
+	if (res < 0) {
+		ULOGE("%s: failed to map %zu bytes of %s pages: %s",
+		      __func__,
+		      arena->size,
+		      tpkt_arena_page_type_to_str(cfg->page_type),
+		      strerror(-res));
+		goto error;
+	}
+
+	if (cfg->populate) {
+		/* Touch one byte per (normal) page */
+		for (i = 0; i < arena->size; i += 4096)
+			arena->base[i] = 0;
+	}
+
+	*ret_obj = arena;
+	return 0;
+
+error:
+	tpkt_arena_destroy(arena);
+	return res;
+}
+
+
+int tpkt_arena_destroy(struct tpkt_arena *arena)
+{
+	if (arena == NULL)
+		return 0;
+
+	if (__atomic_load_n(&arena->users, __ATOMIC_ACQUIRE) > 0) {
+		ULOGE("%s: arena is still used by %u pools",
+		      __func__,
+		      arena->users);
+		return -EBUSY;
+	}
+
+	tpkt_arena_unmap(arena);
+	pthread_mutex_destroy(&arena->mutex);
+	free(arena);
+
+	return 0;
+}
+
+
+int tpkt_arena_alloc(struct tpkt_arena *arena,
+		     size_t size,
+		     size_t align,
+		     void **ptr)
+{
+	int res = 0;
+	size_t offset;
+
+	ULOG_ERRNO_RETURN_ERR_IF(arena == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((align & (align - 1)) != 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(align > TPKT_ARENA_HUGE_PAGE_SIZE, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ptr == NULL, EINVAL);
+
+	if (align == 0)
+		align = 1;
+
+	pthread_mutex_lock(&arena->mutex);
+	offset = (arena->used + align - 1) & ~(align - 1);
+	if (offset > arena->size || size > arena->size - offset) {
+		res = -ENOMEM;
+		goto out;
+	}
+	*ptr = arena->base + offset;
+	arena->used = offset + size;
+
+out:
+	pthread_mutex_unlock(&arena->mutex);
+	return res;
+}
+
+
+int tpkt_arena_get_page_type(struct tpkt_arena *arena)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(arena == NULL, EINVAL);
+
+	return arena->page_type;
+}
+
+
+const char *tpkt_arena_page_type_to_str(enum tpkt_arena_page_type type)
+{
+	switch (type) {
+	case TPKT_ARENA_PAGE_AUTO:
+		return "AUTO";
+	case TPKT_ARENA_PAGE_NORMAL:
+		return "NORMAL";
+	case TPKT_ARENA_PAGE_THP:
+		return "THP";
+	case TPKT_ARENA_PAGE_HUGETLB:
+		return "HUGETLB";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+int tpkt_arena_get_size(struct tpkt_arena *arena, size_t *size, size_t *used)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(arena == NULL, EINVAL);
+
+	if (size != NULL)
+		*size = arena->size;
+	if (used != NULL) {
+		pthread_mutex_lock(&arena->mutex);
+		*used = arena->used;
+		pthread_mutex_unlock(&arena->mutex);
+	}
+
+	return 0;
+}
+
+
+void tpkt_arena_hold(struct tpkt_arena *arena)
+{
+	__atomic_add_fetch(&arena->users, 1, __ATOMIC_RELAXED);
+}
+
+
+void tpkt_arena_release(struct tpkt_arena *arena)
+{
+	__atomic_sub_fetch(&arena->users, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,716 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_capture.h>
+#include <transport-packet/tpkt_csum.h>
+
+#include <time.h>
+
+
+#define TPKT_CAPTURE_DEFAULT_QUEUE_SIZE 8192
+
+/* pcapng block types and options (draft-ietf-opsawg-pcapng) */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_ISB 0x00000005
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_OPT_ISB_IFDROP 5
+#define PCAPNG_EPB_FLAGS_INBOUND 1
+#define PCAPNG_EPB_FLAGS_OUTBOUND 2
+#define PCAPNG_LINKTYPE_RAW 101
+
+/* Synthesized header sizes */
+#define TPKT_CAPTURE_IPV4_HDR_SIZE 20
+#define TPKT_CAPTURE_IPV6_HDR_SIZE 40
+#define TPKT_CAPTURE_UDP_HDR_SIZE 8
+#define TPKT_CAPTURE_MAX_HDR_SIZE                                              \
+	(TPKT_CAPTURE_IPV6_HDR_SIZE + TPKT_CAPTURE_UDP_HDR_SIZE)
+
+
+/* Bounded multi-producer single-consumer queue slot: the sequence number
+ * is the queue position when the slot is free and the position + 1 when it
+ * holds a packet (see D. Vyukov's bounded MPMC queue) */
+struct tpkt_capture_slot {
+	size_t seq;
+	struct tpkt_packet *pkt;
+	uint64_t time;
+	enum tpkt_capture_dir dir;
+};
+
+
+struct tpkt_capture {
+	/* Producers position (updated by the capturing threads) */
+	size_t tail __attribute__((aligned(TPKT_CACHE_LINE_SIZE)));
+
+	/* Consumer position (writer thread only) */
+	size_t head __attribute__((aligned(TPKT_CACHE_LINE_SIZE)));
+
+	struct tpkt_capture_slot *slots;
+	size_t size;
+	size_t mask;
+
+	FILE *file;
+	size_t snaplen;
+	union {
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} local;
+
+	pthread_t thread;
+	int thread_started;
+	int stop;
+
+	/* Set by the writer thread before sleeping on the condition when the
+	 * queue is empty, cleared by the thread that wakes it up */
+	int waiting;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	struct tpkt_capture_stats stats;
+};
+
+
+static inline uint64_t tpkt_capture_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static int tpkt_capture_enqueue(struct tpkt_capture *capture,
+				struct tpkt_packet *pkt,
+				uint64_t time,
+				enum tpkt_capture_dir dir)
+{
+	size_t pos, seq;
+	struct tpkt_capture_slot *slot;
+
+	pos = __atomic_load_n(&capture->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &capture->slots[pos & capture->mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&capture->tail,
+							&pos,
+							pos + 1,
+							1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if ((ptrdiff_t)(seq - pos) < 0) {
+			/* Queue full */
+			__atomic_add_fetch(
+				&capture->stats.dropped, 1, __ATOMIC_RELAXED);
+			return -ENOBUFS;
+		} else {
+			pos = __atomic_load_n(&capture->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	tpkt_ref(pkt);
+	slot->pkt = pkt;
+	slot->time = time;
+	slot->dir = dir;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&capture->stats.queued, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+
+static int tpkt_capture_dequeue(struct tpkt_capture *capture,
+				struct tpkt_capture_slot *entry)
+{
+	size_t pos = capture->head;
+	struct tpkt_capture_slot *slot = &capture->slots[pos & capture->mask];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return -EAGAIN;
+
+	*entry = *slot;
+	__atomic_store_n(&slot->seq, pos + capture->size, __ATOMIC_RELEASE);
+	capture->head = pos + 1;
+
+	return 0;
+}
+
+
+/* Wake the writer thread up if it is waiting for packets */
+static void tpkt_capture_wakeup(struct tpkt_capture *capture)
+{
+	/* Pairs with the fence in tpkt_capture_wait(): either the writer
+	 * sees the new packets or this thread sees the waiting flag */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&capture->waiting, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&capture->mutex);
+	__atomic_store_n(&capture->waiting, 0, __ATOMIC_RELAXED);
+	pthread_cond_signal(&capture->cond);
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+
+/* Sleep until packets are queued or the capture is stopped */
+static void tpkt_capture_wait(struct tpkt_capture *capture)
+{
+	size_t pos = capture->head;
+	struct tpkt_capture_slot *slot = &capture->slots[pos & capture->mask];
+
+	pthread_mutex_lock(&capture->mutex);
+	__atomic_store_n(&capture->waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos + 1 ||
+	    __atomic_load_n(&capture->stop, __ATOMIC_ACQUIRE))
+		__atomic_store_n(&capture->waiting, 0, __ATOMIC_RELAXED);
+	while (capture->waiting)
+		pthread_cond_wait(&capture->cond, &capture->mutex);
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+
+static inline size_t tpkt_capture_pad(size_t len)
+{
+	return (len + 3) & ~(size_t)3;
+}
+
+
+/* Append an option to the options buffer, return the options length */
+static size_t tpkt_capture_add_option(uint8_t *opts,
+				      size_t opts_len,
+				      uint16_t code,
+				      const void *value,
+				      size_t len)
+{
+	uint16_t hdr[2] = {code, len};
+
+	memcpy(opts + opts_len, hdr, sizeof(hdr));
+	memcpy(opts + opts_len + sizeof(hdr), value, len);
+	memset(opts + opts_len + sizeof(hdr) + len,
+	       0,
+	       tpkt_capture_pad(len) - len);
+	return opts_len + sizeof(hdr) + tpkt_capture_pad(len);
+}
+
+
+/* Write a block: header, body (len bytes, padded), options and trailer */
+static int tpkt_capture_write_block(struct tpkt_capture *capture,
+				    uint32_t type,
+				    const void *body,
+				    size_t body_len,
+				    const void *body2,
+				    size_t body2_len,
+				    const uint8_t *opts,
+				    size_t opts_len)
+{
+	static const uint8_t zero[4];
+	static const uint16_t endofopt[2] = {PCAPNG_OPT_ENDOFOPT, 0};
+	size_t data_len = body_len + body2_len;
+	uint32_t hdr[2];
+
+	hdr[0] = type;
+	hdr[1] = 3 * sizeof(uint32_t) + tpkt_capture_pad(data_len) + opts_len +
+		 (opts_len > 0 ? sizeof(endofopt) : 0);
+
+	if (fwrite(hdr, sizeof(hdr), 1, capture->file) != 1)
+		return -EIO;
+	if (body_len > 0 && fwrite(body, body_len, 1, capture->file) != 1)
+		return -EIO;
+	if (body2_len > 0 && fwrite(body2, body2_len, 1, capture->file) != 1)
+		return -EIO;
+	if (tpkt_capture_pad(data_len) > data_len &&
+	    fwrite(zero,
+		   tpkt_capture_pad(data_len) - data_len,
+		   1,
+		   capture->file) != 1)
+		return -EIO;
+	if (opts_len > 0 &&
+	    (fwrite(opts, opts_len, 1, capture->file) != 1 ||
+	     fwrite(endofopt, sizeof(endofopt), 1, capture->file) != 1))
+		return -EIO;
+	if (fwrite(&hdr[1], sizeof(hdr[1]), 1, capture->file) != 1)
+		return -EIO;
+
+	return 0;
+}
+
+
+static int tpkt_capture_write_header(struct tpkt_capture *capture,
+				     const char *name)
+{
+	int res;
+	uint8_t opts[64 + 256];
+	size_t opts_len;
+	static const char userappl[] = "libtransport-packet";
+	struct {
+		uint32_t magic;
+		uint16_t major;
+		uint16_t minor;
+		int64_t section_len;
+	} shb = {PCAPNG_BYTE_ORDER_MAGIC, 1, 0, -1};
+	struct {
+		uint16_t linktype;
+		uint16_t reserved;
+		uint32_t snaplen;
+	} idb = {PCAPNG_LINKTYPE_RAW, 0, 0};
+
+	opts_len = tpkt_capture_add_option(
+		opts, 0, PCAPNG_OPT_SHB_USERAPPL, userappl, strlen(userappl));
+	res = tpkt_capture_write_block(capture,
+				       PCAPNG_SHB,
+				       &shb,
+				       sizeof(shb),
+				       NULL,
+				       0,
+				       opts,
+				       opts_len);
+	if (res < 0)
+		return res;
+
+	if (capture->snaplen > 0 && capture->snaplen < UINT16_MAX)
+		idb.snaplen = capture->snaplen + TPKT_CAPTURE_MAX_HDR_SIZE;
+	opts_len = 0;
+	if (name != NULL)
+		opts_len = tpkt_capture_add_option(opts,
+						   0,
+						   PCAPNG_OPT_IF_NAME,
+						   name,
+						   strnlen(name, 255));
+	return tpkt_capture_write_block(capture,
+					PCAPNG_IDB,
+					&idb,
+					sizeof(idb),
+					NULL,
+					0,
+					opts,
+					opts_len);
+}
+
+
+static int tpkt_capture_write_stats(struct tpkt_capture *capture)
+{
+	uint8_t opts[16];
+	size_t opts_len;
+	uint64_t time = tpkt_capture_now();
+	uint64_t dropped =
+		__atomic_load_n(&capture->stats.dropped, __ATOMIC_RELAXED);
+	uint32_t isb[3] = {0, time >> 32, time & UINT32_MAX};
+
+	opts_len = tpkt_capture_add_option(
+		opts, 0, PCAPNG_OPT_ISB_IFDROP, &dropped, sizeof(dropped));
+	return tpkt_capture_write_block(
+		capture, PCAPNG_ISB, isb, sizeof(isb), NULL, 0, opts, opts_len);
+}
+
+
+/* Build the IP and UDP headers of a packet, return the headers size */
+static size_t tpkt_capture_build_hdr(struct tpkt_capture *capture,
+				     struct tpkt_packet *pkt,
+				     enum tpkt_capture_dir dir,
+				     const void *data,
+				     size_t len,
+				     uint8_t *hdr)
+{
+	uint8_t *udp;
+	uint16_t csum, udp_len = TPKT_CAPTURE_UDP_HDR_SIZE + len;
+	uint32_t sum;
+	const uint8_t *src_addr, *dst_addr;
+	uint16_t src_port, dst_port;
+	size_t addr_len, ip_len;
+	uint8_t pseudo[4];
+
+	if (pkt->addr.in.sin_family == AF_INET6) {
+		static const struct in6_addr any6 = IN6ADDR_ANY_INIT;
+		const uint8_t *local =
+			capture->local.in6.sin6_family == AF_INET6
+				? capture->local.in6.sin6_addr.s6_addr
+				: any6.s6_addr;
+		const uint8_t *peer = pkt->addr.in6.sin6_addr.s6_addr;
+		uint16_t local_port =
+			capture->local.in6.sin6_family == AF_INET6
+				? capture->local.in6.sin6_port
+				: 0;
+		uint16_t payload_len = htons(udp_len);
+
+		addr_len = 16;
+		ip_len = TPKT_CAPTURE_IPV6_HDR_SIZE;
+		src_addr = dir == TPKT_CAPTURE_DIR_IN ? peer : local;
+		dst_addr = dir == TPKT_CAPTURE_DIR_IN ? local : peer;
+		src_port = dir == TPKT_CAPTURE_DIR_IN
+				   ? pkt->addr.in6.sin6_port
+				   : local_port;
+		dst_port = dir == TPKT_CAPTURE_DIR_IN
+				   ? local_port
+				   : pkt->addr.in6.sin6_port;
+
+		memset(hdr, 0, ip_len);
+		hdr[0] = 0x60;
+		memcpy(&hdr[4], &payload_len, sizeof(payload_len));
+		hdr[6] = IPPROTO_UDP;
+		hdr[7] = 64;
+		memcpy(&hdr[8], src_addr, addr_len);
+		memcpy(&hdr[24], dst_addr, addr_len);
+	} else {
+		/* IPv4, also used when the packet has no address */
+		static const uint8_t any4[4];
+		const uint8_t *local =
+			capture->local.in.sin_family == AF_INET
+				? (const uint8_t *)&capture->local.in.sin_addr
+				: any4;
+		const uint8_t *peer =
+			pkt->addr.in.sin_family == AF_INET
+				? (const uint8_t *)&pkt->addr.in.sin_addr
+				: any4;
+		uint16_t local_port = capture->local.in.sin_family == AF_INET
+					      ? capture->local.in.sin_port
+					      : 0;
+		uint16_t peer_port = pkt->addr.in.sin_family == AF_INET
+					     ? pkt->addr.in.sin_port
+					     : 0;
+		uint16_t total_len =
+			htons(TPKT_CAPTURE_IPV4_HDR_SIZE + udp_len);
+
+		addr_len = 4;
+		ip_len = TPKT_CAPTURE_IPV4_HDR_SIZE;
+		src_addr = dir == TPKT_CAPTURE_DIR_IN ? peer : local;
+		dst_addr = dir == TPKT_CAPTURE_DIR_IN ? local : peer;
+		src_port = dir == TPKT_CAPTURE_DIR_IN ? peer_port : local_port;
+		dst_port = dir == TPKT_CAPTURE_DIR_IN ? local_port : peer_port;
+
+		memset(hdr, 0, ip_len);
+		hdr[0] = 0x45;
+		memcpy(&hdr[2], &total_len, sizeof(total_len));
+		hdr[8] = 64;
+		hdr[9] = IPPROTO_UDP;
+		memcpy(&hdr[12], src_addr, addr_len);
+		memcpy(&hdr[16], dst_addr, addr_len);
+		csum = tpkt_csum_inet(hdr, ip_len);
+		memcpy(&hdr[10], &csum, sizeof(csum));
+	}
+
+	udp = hdr + ip_len;
+	udp_len = htons(udp_len);
+	memcpy(&udp[0], &src_port, sizeof(src_port));
+	memcpy(&udp[2], &dst_port, sizeof(dst_port));
+	memcpy(&udp[4], &udp_len, sizeof(udp_len));
+	memset(&udp[6], 0, 2);
+
+	/* UDP checksum over the pseudo header, UDP header and payload */
+	pseudo[0] = 0;
+	pseudo[1] = IPPROTO_UDP;
+	memcpy(&pseudo[2], &udp_len, sizeof(udp_len));
+	sum = tpkt_csum_inet_partial(src_addr, addr_len, 0);
+	sum = tpkt_csum_inet_partial(dst_addr, addr_len, sum);
+	sum = tpkt_csum_inet_partial(pseudo, sizeof(pseudo), sum);
+	sum = tpkt_csum_inet_partial(udp, TPKT_CAPTURE_UDP_HDR_SIZE, sum);
+	sum = tpkt_csum_inet_partial(data, len, sum);
+	csum = tpkt_csum_inet_fold(sum);
+	if (csum == 0)
+		csum = 0xffff;
+	memcpy(&udp[6], &csum, sizeof(csum));
+
+	return ip_len + TPKT_CAPTURE_UDP_HDR_SIZE;
+}
+
+
+static int tpkt_capture_write_packet(struct tpkt_capture *capture,
+				     const struct tpkt_capture_slot *entry)
+{
+	int res;
+	const void *data = NULL;
+	size_t len = 0, cap_len, hdr_len;
+	uint32_t epb[5];
+	uint8_t body[sizeof(epb) + TPKT_CAPTURE_MAX_HDR_SIZE];
+	uint32_t flags;
+	uint8_t opts[128];
+	size_t opts_len;
+	char comment[64];
+	struct tpkt_packet *pkt = entry->pkt;
+
+	res = tpkt_get_cdata(pkt, &data, &len, NULL);
+	if (res < 0)
+		return res;
+	if (len > UINT16_MAX - TPKT_CAPTURE_MAX_HDR_SIZE)
+		len = UINT16_MAX - TPKT_CAPTURE_MAX_HDR_SIZE;
+
+	/* The block body is the EPB fixed part followed by the synthesized
+	 * headers and the packet payload */
+	hdr_len = tpkt_capture_build_hdr(
+		capture, pkt, entry->dir, data, len, body + sizeof(epb));
+	cap_len = len;
+	if (capture->snaplen > 0 && cap_len > capture->snaplen)
+		cap_len = capture->snaplen;
+
+	epb[0] = 0;
+	epb[1] = entry->time >> 32;
+	epb[2] = entry->time & UINT32_MAX;
+	epb[3] = hdr_len + cap_len;
+	epb[4] = hdr_len + len;
+	memcpy(body, epb, sizeof(epb));
+
+	flags = entry->dir == TPKT_CAPTURE_DIR_IN ? PCAPNG_EPB_FLAGS_INBOUND
+						  : PCAPNG_EPB_FLAGS_OUTBOUND;
+	opts_len = tpkt_capture_add_option(
+		opts, 0, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+	snprintf(comment,
+		 sizeof(comment),
+		 "priority=%d timestamp=%" PRIu64,
+		 pkt->priority,
+		 pkt->timestamp);
+	opts_len = tpkt_capture_add_option(
+		opts, opts_len, PCAPNG_OPT_COMMENT, comment, strlen(comment));
+
+	return tpkt_capture_write_block(capture,
+					PCAPNG_EPB,
+					body,
+					sizeof(epb) + hdr_len,
+					data,
+					cap_len,
+					opts,
+					opts_len);
+}
+
+
+static void *tpkt_capture_thread(void *userdata)
+{
+	int res, flushed = 1, write_error = 0;
+	struct tpkt_capture *capture = userdata;
+	struct tpkt_capture_slot entry;
+
+	for (;;) {
+		res = tpkt_capture_dequeue(capture, &entry);
+		if (res < 0) {
+			if (__atomic_load_n(&capture->stop, __ATOMIC_ACQUIRE))
+				break;
+			if (!flushed) {
+				fflush(capture->file);
+				flushed = 1;
+			}
+			tpkt_capture_wait(capture);
+			continue;
+		}
+
+		res = tpkt_capture_write_packet(capture, &entry);
+		tpkt_unref(entry.pkt);
+		if (res < 0) {
+			/* Only log the first error */
+			if (!write_error)
+				ULOG_ERRNO("tpkt_capture_write_packet", -res);
+			write_error = 1;
+			__atomic_add_fetch(
+				&capture->stats.errors, 1, __ATOMIC_RELAXED);
+		} else {
+			__atomic_add_fetch(
+				&capture->stats.written, 1, __ATOMIC_RELAXED);
+		}
+		flushed = 0;
+	}
+
+	return NULL;
+}
+
+
+int tpkt_capture_new(const struct tpkt_capture_cfg *cfg,
+		     struct tpkt_capture **ret_obj)
+{
+	int res;
+	size_t i, queue_size;
+	struct tpkt_capture *capture;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->path == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->local_addr != NULL &&
+					 cfg->local_addrlen >
+						 sizeof(capture->local),
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	res = posix_memalign((void **)&capture,
+			     TPKT_CACHE_LINE_SIZE,
+			     sizeof(*capture));
+	if (res != 0) {
+		ULOG_ERRNO("posix_memalign", res);
+		return -res;
+	}
+	memset(capture, 0, sizeof(*capture));
+	pthread_mutex_init(&capture->mutex, NULL);
+	pthread_cond_init(&capture->cond, NULL);
+	if (cfg->local_addr != NULL)
+		memcpy(&capture->local, cfg->local_addr, cfg->local_addrlen);
+	capture->snaplen = cfg->snaplen;
+
+	queue_size = cfg->queue_size != 0 ? cfg->queue_size
+					  : TPKT_CAPTURE_DEFAULT_QUEUE_SIZE;
+	capture->size = 1;
+	while (capture->size < queue_size)
+		capture->size *= 2;
+	capture->mask = capture->size - 1;
+	capture->slots = calloc(capture->size, sizeof(*capture->slots));
+	if (capture->slots == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto error;
+	}
+	for (i = 0; i < capture->size; i++)
+		capture->slots[i].seq = i;
+
+	capture->file = fopen(cfg->path, "wb");
+	if (capture->file == NULL) {
+		res = -errno;
+		ULOG_ERRNO("fopen", -res);
+		goto error;
+	}
+
+	res = tpkt_capture_write_header(capture, cfg->name);
+	if (res < 0) {
+		ULOG_ERRNO("tpkt_capture_write_header", -res);
+		goto error;
+	}
+
+	res = pthread_create(
+		&capture->thread, NULL, tpkt_capture_thread, capture);
+	if (res != 0) {
+		res = -res;
+		ULOG_ERRNO("pthread_create", -res);
+		goto error;
+	}
+	capture->thread_started = 1;
+
+	*ret_obj = capture;
+	return 0;
+
+error:
+	tpkt_capture_destroy(capture);
+	return res;
+}
+
+
+int tpkt_capture_destroy(struct tpkt_capture *capture)
+{
+	int res = 0;
+
+	if (capture == NULL)
+		return 0;
+
+	if (capture->thread_started) {
+		/* The writer thread drains the queue before exiting */
+		__atomic_store_n(&capture->stop, 1, __ATOMIC_RELEASE);
+		tpkt_capture_wakeup(capture);
+		pthread_join(capture->thread, NULL);
+	}
+
+	if (capture->file != NULL) {
+		if (capture->thread_started) {
+			res = tpkt_capture_write_stats(capture);
+			if (res < 0)
+				ULOG_ERRNO("tpkt_capture_write_stats", -res);
+		}
+		if (fclose(capture->file) != 0 && res == 0) {
+			res = -errno;
+			ULOG_ERRNO("fclose", -res);
+		}
+	}
+
+	pthread_cond_destroy(&capture->cond);
+	pthread_mutex_destroy(&capture->mutex);
+	free(capture->slots);
+	free(capture);
+
+	return res;
+}
+
+
+int tpkt_capture_packet(struct tpkt_capture *capture,
+			struct tpkt_packet *pkt,
+			enum tpkt_capture_dir dir)
+{
+	int res;
+
+	ULOG_ERRNO_RETURN_ERR_IF(capture == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt->local, EPERM);
+
+	res = tpkt_capture_enqueue(capture, pkt, tpkt_capture_now(), dir);
+	if (res == 0)
+		tpkt_capture_wakeup(capture);
+
+	return res;
+}
+
+
+int tpkt_capture_list(struct tpkt_capture *capture,
+		      struct tpkt_list *list,
+		      enum tpkt_capture_dir dir)
+{
+	int count = 0;
+	uint64_t time;
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(capture == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	/* All packets of the list share the same capture time */
+	time = tpkt_capture_now();
+	list_walk_entry_forward(&list->packets, pkt, node)
+	{
+		if (pkt->local)
+			continue;
+		if (tpkt_capture_enqueue(capture, pkt, time, dir) == 0)
+			count++;
+	}
+	if (count > 0)
+		tpkt_capture_wakeup(capture);
+
+	return count;
+}
+
+
+int tpkt_capture_get_stats(struct tpkt_capture *capture,
+			   struct tpkt_capture_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(capture == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	stats->queued =
+		__atomic_load_n(&capture->stats.queued, __ATOMIC_RELAXED);
+	stats->dropped =
+		__atomic_load_n(&capture->stats.dropped, __ATOMIC_RELAXED);
+	stats->written =
+		__atomic_load_n(&capture->stats.written, __ATOMIC_RELAXED);
+	stats->errors =
+		__atomic_load_n(&capture->stats.errors, __ATOMIC_RELAXED);
+
+	return 0;
+}
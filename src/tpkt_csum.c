@@ -0,0 +1,651 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_csum.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define TPKT_CSUM_X86
+#	include <immintrin.h>
+#elif defined(__aarch64__)
+#	define TPKT_CSUM_NEON
+#	include <arm_neon.h>
+#	ifdef __ARM_FEATURE_CRC32
+#		define TPKT_CSUM_ARM_CRC
+#		include <arm_acle.h>
+#	endif
+#endif
+
+
+/* CRC32C polynomial (reflected) */
+#define TPKT_CRC32C_POLY 0x82f63b78
+
+
+/* Computation kernels */
+struct tpkt_csum_kernels {
+	const char *inet_name;
+
+	/* Internet checksum partial sum (data at an even offset) */
+	uint32_t (*inet)(const uint8_t *data, size_t len, uint32_t sum);
+
+	const char *crc32c_name;
+
+	/* CRC32C without the initial and final inversion */
+	uint32_t (*crc32c)(uint32_t crc, const uint8_t *data, size_t len);
+};
+
+
+/* CRC32C slicing-by-8 tables */
+static uint32_t tpkt_crc32c_table[8][256];
+
+/* CRC32C x^(2^n) modulo the polynomial */
+static uint32_t tpkt_crc32c_x2n_table[32];
+
+static struct tpkt_csum_kernels tpkt_csum_kernels;
+static pthread_once_t tpkt_csum_once = PTHREAD_ONCE_INIT;
+
+
+/* Add with end-around carry */
+static inline uint32_t tpkt_csum_add32(uint32_t a, uint32_t b)
+{
+	a += b;
+	return a + (a < b);
+}
+
+
+/* Reduce a 64-bit one's complement sum to 32 bits */
+static inline uint32_t tpkt_csum_fold64(uint64_t sum)
+{
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	return (uint32_t)sum;
+}
+
+
+/* Scalar kernels */
+
+static uint32_t
+tpkt_csum_inet_scalar(const uint8_t *data, size_t len, uint32_t sum)
+{
+	uint64_t acc = sum;
+	uint32_t w32;
+	uint16_t w16 = 0;
+
+	/* Summing 32-bit words is equivalent to summing 16-bit words
+	 * modulo 0xffff, regardless of the byte order */
+	for (; len >= 16; len -= 16, data += 16) {
+		memcpy(&w32, data, 4);
+		acc += w32;
+		memcpy(&w32, data + 4, 4);
+		acc += w32;
+		memcpy(&w32, data + 8, 4);
+		acc += w32;
+		memcpy(&w32, data + 12, 4);
+		acc += w32;
+	}
+	for (; len >= 4; len -= 4, data += 4) {
+		memcpy(&w32, data, 4);
+		acc += w32;
+	}
+	if (len >= 2) {
+		memcpy(&w16, data, 2);
+		acc += w16;
+		data += 2;
+		len -= 2;
+	}
+	if (len > 0) {
+		/* Pad the last byte with a zero byte */
+		w16 = 0;
+		memcpy(&w16, data, 1);
+		acc += w16;
+	}
+
+	return tpkt_csum_fold64(acc);
+}
+
+
+static uint32_t
+tpkt_crc32c_scalar(uint32_t crc, const uint8_t *data, size_t len)
+{
+	const uint32_t(*t)[256] = tpkt_crc32c_table;
+
+	for (; len >= 8; len -= 8, data += 8) {
+		crc ^= (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+		       ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^
+		      t[5][(crc >> 16) & 0xff] ^ t[4][crc >> 24] ^
+		      t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^
+		      t[0][data[7]];
+	}
+	for (; len > 0; len--, data++)
+		crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+
+	return crc;
+}
+
+
+#ifdef TPKT_CSUM_X86
+
+__attribute__((target("sse2"))) static uint32_t
+tpkt_csum_inet_sse2(const uint8_t *data, size_t len, uint32_t sum)
+{
+	uint64_t acc = sum;
+	size_t i, n;
+	uint32_t lanes[4];
+	__m128i mask = _mm_set1_epi32(0xffff);
+	__m128i a, v;
+
+	while (len >= 16) {
+		/* Each 32-bit lane accumulates at most 2 * 0xffff per
+		 * iteration: limit the iterations to avoid overflows */
+		n = len / 16;
+		if (n > 16384)
+			n = 16384;
+		a = _mm_setzero_si128();
+		for (i = 0; i < n; i++, data += 16) {
+			v = _mm_loadu_si128((const __m128i *)data);
+			a = _mm_add_epi32(a, _mm_and_si128(v, mask));
+			a = _mm_add_epi32(a, _mm_srli_epi32(v, 16));
+		}
+		len -= n * 16;
+		_mm_storeu_si128((__m128i *)lanes, a);
+		acc += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+
+	return tpkt_csum_inet_scalar(data, len, tpkt_csum_fold64(acc));
+}
+
+
+__attribute__((target("avx2"))) static uint32_t
+tpkt_csum_inet_avx2(const uint8_t *data, size_t len, uint32_t sum)
+{
+	uint64_t acc = sum;
+	size_t i, n;
+	uint32_t lanes[8];
+	__m256i mask = _mm256_set1_epi32(0xffff);
+	__m256i a, v;
+
+	while (len >= 32) {
+		/* Each 32-bit lane accumulates at most 2 * 0xffff per
+		 * iteration: limit the iterations to avoid overflows */
+		n = len / 32;
+		if (n > 16384)
+			n = 16384;
+		a = _mm256_setzero_si256();
+		for (i = 0; i < n; i++, data += 32) {
+			v = _mm256_loadu_si256((const __m256i *)data);
+			a = _mm256_add_epi32(a, _mm256_and_si256(v, mask));
+			a = _mm256_add_epi32(a, _mm256_srli_epi32(v, 16));
+		}
+		len -= n * 32;
+		_mm256_storeu_si256((__m256i *)lanes, a);
+		for (i = 0; i < 8; i++)
+			acc += lanes[i];
+	}
+
+	return tpkt_csum_inet_scalar(data, len, tpkt_csum_fold64(acc));
+}
+
+
+__attribute__((target("sse4.2"))) static uint32_t
+tpkt_crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len)
+{
+	uint32_t v32;
+#	ifdef __x86_64__
+	uint64_t c = crc, v;
+
+	for (; len >= 8; len -= 8, data += 8) {
+		memcpy(&v, data, 8);
+		c = _mm_crc32_u64(c, v);
+	}
+	crc = (uint32_t)c;
+#	endif /* __x86_64__ */
+
+	for (; len >= 4; len -= 4, data += 4) {
+		memcpy(&v32, data, 4);
+		crc = _mm_crc32_u32(crc, v32);
+	}
+	for (; len > 0; len--, data++)
+		crc = _mm_crc32_u8(crc, *data);
+
+	return crc;
+}
+
+#endif /* TPKT_CSUM_X86 */
+
+
+#ifdef TPKT_CSUM_NEON
+
+static uint32_t
+tpkt_csum_inet_neon(const uint8_t *data, size_t len, uint32_t sum)
+{
+	uint64_t acc = sum;
+	size_t i, n;
+	uint32x4_t a;
+
+	while (len >= 16) {
+		/* Each 32-bit lane accumulates at most 2 * 0xffff per
+		 * iteration: limit the iterations to avoid overflows */
+		n = len / 16;
+		if (n > 16384)
+			n = 16384;
+		a = vdupq_n_u32(0);
+		for (i = 0; i < n; i++, data += 16)
+			a = vpadalq_u16(a, vreinterpretq_u16_u8(vld1q_u8(data)));
+		len -= n * 16;
+		acc += vaddlvq_u32(a);
+	}
+
+	return tpkt_csum_inet_scalar(data, len, tpkt_csum_fold64(acc));
+}
+
+#endif /* TPKT_CSUM_NEON */
+
+
+#ifdef TPKT_CSUM_ARM_CRC
+
+static uint32_t
+tpkt_crc32c_armv8(uint32_t crc, const uint8_t *data, size_t len)
+{
+	uint64_t v;
+
+	for (; len >= 8; len -= 8, data += 8) {
+		memcpy(&v, data, 8);
+		crc = __crc32cd(crc, v);
+	}
+	for (; len > 0; len--, data++)
+		crc = __crc32cb(crc, *data);
+
+	return crc;
+}
+
+#endif /* TPKT_CSUM_ARM_CRC */
+
+
+static void tpkt_csum_select(enum tpkt_csum_impl impl)
+{
+	tpkt_csum_kernels.inet_name = "scalar";
+	tpkt_csum_kernels.inet = tpkt_csum_inet_scalar;
+	tpkt_csum_kernels.crc32c_name = "scalar";
+	tpkt_csum_kernels.crc32c = tpkt_crc32c_scalar;
+	if (impl == TPKT_CSUM_IMPL_SCALAR)
+		return;
+
+#ifdef TPKT_CSUM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		tpkt_csum_kernels.inet_name = "avx2";
+		tpkt_csum_kernels.inet = tpkt_csum_inet_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		tpkt_csum_kernels.inet_name = "sse2";
+		tpkt_csum_kernels.inet = tpkt_csum_inet_sse2;
+	}
+	if (__builtin_cpu_supports("sse4.2")) {
+		tpkt_csum_kernels.crc32c_name = "sse4.2";
+		tpkt_csum_kernels.crc32c = tpkt_crc32c_sse42;
+	}
+#endif /* TPKT_CSUM_X86 */
+
+#ifdef TPKT_CSUM_NEON
+	tpkt_csum_kernels.inet_name = "neon";
+	tpkt_csum_kernels.inet = tpkt_csum_inet_neon;
+#endif /* TPKT_CSUM_NEON */
+
+#ifdef TPKT_CSUM_ARM_CRC
+	tpkt_csum_kernels.crc32c_name = "armv8-crc";
+	tpkt_csum_kernels.crc32c = tpkt_crc32c_armv8;
+#endif /* TPKT_CSUM_ARM_CRC */
+}
+
+
+/* Multiply a and b modulo the CRC32C polynomial (reflected) */
+static uint32_t tpkt_crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31, p = 0;
+
+	while (1) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ TPKT_CRC32C_POLY : b >> 1;
+	}
+
+	return p;
+}
+
+
+static void tpkt_csum_init(void)
+{
+	unsigned int i, j;
+	uint32_t c, p;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (c >> 1) ^ TPKT_CRC32C_POLY : c >> 1;
+		tpkt_crc32c_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		c = tpkt_crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			c = (c >> 8) ^ tpkt_crc32c_table[0][c & 0xff];
+			tpkt_crc32c_table[j][i] = c;
+		}
+	}
+
+	/* x^1, then repeated squaring */
+	p = (uint32_t)1 << 30;
+	tpkt_crc32c_x2n_table[0] = p;
+	for (i = 1; i < 32; i++) {
+		p = tpkt_crc32c_multmodp(p, p);
+		tpkt_crc32c_x2n_table[i] = p;
+	}
+
+	tpkt_csum_select(TPKT_CSUM_IMPL_AUTO);
+}
+
+
+int tpkt_csum_set_impl(enum tpkt_csum_impl impl)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(impl != TPKT_CSUM_IMPL_AUTO &&
+					 impl != TPKT_CSUM_IMPL_SCALAR,
+				 EINVAL);
+
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	tpkt_csum_select(impl);
+
+	return 0;
+}
+
+
+const char *tpkt_csum_inet_get_impl_name(void)
+{
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	return tpkt_csum_kernels.inet_name;
+}
+
+
+const char *tpkt_crc32c_get_impl_name(void)
+{
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	return tpkt_csum_kernels.crc32c_name;
+}
+
+
+uint32_t tpkt_csum_inet_partial(const void *data, size_t len, uint32_t sum)
+{
+	if (len == 0)
+		return sum;
+
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	return tpkt_csum_kernels.inet(data, len, sum);
+}
+
+
+uint32_t tpkt_csum_inet_combine(uint32_t sum1, uint32_t sum2, size_t len1)
+{
+	if (len1 & 1) {
+		/* The second buffer starts at an odd offset:
+		 * swap the bytes of its sum */
+		sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+		sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+		sum2 = ((sum2 & 0xff) << 8) | (sum2 >> 8);
+	}
+
+	return tpkt_csum_add32(sum1, sum2);
+}
+
+
+uint16_t tpkt_csum_inet_fold(uint32_t sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	return (uint16_t)~sum;
+}
+
+
+uint16_t tpkt_csum_inet(const void *data, size_t len)
+{
+	return tpkt_csum_inet_fold(tpkt_csum_inet_partial(data, len, 0));
+}
+
+
+uint16_t
+tpkt_csum_inet_update16(uint16_t csum, uint16_t old_val, uint16_t new_val)
+{
+	/* RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m') */
+	uint32_t sum = (uint16_t)~csum;
+
+	sum += (uint16_t)~old_val;
+	sum += new_val;
+
+	return tpkt_csum_inet_fold(sum);
+}
+
+
+uint16_t tpkt_csum_inet_push(uint16_t csum, const void *hdr, size_t hdr_len)
+{
+	uint32_t sum;
+
+	sum = tpkt_csum_inet_partial(hdr, hdr_len, 0);
+
+	return tpkt_csum_inet_fold(
+		tpkt_csum_inet_combine(sum, (uint16_t)~csum, hdr_len));
+}
+
+
+int tpkt_csum_inet_packet(struct tpkt_packet *pkt, size_t offset, uint16_t *csum)
+{
+	int res;
+	const uint8_t *data;
+	size_t len;
+
+	ULOG_ERRNO_RETURN_ERR_IF(csum == NULL, EINVAL);
+
+	res = tpkt_get_cdata(pkt, (const void **)&data, &len, NULL);
+	if (res < 0)
+		return res;
+	ULOG_ERRNO_RETURN_ERR_IF(offset > len, EINVAL);
+
+	*csum = tpkt_csum_inet(data + offset, len - offset);
+
+	return 0;
+}
+
+
+int tpkt_csum_inet_segments(struct tpkt_packet *const *pkts,
+			    unsigned int count,
+			    uint16_t *csum)
+{
+	int res;
+	unsigned int i;
+	const void *data;
+	size_t len, total = 0;
+	uint32_t sum = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pkts == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(csum == NULL, EINVAL);
+
+	for (i = 0; i < count; i++) {
+		res = tpkt_get_cdata(pkts[i], &data, &len, NULL);
+		if (res < 0)
+			return res;
+		sum = tpkt_csum_inet_combine(
+			sum, tpkt_csum_inet_partial(data, len, 0), total);
+		total += len;
+	}
+
+	*csum = tpkt_csum_inet_fold(sum);
+
+	return 0;
+}
+
+
+int tpkt_csum_inet_list(struct tpkt_list *list,
+			size_t offset,
+			uint16_t *csums,
+			size_t count)
+{
+	int res;
+	size_t i = 0;
+	const uint8_t *data;
+	size_t len;
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(csums == NULL && list->count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count < list->count, ENOBUFS);
+
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	list_walk_entry_forward(&list->packets, pkt, node)
+	{
+		res = tpkt_get_cdata(pkt, (const void **)&data, &len, NULL);
+		if (res < 0)
+			return res;
+		ULOG_ERRNO_RETURN_ERR_IF(offset > len, EINVAL);
+		csums[i++] = tpkt_csum_inet_fold(tpkt_csum_kernels.inet(
+			data + offset, len - offset, 0));
+	}
+
+	return (int)i;
+}
+
+
+uint32_t tpkt_crc32c(uint32_t crc, const void *data, size_t len)
+{
+	if (len == 0)
+		return crc;
+
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	return ~tpkt_csum_kernels.crc32c(~crc, data, len);
+}
+
+
+uint32_t tpkt_crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	unsigned int k = 3;
+	uint32_t p = (uint32_t)1 << 31;
+	uint64_t n = len2;
+
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	/* p = x^(8 * len2) modulo the polynomial */
+	while (n) {
+		if (n & 1)
+			p = tpkt_crc32c_multmodp(tpkt_crc32c_x2n_table[k & 31],
+						 p);
+		n >>= 1;
+		k++;
+	}
+
+	return tpkt_crc32c_multmodp(p, crc1) ^ crc2;
+}
+
+
+int tpkt_crc32c_packet(struct tpkt_packet *pkt, size_t offset, uint32_t *crc)
+{
+	int res;
+	const uint8_t *data;
+	size_t len;
+
+	ULOG_ERRNO_RETURN_ERR_IF(crc == NULL, EINVAL);
+
+	res = tpkt_get_cdata(pkt, (const void **)&data, &len, NULL);
+	if (res < 0)
+		return res;
+	ULOG_ERRNO_RETURN_ERR_IF(offset > len, EINVAL);
+
+	*crc = tpkt_crc32c(0, data + offset, len - offset);
+
+	return 0;
+}
+
+
+int tpkt_crc32c_segments(struct tpkt_packet *const *pkts,
+			 unsigned int count,
+			 uint32_t *crc)
+{
+	int res;
+	unsigned int i;
+	const void *data;
+	size_t len;
+	uint32_t c = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pkts == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(crc == NULL, EINVAL);
+
+	for (i = 0; i < count; i++) {
+		res = tpkt_get_cdata(pkts[i], &data, &len, NULL);
+		if (res < 0)
+			return res;
+		c = tpkt_crc32c(c, data, len);
+	}
+
+	*crc = c;
+
+	return 0;
+}
+
+
+int tpkt_crc32c_list(struct tpkt_list *list,
+		     size_t offset,
+		     uint32_t *crcs,
+		     size_t count)
+{
+	int res;
+	size_t i = 0;
+	const uint8_t *data;
+	size_t len;
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(crcs == NULL && list->count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count < list->count, ENOBUFS);
+
+	pthread_once(&tpkt_csum_once, tpkt_csum_init);
+
+	list_walk_entry_forward(&list->packets, pkt, node)
+	{
+		res = tpkt_get_cdata(pkt, (const void **)&data, &len, NULL);
+		if (res < 0)
+			return res;
+		ULOG_ERRNO_RETURN_ERR_IF(offset > len, EINVAL);
+		crcs[i++] = ~tpkt_csum_kernels.crc32c(
+			0xffffffff, data + offset, len - offset);
+	}
+
+	return (int)i;
+}
@@ -0,0 +1,479 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include "tpkt_probes.h"
+#include <transport-packet/tpkt_demux.h>
+
+
+#define TPKT_DEMUX_DEFAULT_SIZE_HINT 64
+
+/* Marker of a removed entry in the hash table slots */
+#define TPKT_DEMUX_TOMBSTONE ((struct tpkt_demux_flow *)1)
+
+
+struct tpkt_demux_flow {
+	struct tpkt_addr_key key;
+	uint32_t hash;
+	void *userdata;
+	struct tpkt_list *list;
+
+	/* Flows list (active or retired) */
+	struct list_node node;
+};
+
+
+/* Open addressing hash table with linear probing; slots are read
+ * without lock and only modified with the demultiplexer mutex held */
+struct tpkt_demux_table {
+	/* Slot count (power of 2) */
+	size_t size;
+	size_t mask;
+
+	/* Number of used slots (flows and tombstones) */
+	size_t used;
+
+	/* Retired tables list */
+	struct tpkt_demux_table *next;
+
+	struct tpkt_demux_flow *slots[];
+};
+
+
+struct tpkt_demux {
+	tpkt_demux_key_t key_fn;
+	void *key_userdata;
+
+	/* Current table (read with acquire semantics) */
+	struct tpkt_demux_table *table;
+
+	/* Retired tables, freed on reclaim */
+	struct tpkt_demux_table *retired_tables;
+
+	/* Active and retired flows */
+	struct list_node flows;
+	struct list_node retired_flows;
+	size_t flow_count;
+
+	pthread_mutex_t mutex;
+};
+
+
+static struct tpkt_demux_table *tpkt_demux_table_new(size_t size)
+{
+	struct tpkt_demux_table *table;
+
+	table = calloc(1, sizeof(*table) + size * sizeof(table->slots[0]));
+	if (table == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return NULL;
+	}
+	table->size = size;
+	table->mask = size - 1;
+
+	return table;
+}
+
+
+/* Insert a flow in a table that is not yet published or with the
+ * mutex held; the table must have at least one free slot */
+static void tpkt_demux_table_insert(struct tpkt_demux_table *table,
+				    struct tpkt_demux_flow *flow)
+{
+	size_t i = flow->hash & table->mask;
+	struct tpkt_demux_flow *slot;
+
+	for (;;) {
+		slot = table->slots[i];
+		if (slot == NULL || slot == TPKT_DEMUX_TOMBSTONE)
+			break;
+		i = (i + 1) & table->mask;
+	}
+
+	if (slot == NULL)
+		table->used++;
+	__atomic_store_n(&table->slots[i], flow, __ATOMIC_RELEASE);
+}
+
+
+static struct tpkt_demux_flow *
+tpkt_demux_table_lookup(struct tpkt_demux_table *table,
+			const struct tpkt_addr_key *key,
+			uint32_t hash)
+{
+	size_t i = hash & table->mask;
+	size_t n;
+	struct tpkt_demux_flow *slot;
+
+	for (n = 0; n < table->size; n++) {
+		slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+		if (slot == NULL)
+			return NULL;
+		if (slot != TPKT_DEMUX_TOMBSTONE && slot->hash == hash &&
+		    tpkt_addr_key_equal(&slot->key, key))
+			return slot;
+		i = (i + 1) & table->mask;
+	}
+
+	return NULL;
+}
+
+
+/* Make sure the table has room for one more flow, keeping the load
+ * factor (including tombstones) below 3/4; the new table is published
+ * and the old one retired (mutex held) */
+static int tpkt_demux_table_reserve(struct tpkt_demux *demux)
+{
+	size_t size;
+	struct tpkt_demux_flow *flow;
+	struct tpkt_demux_table *table = demux->table;
+	struct tpkt_demux_table *new_table;
+
+	if ((table->used + 1) * 4 <= table->size * 3)
+		return 0;
+
+	size = table->size;
+	while ((demux->flow_count + 1) * 2 > size)
+		size *= 2;
+
+	new_table = tpkt_demux_table_new(size);
+	if (new_table == NULL)
+		return -ENOMEM;
+	list_walk_entry_forward(&demux->flows, flow, node)
+	{
+		tpkt_demux_table_insert(new_table, flow);
+	}
+
+	__atomic_store_n(&demux->table, new_table, __ATOMIC_RELEASE);
+	table->next = demux->retired_tables;
+	demux->retired_tables = table;
+
+	return 0;
+}
+
+
+static void tpkt_demux_flow_destroy(struct tpkt_demux_flow *flow)
+{
+	if (list_node_is_ref(&flow->node))
+		list_del(&flow->node);
+	tpkt_list_destroy(flow->list);
+	free(flow);
+}
+
+
+int tpkt_demux_new(const struct tpkt_demux_cfg *cfg,
+		   struct tpkt_demux **ret_obj)
+{
+	int res;
+	size_t size = 8;
+	size_t size_hint = TPKT_DEMUX_DEFAULT_SIZE_HINT;
+	struct tpkt_demux *demux;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	demux = calloc(1, sizeof(*demux));
+	if (demux == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	list_init(&demux->flows);
+	list_init(&demux->retired_flows);
+	pthread_mutex_init(&demux->mutex, NULL);
+
+	if (cfg != NULL) {
+		demux->key_fn = cfg->key_fn;
+		demux->key_userdata = cfg->key_userdata;
+		if (cfg->size_hint != 0)
+			size_hint = cfg->size_hint;
+	}
+	while (size < size_hint * 2)
+		size *= 2;
+
+	demux->table = tpkt_demux_table_new(size);
+	if (demux->table == NULL) {
+		res = -ENOMEM;
+		goto error;
+	}
+
+	*ret_obj = demux;
+	return 0;
+
+error:
+	tpkt_demux_destroy(demux);
+	return res;
+}
+
+
+int tpkt_demux_destroy(struct tpkt_demux *demux)
+{
+	struct tpkt_demux_flow *flow, *tmp;
+
+	if (demux == NULL)
+		return 0;
+
+	list_walk_entry_forward_safe(&demux->flows, flow, tmp, node)
+	{
+		tpkt_demux_flow_destroy(flow);
+	}
+	tpkt_demux_reclaim(demux);
+	free(demux->table);
+	pthread_mutex_destroy(&demux->mutex);
+	free(demux);
+
+	return 0;
+}
+
+
+int tpkt_demux_add_flow(struct tpkt_demux *demux,
+			const struct sockaddr *addr,
+			uint32_t key,
+			void *userdata,
+			struct tpkt_demux_flow **ret_obj)
+{
+	int res;
+	struct tpkt_demux_flow *flow;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(addr == NULL, EINVAL);
+
+	flow = calloc(1, sizeof(*flow));
+	if (flow == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	list_node_unref(&flow->node);
+	flow->userdata = userdata;
+
+	res = tpkt_addr_key_set(&flow->key, addr, key);
+	if (res < 0) {
+		ULOG_ERRNO("tpkt_addr_key_set", -res);
+		goto error;
+	}
+	flow->hash = tpkt_addr_key_hash(&flow->key);
+
+	res = tpkt_list_new(&flow->list);
+	if (res < 0)
+		goto error;
+
+	pthread_mutex_lock(&demux->mutex);
+	if (tpkt_demux_table_lookup(demux->table, &flow->key, flow->hash) !=
+	    NULL) {
+		pthread_mutex_unlock(&demux->mutex);
+		res = -EEXIST;
+		goto error;
+	}
+	res = tpkt_demux_table_reserve(demux);
+	if (res < 0) {
+		pthread_mutex_unlock(&demux->mutex);
+		goto error;
+	}
+	list_add_before(&demux->flows, &flow->node);
+	demux->flow_count++;
+	tpkt_demux_table_insert(demux->table, flow);
+	pthread_mutex_unlock(&demux->mutex);
+
+	if (ret_obj != NULL)
+		*ret_obj = flow;
+	return 0;
+
+error:
+	tpkt_demux_flow_destroy(flow);
+	return res;
+}
+
+
+int tpkt_demux_remove_flow(struct tpkt_demux *demux,
+			   struct tpkt_demux_flow *flow)
+{
+	size_t i;
+	struct tpkt_demux_table *table;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(flow == NULL, EINVAL);
+
+	pthread_mutex_lock(&demux->mutex);
+	table = demux->table;
+	i = flow->hash & table->mask;
+	while (table->slots[i] != NULL && table->slots[i] != flow)
+		i = (i + 1) & table->mask;
+	if (table->slots[i] != flow) {
+		pthread_mutex_unlock(&demux->mutex);
+		ULOG_ERRNO_RETURN_ERR_IF(1, ENOENT);
+	}
+	__atomic_store_n(
+		&table->slots[i], TPKT_DEMUX_TOMBSTONE, __ATOMIC_RELEASE);
+	list_del(&flow->node);
+	list_add_before(&demux->retired_flows, &flow->node);
+	demux->flow_count--;
+	pthread_mutex_unlock(&demux->mutex);
+
+	return 0;
+}
+
+
+int tpkt_demux_reclaim(struct tpkt_demux *demux)
+{
+	struct tpkt_demux_flow *flow, *tmp;
+	struct tpkt_demux_table *table;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+
+	pthread_mutex_lock(&demux->mutex);
+	list_walk_entry_forward_safe(&demux->retired_flows, flow, tmp, node)
+	{
+		tpkt_demux_flow_destroy(flow);
+	}
+	while (demux->retired_tables != NULL) {
+		table = demux->retired_tables;
+		demux->retired_tables = table->next;
+		free(table);
+	}
+	pthread_mutex_unlock(&demux->mutex);
+
+	return 0;
+}
+
+
+int tpkt_demux_get_flow_count(struct tpkt_demux *demux)
+{
+	size_t count;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+
+	pthread_mutex_lock(&demux->mutex);
+	count = demux->flow_count;
+	pthread_mutex_unlock(&demux->mutex);
+
+	return (int)count;
+}
+
+
+struct tpkt_demux_flow *tpkt_demux_lookup(struct tpkt_demux *demux,
+					  const struct sockaddr *addr,
+					  uint32_t key)
+{
+	int res;
+	struct tpkt_addr_key k;
+
+	ULOG_ERRNO_RETURN_VAL_IF(demux == NULL, EINVAL, NULL);
+	ULOG_ERRNO_RETURN_VAL_IF(addr == NULL, EINVAL, NULL);
+
+	res = tpkt_addr_key_set(&k, addr, key);
+	if (res < 0)
+		return NULL;
+
+	return tpkt_demux_table_lookup(
+		__atomic_load_n(&demux->table, __ATOMIC_ACQUIRE),
+		&k,
+		tpkt_addr_key_hash(&k));
+}
+
+
+static struct tpkt_demux_flow *
+tpkt_demux_lookup_packet_internal(struct tpkt_demux *demux,
+				  struct tpkt_demux_table *table,
+				  struct tpkt_packet *pkt)
+{
+	int res;
+	uint32_t ext = 0;
+	struct tpkt_addr_key k;
+
+	if (demux->key_fn != NULL) {
+		res = demux->key_fn(pkt, &ext, demux->key_userdata);
+		if (res < 0)
+			return NULL;
+	}
+
+	res = tpkt_addr_key_set(&k, (const struct sockaddr *)&pkt->addr, ext);
+	if (res < 0)
+		return NULL;
+
+	return tpkt_demux_table_lookup(table, &k, tpkt_addr_key_hash(&k));
+}
+
+
+struct tpkt_demux_flow *tpkt_demux_lookup_packet(struct tpkt_demux *demux,
+						 struct tpkt_packet *pkt)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(demux == NULL, EINVAL, NULL);
+	ULOG_ERRNO_RETURN_VAL_IF(pkt == NULL, EINVAL, NULL);
+
+	return tpkt_demux_lookup_packet_internal(
+		demux, __atomic_load_n(&demux->table, __ATOMIC_ACQUIRE), pkt);
+}
+
+
+int tpkt_demux_process(struct tpkt_demux *demux, struct tpkt_list *list)
+{
+	int matched = 0;
+	struct tpkt_packet *pkt, *tmp;
+	struct tpkt_demux_flow *flow;
+	struct tpkt_demux_table *table;
+
+	ULOG_ERRNO_RETURN_ERR_IF(demux == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	/* Use the same table for the whole batch */
+	table = __atomic_load_n(&demux->table, __ATOMIC_ACQUIRE);
+
+	list_walk_entry_forward_safe(&list->packets, pkt, tmp, node)
+	{
+		flow = tpkt_demux_lookup_packet_internal(demux, table, pkt);
+		if (flow == NULL)
+			continue;
+
+		/* Move the packet (and its list reference) to the flow list
+		 * without touching the reference count */
+		list_del(&pkt->node);
+		list->count--;
+		tpkt_stats_inc(TPKT_STAT_LIST_REMOVE);
+		TPKT_TRACE_DEQUEUE(list, pkt);
+		TPKT_PROBE_PACKET_ARG(list_remove, list, pkt);
+		list_add_before(&flow->list->packets, &pkt->node);
+		tpkt_list_count_add(flow->list, pkt);
+		matched++;
+	}
+
+	return matched;
+}
+
+
+struct tpkt_list *tpkt_demux_flow_get_list(struct tpkt_demux_flow *flow)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(flow == NULL, EINVAL, NULL);
+
+	return flow->list;
+}
+
+
+void *tpkt_demux_flow_get_userdata(struct tpkt_demux_flow *flow)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(flow == NULL, EINVAL, NULL);
+
+	return flow->userdata;
+}
@@ -0,0 +1,944 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_fec.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define TPKT_FEC_X86
+#	include <immintrin.h>
+#elif defined(__aarch64__)
+#	define TPKT_FEC_NEON
+#	include <arm_neon.h>
+#endif
+
+
+/* GF(2^8) primitive polynomial x^8 + x^4 + x^3 + x^2 + 1 */
+#define TPKT_FEC_GF_POLY 0x11d
+
+/* Size of the length field protected along with the packet data */
+#define TPKT_FEC_LEN_SIZE 2
+
+
+/* Multiplication by a constant: products of the low and high nibbles */
+struct tpkt_fec_mul_tbl {
+	uint8_t lo[16];
+	uint8_t hi[16];
+};
+
+
+/* Computation kernels */
+struct tpkt_fec_kernels {
+	const char *name;
+
+	/* dst ^= src */
+	void (*xor)(uint8_t *dst, const uint8_t *src, size_t len);
+
+	/* dst ^= c * src */
+	void (*mul_add)(uint8_t *dst,
+			const uint8_t *src,
+			size_t len,
+			const struct tpkt_fec_mul_tbl *tbl);
+};
+
+
+static uint8_t tpkt_fec_gf_exp[512];
+static uint8_t tpkt_fec_gf_log[256];
+static const struct tpkt_fec_kernels *tpkt_fec_kernels;
+static pthread_once_t tpkt_fec_once = PTHREAD_ONCE_INIT;
+
+
+static inline uint8_t tpkt_fec_gf_mul(uint8_t a, uint8_t b)
+{
+	if (a == 0 || b == 0)
+		return 0;
+	return tpkt_fec_gf_exp[tpkt_fec_gf_log[a] + tpkt_fec_gf_log[b]];
+}
+
+
+static inline uint8_t tpkt_fec_gf_inv(uint8_t a)
+{
+	return tpkt_fec_gf_exp[255 - tpkt_fec_gf_log[a]];
+}
+
+
+static void tpkt_fec_mul_tbl_init(struct tpkt_fec_mul_tbl *tbl, uint8_t c)
+{
+	unsigned int i;
+
+	for (i = 0; i < 16; i++) {
+		tbl->lo[i] = tpkt_fec_gf_mul(c, i);
+		tbl->hi[i] = tpkt_fec_gf_mul(c, i << 4);
+	}
+}
+
+
+/* Cauchy matrix coefficient for repair packet r and source packet j:
+ * 1 / (x_r + y_j) with x_r = k + r and y_j = j */
+static inline uint8_t
+tpkt_fec_rs_coef(unsigned int k, unsigned int r, unsigned int j)
+{
+	return tpkt_fec_gf_inv((uint8_t)((k + r) ^ j));
+}
+
+
+/* Scalar kernels */
+
+static void tpkt_fec_xor_scalar(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	uint64_t d, s;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&d, dst + i, 8);
+		memcpy(&s, src + i, 8);
+		d ^= s;
+		memcpy(dst + i, &d, 8);
+	}
+	for (; i < len; i++)
+		dst[i] ^= src[i];
+}
+
+
+static void tpkt_fec_mul_add_scalar(uint8_t *dst,
+				    const uint8_t *src,
+				    size_t len,
+				    const struct tpkt_fec_mul_tbl *tbl)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] ^= tbl->lo[src[i] & 0xf] ^ tbl->hi[src[i] >> 4];
+}
+
+
+static const struct tpkt_fec_kernels tpkt_fec_kernels_scalar = {
+	.name = "scalar",
+	.xor = tpkt_fec_xor_scalar,
+	.mul_add = tpkt_fec_mul_add_scalar,
+};
+
+
+#ifdef TPKT_FEC_X86
+
+__attribute__((target("sse2"))) static void
+tpkt_fec_xor_sse2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	__m128i d, s;
+
+	for (; i + 16 <= len; i += 16) {
+		d = _mm_loadu_si128((const __m128i *)(dst + i));
+		s = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, s));
+	}
+	tpkt_fec_xor_scalar(dst + i, src + i, len - i);
+}
+
+
+__attribute__((target("ssse3"))) static void
+tpkt_fec_mul_add_ssse3(uint8_t *dst,
+		       const uint8_t *src,
+		       size_t len,
+		       const struct tpkt_fec_mul_tbl *tbl)
+{
+	size_t i = 0;
+	__m128i lo = _mm_loadu_si128((const __m128i *)tbl->lo);
+	__m128i hi = _mm_loadu_si128((const __m128i *)tbl->hi);
+	__m128i mask = _mm_set1_epi8(0x0f);
+	__m128i s, d, l, h;
+
+	for (; i + 16 <= len; i += 16) {
+		s = _mm_loadu_si128((const __m128i *)(src + i));
+		d = _mm_loadu_si128((const __m128i *)(dst + i));
+		l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+		h = _mm_shuffle_epi8(
+			hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+		d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+		_mm_storeu_si128((__m128i *)(dst + i), d);
+	}
+	tpkt_fec_mul_add_scalar(dst + i, src + i, len - i, tbl);
+}
+
+
+__attribute__((target("avx2"))) static void
+tpkt_fec_xor_avx2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	__m256i d, s;
+
+	for (; i + 32 <= len; i += 32) {
+		d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		s = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_xor_si256(d, s));
+	}
+	tpkt_fec_xor_scalar(dst + i, src + i, len - i);
+}
+
+
+__attribute__((target("avx2"))) static void
+tpkt_fec_mul_add_avx2(uint8_t *dst,
+		      const uint8_t *src,
+		      size_t len,
+		      const struct tpkt_fec_mul_tbl *tbl)
+{
+	size_t i = 0;
+	__m256i lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)tbl->lo));
+	__m256i hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)tbl->hi));
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	__m256i s, d, l, h;
+
+	for (; i + 32 <= len; i += 32) {
+		s = _mm256_loadu_si256((const __m256i *)(src + i));
+		d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		l = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+		h = _mm256_shuffle_epi8(
+			hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+		d = _mm256_xor_si256(d, _mm256_xor_si256(l, h));
+		_mm256_storeu_si256((__m256i *)(dst + i), d);
+	}
+	/* Use VEX-encoded 128-bit instructions for the tail to avoid
+	 * AVX-SSE transition penalties */
+	for (; i + 16 <= len; i += 16) {
+		__m128i s128 = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i d128 = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i m128 = _mm256_castsi256_si128(mask);
+		d128 = _mm_xor_si128(
+			d128,
+			_mm_xor_si128(
+				_mm_shuffle_epi8(_mm256_castsi256_si128(lo),
+						 _mm_and_si128(s128, m128)),
+				_mm_shuffle_epi8(
+					_mm256_castsi256_si128(hi),
+					_mm_and_si128(_mm_srli_epi64(s128, 4),
+						      m128))));
+		_mm_storeu_si128((__m128i *)(dst + i), d128);
+	}
+	tpkt_fec_mul_add_scalar(dst + i, src + i, len - i, tbl);
+}
+
+
+static const struct tpkt_fec_kernels tpkt_fec_kernels_ssse3 = {
+	.name = "ssse3",
+	.xor = tpkt_fec_xor_sse2,
+	.mul_add = tpkt_fec_mul_add_ssse3,
+};
+
+
+static const struct tpkt_fec_kernels tpkt_fec_kernels_avx2 = {
+	.name = "avx2",
+	.xor = tpkt_fec_xor_avx2,
+	.mul_add = tpkt_fec_mul_add_avx2,
+};
+
+#endif /* TPKT_FEC_X86 */
+
+
+#ifdef TPKT_FEC_NEON
+
+static void tpkt_fec_xor_neon(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+		vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+	tpkt_fec_xor_scalar(dst + i, src + i, len - i);
+}
+
+
+static void tpkt_fec_mul_add_neon(uint8_t *dst,
+				  const uint8_t *src,
+				  size_t len,
+				  const struct tpkt_fec_mul_tbl *tbl)
+{
+	size_t i = 0;
+	uint8x16_t lo = vld1q_u8(tbl->lo);
+	uint8x16_t hi = vld1q_u8(tbl->hi);
+	uint8x16_t mask = vdupq_n_u8(0x0f);
+	uint8x16_t s, p;
+
+	for (; i + 16 <= len; i += 16) {
+		s = vld1q_u8(src + i);
+		p = veorq_u8(vqtbl1q_u8(lo, vandq_u8(s, mask)),
+			     vqtbl1q_u8(hi, vshrq_n_u8(s, 4)));
+		vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+	}
+	tpkt_fec_mul_add_scalar(dst + i, src + i, len - i, tbl);
+}
+
+
+static const struct tpkt_fec_kernels tpkt_fec_kernels_neon = {
+	.name = "neon",
+	.xor = tpkt_fec_xor_neon,
+	.mul_add = tpkt_fec_mul_add_neon,
+};
+
+#endif /* TPKT_FEC_NEON */
+
+
+static const struct tpkt_fec_kernels *
+tpkt_fec_get_kernels(enum tpkt_fec_impl impl)
+{
+#ifdef TPKT_FEC_X86
+	__builtin_cpu_init();
+#endif /* TPKT_FEC_X86 */
+
+	switch (impl) {
+	case TPKT_FEC_IMPL_AUTO:
+#ifdef TPKT_FEC_X86
+		if (__builtin_cpu_supports("avx2"))
+			return &tpkt_fec_kernels_avx2;
+		if (__builtin_cpu_supports("ssse3"))
+			return &tpkt_fec_kernels_ssse3;
+#endif /* TPKT_FEC_X86 */
+#ifdef TPKT_FEC_NEON
+		return &tpkt_fec_kernels_neon;
+#endif /* TPKT_FEC_NEON */
+		return &tpkt_fec_kernels_scalar;
+	case TPKT_FEC_IMPL_SCALAR:
+		return &tpkt_fec_kernels_scalar;
+#ifdef TPKT_FEC_X86
+	case TPKT_FEC_IMPL_SSSE3:
+		if (__builtin_cpu_supports("ssse3"))
+			return &tpkt_fec_kernels_ssse3;
+		return NULL;
+	case TPKT_FEC_IMPL_AVX2:
+		if (__builtin_cpu_supports("avx2"))
+			return &tpkt_fec_kernels_avx2;
+		return NULL;
+#endif /* TPKT_FEC_X86 */
+#ifdef TPKT_FEC_NEON
+	case TPKT_FEC_IMPL_NEON:
+		return &tpkt_fec_kernels_neon;
+#endif /* TPKT_FEC_NEON */
+	default:
+		return NULL;
+	}
+}
+
+
+static void tpkt_fec_init(void)
+{
+	unsigned int i, x = 1;
+
+	for (i = 0; i < 255; i++) {
+		tpkt_fec_gf_exp[i] = x;
+		tpkt_fec_gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= TPKT_FEC_GF_POLY;
+	}
+	/* Duplicate the table to avoid a modulo in the multiplication */
+	for (i = 255; i < 512; i++)
+		tpkt_fec_gf_exp[i] = tpkt_fec_gf_exp[i - 255];
+
+	tpkt_fec_kernels = tpkt_fec_get_kernels(TPKT_FEC_IMPL_AUTO);
+}
+
+
+int tpkt_fec_set_impl(enum tpkt_fec_impl impl)
+{
+	const struct tpkt_fec_kernels *kernels;
+
+	pthread_once(&tpkt_fec_once, tpkt_fec_init);
+
+	kernels = tpkt_fec_get_kernels(impl);
+	if (kernels == NULL)
+		return -ENOTSUP;
+	tpkt_fec_kernels = kernels;
+
+	return 0;
+}
+
+
+const char *tpkt_fec_get_impl_name(void)
+{
+	pthread_once(&tpkt_fec_once, tpkt_fec_init);
+
+	return tpkt_fec_kernels->name;
+}
+
+
+/* dst ^= c * src */
+static void
+tpkt_fec_mul_add(uint8_t *dst, const uint8_t *src, size_t len, uint8_t c)
+{
+	struct tpkt_fec_mul_tbl tbl;
+
+	if (c == 0 || len == 0)
+		return;
+	if (c == 1) {
+		tpkt_fec_kernels->xor(dst, src, len);
+		return;
+	}
+	tpkt_fec_mul_tbl_init(&tbl, c);
+	tpkt_fec_kernels->mul_add(dst, src, len, &tbl);
+}
+
+
+/* Get a packet with a data capacity of at least cap bytes; the data
+ * pointer is returned through the data parameter */
+static int tpkt_fec_alloc(struct tpkt_pool *pool,
+			  size_t cap,
+			  struct tpkt_packet **ret_obj,
+			  uint8_t **data)
+{
+	int res;
+	size_t pkt_cap = 0;
+	struct tpkt_packet *pkt;
+
+	if (pool != NULL)
+		res = tpkt_pool_get(pool, &pkt);
+	else
+		res = tpkt_new(cap, &pkt);
+	if (res < 0)
+		return res;
+
+	res = tpkt_get_data(pkt, (void **)data, NULL, &pkt_cap);
+	if (res < 0)
+		goto error;
+	if (pkt_cap < cap) {
+		res = -ENOBUFS;
+		ULOGE("%s: packet capacity %zu < %zu", __func__, pkt_cap, cap);
+		goto error;
+	}
+
+	*ret_obj = pkt;
+	return 0;
+
+error:
+	tpkt_unref(pkt);
+	return res;
+}
+
+
+/* Get the source packets data and the longest data length */
+static int tpkt_fec_get_src(struct tpkt_packet *const *src,
+			    unsigned int count,
+			    const uint8_t **data,
+			    size_t *len,
+			    size_t *max_len)
+{
+	int res;
+	unsigned int i;
+
+	*max_len = 0;
+	for (i = 0; i < count; i++) {
+		if (src[i] == NULL) {
+			data[i] = NULL;
+			len[i] = 0;
+			continue;
+		}
+		res = tpkt_get_cdata(
+			src[i], (const void **)&data[i], &len[i], NULL);
+		if (res < 0)
+			return res;
+		ULOG_ERRNO_RETURN_ERR_IF(len[i] > UINT16_MAX, E2BIG);
+		if (len[i] > *max_len)
+			*max_len = len[i];
+	}
+
+	return 0;
+}
+
+
+static void tpkt_fec_set_metadata(struct tpkt_packet *pkt,
+				  struct tpkt_packet *ref)
+{
+	pkt->addr = ref->addr;
+	pkt->timestamp = ref->timestamp;
+	pkt->priority = ref->priority;
+}
+
+
+int tpkt_fec_xor_encode(struct tpkt_packet *const *src,
+			unsigned int count,
+			struct tpkt_pool *pool,
+			struct tpkt_packet **ret_obj)
+{
+	int res;
+	unsigned int i;
+	size_t max_len, repair_len;
+	const uint8_t **data = NULL;
+	size_t *len = NULL;
+	uint8_t *out;
+	struct tpkt_packet *repair = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	for (i = 0; i < count; i++)
+		ULOG_ERRNO_RETURN_ERR_IF(src[i] == NULL, EINVAL);
+
+	pthread_once(&tpkt_fec_once, tpkt_fec_init);
+
+	data = calloc(count, sizeof(*data));
+	len = calloc(count, sizeof(*len));
+	if (data == NULL || len == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto out;
+	}
+	res = tpkt_fec_get_src(src, count, data, len, &max_len);
+	if (res < 0)
+		goto out;
+	repair_len = TPKT_FEC_LEN_SIZE + max_len;
+
+	res = tpkt_fec_alloc(pool, repair_len, &repair, &out);
+	if (res < 0)
+		goto out;
+	memset(out, 0, repair_len);
+	for (i = 0; i < count; i++) {
+		out[0] ^= len[i] >> 8;
+		out[1] ^= len[i] & 0xff;
+		tpkt_fec_kernels->xor(out + TPKT_FEC_LEN_SIZE, data[i], len[i]);
+	}
+	res = tpkt_set_len(repair, repair_len);
+	if (res < 0)
+		goto out;
+	tpkt_fec_set_metadata(repair, src[0]);
+
+	*ret_obj = repair;
+	repair = NULL;
+
+out:
+	tpkt_unref(repair);
+	free(data);
+	free(len);
+	return res;
+}
+
+
+int tpkt_fec_xor_decode(struct tpkt_packet **src,
+			unsigned int count,
+			struct tpkt_packet *repair,
+			struct tpkt_pool *pool)
+{
+	int res;
+	unsigned int i, missing = count;
+	size_t max_len, repair_len, out_len;
+	const uint8_t *repair_data;
+	const uint8_t **data = NULL;
+	size_t *len = NULL;
+	uint8_t *out;
+	struct tpkt_packet *pkt = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(repair == NULL, EINVAL);
+	for (i = 0; i < count; i++) {
+		if (src[i] != NULL)
+			continue;
+		ULOG_ERRNO_RETURN_ERR_IF(missing != count, EPROTO);
+		missing = i;
+	}
+	ULOG_ERRNO_RETURN_ERR_IF(missing == count, EINVAL);
+
+	pthread_once(&tpkt_fec_once, tpkt_fec_init);
+
+	res = tpkt_get_cdata(
+		repair, (const void **)&repair_data, &repair_len, NULL);
+	if (res < 0)
+		return res;
+	ULOG_ERRNO_RETURN_ERR_IF(repair_len < TPKT_FEC_LEN_SIZE, EPROTO);
+
+	data = calloc(count, sizeof(*data));
+	len = calloc(count, sizeof(*len));
+	if (data == NULL || len == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto out;
+	}
+	res = tpkt_fec_get_src(src, count, data, len, &max_len);
+	if (res < 0)
+		goto out;
+	if (TPKT_FEC_LEN_SIZE + max_len > repair_len) {
+		res = -EPROTO;
+		ULOGE("%s: source packet longer than repair packet", __func__);
+		goto out;
+	}
+
+	/* Recover the length, then the data */
+	out_len = (repair_data[0] << 8) | repair_data[1];
+	for (i = 0; i < count; i++)
+		out_len ^= len[i];
+	if (TPKT_FEC_LEN_SIZE + out_len > repair_len) {
+		res = -EPROTO;
+		ULOGE("%s: invalid recovered length %zu", __func__, out_len);
+		goto out;
+	}
+
+	res = tpkt_fec_alloc(pool, out_len > 0 ? out_len : 1, &pkt, &out);
+	if (res < 0)
+		goto out;
+	memcpy(out, repair_data + TPKT_FEC_LEN_SIZE, out_len);
+	for (i = 0; i < count; i++) {
+		tpkt_fec_kernels->xor(
+			out, data[i], (len[i] < out_len) ? len[i] : out_len);
+	}
+	res = tpkt_set_len(pkt, out_len);
+	if (res < 0)
+		goto out;
+	tpkt_fec_set_metadata(pkt, repair);
+
+	src[missing] = pkt;
+	pkt = NULL;
+
+out:
+	tpkt_unref(pkt);
+	free(data);
+	free(len);
+	return res;
+}
+
+
+int tpkt_fec_rs_encode(struct tpkt_packet *const *src,
+		       unsigned int k,
+		       struct tpkt_packet **repair,
+		       unsigned int m,
+		       struct tpkt_pool *pool)
+{
+	int res;
+	unsigned int i, r;
+	size_t max_len, repair_len;
+	const uint8_t **data = NULL;
+	size_t *len = NULL;
+	uint8_t *out;
+	uint8_t c;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(k == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(repair == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(m == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(k + m > TPKT_FEC_RS_MAX_PACKETS, EINVAL);
+	for (i = 0; i < k; i++)
+		ULOG_ERRNO_RETURN_ERR_IF(src[i] == NULL, EINVAL);
+
+	pthread_once(&tpkt_fec_once, tpkt_fec_init);
+
+	for (r = 0; r < m; r++)
+		repair[r] = NULL;
+
+	data = calloc(k, sizeof(*data));
+	len = calloc(k, sizeof(*len));
+	if (data == NULL || len == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto error;
+	}
+	res = tpkt_fec_get_src(src, k, data, len, &max_len);
+	if (res < 0)
+		goto error;
+	repair_len = TPKT_FEC_LEN_SIZE + max_len;
+
+	for (r = 0; r < m; r++) {
+		res = tpkt_fec_alloc(pool, repair_len, &repair[r], &out);
+		if (res < 0)
+			goto error;
+		memset(out, 0, repair_len);
+		for (i = 0; i < k; i++) {
+			c = tpkt_fec_rs_coef(k, r, i);
+			out[0] ^= tpkt_fec_gf_mul(c, len[i] >> 8);
+			out[1] ^= tpkt_fec_gf_mul(c, len[i] & 0xff);
+			tpkt_fec_mul_add(
+				out + TPKT_FEC_LEN_SIZE, data[i], len[i], c);
+		}
+		res = tpkt_set_len(repair[r], repair_len);
+		if (res < 0)
+			goto error;
+		tpkt_fec_set_metadata(repair[r], src[0]);
+	}
+
+	free(data);
+	free(len);
+	return 0;
+
+error:
+	for (r = 0; r < m; r++) {
+		tpkt_unref(repair[r]);
+		repair[r] = NULL;
+	}
+	free(data);
+	free(len);
+	return res;
+}
+
+
+/* Invert a n x n matrix in GF(2^8) (Gauss-Jordan elimination);
+ * the input matrix is destroyed */
+static int tpkt_fec_matrix_invert(uint8_t *a, uint8_t *inv, unsigned int n)
+{
+	unsigned int i, j, col, pivot;
+	uint8_t c, tmp;
+
+	memset(inv, 0, n * n);
+	for (i = 0; i < n; i++)
+		inv[i * n + i] = 1;
+
+	for (col = 0; col < n; col++) {
+		for (pivot = col; pivot < n && a[pivot * n + col] == 0; pivot++)
+			;
+		if (pivot == n)
+			return -EPROTO;
+		if (pivot != col) {
+			for (j = 0; j < n; j++) {
+				tmp = a[col * n + j];
+				a[col * n + j] = a[pivot * n + j];
+				a[pivot * n + j] = tmp;
+				tmp = inv[col * n + j];
+				inv[col * n + j] = inv[pivot * n + j];
+				inv[pivot * n + j] = tmp;
+			}
+		}
+		c = tpkt_fec_gf_inv(a[col * n + col]);
+		for (j = 0; j < n; j++) {
+			a[col * n + j] = tpkt_fec_gf_mul(a[col * n + j], c);
+			inv[col * n + j] = tpkt_fec_gf_mul(inv[col * n + j], c);
+		}
+		for (i = 0; i < n; i++) {
+			if (i == col || a[i * n + col] == 0)
+				continue;
+			c = a[i * n + col];
+			for (j = 0; j < n; j++) {
+				a[i * n + j] ^=
+					tpkt_fec_gf_mul(c, a[col * n + j]);
+				inv[i * n + j] ^=
+					tpkt_fec_gf_mul(c, inv[col * n + j]);
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+int tpkt_fec_rs_decode(struct tpkt_packet **src,
+		       unsigned int k,
+		       struct tpkt_packet *const *repair,
+		       unsigned int m,
+		       struct tpkt_pool *pool)
+{
+	int res;
+	unsigned int i, j, a, r, n = 0;
+	unsigned int missing[TPKT_FEC_RS_MAX_PACKETS];
+	unsigned int rows[TPKT_FEC_RS_MAX_PACKETS];
+	size_t max_len, repair_len = 0, len, out_len;
+	const uint8_t **data = NULL;
+	size_t *src_len = NULL;
+	const uint8_t *repair_data;
+	uint8_t *mat = NULL, *inv = NULL, *y = NULL, *out;
+	struct tpkt_packet **pkts = NULL;
+	uint8_t c;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(k == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(repair == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(m == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(k + m > TPKT_FEC_RS_MAX_PACKETS, EINVAL);
+
+	pthread_once(&tpkt_fec_once, tpkt_fec_init);
+
+	for (i = 0; i < k; i++) {
+		if (src[i] == NULL)
+			missing[n++] = i;
+	}
+	if (n == 0)
+		return 0;
+
+	/* Use the first available repair packets */
+	for (r = 0, a = 0; r < m && a < n; r++) {
+		if (repair[r] == NULL)
+			continue;
+		res = tpkt_get_cdata(repair[r], NULL, &len, NULL);
+		if (res < 0)
+			return res;
+		ULOG_ERRNO_RETURN_ERR_IF(len < TPKT_FEC_LEN_SIZE, EPROTO);
+		ULOG_ERRNO_RETURN_ERR_IF(a > 0 && len != repair_len, EPROTO);
+		repair_len = len;
+		rows[a++] = r;
+	}
+	if (a < n) {
+		ULOGE("%s: not enough packets to recover %u packets",
+		      __func__,
+		      n);
+		return -EPROTO;
+	}
+
+	data = calloc(k, sizeof(*data));
+	src_len = calloc(k, sizeof(*src_len));
+	pkts = calloc(n, sizeof(*pkts));
+	mat = malloc(n * n);
+	inv = malloc(n * n);
+	y = malloc(n * repair_len);
+	if (data == NULL || src_len == NULL || pkts == NULL || mat == NULL ||
+	    inv == NULL || y == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("alloc", -res);
+		goto out;
+	}
+	res = tpkt_fec_get_src(src, k, data, src_len, &max_len);
+	if (res < 0)
+		goto out;
+	if (TPKT_FEC_LEN_SIZE + max_len > repair_len) {
+		res = -EPROTO;
+		ULOGE("%s: source packet longer than repair packet", __func__);
+		goto out;
+	}
+
+	/* Remove the contribution of the available source packets from
+	 * the repair packets */
+	for (a = 0; a < n; a++) {
+		uint8_t *ya = y + a * repair_len;
+		r = rows[a];
+		res = tpkt_get_cdata(
+			repair[r], (const void **)&repair_data, NULL, NULL);
+		if (res < 0)
+			goto out;
+		memcpy(ya, repair_data, repair_len);
+		for (i = 0; i < k; i++) {
+			if (data[i] == NULL)
+				continue;
+			c = tpkt_fec_rs_coef(k, r, i);
+			ya[0] ^= tpkt_fec_gf_mul(c, src_len[i] >> 8);
+			ya[1] ^= tpkt_fec_gf_mul(c, src_len[i] & 0xff);
+			tpkt_fec_mul_add(ya + TPKT_FEC_LEN_SIZE,
+					 data[i],
+					 src_len[i],
+					 c);
+		}
+		for (j = 0; j < n; j++)
+			mat[a * n + j] = tpkt_fec_rs_coef(k, r, missing[j]);
+	}
+
+	res = tpkt_fec_matrix_invert(mat, inv, n);
+	if (res < 0) {
+		ULOG_ERRNO("tpkt_fec_matrix_invert", -res);
+		goto out;
+	}
+
+	/* Recover the missing packets: length first, then data */
+	for (j = 0; j < n; j++) {
+		uint8_t len_hi = 0, len_lo = 0;
+		for (a = 0; a < n; a++) {
+			c = inv[j * n + a];
+			len_hi ^= tpkt_fec_gf_mul(c, y[a * repair_len]);
+			len_lo ^= tpkt_fec_gf_mul(c, y[a * repair_len + 1]);
+		}
+		out_len = (len_hi << 8) | len_lo;
+		if (TPKT_FEC_LEN_SIZE + out_len > repair_len) {
+			res = -EPROTO;
+			ULOGE("%s: invalid recovered length %zu",
+			      __func__,
+			      out_len);
+			goto out;
+		}
+
+		res = tpkt_fec_alloc(
+			pool, out_len > 0 ? out_len : 1, &pkts[j], &out);
+		if (res < 0)
+			goto out;
+		memset(out, 0, out_len);
+		for (a = 0; a < n; a++) {
+			tpkt_fec_mul_add(out,
+					 y + a * repair_len + TPKT_FEC_LEN_SIZE,
+					 out_len,
+					 inv[j * n + a]);
+		}
+		res = tpkt_set_len(pkts[j], out_len);
+		if (res < 0)
+			goto out;
+		tpkt_fec_set_metadata(pkts[j], repair[rows[0]]);
+	}
+
+	/* Success: transfer the packets to the caller */
+	for (j = 0; j < n; j++) {
+		src[missing[j]] = pkts[j];
+		pkts[j] = NULL;
+	}
+	res = (int)n;
+
+out:
+	if (pkts != NULL) {
+		for (j = 0; j < n; j++)
+			tpkt_unref(pkts[j]);
+	}
+	free(data);
+	free(src_len);
+	free(pkts);
+	free(mat);
+	free(inv);
+	free(y);
+	return res;
+}
+
+
+int tpkt_fec_rs_encode_list(struct tpkt_list *list,
+			    unsigned int m,
+			    struct tpkt_pool *pool,
+			    struct tpkt_list *repair_list)
+{
+	int res;
+	unsigned int i, k = 0;
+	struct tpkt_packet **src = NULL, **repair = NULL;
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(repair_list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list->count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(m == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list->count + m > TPKT_FEC_RS_MAX_PACKETS,
+				 EINVAL);
+
+	src = calloc(list->count, sizeof(*src));
+	repair = calloc(m, sizeof(*repair));
+	if (src == NULL || repair == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto out;
+	}
+	list_walk_entry_forward(&list->packets, pkt, node)
+	{
+		src[k++] = pkt;
+	}
+
+	res = tpkt_fec_rs_encode(src, k, repair, m, pool);
+	if (res < 0)
+		goto out;
+
+	for (i = 0; i < m; i++) {
+		/* Transfer the reference to the list */
+		tpkt_list_add_last(repair_list, repair[i]);
+		tpkt_unref(repair[i]);
+	}
+
+out:
+	free(src);
+	free(repair);
+	return res;
+}
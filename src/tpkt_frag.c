@@ -0,0 +1,532 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_frag.h>
+
+
+#define TPKT_REASM_DEFAULT_MAX_FRAMES 16
+#define TPKT_REASM_DEFAULT_MAX_FRAGMENTS 64
+
+/* Number of completed or dropped frame ids remembered to detect late
+ * fragments */
+#define TPKT_REASM_DONE_COUNT 32
+
+
+struct tpkt_reasm_frame {
+	int used;
+	uint32_t frame_id;
+	unsigned int count;
+	unsigned int received;
+	size_t bytes;
+
+	/* Time of the first fragment */
+	uint64_t start;
+
+	/* Fragments array (max_fragments entries, count used) */
+	struct tpkt_packet **frags;
+};
+
+
+struct tpkt_reasm {
+	struct tpkt_reasm_cfg cfg;
+
+	/* Frames array (max_frames entries) */
+	struct tpkt_reasm_frame *frames;
+	unsigned int frame_count;
+
+	/* Fragments storage for all frames */
+	struct tpkt_packet **frags;
+
+	/* Total data length of the fragments held */
+	size_t bytes;
+
+	/* Ring of recently completed or dropped frame ids */
+	uint32_t done[TPKT_REASM_DONE_COUNT];
+	unsigned int done_count;
+	unsigned int done_next;
+
+	struct tpkt_reasm_stats stats;
+};
+
+
+/* Remove the packets added at the end of a list after a failure */
+static void tpkt_frag_rollback(struct tpkt_list *list, int count)
+{
+	struct tpkt_packet *pkt;
+
+	for (; count > 0; count--) {
+		pkt = tpkt_list_last(list);
+		tpkt_list_remove(list, pkt);
+		tpkt_unref(pkt);
+	}
+}
+
+
+int tpkt_frag_split_buffer(struct pomp_buffer *buf,
+			   size_t max_size,
+			   struct tpkt_list *list)
+{
+	int res, count = 0;
+	size_t len, offset, frag_len;
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(max_size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	res = pomp_buffer_get_cdata(buf, NULL, &len, NULL);
+	if (res < 0)
+		return res;
+
+	for (offset = 0; offset < len; offset += frag_len) {
+		frag_len = (len - offset < max_size) ? len - offset : max_size;
+		res = tpkt_new_from_buffer_slice(buf, offset, frag_len, &pkt);
+		if (res < 0)
+			goto error;
+		res = tpkt_list_add_last(list, pkt);
+		tpkt_unref(pkt);
+		if (res < 0)
+			goto error;
+		count++;
+	}
+
+	return count;
+
+error:
+	tpkt_frag_rollback(list, count);
+	return res;
+}
+
+
+int tpkt_frag_split_packet(struct tpkt_packet *pkt,
+			   size_t max_size,
+			   struct tpkt_list *list)
+{
+	int res, count = 0;
+	size_t len, offset, frag_len;
+	struct tpkt_packet *frag;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(max_size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	res = tpkt_get_cdata(pkt, NULL, &len, NULL);
+	if (res < 0)
+		return res;
+
+	for (offset = 0; offset < len; offset += frag_len) {
+		frag_len = (len - offset < max_size) ? len - offset : max_size;
+		res = tpkt_new_slice(pkt, offset, frag_len, &frag);
+		if (res < 0)
+			goto error;
+		res = tpkt_list_add_last(list, frag);
+		tpkt_unref(frag);
+		if (res < 0)
+			goto error;
+		count++;
+	}
+
+	return count;
+
+error:
+	tpkt_frag_rollback(list, count);
+	return res;
+}
+
+
+int tpkt_frag_join(struct tpkt_list *list, struct pomp_buffer **ret_obj)
+{
+	int res;
+	size_t len, total = 0;
+	const void *src;
+	uint8_t *dst;
+	struct tpkt_packet *pkt;
+	struct pomp_buffer *buf;
+
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	list_walk_entry_forward(&list->packets, pkt, node)
+	{
+		res = tpkt_get_cdata(pkt, NULL, &len, NULL);
+		if (res < 0)
+			return res;
+		total += len;
+	}
+
+	buf = pomp_buffer_new(total > 0 ? total : 1);
+	if (buf == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("pomp_buffer_new", -res);
+		return res;
+	}
+	res = pomp_buffer_get_data(buf, (void **)&dst, NULL, NULL);
+	if (res < 0)
+		goto error;
+
+	list_walk_entry_forward(&list->packets, pkt, node)
+	{
+		res = tpkt_get_cdata(pkt, &src, &len, NULL);
+		if (res < 0)
+			goto error;
+		memcpy(dst, src, len);
+		dst += len;
+	}
+	res = pomp_buffer_set_len(buf, total);
+	if (res < 0)
+		goto error;
+
+	*ret_obj = buf;
+	return 0;
+
+error:
+	pomp_buffer_unref(buf);
+	return res;
+}
+
+
+static void tpkt_reasm_set_done(struct tpkt_reasm *reasm, uint32_t frame_id)
+{
+	reasm->done[reasm->done_next] = frame_id;
+	reasm->done_next = (reasm->done_next + 1) % TPKT_REASM_DONE_COUNT;
+	if (reasm->done_count < TPKT_REASM_DONE_COUNT)
+		reasm->done_count++;
+}
+
+
+static int tpkt_reasm_is_done(struct tpkt_reasm *reasm, uint32_t frame_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < reasm->done_count; i++) {
+		if (reasm->done[i] == frame_id)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static struct tpkt_reasm_frame *tpkt_reasm_find(struct tpkt_reasm *reasm,
+						uint32_t frame_id)
+{
+	unsigned int i;
+	struct tpkt_reasm_frame *frame;
+
+	for (i = 0; i < reasm->cfg.max_frames; i++) {
+		frame = &reasm->frames[i];
+		if (frame->used && frame->frame_id == frame_id)
+			return frame;
+	}
+
+	return NULL;
+}
+
+
+/* Find the oldest frame, excluding a given frame (optional) */
+static struct tpkt_reasm_frame *
+tpkt_reasm_find_oldest(struct tpkt_reasm *reasm,
+		       struct tpkt_reasm_frame *exclude)
+{
+	unsigned int i;
+	struct tpkt_reasm_frame *frame, *oldest = NULL;
+
+	for (i = 0; i < reasm->cfg.max_frames; i++) {
+		frame = &reasm->frames[i];
+		if (!frame->used || frame == exclude)
+			continue;
+		if (oldest == NULL || frame->start < oldest->start)
+			oldest = frame;
+	}
+
+	return oldest;
+}
+
+
+static void tpkt_reasm_release(struct tpkt_reasm *reasm,
+			       struct tpkt_reasm_frame *frame)
+{
+	tpkt_reasm_set_done(reasm, frame->frame_id);
+	reasm->bytes -= frame->bytes;
+	reasm->frame_count--;
+	frame->used = 0;
+}
+
+
+static void tpkt_reasm_drop(struct tpkt_reasm *reasm,
+			    struct tpkt_reasm_frame *frame)
+{
+	unsigned int i;
+
+	for (i = 0; i < frame->count; i++) {
+		tpkt_unref(frame->frags[i]);
+		frame->frags[i] = NULL;
+	}
+	tpkt_reasm_release(reasm, frame);
+}
+
+
+int tpkt_reasm_new(const struct tpkt_reasm_cfg *cfg,
+		   struct tpkt_reasm **ret_obj)
+{
+	int res;
+	unsigned int i;
+	struct tpkt_reasm *reasm;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	reasm = calloc(1, sizeof(*reasm));
+	if (reasm == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	reasm->cfg = *cfg;
+	if (reasm->cfg.max_frames == 0)
+		reasm->cfg.max_frames = TPKT_REASM_DEFAULT_MAX_FRAMES;
+	if (reasm->cfg.max_fragments == 0)
+		reasm->cfg.max_fragments = TPKT_REASM_DEFAULT_MAX_FRAGMENTS;
+
+	reasm->frames =
+		calloc(reasm->cfg.max_frames, sizeof(*reasm->frames));
+	if (reasm->frames == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto error;
+	}
+	reasm->frags = calloc((size_t)reasm->cfg.max_frames *
+				      reasm->cfg.max_fragments,
+			      sizeof(*reasm->frags));
+	if (reasm->frags == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto error;
+	}
+	for (i = 0; i < reasm->cfg.max_frames; i++) {
+		reasm->frames[i].frags =
+			&reasm->frags[(size_t)i * reasm->cfg.max_fragments];
+	}
+
+	*ret_obj = reasm;
+	return 0;
+
+error:
+	tpkt_reasm_destroy(reasm);
+	return res;
+}
+
+
+int tpkt_reasm_destroy(struct tpkt_reasm *reasm)
+{
+	if (reasm == NULL)
+		return 0;
+
+	if (reasm->frames != NULL && reasm->frags != NULL)
+		tpkt_reasm_flush(reasm);
+	free(reasm->frames);
+	free(reasm->frags);
+	free(reasm);
+
+	return 0;
+}
+
+
+int tpkt_reasm_push(struct tpkt_reasm *reasm,
+		    uint32_t frame_id,
+		    unsigned int index,
+		    unsigned int count,
+		    struct tpkt_packet *pkt,
+		    uint64_t ts,
+		    struct tpkt_list *list)
+{
+	int res;
+	unsigned int i;
+	size_t len;
+	struct tpkt_reasm_frame *frame, *oldest;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reasm == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	/* The fragments are output in a list */
+	ULOG_ERRNO_RETURN_ERR_IF(list_node_is_ref(&pkt->node), EBUSY);
+
+	if (count == 0 || count > reasm->cfg.max_fragments || index >= count) {
+		reasm->stats.invalid++;
+		return -EPROTO;
+	}
+
+	res = tpkt_get_cdata(pkt, NULL, &len, NULL);
+	if (res < 0)
+		return res;
+	if (reasm->cfg.max_bytes != 0 && len > reasm->cfg.max_bytes)
+		return -ENOBUFS;
+
+	frame = tpkt_reasm_find(reasm, frame_id);
+	if (frame != NULL) {
+		if (count != frame->count) {
+			reasm->stats.invalid++;
+			return -EPROTO;
+		}
+		if (frame->frags[index] != NULL) {
+			reasm->stats.duplicate++;
+			return -EEXIST;
+		}
+	} else {
+		if (tpkt_reasm_is_done(reasm, frame_id)) {
+			reasm->stats.late++;
+			return -EALREADY;
+		}
+		if (reasm->frame_count == reasm->cfg.max_frames) {
+			oldest = tpkt_reasm_find_oldest(reasm, NULL);
+			tpkt_reasm_drop(reasm, oldest);
+			reasm->stats.evictions++;
+		}
+		for (i = 0; reasm->frames[i].used; i++)
+			;
+		frame = &reasm->frames[i];
+		frame->used = 1;
+		frame->frame_id = frame_id;
+		frame->count = count;
+		frame->received = 0;
+		frame->bytes = 0;
+		frame->start = ts;
+		reasm->frame_count++;
+	}
+
+	/* Respect the memory budget by dropping the oldest other frames */
+	while (reasm->cfg.max_bytes != 0 &&
+	       reasm->bytes + len > reasm->cfg.max_bytes) {
+		oldest = tpkt_reasm_find_oldest(reasm, frame);
+		if (oldest == NULL)
+			oldest = frame;
+		tpkt_reasm_drop(reasm, oldest);
+		reasm->stats.evictions++;
+		if (oldest == frame)
+			return -ENOBUFS;
+	}
+
+	tpkt_ref(pkt);
+	frame->frags[index] = pkt;
+	frame->received++;
+	frame->bytes += len;
+	reasm->bytes += len;
+	if (frame->received < frame->count)
+		return 0;
+
+	/* Frame complete: transfer the fragments to the list */
+	for (i = 0; i < frame->count; i++) {
+		tpkt_list_add_last(list, frame->frags[i]);
+		tpkt_unref(frame->frags[i]);
+		frame->frags[i] = NULL;
+	}
+	tpkt_reasm_release(reasm, frame);
+	reasm->stats.frames++;
+
+	return 1;
+}
+
+
+int tpkt_reasm_evict(struct tpkt_reasm *reasm, uint64_t ts)
+{
+	int count = 0;
+	unsigned int i;
+	struct tpkt_reasm_frame *frame;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reasm == NULL, EINVAL);
+
+	if (reasm->cfg.timeout == 0)
+		return 0;
+
+	for (i = 0; i < reasm->cfg.max_frames; i++) {
+		frame = &reasm->frames[i];
+		if (!frame->used || ts < frame->start + reasm->cfg.timeout)
+			continue;
+		tpkt_reasm_drop(reasm, frame);
+		reasm->stats.timeouts++;
+		count++;
+	}
+
+	return count;
+}
+
+
+int tpkt_reasm_get_next_deadline(struct tpkt_reasm *reasm, uint64_t *ts)
+{
+	struct tpkt_reasm_frame *oldest;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reasm == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ts == NULL, EINVAL);
+
+	if (reasm->cfg.timeout == 0)
+		return -ENOENT;
+	oldest = tpkt_reasm_find_oldest(reasm, NULL);
+	if (oldest == NULL)
+		return -ENOENT;
+
+	*ts = oldest->start + reasm->cfg.timeout;
+
+	return 0;
+}
+
+
+int tpkt_reasm_flush(struct tpkt_reasm *reasm)
+{
+	unsigned int i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reasm == NULL, EINVAL);
+
+	for (i = 0; i < reasm->cfg.max_frames; i++) {
+		if (reasm->frames[i].used)
+			tpkt_reasm_drop(reasm, &reasm->frames[i]);
+	}
+
+	return 0;
+}
+
+
+int tpkt_reasm_get_bytes(struct tpkt_reasm *reasm, size_t *bytes)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(reasm == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(bytes == NULL, EINVAL);
+
+	*bytes = reasm->bytes;
+
+	return 0;
+}
+
+
+int tpkt_reasm_get_stats(struct tpkt_reasm *reasm,
+			 struct tpkt_reasm_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(reasm == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = reasm->stats;
+
+	return 0;
+}
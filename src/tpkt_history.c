@@ -0,0 +1,311 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_history.h>
+
+
+/* Maximum slot count; the extended sequence numbers of the packets in
+ * the history must be less than half the 16-bit range apart */
+#define TPKT_HISTORY_MAX_COUNT 32768
+
+
+struct tpkt_history_slot {
+	struct tpkt_packet *pkt;
+	uint64_t ext_seq;
+	uint64_t ts;
+	size_t len;
+};
+
+
+struct tpkt_history {
+	struct tpkt_history_cfg cfg;
+
+	/* Slots array (size entries, power of 2) indexed by the extended
+	 * sequence number */
+	struct tpkt_history_slot *slots;
+	size_t size;
+	size_t mask;
+
+	/* Extended sequence numbers of the oldest slot and of the slot
+	 * after the newest packet; slots in between may be empty */
+	uint64_t first;
+	uint64_t next;
+	int started;
+
+	size_t count;
+	size_t bytes;
+};
+
+
+static void tpkt_history_remove_first(struct tpkt_history *history)
+{
+	struct tpkt_history_slot *slot;
+
+	slot = &history->slots[history->first & history->mask];
+	if (slot->pkt != NULL && slot->ext_seq == history->first) {
+		tpkt_unref(slot->pkt);
+		slot->pkt = NULL;
+		history->count--;
+		history->bytes -= slot->len;
+	}
+	history->first++;
+}
+
+
+/* Return 1 if the oldest packet must be evicted */
+static int tpkt_history_must_evict(struct tpkt_history *history, uint64_t ts)
+{
+	struct tpkt_history_slot *slot;
+
+	if (history->count > history->cfg.max_count)
+		return 1;
+
+	if (history->cfg.max_bytes != 0 &&
+	    history->bytes > history->cfg.max_bytes)
+		return 1;
+
+	if (history->cfg.max_age == 0)
+		return 0;
+
+	slot = &history->slots[history->first & history->mask];
+	return slot->pkt != NULL && slot->ext_seq == history->first &&
+	       ts > slot->ts + history->cfg.max_age;
+}
+
+
+/* Evict the oldest packets (limits and age), optionally keeping at
+ * least one packet; returns the evicted count */
+static int tpkt_history_evict_internal(struct tpkt_history *history,
+				       uint64_t ts,
+				       int keep_last)
+{
+	size_t count = history->count;
+
+	while (history->first != history->next) {
+		struct tpkt_history_slot *slot =
+			&history->slots[history->first & history->mask];
+		if (slot->pkt == NULL || slot->ext_seq != history->first) {
+			/* Skip the sequence number gaps */
+			history->first++;
+			continue;
+		}
+		if (keep_last && history->count == 1)
+			break;
+		if (!tpkt_history_must_evict(history, ts))
+			break;
+		tpkt_history_remove_first(history);
+	}
+
+	return (int)(count - history->count);
+}
+
+
+/* Extend a 16-bit sequence number relative to the newest packet */
+static uint64_t tpkt_history_extend(struct tpkt_history *history,
+				    uint16_t seq)
+{
+	uint64_t last = history->next - 1;
+	int16_t diff = (int16_t)(seq - (uint16_t)last);
+
+	/* Keep the extended sequence numbers positive */
+	if (diff < 0 && (uint64_t)(-diff) > last)
+		return UINT64_MAX;
+
+	return last + diff;
+}
+
+
+int tpkt_history_new(const struct tpkt_history_cfg *cfg,
+		     struct tpkt_history **ret_obj)
+{
+	int res;
+	struct tpkt_history *history;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->max_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->max_count > TPKT_HISTORY_MAX_COUNT,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	history = calloc(1, sizeof(*history));
+	if (history == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	history->cfg = *cfg;
+	history->size = 1;
+	while (history->size < cfg->max_count)
+		history->size *= 2;
+	history->mask = history->size - 1;
+
+	history->slots = calloc(history->size, sizeof(*history->slots));
+	if (history->slots == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		free(history);
+		return res;
+	}
+
+	*ret_obj = history;
+	return 0;
+}
+
+
+int tpkt_history_destroy(struct tpkt_history *history)
+{
+	if (history == NULL)
+		return 0;
+
+	tpkt_history_flush(history);
+	free(history->slots);
+	free(history);
+
+	return 0;
+}
+
+
+int tpkt_history_add(struct tpkt_history *history,
+		     uint16_t seq,
+		     struct tpkt_packet *pkt,
+		     uint64_t ts)
+{
+	int res;
+	uint64_t ext_seq;
+	size_t len = 0;
+	struct tpkt_history_slot *slot;
+
+	ULOG_ERRNO_RETURN_ERR_IF(history == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+
+	if (ts == 0)
+		ts = pkt->timestamp;
+
+	res = tpkt_get_cdata(pkt, NULL, &len, NULL);
+	if (res < 0)
+		return res;
+
+	if (!history->started) {
+		/* Start far enough from 0 so that older sequence numbers
+		 * can still be extended */
+		ext_seq = (uint64_t)1 << 32 | seq;
+		history->first = ext_seq;
+		history->next = ext_seq;
+		history->started = 1;
+	} else {
+		ext_seq = tpkt_history_extend(history, seq);
+		if (ext_seq < history->next)
+			return -EALREADY;
+	}
+
+	/* Make room in the slots window */
+	while (history->first != history->next &&
+	       ext_seq - history->first >= history->size)
+		tpkt_history_remove_first(history);
+	if (history->first == history->next)
+		history->first = ext_seq;
+
+	slot = &history->slots[ext_seq & history->mask];
+	tpkt_ref(pkt);
+	slot->pkt = pkt;
+	slot->ext_seq = ext_seq;
+	slot->ts = ts;
+	slot->len = len;
+	history->next = ext_seq + 1;
+	history->count++;
+	history->bytes += len;
+
+	/* Apply the size and age limits, keeping at least the new packet */
+	tpkt_history_evict_internal(history, ts, 1);
+
+	return 0;
+}
+
+
+int tpkt_history_get(struct tpkt_history *history,
+		     uint16_t seq,
+		     struct tpkt_packet **ret_obj)
+{
+	uint64_t ext_seq;
+	struct tpkt_history_slot *slot;
+
+	ULOG_ERRNO_RETURN_ERR_IF(history == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	if (history->count == 0)
+		return -ENOENT;
+
+	ext_seq = tpkt_history_extend(history, seq);
+	if (ext_seq < history->first || ext_seq >= history->next)
+		return -ENOENT;
+
+	slot = &history->slots[ext_seq & history->mask];
+	if (slot->pkt == NULL || slot->ext_seq != ext_seq)
+		return -ENOENT;
+
+	tpkt_ref(slot->pkt);
+	*ret_obj = slot->pkt;
+	return 0;
+}
+
+
+int tpkt_history_evict(struct tpkt_history *history, uint64_t ts)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(history == NULL, EINVAL);
+
+	return tpkt_history_evict_internal(history, ts, 0);
+}
+
+
+int tpkt_history_flush(struct tpkt_history *history)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(history == NULL, EINVAL);
+
+	while (history->first != history->next)
+		tpkt_history_remove_first(history);
+	history->started = 0;
+
+	return 0;
+}
+
+
+int tpkt_history_get_count(struct tpkt_history *history)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(history == NULL, EINVAL);
+
+	return (int)history->count;
+}
+
+
+int tpkt_history_get_bytes(struct tpkt_history *history, size_t *bytes)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(history == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(bytes == NULL, EINVAL);
+
+	*bytes = history->bytes;
+	return 0;
+}
@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "tpkt_priv.h"
+#include "tpkt_probes.h"
+#include <transport-packet/tpkt_io.h>
+
+
+/* Maximum number of packets sent in a single system call */
+#define TPKT_IO_BATCH_SIZE 64
+
+
+/* Control messages of a packet: IP_TOS or IPV6_TCLASS, and SO_PRIORITY */
+union tpkt_io_cmsg_buf {
+	uint8_t buf[2 * CMSG_SPACE(sizeof(int))];
+	struct cmsghdr align;
+};
+
+
+static const struct tpkt_qos_map tpkt_io_default_qos_map = {
+	.dscp = {0, 10, 18, 26, 34, 40, 46, 48},
+	.ecn = 0,
+	.so_priority = {-1, -1, -1, -1, -1, -1, -1, -1},
+};
+
+
+int tpkt_qos_map_get_default(struct tpkt_qos_map *map)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(map == NULL, EINVAL);
+
+	*map = tpkt_io_default_qos_map;
+
+	return 0;
+}
+
+
+static void tpkt_io_add_cmsg(struct msghdr *msg,
+			     struct cmsghdr **cmsg,
+			     int level,
+			     int type,
+			     int value)
+{
+	(*cmsg)->cmsg_level = level;
+	(*cmsg)->cmsg_type = type;
+	(*cmsg)->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(*cmsg), &value, sizeof(int));
+	msg->msg_controllen += CMSG_SPACE(sizeof(int));
+	*cmsg = (struct cmsghdr *)((uint8_t *)*cmsg + CMSG_SPACE(sizeof(int)));
+}
+
+
+static int tpkt_io_qos_map_is_valid(const struct tpkt_qos_map *map)
+{
+	unsigned int i;
+
+	if (map->ecn < 0 || map->ecn > 3)
+		return 0;
+	for (i = 0; i <= QOS_PRIORITY_MAX; i++) {
+		if (map->dscp[i] < -1 || map->dscp[i] > 63)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+static void tpkt_io_set_qos(struct tpkt_packet *pkt,
+			    struct msghdr *msg,
+			    union tpkt_io_cmsg_buf *cbuf,
+			    const struct tpkt_qos_map *map,
+			    int family)
+{
+	int dscp = map->dscp[pkt->priority];
+	int so_priority = map->so_priority[pkt->priority];
+	struct cmsghdr *cmsg = (struct cmsghdr *)cbuf->buf;
+
+	msg->msg_control = cbuf->buf;
+	msg->msg_controllen = 0;
+
+	if (dscp >= 0) {
+		if (family == AF_INET6) {
+			tpkt_io_add_cmsg(msg,
+					 &cmsg,
+					 IPPROTO_IPV6,
+					 IPV6_TCLASS,
+					 (dscp << 2) | map->ecn);
+		} else {
+			tpkt_io_add_cmsg(msg,
+					 &cmsg,
+					 IPPROTO_IP,
+					 IP_TOS,
+					 (dscp << 2) | map->ecn);
+		}
+	}
+	if (so_priority >= 0) {
+		tpkt_io_add_cmsg(
+			msg, &cmsg, SOL_SOCKET, SO_PRIORITY, so_priority);
+	}
+
+	if (msg->msg_controllen == 0)
+		msg->msg_control = NULL;
+}
+
+
+int tpkt_send_list(int fd,
+		   struct tpkt_list *list,
+		   const struct tpkt_qos_map *map)
+{
+	int res, err;
+	int family, sock_family = AF_UNSPEC;
+	unsigned int i, count;
+	int sent = 0;
+	struct mmsghdr msgs[TPKT_IO_BATCH_SIZE];
+	struct tpkt_packet *pkts[TPKT_IO_BATCH_SIZE];
+	union tpkt_io_cmsg_buf cbufs[TPKT_IO_BATCH_SIZE];
+	struct tpkt_packet *pkt;
+	struct sockaddr_storage sock_addr;
+	socklen_t sock_addrlen;
+	struct iovec *iov;
+	size_t iov_len;
+
+	ULOG_ERRNO_RETURN_ERR_IF(fd < 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(map != NULL && !tpkt_io_qos_map_is_valid(map),
+				 EINVAL);
+
+	while (list->count > 0) {
+		/* Prepare a batch */
+		count = 0;
+		memset(msgs, 0, sizeof(msgs));
+		pkt = tpkt_list_first(list);
+		while (pkt != NULL && count < TPKT_IO_BATCH_SIZE) {
+			res = tpkt_get_iov_write(pkt, &iov, &iov_len);
+			if (res < 0)
+				return (sent > 0) ? sent : res;
+			msgs[count].msg_hdr.msg_iov = iov;
+			msgs[count].msg_hdr.msg_iovlen = iov_len;
+
+			family = pkt->addr.in.sin_family;
+			if (family == AF_INET) {
+				msgs[count].msg_hdr.msg_name = &pkt->addr.in;
+				msgs[count].msg_hdr.msg_namelen =
+					sizeof(pkt->addr.in);
+			} else if (family == AF_INET6) {
+				msgs[count].msg_hdr.msg_name = &pkt->addr.in6;
+				msgs[count].msg_hdr.msg_namelen =
+					sizeof(pkt->addr.in6);
+			} else if (map != NULL) {
+				/* Connected socket: the control message
+				 * type depends on the socket family, which
+				 * is only queried when needed */
+				if (sock_family == AF_UNSPEC) {
+					sock_addrlen = sizeof(sock_addr);
+					res = getsockname(
+						fd,
+						(struct sockaddr *)&sock_addr,
+						&sock_addrlen);
+					if (res < 0) {
+						res = -errno;
+						ULOG_ERRNO("getsockname", -res);
+						return (sent > 0) ? sent : res;
+					}
+					sock_family = sock_addr.ss_family;
+				}
+				family = sock_family;
+			}
+
+			if (map != NULL) {
+				tpkt_io_set_qos(pkt,
+						&msgs[count].msg_hdr,
+						&cbufs[count],
+						map,
+						family);
+			}
+
+			pkts[count++] = pkt;
+			pkt = tpkt_list_next(list, pkt);
+		}
+
+		/* Send the batch */
+		res = sendmmsg(fd, msgs, count, 0);
+		if (res < 0) {
+			err = errno;
+			if (err != EAGAIN && err != EWOULDBLOCK)
+				ULOG_ERRNO("sendmmsg", err);
+			return (sent > 0) ? sent : -err;
+		}
+
+		for (i = 0; i < (unsigned int)res; i++) {
+			TPKT_PROBE_PACKET_ARG(send, fd, pkts[i]);
+			tpkt_list_remove(list, pkts[i]);
+			TPKT_TRACE_POINT(pkts[i], SENT);
+			tpkt_unref(pkts[i]);
+		}
+		sent += res;
+
+		/* Partial send: the socket buffer is full */
+		if ((unsigned int)res < count)
+			break;
+	}
+
+	return sent;
+}
@@ -0,0 +1,315 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_jitter.h>
+
+
+/* Maximum slot count; the extended sequence numbers of the packets in
+ * the buffer must be less than half the 16-bit range apart */
+#define TPKT_JITTER_MAX_SLOT_COUNT 32768
+
+
+struct tpkt_jitter_slot {
+	struct tpkt_packet *pkt;
+	uint64_t ext_seq;
+};
+
+
+struct tpkt_jitter {
+	struct tpkt_jitter_cfg cfg;
+
+	/* Maximum of the playout delay and the reorder timeout */
+	uint64_t gap_delay;
+
+	/* Slots array (size entries, power of 2) indexed by the extended
+	 * sequence number */
+	struct tpkt_jitter_slot *slots;
+	size_t size;
+	size_t mask;
+
+	/* Extended sequence numbers of the next packet to release and of
+	 * the slot after the newest packet */
+	uint64_t next;
+	uint64_t end;
+	int started;
+
+	size_t count;
+	struct tpkt_jitter_stats stats;
+};
+
+
+static inline struct tpkt_jitter_slot *
+tpkt_jitter_get_slot(struct tpkt_jitter *jitter, uint64_t ext_seq)
+{
+	struct tpkt_jitter_slot *slot = &jitter->slots[ext_seq & jitter->mask];
+
+	return (slot->pkt != NULL && slot->ext_seq == ext_seq) ? slot : NULL;
+}
+
+
+/* Find the first packet after the next expected one */
+static struct tpkt_jitter_slot *
+tpkt_jitter_find_next(struct tpkt_jitter *jitter)
+{
+	uint64_t ext_seq;
+	struct tpkt_jitter_slot *slot;
+
+	for (ext_seq = jitter->next + 1; ext_seq < jitter->end; ext_seq++) {
+		slot = tpkt_jitter_get_slot(jitter, ext_seq);
+		if (slot != NULL)
+			return slot;
+	}
+
+	return NULL;
+}
+
+
+/* Skip the next expected sequence number, dropping its packet if any */
+static void tpkt_jitter_skip(struct tpkt_jitter *jitter)
+{
+	struct tpkt_jitter_slot *slot;
+
+	slot = tpkt_jitter_get_slot(jitter, jitter->next);
+	if (slot != NULL) {
+		tpkt_unref(slot->pkt);
+		slot->pkt = NULL;
+		jitter->count--;
+		jitter->stats.overflow++;
+	} else {
+		jitter->stats.lost++;
+	}
+	jitter->next++;
+}
+
+
+int tpkt_jitter_new(const struct tpkt_jitter_cfg *cfg,
+		    struct tpkt_jitter **ret_obj)
+{
+	int res;
+	struct tpkt_jitter *jitter;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->slot_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->slot_count > TPKT_JITTER_MAX_SLOT_COUNT,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	jitter = calloc(1, sizeof(*jitter));
+	if (jitter == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	jitter->cfg = *cfg;
+	jitter->gap_delay = (cfg->reorder_timeout > cfg->playout_delay)
+				    ? cfg->reorder_timeout
+				    : cfg->playout_delay;
+	jitter->size = 1;
+	while (jitter->size < cfg->slot_count)
+		jitter->size *= 2;
+	jitter->mask = jitter->size - 1;
+
+	jitter->slots = calloc(jitter->size, sizeof(*jitter->slots));
+	if (jitter->slots == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		free(jitter);
+		return res;
+	}
+
+	*ret_obj = jitter;
+	return 0;
+}
+
+
+int tpkt_jitter_destroy(struct tpkt_jitter *jitter)
+{
+	if (jitter == NULL)
+		return 0;
+
+	tpkt_jitter_flush(jitter);
+	free(jitter->slots);
+	free(jitter);
+
+	return 0;
+}
+
+
+int tpkt_jitter_push(struct tpkt_jitter *jitter,
+		     uint16_t seq,
+		     struct tpkt_packet *pkt)
+{
+	uint64_t ext_seq;
+	int16_t diff;
+	struct tpkt_jitter_slot *slot;
+
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+
+	if (!jitter->started) {
+		/* Start far enough from 0 so that older sequence numbers
+		 * can still be extended */
+		ext_seq = (uint64_t)1 << 32 | seq;
+		jitter->next = ext_seq;
+		jitter->end = ext_seq;
+		jitter->started = 1;
+	} else {
+		/* Extend relative to the newest sequence number */
+		diff = (int16_t)(seq - (uint16_t)(jitter->end - 1));
+		ext_seq = jitter->end - 1 + diff;
+	}
+
+	if (ext_seq < jitter->next) {
+		jitter->stats.late++;
+		return -ETIMEDOUT;
+	}
+	if (tpkt_jitter_get_slot(jitter, ext_seq) != NULL) {
+		jitter->stats.duplicate++;
+		return -EEXIST;
+	}
+
+	/* Make room in the slots window */
+	while (ext_seq - jitter->next >= jitter->size)
+		tpkt_jitter_skip(jitter);
+
+	slot = &jitter->slots[ext_seq & jitter->mask];
+	tpkt_ref(pkt);
+	slot->pkt = pkt;
+	slot->ext_seq = ext_seq;
+	jitter->count++;
+	jitter->stats.received++;
+	if (ext_seq >= jitter->end)
+		jitter->end = ext_seq + 1;
+
+	return 0;
+}
+
+
+int tpkt_jitter_pop(struct tpkt_jitter *jitter,
+		    uint64_t ts,
+		    struct tpkt_list *list)
+{
+	int res;
+	int released = 0;
+	struct tpkt_jitter_slot *slot;
+
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	while (jitter->count > 0) {
+		slot = tpkt_jitter_get_slot(jitter, jitter->next);
+		if (slot == NULL) {
+			/* Missing packet: give up when the next available
+			 * packet is due */
+			slot = tpkt_jitter_find_next(jitter);
+			if (slot == NULL ||
+			    ts < slot->pkt->timestamp + jitter->gap_delay)
+				break;
+			jitter->stats.lost += slot->ext_seq - jitter->next;
+			jitter->next = slot->ext_seq;
+		} else if (jitter->cfg.playout_delay != 0 &&
+			   ts < slot->pkt->timestamp +
+					   jitter->cfg.playout_delay) {
+			break;
+		}
+
+		/* Transfer the reference to the list */
+		res = tpkt_list_add_last(list, slot->pkt);
+		if (res < 0)
+			return (released > 0) ? released : res;
+		tpkt_unref(slot->pkt);
+		slot->pkt = NULL;
+		jitter->count--;
+		jitter->next++;
+		jitter->stats.released++;
+		released++;
+	}
+
+	return released;
+}
+
+
+int tpkt_jitter_get_next_deadline(struct tpkt_jitter *jitter, uint64_t *ts)
+{
+	struct tpkt_jitter_slot *slot;
+
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ts == NULL, EINVAL);
+
+	if (jitter->count == 0)
+		return -ENOENT;
+
+	slot = tpkt_jitter_get_slot(jitter, jitter->next);
+	if (slot != NULL) {
+		*ts = slot->pkt->timestamp + jitter->cfg.playout_delay;
+		return 0;
+	}
+
+	slot = tpkt_jitter_find_next(jitter);
+	if (slot == NULL)
+		return -ENOENT;
+	*ts = slot->pkt->timestamp + jitter->gap_delay;
+	return 0;
+}
+
+
+int tpkt_jitter_flush(struct tpkt_jitter *jitter)
+{
+	size_t i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+
+	for (i = 0; i < jitter->size && jitter->count > 0; i++) {
+		if (jitter->slots[i].pkt == NULL)
+			continue;
+		tpkt_unref(jitter->slots[i].pkt);
+		jitter->slots[i].pkt = NULL;
+		jitter->count--;
+	}
+	jitter->started = 0;
+
+	return 0;
+}
+
+
+int tpkt_jitter_get_count(struct tpkt_jitter *jitter)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+
+	return (int)jitter->count;
+}
+
+
+int tpkt_jitter_get_stats(struct tpkt_jitter *jitter,
+			  struct tpkt_jitter_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(jitter == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = jitter->stats;
+	return 0;
+}
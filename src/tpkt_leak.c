@@ -0,0 +1,457 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_leak.h>
+
+
+#ifdef TPKT_LEAK_TRACKER
+
+#	include <inttypes.h>
+#	include <limits.h>
+#	ifdef __linux__
+#		include <dlfcn.h>
+#	endif /* __linux__ */
+
+/* Number of registry shards (power of 2) */
+#	define TPKT_LEAK_SHARD_COUNT 64
+
+
+struct tpkt_leak_shard {
+	pthread_mutex_t mutex;
+	/* Registered packets in creation order (initialized on first use) */
+	struct list_node packets;
+	size_t count;
+} __attribute__((aligned(TPKT_CACHE_LINE_SIZE)));
+
+
+/* Call site aggregation table (open addressing, power of 2 size) */
+struct tpkt_leak_site_table {
+	struct tpkt_leak_site *sites;
+	size_t size;
+	size_t count;
+};
+
+
+static struct tpkt_leak_shard tpkt_leak_shards[TPKT_LEAK_SHARD_COUNT] = {
+	[0 ... TPKT_LEAK_SHARD_COUNT - 1] = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+	},
+};
+
+
+static inline uint64_t tpkt_leak_now(void)
+{
+	struct timespec ts;
+	uint64_t us = 0;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+static inline struct tpkt_leak_shard *
+tpkt_leak_get_shard(const struct tpkt_packet *pkt)
+{
+	/* Packets are at least 64 bytes apart */
+	uintptr_t addr = (uintptr_t)pkt >> 6;
+
+	return &tpkt_leak_shards[(addr ^ (addr >> 6)) &
+				 (TPKT_LEAK_SHARD_COUNT - 1)];
+}
+
+
+void tpkt_leak_register(struct tpkt_packet *pkt, const void *site)
+{
+	struct tpkt_leak_shard *shard = tpkt_leak_get_shard(pkt);
+
+	pkt->leak.site = site;
+
+	pthread_mutex_lock(&shard->mutex);
+	if (shard->packets.next == NULL)
+		list_init(&shard->packets);
+	/* Time taken under the lock so that each shard list stays sorted */
+	pkt->leak.time = tpkt_leak_now();
+	list_add_before(&shard->packets, &pkt->leak.node);
+	shard->count++;
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+
+void tpkt_leak_unregister(struct tpkt_packet *pkt)
+{
+	struct tpkt_leak_shard *shard = tpkt_leak_get_shard(pkt);
+
+	pthread_mutex_lock(&shard->mutex);
+	if (list_node_is_ref(&pkt->leak.node)) {
+		list_del(&pkt->leak.node);
+		shard->count--;
+	}
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+
+int tpkt_leak_is_available(void)
+{
+	return 1;
+}
+
+
+int tpkt_leak_get_count(void)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < TPKT_LEAK_SHARD_COUNT; i++) {
+		pthread_mutex_lock(&tpkt_leak_shards[i].mutex);
+		count += tpkt_leak_shards[i].count;
+		pthread_mutex_unlock(&tpkt_leak_shards[i].mutex);
+	}
+
+	return count > INT_MAX ? INT_MAX : (int)count;
+}
+
+
+static int tpkt_leak_packet_compare(const void *a, const void *b)
+{
+	const struct tpkt_leak_packet *pa = a, *pb = b;
+
+	if (pa->age_us != pb->age_us)
+		return pa->age_us > pb->age_us ? -1 : 1;
+	return 0;
+}
+
+
+int tpkt_leak_get_oldest(struct tpkt_leak_packet *pkts,
+			 size_t max_count,
+			 size_t *count)
+{
+	size_t i, n = 0;
+	uint64_t now;
+	struct tpkt_leak_packet *tmp;
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pkts == NULL && max_count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+
+	*count = 0;
+	if (max_count == 0)
+		return 0;
+
+	/* The oldest packets are the first ones of each shard list; collect
+	 * up to max_count packets per shard and keep the oldest overall */
+	tmp = malloc(TPKT_LEAK_SHARD_COUNT * max_count * sizeof(*tmp));
+	if (tmp == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return -ENOMEM;
+	}
+
+	now = tpkt_leak_now();
+	for (i = 0; i < TPKT_LEAK_SHARD_COUNT; i++) {
+		struct tpkt_leak_shard *shard = &tpkt_leak_shards[i];
+		size_t shard_count = 0;
+
+		pthread_mutex_lock(&shard->mutex);
+		if (shard->packets.next == NULL) {
+			pthread_mutex_unlock(&shard->mutex);
+			continue;
+		}
+		list_walk_entry_forward(&shard->packets, pkt, leak.node)
+		{
+			if (shard_count++ == max_count)
+				break;
+			tmp[n].pkt = pkt;
+			tmp[n].site = pkt->leak.site;
+			tmp[n].age_us =
+				now > pkt->leak.time ? now - pkt->leak.time : 0;
+			n++;
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+
+	qsort(tmp, n, sizeof(*tmp), tpkt_leak_packet_compare);
+	if (n > max_count)
+		n = max_count;
+	memcpy(pkts, tmp, n * sizeof(*tmp));
+	*count = n;
+	free(tmp);
+
+	return 0;
+}
+
+
+static int tpkt_leak_site_table_grow(struct tpkt_leak_site_table *table)
+{
+	size_t i, j, size = table->size > 0 ? table->size * 2 : 64;
+	struct tpkt_leak_site *sites;
+
+	sites = calloc(size, sizeof(*sites));
+	if (sites == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < table->size; i++) {
+		if (table->sites[i].count == 0)
+			continue;
+		j = ((uintptr_t)table->sites[i].site >> 2) & (size - 1);
+		while (sites[j].count != 0)
+			j = (j + 1) & (size - 1);
+		sites[j] = table->sites[i];
+	}
+
+	free(table->sites);
+	table->sites = sites;
+	table->size = size;
+
+	return 0;
+}
+
+
+static int tpkt_leak_site_table_add(struct tpkt_leak_site_table *table,
+				    const void *site,
+				    uint64_t age_us)
+{
+	int res;
+	size_t i;
+
+	/* Keep the load factor below 1/2 */
+	if (2 * (table->count + 1) > table->size) {
+		res = tpkt_leak_site_table_grow(table);
+		if (res < 0)
+			return res;
+	}
+
+	i = ((uintptr_t)site >> 2) & (table->size - 1);
+	while (table->sites[i].count != 0 && table->sites[i].site != site)
+		i = (i + 1) & (table->size - 1);
+
+	if (table->sites[i].count == 0) {
+		table->sites[i].site = site;
+		table->count++;
+	}
+	table->sites[i].count++;
+	if (age_us > table->sites[i].max_age_us)
+		table->sites[i].max_age_us = age_us;
+
+	return 0;
+}
+
+
+static int tpkt_leak_site_compare(const void *a, const void *b)
+{
+	const struct tpkt_leak_site *sa = a, *sb = b;
+
+	/* Empty table entries last */
+	if (sa->count != sb->count)
+		return sa->count > sb->count ? -1 : 1;
+	if (sa->max_age_us != sb->max_age_us)
+		return sa->max_age_us > sb->max_age_us ? -1 : 1;
+	return 0;
+}
+
+
+int tpkt_leak_get_sites(struct tpkt_leak_site *sites,
+			size_t max_count,
+			size_t *count)
+{
+	int res = 0;
+	size_t i, n;
+	uint64_t now;
+	struct tpkt_leak_site_table table = {0};
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(sites == NULL && max_count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+
+	*count = 0;
+	if (max_count == 0)
+		return 0;
+
+	now = tpkt_leak_now();
+	for (i = 0; i < TPKT_LEAK_SHARD_COUNT && res == 0; i++) {
+		struct tpkt_leak_shard *shard = &tpkt_leak_shards[i];
+
+		pthread_mutex_lock(&shard->mutex);
+		if (shard->packets.next == NULL) {
+			pthread_mutex_unlock(&shard->mutex);
+			continue;
+		}
+		list_walk_entry_forward(&shard->packets, pkt, leak.node)
+		{
+			uint64_t age = now > pkt->leak.time
+					       ? now - pkt->leak.time
+					       : 0;
+			res = tpkt_leak_site_table_add(
+				&table, pkt->leak.site, age);
+			if (res < 0)
+				break;
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+	if (res < 0 || table.count == 0)
+		goto out;
+
+	qsort(table.sites, table.size, sizeof(*table.sites),
+	      tpkt_leak_site_compare);
+	n = table.count < max_count ? table.count : max_count;
+	memcpy(sites, table.sites, n * sizeof(*sites));
+	*count = n;
+
+out:
+	free(table.sites);
+	return res;
+}
+
+
+/* Symbol containing a call site, or if not exported the object file
+ * (the offset can then be resolved with addr2line) */
+static const char *tpkt_leak_site_name(const void *site, uintptr_t *offset)
+{
+#	ifdef __linux__
+	Dl_info info;
+	const char *p;
+
+	if (dladdr(site, &info) != 0) {
+		if (info.dli_sname != NULL) {
+			*offset = (uintptr_t)site - (uintptr_t)info.dli_saddr;
+			return info.dli_sname;
+		}
+		if (info.dli_fname != NULL) {
+			*offset = (uintptr_t)site - (uintptr_t)info.dli_fbase;
+			p = strrchr(info.dli_fname, '/');
+			return p != NULL ? p + 1 : info.dli_fname;
+		}
+	}
+#	endif /* __linux__ */
+	*offset = (uintptr_t)site;
+	return "?";
+}
+
+
+int tpkt_leak_dump(size_t max_count, uint64_t min_age_us)
+{
+	int res;
+	size_t i, count;
+	uintptr_t offset;
+	const char *name;
+	struct tpkt_leak_site *sites = NULL;
+	struct tpkt_leak_packet *pkts = NULL;
+
+	res = tpkt_leak_get_count();
+	if (res < 0)
+		return res;
+	ULOGI("leak: %d live packets", res);
+	if (max_count == 0)
+		return 0;
+
+	sites = calloc(max_count, sizeof(*sites));
+	pkts = calloc(max_count, sizeof(*pkts));
+	if (sites == NULL || pkts == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto out;
+	}
+
+	res = tpkt_leak_get_sites(sites, max_count, &count);
+	if (res < 0)
+		goto out;
+	for (i = 0; i < count; i++) {
+		name = tpkt_leak_site_name(sites[i].site, &offset);
+		ULOGI("leak: site %p (%s+0x%" PRIxPTR "): %zu packets, "
+		      "oldest %" PRIu64 " us",
+		      sites[i].site,
+		      name,
+		      offset,
+		      sites[i].count,
+		      sites[i].max_age_us);
+	}
+
+	res = tpkt_leak_get_oldest(pkts, max_count, &count);
+	if (res < 0)
+		goto out;
+	for (i = 0; i < count && pkts[i].age_us >= min_age_us; i++) {
+		name = tpkt_leak_site_name(pkts[i].site, &offset);
+		ULOGI("leak: packet %p from %p (%s+0x%" PRIxPTR "): "
+		      "age %" PRIu64 " us",
+		      pkts[i].pkt,
+		      pkts[i].site,
+		      name,
+		      offset,
+		      pkts[i].age_us);
+	}
+
+out:
+	free(sites);
+	free(pkts);
+	return res;
+}
+
+#else /* TPKT_LEAK_TRACKER */
+
+int tpkt_leak_is_available(void)
+{
+	return 0;
+}
+
+
+int tpkt_leak_get_count(void)
+{
+	return -ENOSYS;
+}
+
+
+int tpkt_leak_get_oldest(struct tpkt_leak_packet *pkts,
+			 size_t max_count,
+			 size_t *count)
+{
+	(void)pkts;
+	(void)max_count;
+	(void)count;
+	return -ENOSYS;
+}
+
+
+int tpkt_leak_get_sites(struct tpkt_leak_site *sites,
+			size_t max_count,
+			size_t *count)
+{
+	(void)sites;
+	(void)max_count;
+	(void)count;
+	return -ENOSYS;
+}
+
+
+int tpkt_leak_dump(size_t max_count, uint64_t min_age_us)
+{
+	(void)max_count;
+	(void)min_age_us;
+	return -ENOSYS;
+}
+
+#endif /* TPKT_LEAK_TRACKER */
@@ -25,6 +25,27 @@
  */
 
 #include "tpkt_priv.h"
+#include "tpkt_probes.h"
+
+
+void tpkt_list_count_add(struct tpkt_list *list, struct tpkt_packet *pkt)
+{
+	list->count++;
+	if (list->count > list->max_count)
+		list->max_count = list->count;
+	list->added_packets++;
+	if (list->byte_stats) {
+		size_t len = 0;
+		if (pkt->buf != NULL)
+			pomp_buffer_get_cdata(pkt->buf, NULL, &len, NULL);
+		else
+			len = pkt->data.len;
+		list->added_bytes += len;
+	}
+	tpkt_stats_inc(TPKT_STAT_LIST_ADD);
+	TPKT_TRACE_POINT(pkt, ENQUEUED);
+	TPKT_PROBE_PACKET_ARG(list_add, list, pkt);
+}
 
 
 int tpkt_list_new(struct tpkt_list **ret_obj)
@@ -32,7 +53,7 @@ int tpkt_list_new(struct tpkt_list **ret_obj)
 	int res = 0;
 	struct tpkt_list *list;
 
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
 	list = calloc(1, sizeof(*list));
 	if (list == NULL) {
@@ -58,6 +79,7 @@ int tpkt_list_destroy(struct tpkt_list *list)
 	if (res < 0)
 		return res;
 
+	TPKT_TRACE_LIST_CLEAR(list);
 	free(list);
 
 	return 0;
@@ -66,7 +88,7 @@ int tpkt_list_destroy(struct tpkt_list *list)
 
 int tpkt_list_get_count(struct tpkt_list *list)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(list == NULL, EINVAL);
 
 	return (int)list->count;
 }
@@ -90,7 +112,7 @@ struct tpkt_packet *tpkt_list_prev(struct tpkt_list *list,
 	struct list_node *node;
 	struct tpkt_packet *prev;
 
-	ULOG_ERRNO_RETURN_VAL_IF(list == NULL, EINVAL, NULL);
+	TPKT_ARG_RETURN_VAL_IF(list == NULL, EINVAL, NULL);
 
 	node = list_prev(&list->packets, next ? &next->node : &list->packets);
 	if (!node)
@@ -107,7 +129,7 @@ struct tpkt_packet *tpkt_list_next(struct tpkt_list *list,
 	struct list_node *node;
 	struct tpkt_packet *next;
 
-	ULOG_ERRNO_RETURN_VAL_IF(list == NULL, EINVAL, NULL);
+	TPKT_ARG_RETURN_VAL_IF(list == NULL, EINVAL, NULL);
 
 	node = list_next(&list->packets, prev ? &prev->node : &list->packets);
 	if (!node)
@@ -136,8 +158,8 @@ int tpkt_list_add_before(struct tpkt_list *list,
 {
 	struct list_node *node;
 
-	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(list == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(next && list_node_is_unref(&next->node),
 				 ENOENT);
 	ULOG_ERRNO_RETURN_ERR_IF(list_node_is_ref(&pkt->node), EBUSY);
@@ -148,7 +170,7 @@ int tpkt_list_add_before(struct tpkt_list *list,
 
 	list_add_before(node, &pkt->node);
 
-	list->count++;
+	tpkt_list_count_add(list, pkt);
 
 	return 0;
 }
@@ -160,8 +182,8 @@ int tpkt_list_add_after(struct tpkt_list *list,
 {
 	struct list_node *node;
 
-	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(list == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(prev && list_node_is_unref(&prev->node),
 				 ENOENT);
 	ULOG_ERRNO_RETURN_ERR_IF(list_node_is_ref(&pkt->node), EBUSY);
@@ -172,7 +194,7 @@ int tpkt_list_add_after(struct tpkt_list *list,
 
 	list_add_after(node, &pkt->node);
 
-	list->count++;
+	tpkt_list_count_add(list, pkt);
 
 	return 0;
 }
@@ -196,8 +218,8 @@ int tpkt_list_move_before(struct tpkt_list *list,
 {
 	struct list_node *node;
 
-	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(list == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(next && list_node_is_unref(&next->node),
 				 ENOENT);
 	ULOG_ERRNO_RETURN_ERR_IF(list_node_is_unref(&pkt->node), ENOENT);
@@ -216,8 +238,8 @@ int tpkt_list_move_after(struct tpkt_list *list,
 {
 	struct list_node *node;
 
-	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(list == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(prev && list_node_is_unref(&prev->node),
 				 ENOENT);
 	ULOG_ERRNO_RETURN_ERR_IF(list_node_is_unref(&pkt->node), ENOENT);
@@ -232,12 +254,15 @@ int tpkt_list_move_after(struct tpkt_list *list,
 
 int tpkt_list_remove(struct tpkt_list *list, struct tpkt_packet *pkt)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(list == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(pkt == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(list_node_is_unref(&pkt->node), ENOENT);
 
 	list_del(&pkt->node);
 	list->count--;
+	tpkt_stats_inc(TPKT_STAT_LIST_REMOVE);
+	TPKT_TRACE_DEQUEUE(list, pkt);
+	TPKT_PROBE_PACKET_ARG(list_remove, list, pkt);
 
 	return 0;
 }
@@ -248,7 +273,7 @@ int tpkt_list_flush(struct tpkt_list *list)
 	struct tpkt_packet *pkt;
 	struct tpkt_packet *pkt_tmp;
 
-	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	TPKT_ARG_RETURN_ERR_IF(list == NULL, EINVAL);
 
 	list_walk_entry_forward_safe(&list->packets, pkt, pkt_tmp, node)
 	{
@@ -256,7 +281,45 @@ int tpkt_list_flush(struct tpkt_list *list)
 		tpkt_unref(pkt);
 	}
 
+	tpkt_stats_add(TPKT_STAT_LIST_REMOVE, list->count);
 	list->count = 0;
 
 	return 0;
 }
+
+
+int tpkt_list_get_stats(struct tpkt_list *list, struct tpkt_list_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	stats->count = list->count;
+	stats->max_count = list->max_count;
+	stats->added_packets = list->added_packets;
+	stats->added_bytes = list->added_bytes;
+
+	return 0;
+}
+
+
+int tpkt_list_enable_byte_stats(struct tpkt_list *list, int enable)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	list->byte_stats = !!enable;
+	list->added_bytes = 0;
+
+	return 0;
+}
+
+
+int tpkt_list_reset_stats(struct tpkt_list *list)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	list->max_count = list->count;
+	list->added_packets = 0;
+	list->added_bytes = 0;
+
+	return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+
+
+struct tpkt_mem_account tpkt_mem_global = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+/* Set while a level change callback is running on the current thread:
+ * level changes caused by the callback itself are reported on the next
+ * allocation or release after the callback returns */
+static __thread int tpkt_mem_in_cb;
+
+
+static inline uint64_t tpkt_mem_load(const uint64_t *val)
+{
+	return __atomic_load_n(val, __ATOMIC_RELAXED);
+}
+
+
+static enum tpkt_mem_level tpkt_mem_get_level(struct tpkt_mem_account *acct,
+					      uint64_t packets,
+					      uint64_t bytes)
+{
+	uint64_t bytes_limit, packets_limit;
+
+	bytes_limit = tpkt_mem_load(&acct->limits.hard_bytes);
+	packets_limit = tpkt_mem_load(&acct->limits.hard_packets);
+	if ((bytes_limit != 0 && bytes >= bytes_limit) ||
+	    (packets_limit != 0 && packets >= packets_limit))
+		return TPKT_MEM_LEVEL_HARD;
+
+	bytes_limit = tpkt_mem_load(&acct->limits.soft_bytes);
+	packets_limit = tpkt_mem_load(&acct->limits.soft_packets);
+	if ((bytes_limit != 0 && bytes >= bytes_limit) ||
+	    (packets_limit != 0 && packets >= packets_limit))
+		return TPKT_MEM_LEVEL_SOFT;
+
+	return TPKT_MEM_LEVEL_NORMAL;
+}
+
+
+static void tpkt_mem_update_level(struct tpkt_mem_account *acct,
+				  uint64_t packets,
+				  uint64_t bytes)
+{
+	enum tpkt_mem_level level;
+
+	level = tpkt_mem_get_level(acct, packets, bytes);
+	if ((int)level == __atomic_load_n(&acct->level, __ATOMIC_RELAXED) ||
+	    tpkt_mem_in_cb)
+		return;
+
+	/* The callback is called with the mutex held so that the level
+	 * changes are reported in order; re-compute the level with the
+	 * current counts as other threads may have changed them */
+	pthread_mutex_lock(&acct->mutex);
+	level = tpkt_mem_get_level(acct,
+				   tpkt_mem_load(&acct->packets),
+				   tpkt_mem_load(&acct->bytes));
+	if ((int)level != acct->level) {
+		__atomic_store_n(&acct->level, level, __ATOMIC_RELAXED);
+		if (acct->limits.cb != NULL) {
+			tpkt_mem_in_cb = 1;
+			acct->limits.cb(
+				acct->pool, level, acct->limits.userdata);
+			tpkt_mem_in_cb = 0;
+		}
+	}
+	pthread_mutex_unlock(&acct->mutex);
+}
+
+
+static void tpkt_mem_update_peak(uint64_t *peak, uint64_t val)
+{
+	uint64_t cur = tpkt_mem_load(peak);
+
+	while (val > cur && !__atomic_compare_exchange_n(peak,
+							 &cur,
+							 val,
+							 1,
+							 __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED))
+		;
+}
+
+
+void tpkt_mem_account_init(struct tpkt_mem_account *acct,
+			   struct tpkt_pool *pool)
+{
+	memset(acct, 0, sizeof(*acct));
+	pthread_mutex_init(&acct->mutex, NULL);
+	acct->pool = pool;
+}
+
+
+void tpkt_mem_account_clear(struct tpkt_mem_account *acct)
+{
+	pthread_mutex_destroy(&acct->mutex);
+}
+
+
+int tpkt_mem_charge(struct tpkt_mem_account *acct,
+		    uint64_t packets,
+		    uint64_t bytes)
+{
+	uint64_t cur_packets, cur_bytes, packets_limit, bytes_limit;
+
+	/* Keep the shared counters off the allocation path when nothing
+	 * uses them */
+	if (!__atomic_load_n(&acct->active, __ATOMIC_RELAXED))
+		return 0;
+
+	cur_packets = __atomic_add_fetch(
+		&acct->packets, packets, __ATOMIC_RELAXED);
+	cur_bytes = __atomic_add_fetch(&acct->bytes, bytes, __ATOMIC_RELAXED);
+
+	if (__atomic_load_n(&acct->limits.fail_fast, __ATOMIC_RELAXED)) {
+		packets_limit = tpkt_mem_load(&acct->limits.hard_packets);
+		bytes_limit = tpkt_mem_load(&acct->limits.hard_bytes);
+		if ((packets_limit != 0 && cur_packets > packets_limit) ||
+		    (bytes_limit != 0 && cur_bytes > bytes_limit)) {
+			__atomic_sub_fetch(
+				&acct->packets, packets, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(
+				&acct->bytes, bytes, __ATOMIC_RELAXED);
+			__atomic_add_fetch(
+				&acct->failures, 1, __ATOMIC_RELAXED);
+			tpkt_mem_update_level(
+				acct, cur_packets - packets, cur_bytes - bytes);
+			return -ENOBUFS;
+		}
+	}
+
+	tpkt_mem_update_peak(&acct->peak_packets, cur_packets);
+	tpkt_mem_update_peak(&acct->peak_bytes, cur_bytes);
+	tpkt_mem_update_level(acct, cur_packets, cur_bytes);
+
+	return 1;
+}
+
+
+void tpkt_mem_uncharge(struct tpkt_mem_account *acct,
+		       uint64_t packets,
+		       uint64_t bytes)
+{
+	uint64_t cur_packets, cur_bytes;
+
+	cur_packets = __atomic_sub_fetch(
+		&acct->packets, packets, __ATOMIC_RELAXED);
+	cur_bytes = __atomic_sub_fetch(&acct->bytes, bytes, __ATOMIC_RELAXED);
+	tpkt_mem_update_level(acct, cur_packets, cur_bytes);
+}
+
+
+static int tpkt_mem_account_set_limits(struct tpkt_mem_account *acct,
+				       const struct tpkt_mem_limits *limits)
+{
+	struct tpkt_mem_limits none;
+
+	ULOG_ERRNO_RETURN_ERR_IF(tpkt_mem_in_cb, EBUSY);
+
+	if (limits == NULL) {
+		memset(&none, 0, sizeof(none));
+		limits = &none;
+	}
+
+	pthread_mutex_lock(&acct->mutex);
+	__atomic_store_n(
+		&acct->limits.soft_bytes, limits->soft_bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&acct->limits.soft_packets,
+			 limits->soft_packets,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(
+		&acct->limits.hard_bytes, limits->hard_bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&acct->limits.hard_packets,
+			 limits->hard_packets,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(
+		&acct->limits.fail_fast, limits->fail_fast, __ATOMIC_RELAXED);
+	acct->limits.cb = limits->cb;
+	acct->limits.userdata = limits->userdata;
+	acct->limits.accounting = limits->accounting;
+	__atomic_store_n(&acct->active,
+			 limits->soft_bytes != 0 || limits->soft_packets != 0 ||
+				 limits->hard_bytes != 0 ||
+				 limits->hard_packets != 0 ||
+				 limits->cb != NULL || limits->accounting,
+			 __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&acct->mutex);
+
+	return 0;
+}
+
+
+static void tpkt_mem_account_get_stats(struct tpkt_mem_account *acct,
+				       struct tpkt_mem_stats *stats)
+{
+	stats->packets = tpkt_mem_load(&acct->packets);
+	stats->bytes = tpkt_mem_load(&acct->bytes);
+	stats->peak_packets = tpkt_mem_load(&acct->peak_packets);
+	stats->peak_bytes = tpkt_mem_load(&acct->peak_bytes);
+	stats->failures = tpkt_mem_load(&acct->failures);
+	stats->level = __atomic_load_n(&acct->level, __ATOMIC_RELAXED);
+}
+
+
+int tpkt_mem_set_limits(const struct tpkt_mem_limits *limits)
+{
+	return tpkt_mem_account_set_limits(&tpkt_mem_global, limits);
+}
+
+
+int tpkt_mem_get_stats(struct tpkt_mem_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	tpkt_mem_account_get_stats(&tpkt_mem_global, stats);
+
+	return 0;
+}
+
+
+int tpkt_pool_set_mem_limits(struct tpkt_pool *pool,
+			     const struct tpkt_mem_limits *limits)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+
+	return tpkt_mem_account_set_limits(&pool->mem_acct, limits);
+}
+
+
+int tpkt_pool_get_mem_stats(struct tpkt_pool *pool,
+			    struct tpkt_mem_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	tpkt_mem_account_get_stats(&pool->mem_acct, stats);
+
+	return 0;
+}
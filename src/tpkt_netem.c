@@ -0,0 +1,377 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_netem.h>
+
+#include <limits.h>
+
+
+#define TPKT_NETEM_DEFAULT_LIMIT 10000
+#define TPKT_NETEM_PPM 1000000
+
+
+/* Queued packet; the sequence number keeps the push order of the packets
+ * with the same delivery time */
+struct tpkt_netem_entry {
+	uint64_t time;
+	uint64_t seq;
+	struct tpkt_packet *pkt;
+};
+
+
+struct tpkt_netem {
+	struct tpkt_netem_cfg cfg;
+
+	/* Pseudo-random generator state (xorshift64*) */
+	uint64_t rng;
+
+	/* Gilbert-Elliott model state */
+	int bad_state;
+
+	/* Time at which the link is free for the next packet, in
+	 * nanoseconds (bandwidth limit) */
+	uint64_t link_free;
+
+	/* Queued packets: binary min-heap on (time, seq) of limit entries */
+	struct tpkt_netem_entry *heap;
+	size_t count;
+	uint64_t seq;
+
+	struct tpkt_netem_stats stats;
+};
+
+
+static uint64_t tpkt_netem_random(struct tpkt_netem *netem)
+{
+	uint64_t x = netem->rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	netem->rng = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+/* Return 1 with the given probability in parts per million */
+static int tpkt_netem_chance(struct tpkt_netem *netem, uint32_t ppm)
+{
+	if (ppm == 0)
+		return 0;
+	if (ppm >= TPKT_NETEM_PPM)
+		return 1;
+	return ((tpkt_netem_random(netem) >> 32) * TPKT_NETEM_PPM >> 32) <
+	       ppm;
+}
+
+
+static int tpkt_netem_is_lost(struct tpkt_netem *netem)
+{
+	const struct tpkt_netem_cfg *cfg = &netem->cfg;
+
+	switch (cfg->loss_model) {
+	case TPKT_NETEM_LOSS_BERNOULLI:
+		return tpkt_netem_chance(netem, cfg->loss);
+	case TPKT_NETEM_LOSS_GILBERT_ELLIOTT:
+		/* State transition, then loss in the new state */
+		if (netem->bad_state)
+			netem->bad_state =
+				!tpkt_netem_chance(netem, cfg->gilbert.r);
+		else
+			netem->bad_state =
+				tpkt_netem_chance(netem, cfg->gilbert.p);
+		return tpkt_netem_chance(netem,
+					 netem->bad_state
+						 ? cfg->gilbert.loss_bad
+						 : cfg->gilbert.loss_good);
+	case TPKT_NETEM_LOSS_NONE:
+	default:
+		return 0;
+	}
+}
+
+
+static inline int tpkt_netem_entry_before(const struct tpkt_netem_entry *a,
+					  const struct tpkt_netem_entry *b)
+{
+	return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+
+static void tpkt_netem_heap_push(struct tpkt_netem *netem,
+				 uint64_t time,
+				 struct tpkt_packet *pkt)
+{
+	size_t i = netem->count++, parent;
+	struct tpkt_netem_entry entry = {time, netem->seq++, pkt};
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!tpkt_netem_entry_before(&entry, &netem->heap[parent]))
+			break;
+		netem->heap[i] = netem->heap[parent];
+		i = parent;
+	}
+	netem->heap[i] = entry;
+}
+
+
+static struct tpkt_packet *tpkt_netem_heap_pop(struct tpkt_netem *netem)
+{
+	size_t i = 0, child;
+	struct tpkt_packet *pkt = netem->heap[0].pkt;
+	struct tpkt_netem_entry last = netem->heap[--netem->count];
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= netem->count)
+			break;
+		if (child + 1 < netem->count &&
+		    tpkt_netem_entry_before(&netem->heap[child + 1],
+					    &netem->heap[child]))
+			child++;
+		if (!tpkt_netem_entry_before(&netem->heap[child], &last))
+			break;
+		netem->heap[i] = netem->heap[child];
+		i = child;
+	}
+	netem->heap[i] = last;
+
+	return pkt;
+}
+
+
+/* Compute the delivery time of a packet and queue it */
+static void tpkt_netem_schedule(struct tpkt_netem *netem,
+				struct tpkt_packet *pkt,
+				uint64_t arrival)
+{
+	const struct tpkt_netem_cfg *cfg = &netem->cfg;
+	uint64_t time, delay = cfg->delay, jitter, start;
+	size_t len = 0;
+
+	if (tpkt_netem_chance(netem, cfg->reorder)) {
+		netem->stats.reordered++;
+		tpkt_netem_heap_push(netem, arrival, pkt);
+		return;
+	}
+
+	if (cfg->jitter > 0) {
+		/* Uniform in [-jitter, jitter] */
+		jitter = tpkt_netem_random(netem) % (2 * cfg->jitter + 1);
+		if (jitter >= cfg->jitter)
+			delay += jitter - cfg->jitter;
+		else if (cfg->jitter - jitter < delay)
+			delay -= cfg->jitter - jitter;
+		else
+			delay = 0;
+	}
+	time = arrival + delay;
+
+	if (cfg->rate > 0) {
+		/* Serialization after the delay, in nanoseconds */
+		tpkt_get_cdata(pkt, NULL, &len, NULL);
+		start = time * 1000;
+		if (netem->link_free > start)
+			start = netem->link_free;
+		netem->link_free = start + (len + cfg->overhead) *
+						   8000000000ULL / cfg->rate;
+		time = (netem->link_free + 999) / 1000;
+	}
+
+	tpkt_netem_heap_push(netem, time, pkt);
+}
+
+
+int tpkt_netem_new(const struct tpkt_netem_cfg *cfg,
+		   struct tpkt_netem **ret_obj)
+{
+	int res;
+	uint64_t seed;
+	struct tpkt_netem *netem;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->loss_model != TPKT_NETEM_LOSS_NONE &&
+			cfg->loss_model != TPKT_NETEM_LOSS_BERNOULLI &&
+			cfg->loss_model != TPKT_NETEM_LOSS_GILBERT_ELLIOTT,
+		EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->jitter > UINT64_MAX / 4, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	netem = calloc(1, sizeof(*netem));
+	if (netem == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	netem->cfg = *cfg;
+	if (netem->cfg.limit == 0)
+		netem->cfg.limit = TPKT_NETEM_DEFAULT_LIMIT;
+
+	/* Scramble the seed (splitmix64) so that close seeds give unrelated
+	 * sequences; the xorshift state must not be 0 */
+	seed = cfg->seed + 0x9E3779B97F4A7C15ULL;
+	seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+	seed ^= seed >> 31;
+	netem->rng = seed != 0 ? seed : 1;
+
+	netem->heap = calloc(netem->cfg.limit, sizeof(*netem->heap));
+	if (netem->heap == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		free(netem);
+		return res;
+	}
+
+	*ret_obj = netem;
+	return 0;
+}
+
+
+int tpkt_netem_destroy(struct tpkt_netem *netem)
+{
+	size_t i;
+
+	if (netem == NULL)
+		return 0;
+
+	for (i = 0; i < netem->count; i++)
+		tpkt_unref(netem->heap[i].pkt);
+	free(netem->heap);
+	free(netem);
+
+	return 0;
+}
+
+
+int tpkt_netem_push(struct tpkt_netem *netem,
+		    struct tpkt_list *list,
+		    uint64_t ts)
+{
+	int res;
+	uint64_t arrival;
+	struct tpkt_packet *pkt, *tmp, *dup;
+
+	ULOG_ERRNO_RETURN_ERR_IF(netem == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	list_walk_entry_forward_safe(&list->packets, pkt, tmp, node)
+	{
+		tpkt_list_remove(list, pkt);
+		netem->stats.pushed++;
+		arrival = pkt->timestamp != 0 ? pkt->timestamp : ts;
+
+		if (tpkt_netem_is_lost(netem)) {
+			netem->stats.lost++;
+			tpkt_unref(pkt);
+			continue;
+		}
+
+		/* The delivery time is written in the packet timestamp */
+		if (tpkt_get_ref_count(pkt) > 1) {
+			res = tpkt_clone(pkt, &dup);
+			tpkt_unref(pkt);
+			if (res < 0) {
+				netem->stats.overflow++;
+				continue;
+			}
+			pkt = dup;
+		}
+
+		if (tpkt_netem_chance(netem, netem->cfg.duplicate) &&
+		    netem->count + 1 < netem->cfg.limit &&
+		    tpkt_clone(pkt, &dup) == 0) {
+			netem->stats.duplicated++;
+			tpkt_netem_schedule(netem, dup, arrival);
+		}
+
+		if (netem->count >= netem->cfg.limit) {
+			netem->stats.overflow++;
+			tpkt_unref(pkt);
+			continue;
+		}
+		tpkt_netem_schedule(netem, pkt, arrival);
+	}
+
+	return 0;
+}
+
+
+int tpkt_netem_pop(struct tpkt_netem *netem,
+		   uint64_t ts,
+		   struct tpkt_list *list)
+{
+	int res, count = 0;
+	uint64_t time;
+	struct tpkt_packet *pkt;
+
+	ULOG_ERRNO_RETURN_ERR_IF(netem == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	while (netem->count > 0 && netem->heap[0].time <= ts &&
+	       count < INT_MAX) {
+		time = netem->heap[0].time;
+		pkt = tpkt_netem_heap_pop(netem);
+		pkt->timestamp = time;
+		res = tpkt_list_add_last(list, pkt);
+		tpkt_unref(pkt);
+		if (res < 0)
+			return res;
+		netem->stats.released++;
+		count++;
+	}
+
+	return count;
+}
+
+
+int tpkt_netem_get_next_deadline(struct tpkt_netem *netem, uint64_t *ts)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(netem == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ts == NULL, EINVAL);
+
+	if (netem->count == 0)
+		return -ENOENT;
+	*ts = netem->heap[0].time;
+
+	return 0;
+}
+
+
+int tpkt_netem_get_stats(struct tpkt_netem *netem,
+			 struct tpkt_netem_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(netem == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = netem->stats;
+	stats->queued = netem->count;
+
+	return 0;
+}
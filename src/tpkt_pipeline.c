@@ -0,0 +1,719 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_pipeline.h>
+
+
+#define TPKT_PIPELINE_DEFAULT_QUEUE_SIZE 4096
+#define TPKT_PIPELINE_DEFAULT_BATCH_SIZE 64
+
+/* Maximum number of batches processed by a loop stage before yielding to
+ * the other loop events */
+#define TPKT_PIPELINE_LOOP_MAX_BATCHES 16
+
+
+/* Single-producer single-consumer packet queue; the waiting flags are set
+ * by a side before sleeping on its eventfd, and cleared by the other side
+ * when it wakes it up */
+struct tpkt_pipeline_queue {
+	/* Producer position and state */
+	size_t tail __attribute__((aligned(TPKT_CACHE_LINE_SIZE)));
+	int producer_waiting;
+	int producer_fd;
+
+	/* Consumer position and state */
+	size_t head __attribute__((aligned(TPKT_CACHE_LINE_SIZE)));
+	int consumer_waiting;
+	int consumer_fd;
+
+	struct tpkt_packet **slots __attribute__((
+		aligned(TPKT_CACHE_LINE_SIZE)));
+	size_t size;
+	size_t mask;
+};
+
+
+struct tpkt_pipeline_stage {
+	struct tpkt_pipeline *pipeline;
+	unsigned int index;
+	struct tpkt_pipeline_stage_cfg cfg;
+	char name[16];
+
+	/* Input queue */
+	struct tpkt_pipeline_queue in;
+
+	/* Wakeup eventfd */
+	int fd;
+
+	/* Batch passed to the callback; the packets left in it could not
+	 * be passed to the next stage yet */
+	struct tpkt_list *list;
+
+	pthread_t thread;
+	int thread_created;
+	int loop_added;
+
+	struct tpkt_pipeline_stage_stats stats;
+};
+
+
+struct tpkt_pipeline {
+	struct tpkt_pipeline_cfg cfg;
+	int started;
+	int stopping;
+	int stop_fd;
+
+	/* tpkt_pipeline_push() wakeup eventfd */
+	int push_fd;
+	uint64_t dropped;
+
+	unsigned int stage_count;
+	struct tpkt_pipeline_stage **stages;
+};
+
+
+static void tpkt_pipeline_wakeup(int fd)
+{
+	uint64_t value = 1;
+	ssize_t writelen;
+
+	writelen = write(fd, &value, sizeof(value));
+	if (writelen != (ssize_t)sizeof(value))
+		ULOG_ERRNO("write", errno);
+}
+
+
+static void tpkt_pipeline_clear_wakeup(int fd)
+{
+	uint64_t value;
+	ssize_t readlen;
+
+	/* The eventfd is non-blocking */
+	readlen = read(fd, &value, sizeof(value));
+	(void)readlen;
+}
+
+
+static int tpkt_pipeline_queue_init(struct tpkt_pipeline_queue *queue,
+				    size_t size)
+{
+	queue->size = 1;
+	while (queue->size < size)
+		queue->size *= 2;
+	queue->mask = queue->size - 1;
+	queue->slots = calloc(queue->size, sizeof(*queue->slots));
+	if (queue->slots == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return -ENOMEM;
+	}
+	queue->producer_fd = -1;
+	queue->consumer_fd = -1;
+
+	return 0;
+}
+
+
+static void tpkt_pipeline_queue_clear(struct tpkt_pipeline_queue *queue)
+{
+	while (queue->head != queue->tail) {
+		tpkt_unref(queue->slots[queue->head & queue->mask]);
+		queue->head++;
+	}
+	free(queue->slots);
+	queue->slots = NULL;
+}
+
+
+/* Move packets from the list to the queue (producer side); return the
+ * number of packets moved */
+static size_t tpkt_pipeline_queue_put(struct tpkt_pipeline_queue *queue,
+				      struct tpkt_list *list)
+{
+	size_t tail = queue->tail, count = 0, room;
+	struct tpkt_packet *pkt, *tmp;
+
+	room = queue->size -
+	       (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE));
+	if (room == 0)
+		return 0;
+
+	list_walk_entry_forward_safe(&list->packets, pkt, tmp, node)
+	{
+		if (count == room)
+			break;
+		/* Move the packet with its list reference */
+		tpkt_list_remove(list, pkt);
+		queue->slots[(tail + count) & queue->mask] = pkt;
+		count++;
+	}
+	if (count == 0)
+		return 0;
+	__atomic_store_n(&queue->tail, tail + count, __ATOMIC_RELEASE);
+
+	/* Wake the consumer up if it is sleeping */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&queue->consumer_waiting, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&queue->consumer_waiting, 0, __ATOMIC_RELAXED))
+		tpkt_pipeline_wakeup(queue->consumer_fd);
+
+	return count;
+}
+
+
+/* Move up to max_count packets from the queue to the list (consumer side);
+ * return the number of packets moved */
+static size_t tpkt_pipeline_queue_get(struct tpkt_pipeline_queue *queue,
+				      struct tpkt_list *list,
+				      size_t max_count)
+{
+	size_t head = queue->head, count, i;
+	struct tpkt_packet *pkt;
+
+	count = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) - head;
+	if (count > max_count)
+		count = max_count;
+	if (count == 0)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		/* Move the packet with its queue reference */
+		pkt = queue->slots[(head + i) & queue->mask];
+		list_add_before(&list->packets, &pkt->node);
+		tpkt_list_count_add(list, pkt);
+	}
+	__atomic_store_n(&queue->head, head + count, __ATOMIC_RELEASE);
+
+	/* Wake the producer up if it is waiting for room */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&queue->producer_waiting, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&queue->producer_waiting, 0, __ATOMIC_RELAXED))
+		tpkt_pipeline_wakeup(queue->producer_fd);
+
+	return count;
+}
+
+
+/* Set a waiting flag before sleeping; return 1 if the side can sleep, 0 if
+ * the condition it waits for is already met */
+static int tpkt_pipeline_queue_prepare_wait(struct tpkt_pipeline_queue *queue,
+					    int producer)
+{
+	size_t used;
+
+	__atomic_store_n(producer ? &queue->producer_waiting
+				  : &queue->consumer_waiting,
+			 1,
+			 __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	used = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+	if (producer ? used < queue->size : used > 0) {
+		__atomic_store_n(producer ? &queue->producer_waiting
+					  : &queue->consumer_waiting,
+				 0,
+				 __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* Pass the packets left in the stage list to the next stage */
+static void tpkt_pipeline_stage_forward(struct tpkt_pipeline_stage *stage)
+{
+	struct tpkt_pipeline *pipeline = stage->pipeline;
+
+	if (stage->index + 1 == pipeline->stage_count)
+		tpkt_list_flush(stage->list);
+	else
+		tpkt_pipeline_queue_put(
+			&pipeline->stages[stage->index + 1]->in, stage->list);
+}
+
+
+/* Process a batch; return 1 if a batch was processed, 0 if the stage must
+ * wait for input packets or, if blocked is set, for room in the next stage
+ * queue */
+static int tpkt_pipeline_stage_process(struct tpkt_pipeline_stage *stage,
+				       int *blocked)
+{
+	size_t count;
+
+	*blocked = 0;
+	if (stage->list->count > 0) {
+		tpkt_pipeline_stage_forward(stage);
+		if (stage->list->count > 0) {
+			*blocked = 1;
+			return 0;
+		}
+	}
+
+	count = tpkt_pipeline_queue_get(
+		&stage->in, stage->list, stage->cfg.batch_size);
+	if (count == 0)
+		return 0;
+
+	__atomic_store_n(&stage->stats.batches,
+			 stage->stats.batches + 1,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&stage->stats.packets,
+			 stage->stats.packets + count,
+			 __ATOMIC_RELAXED);
+	stage->cfg.cb(stage->pipeline,
+		      stage->index,
+		      stage->list,
+		      stage->cfg.userdata);
+	tpkt_pipeline_stage_forward(stage);
+
+	return 1;
+}
+
+
+/* Return 1 if the stage can sleep until woken up */
+static int tpkt_pipeline_stage_prepare_wait(struct tpkt_pipeline_stage *stage,
+					    int blocked)
+{
+	struct tpkt_pipeline *pipeline = stage->pipeline;
+	int res;
+
+	if (blocked) {
+		res = tpkt_pipeline_queue_prepare_wait(
+			&pipeline->stages[stage->index + 1]->in, 1);
+		if (res)
+			__atomic_store_n(&stage->stats.blocked,
+					 stage->stats.blocked + 1,
+					 __ATOMIC_RELAXED);
+	} else {
+		res = tpkt_pipeline_queue_prepare_wait(&stage->in, 0);
+		if (res)
+			__atomic_store_n(&stage->stats.idle,
+					 stage->stats.idle + 1,
+					 __ATOMIC_RELAXED);
+	}
+
+	return res;
+}
+
+
+static void *tpkt_pipeline_stage_thread(void *userdata)
+{
+	int res, blocked;
+	struct tpkt_pipeline_stage *stage = userdata;
+	struct tpkt_pipeline *pipeline = stage->pipeline;
+	struct pollfd fds[2];
+	cpu_set_t cpuset;
+
+	pthread_setname_np(pthread_self(), stage->name);
+
+	if (stage->cfg.pin) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(stage->cfg.cpu, &cpuset);
+		res = pthread_setaffinity_np(
+			pthread_self(), sizeof(cpuset), &cpuset);
+		if (res != 0)
+			ULOG_ERRNO("pthread_setaffinity_np", res);
+	}
+
+	fds[0].fd = stage->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = pipeline->stop_fd;
+	fds[1].events = POLLIN;
+
+	while (!__atomic_load_n(&pipeline->stopping, __ATOMIC_RELAXED)) {
+		if (tpkt_pipeline_stage_process(stage, &blocked))
+			continue;
+		if (!tpkt_pipeline_stage_prepare_wait(stage, blocked))
+			continue;
+
+		res = poll(fds, 2, -1);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			ULOG_ERRNO("poll", errno);
+			break;
+		}
+		if (fds[1].revents & POLLIN)
+			break;
+		tpkt_pipeline_clear_wakeup(stage->fd);
+	}
+
+	return NULL;
+}
+
+
+static void
+tpkt_pipeline_stage_loop_cb(int fd, uint32_t revents, void *userdata)
+{
+	int i, blocked;
+	struct tpkt_pipeline_stage *stage = userdata;
+
+	(void)fd;
+	(void)revents;
+
+	tpkt_pipeline_clear_wakeup(stage->fd);
+
+	for (i = 0; i < TPKT_PIPELINE_LOOP_MAX_BATCHES; i++) {
+		if (tpkt_pipeline_stage_process(stage, &blocked))
+			continue;
+		if (tpkt_pipeline_stage_prepare_wait(stage, blocked))
+			return;
+	}
+
+	/* Yield to the other loop events and process the rest later */
+	tpkt_pipeline_wakeup(stage->fd);
+}
+
+
+static void tpkt_pipeline_stage_destroy(struct tpkt_pipeline_stage *stage)
+{
+	if (stage == NULL)
+		return;
+
+	tpkt_pipeline_queue_clear(&stage->in);
+	tpkt_list_destroy(stage->list);
+	if (stage->fd >= 0)
+		close(stage->fd);
+	free(stage);
+}
+
+
+int tpkt_pipeline_new(const struct tpkt_pipeline_cfg *cfg,
+		      struct tpkt_pipeline **ret_obj)
+{
+	int res;
+	struct tpkt_pipeline *pipeline;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->backpressure != TPKT_PIPELINE_BACKPRESSURE_BLOCK &&
+			cfg->backpressure != TPKT_PIPELINE_BACKPRESSURE_DROP,
+		EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	pipeline = calloc(1, sizeof(*pipeline));
+	if (pipeline == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	pipeline->cfg = *cfg;
+	if (pipeline->cfg.queue_size == 0)
+		pipeline->cfg.queue_size = TPKT_PIPELINE_DEFAULT_QUEUE_SIZE;
+	if (pipeline->cfg.batch_size == 0)
+		pipeline->cfg.batch_size = TPKT_PIPELINE_DEFAULT_BATCH_SIZE;
+	pipeline->push_fd = -1;
+
+	pipeline->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pipeline->stop_fd < 0) {
+		res = -errno;
+		ULOG_ERRNO("eventfd", -res);
+		goto error;
+	}
+	pipeline->push_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pipeline->push_fd < 0) {
+		res = -errno;
+		ULOG_ERRNO("eventfd", -res);
+		goto error;
+	}
+
+	*ret_obj = pipeline;
+	return 0;
+
+error:
+	tpkt_pipeline_destroy(pipeline);
+	return res;
+}
+
+
+int tpkt_pipeline_destroy(struct tpkt_pipeline *pipeline)
+{
+	unsigned int i;
+
+	if (pipeline == NULL)
+		return 0;
+
+	tpkt_pipeline_stop(pipeline);
+
+	for (i = 0; i < pipeline->stage_count; i++)
+		tpkt_pipeline_stage_destroy(pipeline->stages[i]);
+	free(pipeline->stages);
+	if (pipeline->stop_fd >= 0)
+		close(pipeline->stop_fd);
+	if (pipeline->push_fd >= 0)
+		close(pipeline->push_fd);
+	free(pipeline);
+
+	return 0;
+}
+
+
+int tpkt_pipeline_add_stage(struct tpkt_pipeline *pipeline,
+			    const struct tpkt_pipeline_stage_cfg *cfg)
+{
+	int res;
+	struct tpkt_pipeline_stage *stage, **stages;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->cb == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		cfg->pin && (cfg->cpu < 0 || cfg->cpu >= CPU_SETSIZE), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline->started, EBUSY);
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline->stage_count >= INT_MAX, EINVAL);
+
+	stages = realloc(pipeline->stages,
+			 (pipeline->stage_count + 1) * sizeof(*stages));
+	if (stages == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("realloc", -res);
+		return res;
+	}
+	pipeline->stages = stages;
+
+	res = posix_memalign(
+		(void **)&stage, TPKT_CACHE_LINE_SIZE, sizeof(*stage));
+	if (res != 0) {
+		ULOG_ERRNO("posix_memalign", res);
+		return -res;
+	}
+	memset(stage, 0, sizeof(*stage));
+	stage->pipeline = pipeline;
+	stage->index = pipeline->stage_count;
+	stage->cfg = *cfg;
+	stage->cfg.name = NULL;
+	if (stage->cfg.batch_size == 0)
+		stage->cfg.batch_size = pipeline->cfg.batch_size;
+	if (cfg->name != NULL)
+		snprintf(stage->name, sizeof(stage->name), "%s", cfg->name);
+	else
+		snprintf(stage->name,
+			 sizeof(stage->name),
+			 "tpkt_pipe%u",
+			 stage->index);
+
+	stage->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stage->fd < 0) {
+		res = -errno;
+		ULOG_ERRNO("eventfd", -res);
+		goto error;
+	}
+
+	res = tpkt_pipeline_queue_init(&stage->in, pipeline->cfg.queue_size);
+	if (res < 0)
+		goto error;
+	stage->in.consumer_fd = stage->fd;
+	if (stage->index == 0)
+		stage->in.producer_fd = pipeline->push_fd;
+	else
+		stage->in.producer_fd = pipeline->stages[stage->index - 1]->fd;
+
+	res = tpkt_list_new(&stage->list);
+	if (res < 0) {
+		ULOG_ERRNO("tpkt_list_new", -res);
+		goto error;
+	}
+
+	pipeline->stages[pipeline->stage_count++] = stage;
+	return stage->index;
+
+error:
+	tpkt_pipeline_stage_destroy(stage);
+	return res;
+}
+
+
+int tpkt_pipeline_start(struct tpkt_pipeline *pipeline)
+{
+	int res;
+	unsigned int i;
+	struct tpkt_pipeline_stage *stage;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline->stage_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline->started, EBUSY);
+
+	/* Clear a previous stop request */
+	tpkt_pipeline_clear_wakeup(pipeline->stop_fd);
+	pipeline->stopping = 0;
+
+	pipeline->started = 1;
+	for (i = 0; i < pipeline->stage_count; i++) {
+		stage = pipeline->stages[i];
+		stage->in.producer_waiting = 0;
+		stage->in.consumer_waiting = 0;
+		if (stage->cfg.loop != NULL) {
+			res = pomp_loop_add(stage->cfg.loop,
+					    stage->fd,
+					    POMP_FD_EVENT_IN,
+					    tpkt_pipeline_stage_loop_cb,
+					    stage);
+			if (res < 0) {
+				ULOG_ERRNO("pomp_loop_add", -res);
+				tpkt_pipeline_stop(pipeline);
+				return res;
+			}
+			stage->loop_added = 1;
+			/* Process the packets queued while stopped */
+			tpkt_pipeline_wakeup(stage->fd);
+			continue;
+		}
+		res = pthread_create(&stage->thread,
+				     NULL,
+				     tpkt_pipeline_stage_thread,
+				     stage);
+		if (res != 0) {
+			res = -res;
+			ULOG_ERRNO("pthread_create", -res);
+			tpkt_pipeline_stop(pipeline);
+			return res;
+		}
+		stage->thread_created = 1;
+	}
+
+	return 0;
+}
+
+
+int tpkt_pipeline_stop(struct tpkt_pipeline *pipeline)
+{
+	unsigned int i;
+	struct tpkt_pipeline_stage *stage;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline == NULL, EINVAL);
+
+	if (!pipeline->started)
+		return 0;
+
+	/* The stop fd stays readable so that all threads are woken up */
+	__atomic_store_n(&pipeline->stopping, 1, __ATOMIC_RELAXED);
+	tpkt_pipeline_wakeup(pipeline->stop_fd);
+
+	for (i = 0; i < pipeline->stage_count; i++) {
+		stage = pipeline->stages[i];
+		if (stage->thread_created) {
+			pthread_join(stage->thread, NULL);
+			stage->thread_created = 0;
+		}
+		if (stage->loop_added) {
+			pomp_loop_remove(stage->cfg.loop, stage->fd);
+			stage->loop_added = 0;
+		}
+	}
+	pipeline->started = 0;
+
+	return 0;
+}
+
+
+int tpkt_pipeline_push(struct tpkt_pipeline *pipeline,
+		       struct tpkt_list *list)
+{
+	int res;
+	size_t count = 0;
+	struct tpkt_pipeline_queue *queue;
+	struct pollfd fds[2];
+
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline->stage_count == 0, EPIPE);
+	ULOG_ERRNO_RETURN_ERR_IF(list->count > INT_MAX, EINVAL);
+
+	queue = &pipeline->stages[0]->in;
+	fds[0].fd = pipeline->push_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = pipeline->stop_fd;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		count += tpkt_pipeline_queue_put(queue, list);
+		if (list->count == 0)
+			break;
+
+		if (pipeline->cfg.backpressure ==
+			    TPKT_PIPELINE_BACKPRESSURE_DROP ||
+		    __atomic_load_n(&pipeline->stopping, __ATOMIC_RELAXED) ||
+		    !pipeline->started) {
+			/* The packets that do not fit are dropped */
+			__atomic_add_fetch(&pipeline->dropped,
+					   list->count,
+					   __ATOMIC_RELAXED);
+			tpkt_list_flush(list);
+			break;
+		}
+
+		if (!tpkt_pipeline_queue_prepare_wait(queue, 1))
+			continue;
+		res = poll(fds, 2, -1);
+		if (res < 0 && errno != EINTR) {
+			res = -errno;
+			ULOG_ERRNO("poll", -res);
+			return res;
+		}
+		tpkt_pipeline_clear_wakeup(pipeline->push_fd);
+	}
+
+	return (int)count;
+}
+
+
+int tpkt_pipeline_get_stage_stats(struct tpkt_pipeline *pipeline,
+				  unsigned int stage,
+				  struct tpkt_pipeline_stage_stats *stats)
+{
+	struct tpkt_pipeline_stage_stats *s;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stage >= pipeline->stage_count, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	s = &pipeline->stages[stage]->stats;
+	stats->batches = __atomic_load_n(&s->batches, __ATOMIC_RELAXED);
+	stats->packets = __atomic_load_n(&s->packets, __ATOMIC_RELAXED);
+	stats->blocked = __atomic_load_n(&s->blocked, __ATOMIC_RELAXED);
+	stats->idle = __atomic_load_n(&s->idle, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+
+int tpkt_pipeline_get_dropped(struct tpkt_pipeline *pipeline,
+			      uint64_t *dropped)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(pipeline == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(dropped == NULL, EINVAL);
+
+	*dropped = __atomic_load_n(&pipeline->dropped, __ATOMIC_RELAXED);
+
+	return 0;
+}
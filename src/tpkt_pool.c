@@ -0,0 +1,546 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_arena.h>
+
+
+/* Alignment of the packet data buffers in bytes */
+#define TPKT_POOL_ALIGN 64
+
+
+static void tpkt_pool_backing_ref(void *obj)
+{
+	struct tpkt_packet *pkt = obj;
+
+	__atomic_add_fetch(&pkt->pool_hold, 1, __ATOMIC_RELAXED);
+}
+
+
+static void tpkt_pool_backing_unref(void *obj)
+{
+	struct tpkt_packet *pkt = obj;
+
+	if (__atomic_sub_fetch(&pkt->pool_hold, 1, __ATOMIC_ACQ_REL) == 0)
+		tpkt_pool_put(pkt->pool, pkt);
+}
+
+
+static int tpkt_pool_backing_is_shared(void *obj)
+{
+	struct tpkt_packet *pkt = obj;
+
+	return __atomic_load_n(&pkt->pool_hold, __ATOMIC_ACQUIRE) > 1;
+}
+
+
+static const struct tpkt_backing_ops tpkt_pool_backing_ops = {
+	.ref = tpkt_pool_backing_ref,
+	.unref = tpkt_pool_backing_unref,
+	.is_shared = tpkt_pool_backing_is_shared,
+};
+
+
+static void tpkt_pool_cache_release(void *obj);
+
+
+int tpkt_pool_new(size_t count, size_t cap, struct tpkt_pool **ret_obj)
+{
+	struct tpkt_pool_cfg cfg = {
+		.count = count,
+		.cap = cap,
+	};
+
+	return tpkt_pool_new_with_cfg(&cfg, ret_obj);
+}
+
+
+int tpkt_pool_new_with_cfg(const struct tpkt_pool_cfg *cfg,
+			   struct tpkt_pool **ret_obj)
+{
+	int res;
+	size_t i, count;
+	struct tpkt_pool *pool;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->cap == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	count = cfg->count;
+	pool->count = count;
+	pool->cap = cfg->cap;
+	pool->stride =
+		(cfg->cap + TPKT_POOL_ALIGN - 1) & ~(TPKT_POOL_ALIGN - 1);
+	pthread_mutex_init(&pool->mutex, NULL);
+	list_init(&pool->caches);
+	tpkt_mem_account_init(&pool->mem_acct, pool);
+
+	if (cfg->arena != NULL) {
+		/* Arena memory is only released when the arena is destroyed */
+		tpkt_arena_hold(cfg->arena);
+		pool->arena = cfg->arena;
+		res = tpkt_arena_alloc(pool->arena,
+				       count * sizeof(*pool->slots),
+				       TPKT_CACHE_LINE_SIZE,
+				       (void **)&pool->slots);
+		if (res < 0) {
+			ULOG_ERRNO("tpkt_arena_alloc", -res);
+			goto error;
+		}
+	} else {
+		res = posix_memalign((void **)&pool->slots,
+				     TPKT_CACHE_LINE_SIZE,
+				     count * sizeof(*pool->slots));
+		if (res != 0) {
+			res = -res;
+			pool->slots = NULL;
+			ULOG_ERRNO("posix_memalign", -res);
+			goto error;
+		}
+	}
+	memset(pool->slots, 0, count * sizeof(*pool->slots));
+
+	pool->free = calloc(count, sizeof(*pool->free));
+	if (pool->free == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto error;
+	}
+
+	/* Push the packets in reverse order so that the first packets
+	 * are used first */
+	for (i = 0; i < count; i++)
+		pool->free[i] = &pool->slots[count - 1 - i].pkt;
+	pool->free_count = count;
+
+	if (pool->arena != NULL) {
+		res = tpkt_arena_alloc(pool->arena,
+				       count * pool->stride,
+				       TPKT_POOL_ALIGN,
+				       (void **)&pool->mem);
+		if (res < 0) {
+			ULOG_ERRNO("tpkt_arena_alloc", -res);
+			goto error;
+		}
+	} else {
+		res = posix_memalign((void **)&pool->mem,
+				     TPKT_POOL_ALIGN,
+				     count * pool->stride);
+		if (res != 0) {
+			res = -res;
+			pool->mem = NULL;
+			ULOG_ERRNO("posix_memalign", -res);
+			goto error;
+		}
+	}
+
+	if (cfg->cache_size > 0) {
+		res = pthread_key_create(&pool->cache_key,
+					 tpkt_pool_cache_release);
+		if (res != 0) {
+			res = -res;
+			ULOG_ERRNO("pthread_key_create", -res);
+			goto error;
+		}
+		pool->mag_size = cfg->cache_size;
+	}
+
+	*ret_obj = pool;
+	return 0;
+
+error:
+	tpkt_pool_destroy(pool);
+	return res;
+}
+
+
+static void tpkt_pool_mag_list_free(struct tpkt_pool_mag *mag)
+{
+	struct tpkt_pool_mag *next;
+
+	for (; mag != NULL; mag = next) {
+		next = mag->next;
+		free(mag);
+	}
+}
+
+
+/* Must be called with the pool mutex held */
+static size_t tpkt_pool_get_free_count_locked(struct tpkt_pool *pool)
+{
+	size_t free_count;
+	struct tpkt_pool_cache *cache;
+
+	free_count = pool->free_count + pool->depot_full_count * pool->mag_size;
+	list_walk_entry_forward(&pool->caches, cache, node)
+	{
+		free_count += __atomic_load_n(&cache->count, __ATOMIC_RELAXED);
+	}
+
+	return free_count;
+}
+
+
+int tpkt_pool_destroy(struct tpkt_pool *pool)
+{
+	size_t free_count;
+	struct tpkt_pool_cache *cache, *tmp;
+
+	if (pool == NULL)
+		return 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	free_count = tpkt_pool_get_free_count_locked(pool);
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (pool->free != NULL && free_count != pool->count) {
+		ULOGE("%s: %zu packets are still in use",
+		      __func__,
+		      pool->count - free_count);
+		return -EBUSY;
+	}
+
+	if (pool->mag_size > 0) {
+		/* The destructor is no longer called for the threads
+		 * still owning a cache: free the caches here */
+		pthread_key_delete(pool->cache_key);
+		list_walk_entry_forward_safe(&pool->caches, cache, tmp, node)
+		{
+			list_del(&cache->node);
+			free(cache->loaded);
+			free(cache->prev);
+			free(cache);
+		}
+		tpkt_pool_mag_list_free(pool->depot_full);
+		tpkt_pool_mag_list_free(pool->depot_empty);
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+	tpkt_mem_account_clear(&pool->mem_acct);
+	if (pool->arena != NULL) {
+		tpkt_arena_release(pool->arena);
+	} else {
+		free(pool->mem);
+		free(pool->slots);
+	}
+	free(pool->free);
+	free(pool);
+
+	return 0;
+}
+
+
+/* Allocate an empty magazine, from the depot if possible; must be
+ * called with the pool mutex held */
+static struct tpkt_pool_mag *tpkt_pool_mag_get_empty(struct tpkt_pool *pool)
+{
+	struct tpkt_pool_mag *mag = pool->depot_empty;
+
+	if (mag != NULL) {
+		pool->depot_empty = mag->next;
+		return mag;
+	}
+
+	mag = malloc(sizeof(*mag) + pool->mag_size * sizeof(mag->pkts[0]));
+	if (mag == NULL) {
+		ULOG_ERRNO("malloc", ENOMEM);
+		return NULL;
+	}
+	mag->next = NULL;
+	mag->rounds = 0;
+
+	return mag;
+}
+
+
+static struct tpkt_pool_cache *tpkt_pool_cache_get(struct tpkt_pool *pool)
+{
+	int res;
+	struct tpkt_pool_cache *cache;
+
+	cache = pthread_getspecific(pool->cache_key);
+	if (cache != NULL)
+		return cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		return NULL;
+	}
+	cache->pool = pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	cache->loaded = tpkt_pool_mag_get_empty(pool);
+	cache->prev = tpkt_pool_mag_get_empty(pool);
+	if (cache->loaded == NULL || cache->prev == NULL) {
+		pthread_mutex_unlock(&pool->mutex);
+		free(cache->loaded);
+		free(cache->prev);
+		free(cache);
+		return NULL;
+	}
+	list_add_before(&pool->caches, &cache->node);
+	pthread_mutex_unlock(&pool->mutex);
+
+	res = pthread_setspecific(pool->cache_key, cache);
+	if (res != 0) {
+		ULOG_ERRNO("pthread_setspecific", res);
+		tpkt_pool_cache_release(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+
+/* Thread exit: return the cached packets and the magazines */
+static void tpkt_pool_cache_release(void *obj)
+{
+	size_t i;
+	struct tpkt_pool_cache *cache = obj;
+	struct tpkt_pool *pool = cache->pool;
+	struct tpkt_pool_mag *mags[2] = {cache->loaded, cache->prev};
+
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < 2; i++) {
+		while (mags[i]->rounds > 0)
+			pool->free[pool->free_count++] =
+				mags[i]->pkts[--mags[i]->rounds];
+		mags[i]->next = pool->depot_empty;
+		pool->depot_empty = mags[i];
+	}
+	list_del(&cache->node);
+	pthread_mutex_unlock(&pool->mutex);
+
+	free(cache);
+}
+
+
+static struct tpkt_packet *tpkt_pool_cache_alloc(struct tpkt_pool *pool)
+{
+	struct tpkt_pool_cache *cache;
+	struct tpkt_pool_mag *mag;
+	struct tpkt_packet *pkt = NULL;
+
+	cache = tpkt_pool_cache_get(pool);
+	if (cache == NULL)
+		return NULL;
+
+	if (cache->loaded->rounds == 0) {
+		if (cache->prev->rounds > 0) {
+			mag = cache->loaded;
+			cache->loaded = cache->prev;
+			cache->prev = mag;
+		} else {
+			/* Exchange the empty previous magazine for a full
+			 * one from the depot, or fill it from the free
+			 * packets stack */
+			pthread_mutex_lock(&pool->mutex);
+			mag = pool->depot_full;
+			if (mag != NULL) {
+				pool->depot_full = mag->next;
+				pool->depot_full_count--;
+				cache->prev->next = pool->depot_empty;
+				pool->depot_empty = cache->prev;
+				cache->prev = cache->loaded;
+				cache->loaded = mag;
+			} else {
+				mag = cache->loaded;
+				while (mag->rounds < pool->mag_size &&
+				       pool->free_count > 0) {
+					mag->pkts[mag->rounds++] =
+						pool->free[--pool->free_count];
+				}
+			}
+			/* The packets now belong to the cache; update its
+			 * count under the mutex so that the pool free count
+			 * stays consistent */
+			__atomic_store_n(&cache->count,
+					 cache->count + mag->rounds,
+					 __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&pool->mutex);
+			if (cache->loaded->rounds == 0)
+				return NULL;
+		}
+	}
+
+	pkt = cache->loaded->pkts[--cache->loaded->rounds];
+	__atomic_store_n(&cache->count, cache->count - 1, __ATOMIC_RELAXED);
+
+	return pkt;
+}
+
+
+static int tpkt_pool_cache_free(struct tpkt_pool *pool, struct tpkt_packet *pkt)
+{
+	struct tpkt_pool_cache *cache;
+	struct tpkt_pool_mag *mag;
+
+	cache = tpkt_pool_cache_get(pool);
+	if (cache == NULL)
+		return -ENOMEM;
+
+	if (cache->loaded->rounds == pool->mag_size) {
+		if (cache->prev->rounds < pool->mag_size) {
+			mag = cache->loaded;
+			cache->loaded = cache->prev;
+			cache->prev = mag;
+		} else {
+			/* Exchange the full previous magazine for an empty
+			 * one from the depot */
+			pthread_mutex_lock(&pool->mutex);
+			mag = tpkt_pool_mag_get_empty(pool);
+			if (mag != NULL) {
+				__atomic_store_n(&cache->count,
+						 cache->count -
+							 cache->prev->rounds,
+						 __ATOMIC_RELAXED);
+				cache->prev->next = pool->depot_full;
+				pool->depot_full = cache->prev;
+				pool->depot_full_count++;
+				cache->prev = cache->loaded;
+				cache->loaded = mag;
+			}
+			pthread_mutex_unlock(&pool->mutex);
+			if (mag == NULL)
+				return -ENOMEM;
+		}
+	}
+
+	cache->loaded->pkts[cache->loaded->rounds++] = pkt;
+	__atomic_store_n(&cache->count,
+			 cache->count + 1,
+			 __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+
+/* Return a packet slot to the free packets */
+static void tpkt_pool_put_slot(struct tpkt_pool *pool,
+			       struct tpkt_packet *pkt)
+{
+	/* Fall back to the free packets stack if the cache cannot be
+	 * used (allocation failure) */
+	if (pool->mag_size > 0 && tpkt_pool_cache_free(pool, pkt) == 0)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->free[pool->free_count++] = pkt;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+int tpkt_pool_get(struct tpkt_pool *pool, struct tpkt_packet **ret_obj)
+{
+	int res;
+	size_t index;
+	uint8_t mem_accts = 0;
+	struct tpkt_packet *pkt = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	if (pool->mag_size > 0) {
+		pkt = tpkt_pool_cache_alloc(pool);
+	} else {
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->free_count > 0)
+			pkt = pool->free[--pool->free_count];
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	/* Do not log, running out of packets is an expected condition */
+	if (pkt == NULL)
+		return -EAGAIN;
+
+	/* Do not log either when exceeding a hard limit in fail-fast mode */
+	res = tpkt_mem_charge(&pool->mem_acct, 1, pool->cap);
+	if (res < 0)
+		goto error;
+	if (res > 0)
+		mem_accts |= TPKT_MEM_ACCT_POOL;
+	res = tpkt_mem_charge(&tpkt_mem_global, 1, pool->cap);
+	if (res < 0) {
+		if (mem_accts & TPKT_MEM_ACCT_POOL)
+			tpkt_mem_uncharge(&pool->mem_acct, 1, pool->cap);
+		goto error;
+	}
+	if (res > 0)
+		mem_accts |= TPKT_MEM_ACCT_GLOBAL;
+
+	index = (union tpkt_pool_slot *)pkt - pool->slots;
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->pool = pool;
+	pkt->pool_hold = 1;
+	pkt->mem_accts = mem_accts;
+	pkt->backing.ops = &tpkt_pool_backing_ops;
+	pkt->backing.obj = pkt;
+	pkt->data.data = pool->mem + index * pool->stride;
+	pkt->data.cap = pool->cap;
+	tpkt_init(pkt);
+	tpkt_stats_inc(TPKT_STAT_POOL_GET);
+	TPKT_LEAK_REGISTER(pkt);
+
+	*ret_obj = pkt;
+	return 0;
+
+error:
+	tpkt_pool_put_slot(pool, pkt);
+	return res;
+}
+
+
+void tpkt_pool_put(struct tpkt_pool *pool, struct tpkt_packet *pkt)
+{
+	/* The packet fields are kept until the slot is reused */
+	if (pkt->mem_accts & TPKT_MEM_ACCT_POOL)
+		tpkt_mem_uncharge(&pool->mem_acct, 0, pool->cap);
+	if (pkt->mem_accts & TPKT_MEM_ACCT_GLOBAL)
+		tpkt_mem_uncharge(&tpkt_mem_global, 0, pool->cap);
+	tpkt_pool_put_slot(pool, pkt);
+}
+
+
+int tpkt_pool_get_free_count(struct tpkt_pool *pool)
+{
+	size_t free_count;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+
+	pthread_mutex_lock(&pool->mutex);
+	free_count = tpkt_pool_get_free_count_locked(pool);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return (int)free_count;
+}
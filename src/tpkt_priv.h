@@ -27,6 +27,8 @@
 #ifndef _TPKT_PRIV_H_
 #define _TPKT_PRIV_H_
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,13 +39,78 @@
 
 #include <futils/futils.h>
 #include <transport-packet/tpkt.h>
+#include <transport-packet/tpkt_trace.h>
 
 
-/* Transport packet */
+/* Backing storage operations; the backing storage holds the memory
+ * referenced by the packet data when it is not owned by the packet
+ * itself (e.g. pool slot) */
+struct tpkt_backing_ops {
+	/* Add a reference to the backing storage */
+	void (*ref)(void *obj);
+
+	/* Remove a reference to the backing storage */
+	void (*unref)(void *obj);
+
+	/* Return 1 if the backing storage is referenced more than once */
+	int (*is_shared)(void *obj);
+};
+
+
+/* Argument checks of the per-packet and list functions (NULL handles and
+ * output pointers); compiled out when TPKT_DISABLE_ARG_CHECKS is defined,
+ * e.g. in release builds where the callers are trusted */
+#ifdef TPKT_DISABLE_ARG_CHECKS
+#	define TPKT_ARG_RETURN_ERR_IF(_cond, _err)                            \
+		do {                                                           \
+		} while (0)
+#	define TPKT_ARG_RETURN_VAL_IF(_cond, _err, _val)                      \
+		do {                                                           \
+		} while (0)
+#else /* TPKT_DISABLE_ARG_CHECKS */
+#	define TPKT_ARG_RETURN_ERR_IF(_cond, _err)                            \
+		ULOG_ERRNO_RETURN_ERR_IF(_cond, _err)
+#	define TPKT_ARG_RETURN_VAL_IF(_cond, _err, _val)                      \
+		ULOG_ERRNO_RETURN_VAL_IF(_cond, _err, _val)
+#endif /* TPKT_DISABLE_ARG_CHECKS */
+
+
+/* Return -EPERM if the condition is true (packet shared or read-only data),
+ * counting the rejection in the library statistics */
+#define TPKT_EPERM_RETURN_ERR_IF(_cond)                                        \
+	do {                                                                   \
+		int _c = (_cond);                                              \
+		if (_c)                                                        \
+			tpkt_stats_inc(TPKT_STAT_EPERM);                       \
+		ULOG_ERRNO_RETURN_ERR_IF(_c, EPERM);                           \
+	} while (0)
+
+
+/* Cache line size in bytes */
+#define TPKT_CACHE_LINE_SIZE 64
+
+
+/* Transport packet; the structure starts with the same fields as the
+ * public struct tpkt_packet_abi (see transport-packet/tpkt_inline.h).
+ * The fields are grouped by access pattern (checked in tpkt.c):
+ * - first cache line: fields accessed on list walks and by the getters
+ *   and setters;
+ * - second cache line: fields accessed on send / receive and release;
+ * - remaining: cold metadata. */
 struct tpkt_packet {
 	/* Packet current reference count */
 	unsigned int ref_count;
 
+	/* QoS priority */
+	uint8_t priority;
+
+	/* Thread-local mode: the reference count is not updated atomically */
+	uint8_t local;
+
+	/* 1: data buffer is read-only; 0: data buffer is read/write
+	 * (only if buf is NULL) */
+	uint8_t data_cst;
+
 	/* Buffer associated with the packet (optional, can be NULL);
 	 * if not NULL, this buffer must be used instead of the data
 	 * structure */
@@ -65,17 +132,14 @@ struct tpkt_packet {
 		/* Packet length in bytes (write: filled by the caller;
 		 * read: filled by the library) */
 		size_t len;
-
-		/* 1: buffer is read-only; 0: buffer is read/write */
-		int cst;
 	} data;
 
-	/* Scatter-gather I/O structure */
-#ifdef _WIN32
-	WSABUF wsabuf;
-#else /* _WIN32 */
-	struct iovec iov;
-#endif /* _WIN32 */
+	/* To be included in a list */
+	struct list_node node;
+
+	/* Packet timestamp in microseconds on the monotonic clock
+	 * (write: packet send timestamp; read: packet receive timestamp) */
+	uint64_t timestamp;
 
 	/* Peer address (write: filled by the caller;
 	 * read: filled by the library) */
@@ -84,24 +148,177 @@ struct tpkt_packet {
 		struct sockaddr_in6 in6;
 	} addr;
 
-	/* Packet timestamp in microseconds on the monotonic clock
-	 * (write: packet send timestamp; read: packet receive timestamp) */
-	uint64_t timestamp;
+	/* End of the public prefix (struct tpkt_packet_abi) */
 
-	/* To be included in a list */
-	struct list_node node;
+	/* Pool slot reference count (pool packets only): one reference
+	 * for the packet itself and one for each of its clones */
+	unsigned int pool_hold;
 
-	/* QoS priority */
-	uint8_t priority;
+	/* Scatter-gather I/O structure */
+#ifdef _WIN32
+	WSABUF wsabuf;
+#else /* _WIN32 */
+	struct iovec iov;
+#endif /* _WIN32 */
 
-	/* Importance of the packet (low numbers are more important) */
-	uint32_t importance;
+	/* Backing storage of the packet data (optional, ops can be NULL);
+	 * a reference is held by the packet and by all of its clones */
+	struct {
+		const struct tpkt_backing_ops *ops;
+		void *obj;
+	} backing;
+
+	/* Pool the packet belongs to (NULL if the packet was allocated
+	 * on its own); pool packets are returned to the pool instead of
+	 * being freed */
+	struct tpkt_pool *pool;
 
 	/* User data */
 	struct {
 		tpkt_user_data_release_t release;
 		void *data;
 	} user_data;
+
+	/* Payload bytes charged to the process-wide memory accounting
+	 * (packets not from a pool) */
+	size_t mem_charge;
+
+	/* Importance of the packet (low numbers are more important) */
+	uint32_t importance;
+
+	/* Memory accountings the packet is charged to
+	 * (TPKT_MEM_ACCT_* flags) */
+	uint8_t mem_accts;
+
+#ifdef TPKT_TRACE
+	/* Checkpoint times in nanoseconds on the monotonic clock
+	 * (0: checkpoint not reached) */
+	uint64_t trace[TPKT_TRACE_POINT_COUNT];
+#endif /* TPKT_TRACE */
+
+#ifdef TPKT_LEAK_TRACKER
+	/* Leak tracker registration: shard list node, creation call site
+	 * and creation time in microseconds */
+	struct {
+		struct list_node node;
+		const void *site;
+		uint64_t time;
+	} leak;
+#endif /* TPKT_LEAK_TRACKER */
+};
+
+
+/* Pool packet slot: the packet structure padded to a whole number of cache
+ * lines, so that all the packets of a cache line aligned pool array start
+ * on a cache line. The structure itself is not declared aligned, as the
+ * list iterators compute packet pointers from the list heads. */
+union tpkt_pool_slot {
+	struct tpkt_packet pkt;
+	uint8_t pad[(sizeof(struct tpkt_packet) + TPKT_CACHE_LINE_SIZE - 1) &
+		    ~(TPKT_CACHE_LINE_SIZE - 1)];
+};
+
+
+/* Memory accounting (process-wide or per pool) */
+struct tpkt_mem_account {
+	/* Live packets and payload bytes */
+	uint64_t packets;
+	uint64_t bytes;
+
+	/* Highest counts */
+	uint64_t peak_packets;
+	uint64_t peak_bytes;
+
+	/* Allocations refused in fail-fast mode */
+	uint64_t failures;
+
+	/* Current usage level (enum tpkt_mem_level) */
+	int level;
+
+	/* 1 if the packets are charged: limits, callback or accounting
+	 * set (written with the mutex held) */
+	int active;
+
+	/* Limits (written with the mutex held) */
+	struct tpkt_mem_limits limits;
+	pthread_mutex_t mutex;
+
+	/* Pool the accounting belongs to (NULL for the process-wide
+	 * accounting) */
+	struct tpkt_pool *pool;
+};
+
+
+/* Packet pool magazine: fixed-size stack of free packets */
+struct tpkt_pool_mag {
+	/* Next magazine in the depot lists */
+	struct tpkt_pool_mag *next;
+
+	/* Packet count */
+	size_t rounds;
+
+	struct tpkt_packet *pkts[];
+};
+
+
+/* Packet pool per-thread cache */
+struct tpkt_pool_cache {
+	struct tpkt_pool *pool;
+
+	/* Magazine in use and previous magazine */
+	struct tpkt_pool_mag *loaded;
+	struct tpkt_pool_mag *prev;
+
+	/* Packet count in both magazines (written by the owner thread,
+	 * read by other threads to compute the free count) */
+	size_t count;
+
+	/* Pool caches list */
+	struct list_node node;
+};
+
+
+/* Packet pool */
+struct tpkt_pool {
+	/* Packet objects (count entries) */
+	union tpkt_pool_slot *slots;
+
+	/* Packet data memory (count * stride bytes) */
+	uint8_t *mem;
+
+	/* Packet count */
+	size_t count;
+
+	/* Packet data capacity in bytes */
+	size_t cap;
+
+	/* Distance between 2 packet data buffers in bytes */
+	size_t stride;
+
+	/* Free packets stack (free_count entries) */
+	struct tpkt_packet **free;
+	size_t free_count;
+	pthread_mutex_t mutex;
+
+	/* Per-thread caches magazine size (0 if the caches are disabled) */
+	size_t mag_size;
+
+	/* Per-thread cache key */
+	pthread_key_t cache_key;
+
+	/* Per-thread caches list */
+	struct list_node caches;
+
+	/* Depot of full and empty magazines */
+	struct tpkt_pool_mag *depot_full;
+	struct tpkt_pool_mag *depot_empty;
+	size_t depot_full_count;
+
+	/* Arena the packets and data memory are allocated from (NULL if
+	 * they are allocated from the heap) */
+	struct tpkt_arena *arena;
+	/* Memory accounting */
+	struct tpkt_mem_account mem_acct;
 };
 
 
@@ -109,7 +326,268 @@ struct tpkt_packet {
 struct tpkt_list {
 	struct list_node packets;
 	size_t count;
+
+	/* Statistics (see struct tpkt_list_stats) */
+	size_t max_count;
+	uint64_t added_packets;
+	uint64_t added_bytes;
+	int byte_stats;
+
+#ifdef TPKT_TRACE
+	/* Time spent in the list histogram (NULL if not enabled) */
+	struct tpkt_trace_hist *trace;
+#endif /* TPKT_TRACE */
 };
 
 
+/* Peer address key: hashable form of an IPv4 or IPv6 address and port,
+ * with an optional caller-supplied extra key */
+struct tpkt_addr_key {
+	/* Address family (high 16 bits) and port in network order
+	 * (low 16 bits) */
+	uint32_t family_port;
+
+	/* Extra key */
+	uint32_t ext;
+
+	/* Address in network order (IPv4: first word only) */
+	uint32_t addr[4];
+};
+
+
+static inline int tpkt_addr_key_set(struct tpkt_addr_key *key,
+				    const struct sockaddr *addr,
+				    uint32_t ext)
+{
+	const struct sockaddr_in *in;
+	const struct sockaddr_in6 *in6;
+
+	switch (addr->sa_family) {
+	case AF_INET:
+		in = (const struct sockaddr_in *)addr;
+		key->family_port = ((uint32_t)AF_INET << 16) | in->sin_port;
+		key->ext = ext;
+		key->addr[0] = in->sin_addr.s_addr;
+		key->addr[1] = 0;
+		key->addr[2] = 0;
+		key->addr[3] = 0;
+		return 0;
+	case AF_INET6:
+		in6 = (const struct sockaddr_in6 *)addr;
+		key->family_port = ((uint32_t)AF_INET6 << 16) | in6->sin6_port;
+		key->ext = ext;
+		memcpy(key->addr, &in6->sin6_addr, sizeof(key->addr));
+		return 0;
+	default:
+		return -EAFNOSUPPORT;
+	}
+}
+
+
+static inline uint32_t tpkt_addr_key_hash(const struct tpkt_addr_key *key)
+{
+	uint64_t h;
+
+	h = ((uint64_t)key->family_port << 32) | key->addr[0];
+	h ^= (uint64_t)key->ext * 0x9e3779b97f4a7c15ULL;
+	if ((key->family_port >> 16) == AF_INET6) {
+		h ^= ((uint64_t)key->addr[1] << 32 | key->addr[2]) *
+		     0xc2b2ae3d27d4eb4fULL;
+		h ^= (uint64_t)key->addr[3] * 0x165667b19e3779f9ULL;
+	}
+
+	/* 64-bit finalizer (MurmurHash3) */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return (uint32_t)h;
+}
+
+
+static inline int tpkt_addr_key_equal(const struct tpkt_addr_key *k1,
+				      const struct tpkt_addr_key *k2)
+{
+	/* IPv4 fast path: the remaining address words are 0 */
+	if (k1->family_port != k2->family_port || k1->ext != k2->ext ||
+	    k1->addr[0] != k2->addr[0])
+		return 0;
+	if ((k1->family_port >> 16) == AF_INET)
+		return 1;
+	return k1->addr[1] == k2->addr[1] && k1->addr[2] == k2->addr[2] &&
+	       k1->addr[3] == k2->addr[3];
+}
+
+
+/* Common packet initialization (reference count, list node) */
+void tpkt_init(struct tpkt_packet *pkt);
+
+
+/* Reference count for the internal checks (no argument checks) */
+static inline unsigned int tpkt_ref_count(struct tpkt_packet *pkt)
+{
+	if (pkt->local)
+		return pkt->ref_count;
+	return __atomic_load_n(&pkt->ref_count, __ATOMIC_ACQUIRE);
+}
+
+
+/* Returns 1 if the packet data can be written */
+int tpkt_data_is_writable(struct tpkt_packet *pkt);
+
+
+/* Update the list count and statistics after a packet was linked in
+ * the list */
+void tpkt_list_count_add(struct tpkt_list *list, struct tpkt_packet *pkt);
+
+
+/* Return a pool packet to its pool */
+void tpkt_pool_put(struct tpkt_pool *pool, struct tpkt_packet *pkt);
+
+
+/* Process-wide memory accounting */
+extern struct tpkt_mem_account tpkt_mem_global;
+
+
+/* Initialize or clear a memory accounting */
+void tpkt_mem_account_init(struct tpkt_mem_account *acct,
+			   struct tpkt_pool *pool);
+void tpkt_mem_account_clear(struct tpkt_mem_account *acct);
+
+
+/* Flags of the memory accountings a packet is charged to */
+#define TPKT_MEM_ACCT_GLOBAL 0x01
+#define TPKT_MEM_ACCT_POOL 0x02
+
+
+/* Charge packets and payload bytes to a memory accounting; returns 1 if
+ * charged, 0 if the accounting is not active (the matching uncharge must
+ * then be skipped), or -ENOBUFS if a hard limit would be exceeded in
+ * fail-fast mode */
+int tpkt_mem_charge(struct tpkt_mem_account *acct,
+		    uint64_t packets,
+		    uint64_t bytes);
+
+
+/* Uncharge packets and payload bytes from a memory accounting */
+void tpkt_mem_uncharge(struct tpkt_mem_account *acct,
+		       uint64_t packets,
+		       uint64_t bytes);
+
+
+/* Library event counters (see struct tpkt_stats) */
+enum tpkt_stat {
+	TPKT_STAT_NEW = 0,
+	TPKT_STAT_NEW_FROM_BUFFER,
+	TPKT_STAT_NEW_FROM_DATA,
+	TPKT_STAT_NEW_FROM_CDATA,
+	TPKT_STAT_NEW_WITH_DATA,
+	TPKT_STAT_NEW_SLICE,
+	TPKT_STAT_POOL_GET,
+	TPKT_STAT_CLONE,
+	TPKT_STAT_RELEASE,
+	TPKT_STAT_LIST_ADD,
+	TPKT_STAT_LIST_REMOVE,
+	TPKT_STAT_EPERM,
+
+	TPKT_STAT_COUNT,
+};
+
+
+/* Per-thread counters; only written by their thread, summed by
+ * tpkt_get_stats() */
+struct tpkt_stats_shard {
+	uint64_t counters[TPKT_STAT_COUNT];
+	struct list_node node;
+};
+
+
+/* Counters of the current thread (NULL until the first event) */
+extern __thread struct tpkt_stats_shard *tpkt_stats_local;
+
+
+/* Register the counters of the current thread; returns NULL on
+ * allocation failure (the events are then not counted) */
+struct tpkt_stats_shard *tpkt_stats_shard_new(void);
+
+
+static inline void tpkt_stats_add(enum tpkt_stat stat, uint64_t count)
+{
+	struct tpkt_stats_shard *shard = tpkt_stats_local;
+
+	if (shard == NULL) {
+		shard = tpkt_stats_shard_new();
+		if (shard == NULL)
+			return;
+	}
+
+	/* Single writer: a relaxed load and store (no locked instruction)
+	 * are enough for the concurrent readers to see untorn values */
+	__atomic_store_n(&shard->counters[stat],
+			 shard->counters[stat] + count,
+			 __ATOMIC_RELAXED);
+}
+
+
+static inline void tpkt_stats_inc(enum tpkt_stat stat)
+{
+	tpkt_stats_add(stat, 1);
+}
+
+
+/* Lifecycle tracing checkpoints (see transport-packet/tpkt_trace.h),
+ * compiled out without TPKT_TRACE */
+#ifdef TPKT_TRACE
+void tpkt_trace_point(struct tpkt_packet *pkt, enum tpkt_trace_point point);
+void tpkt_trace_dequeue(struct tpkt_list *list, struct tpkt_packet *pkt);
+void tpkt_trace_release(struct tpkt_packet *pkt);
+void tpkt_trace_list_clear(struct tpkt_list *list);
+#	define TPKT_TRACE_POINT(_pkt, _point)                                  \
+		tpkt_trace_point(_pkt, TPKT_TRACE_POINT_##_point)
+#	define TPKT_TRACE_DEQUEUE(_list, _pkt) tpkt_trace_dequeue(_list, _pkt)
+#	define TPKT_TRACE_RELEASE(_pkt) tpkt_trace_release(_pkt)
+#	define TPKT_TRACE_LIST_CLEAR(_list) tpkt_trace_list_clear(_list)
+#else /* TPKT_TRACE */
+#	define TPKT_TRACE_POINT(_pkt, _point)                                  \
+		do {                                                           \
+		} while (0)
+#	define TPKT_TRACE_DEQUEUE(_list, _pkt)                                 \
+		do {                                                           \
+		} while (0)
+#	define TPKT_TRACE_RELEASE(_pkt)                                        \
+		do {                                                           \
+		} while (0)
+#	define TPKT_TRACE_LIST_CLEAR(_list)                                    \
+		do {                                                           \
+		} while (0)
+#endif /* TPKT_TRACE */
+
+
+/* Leak tracker registration (see transport-packet/tpkt_leak.h), compiled
+ * out without TPKT_LEAK_TRACKER; TPKT_LEAK_REGISTER() must be used in the
+ * exported function creating the packet, so that the call site is its
+ * caller */
+#ifdef TPKT_LEAK_TRACKER
+void tpkt_leak_register(struct tpkt_packet *pkt, const void *site);
+void tpkt_leak_unregister(struct tpkt_packet *pkt);
+#	define TPKT_LEAK_REGISTER(_pkt)                                        \
+		tpkt_leak_register(_pkt, __builtin_return_address(0))
+#	define TPKT_LEAK_UNREGISTER(_pkt) tpkt_leak_unregister(_pkt)
+#else /* TPKT_LEAK_TRACKER */
+#	define TPKT_LEAK_REGISTER(_pkt)                                        \
+		do {                                                           \
+		} while (0)
+#	define TPKT_LEAK_UNREGISTER(_pkt)                                      \
+		do {                                                           \
+		} while (0)
+#endif /* TPKT_LEAK_TRACKER */
+
+
+/* Add or remove an arena user (a pool allocating from the arena) */
+void tpkt_arena_hold(struct tpkt_arena *arena);
+void tpkt_arena_release(struct tpkt_arena *arena);
+
+
 #endif /* !_TPKT_PRIV_H_ */
@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TPKT_PROBES_H_
+#define _TPKT_PROBES_H_
+
+/* USDT static tracepoints (provider "tpkt"), compiled in when building with
+ * TPKT_USDT defined on Linux (requires <sys/sdt.h> from systemtap). Each
+ * probe has a semaphore, incremented by the tracer when attached, so that
+ * the probe arguments are only computed while the probe is in use.
+ *
+ * Probes and arguments (len is the packet data length, prio the packet
+ * priority and ts the packet timestamp):
+ * - create(pkt, len, prio, ts): packet created or obtained from a pool
+ * - destroy(pkt, len, prio, ts): packet released
+ * - clone(pkt, clone, len, prio, ts)
+ * - list_add(list, pkt, len, prio, ts)
+ * - list_remove(list, pkt, len, prio, ts)
+ * - send(fd, pkt, len, prio, ts): packet sent by tpkt_send_list()
+ * - recv(fd, pkt, len, prio, ts): packet received by the receive engine */
+
+#if defined(TPKT_USDT) && defined(__linux__)
+
+#	define _SDT_HAS_SEMAPHORES 1
+#	include <sys/sdt.h>
+
+#	define TPKT_PROBES(_X)                                                 \
+		_X(create)                                                     \
+		_X(destroy)                                                    \
+		_X(clone)                                                      \
+		_X(list_add)                                                   \
+		_X(list_remove)                                                \
+		_X(send)                                                       \
+		_X(recv)
+
+#	define TPKT_PROBE_SEMAPHORE(_name) tpkt_##_name##_semaphore
+
+/* Semaphores, defined once in tpkt.c */
+#	define TPKT_PROBE_DECLARE(_name)                                       \
+		extern volatile unsigned short TPKT_PROBE_SEMAPHORE(_name);
+#	define TPKT_PROBE_DEFINE(_name)                                        \
+		__attribute__((section(".probes"))) volatile unsigned short    \
+			TPKT_PROBE_SEMAPHORE(_name);
+
+TPKT_PROBES(TPKT_PROBE_DECLARE)
+
+#	define TPKT_PROBE_ENABLED(_name)                                       \
+		__builtin_expect(TPKT_PROBE_SEMAPHORE(_name) != 0, 0)
+
+
+static inline size_t tpkt_probe_len(struct tpkt_packet *pkt)
+{
+	size_t len = 0;
+
+	if (pkt->buf != NULL)
+		pomp_buffer_get_cdata(pkt->buf, NULL, &len, NULL);
+	else
+		len = pkt->data.len;
+	return len;
+}
+
+
+#	define TPKT_PROBE_PACKET(_name, _pkt)                                  \
+		do {                                                           \
+			if (TPKT_PROBE_ENABLED(_name))                         \
+				DTRACE_PROBE4(tpkt,                            \
+					      _name,                           \
+					      _pkt,                            \
+					      tpkt_probe_len(_pkt),            \
+					      (_pkt)->priority,                \
+					      (_pkt)->timestamp);              \
+		} while (0)
+
+/* Probe with an extra first argument (list, clone or file descriptor) */
+#	define TPKT_PROBE_PACKET_ARG(_name, _arg, _pkt)                        \
+		do {                                                           \
+			if (TPKT_PROBE_ENABLED(_name))                         \
+				DTRACE_PROBE5(tpkt,                            \
+					      _name,                           \
+					      _arg,                            \
+					      _pkt,                            \
+					      tpkt_probe_len(_pkt),            \
+					      (_pkt)->priority,                \
+					      (_pkt)->timestamp);              \
+		} while (0)
+
+#else /* TPKT_USDT && __linux__ */
+
+#	define TPKT_PROBES(_X)
+#	define TPKT_PROBE_DEFINE(_name)
+#	define TPKT_PROBE_PACKET(_name, _pkt)                                  \
+		do {                                                           \
+		} while (0)
+#	define TPKT_PROBE_PACKET_ARG(_name, _arg, _pkt)                        \
+		do {                                                           \
+		} while (0)
+
+#endif /* TPKT_USDT && __linux__ */
+
+#endif /* !_TPKT_PROBES_H_ */
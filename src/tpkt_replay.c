@@ -0,0 +1,882 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_replay.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#	include <sys/mman.h>
+#endif /* !_WIN32 */
+
+
+/* pcap file format */
+#define PCAP_MAGIC_USEC 0xA1B2C3D4
+#define PCAP_MAGIC_NSEC 0xA1B23C4D
+#define PCAP_HDR_SIZE 24
+#define PCAP_RECORD_HDR_SIZE 16
+
+/* pcapng file format (draft-ietf-opsawg-pcapng) */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_IF_TSOFFSET 14
+
+/* Link types */
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86DD
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88A8
+
+
+/* Mapped file, referenced by the replay and by the produced packets */
+struct tpkt_replay_map {
+	int ref_count;
+	void *base;
+	size_t size;
+};
+
+
+/* pcapng interface */
+struct tpkt_replay_iface {
+	uint16_t linktype;
+
+	/* Timestamp resolution: units per second is 10^exp10 or 2^exp2 */
+	int exp10;
+	int exp2;
+
+	/* Timestamp offset in microseconds */
+	int64_t offset_us;
+};
+
+
+/* UDP datagram read from the file */
+struct tpkt_replay_record {
+	const uint8_t *payload;
+	size_t len;
+	union {
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} addr;
+	/* Capture time in microseconds since the Epoch */
+	uint64_t time;
+};
+
+
+struct tpkt_replay {
+	struct tpkt_replay_cfg cfg;
+	struct tpkt_replay_map *map;
+	const uint8_t *data;
+	size_t size;
+
+	/* File format: pcapng or pcap (nanosecond resolution or not) */
+	int pcapng;
+	int nsec;
+	uint16_t linktype;
+
+	/* The file byte order is not the host byte order */
+	int swap;
+
+	/* Read offset and offset of the first record */
+	size_t offset;
+	size_t start_offset;
+
+	/* pcapng interfaces of the current section */
+	struct tpkt_replay_iface *ifaces;
+	size_t iface_count;
+
+	/* Next datagram, read but not yet due */
+	struct tpkt_replay_record pending;
+	int has_pending;
+
+	/* Pacing: monotonic time of the first read, capture time of the
+	 * first packet and replay time offset of the current loop, in
+	 * microseconds */
+	int started;
+	uint64_t start_time;
+	uint64_t first_time;
+	uint64_t last_time;
+	uint64_t loop_offset;
+
+	struct tpkt_replay_stats stats;
+};
+
+
+static void tpkt_replay_map_ref(void *obj)
+{
+	struct tpkt_replay_map *map = obj;
+
+	__atomic_add_fetch(&map->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+
+static void tpkt_replay_map_unref(void *obj)
+{
+	struct tpkt_replay_map *map = obj;
+
+	if (__atomic_sub_fetch(&map->ref_count, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+#ifdef _WIN32
+	free(map->base);
+#else /* _WIN32 */
+	munmap(map->base, map->size);
+#endif /* _WIN32 */
+	free(map);
+}
+
+
+static int tpkt_replay_map_is_shared(void *obj)
+{
+	struct tpkt_replay_map *map = obj;
+
+	return __atomic_load_n(&map->ref_count, __ATOMIC_ACQUIRE) > 1;
+}
+
+
+static const struct tpkt_backing_ops tpkt_replay_map_ops = {
+	.ref = tpkt_replay_map_ref,
+	.unref = tpkt_replay_map_unref,
+	.is_shared = tpkt_replay_map_is_shared,
+};
+
+
+static int tpkt_replay_map_file(const char *path, struct tpkt_replay_map *map)
+{
+	int res = 0, fd;
+	struct stat st;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		res = -errno;
+		ULOG_ERRNO("open", -res);
+		return res;
+	}
+	if (fstat(fd, &st) < 0) {
+		res = -errno;
+		ULOG_ERRNO("fstat", -res);
+		goto out;
+	}
+	if (st.st_size == 0) {
+		res = -EPROTO;
+		ULOGE("%s: empty file", __func__);
+		goto out;
+	}
+	map->size = st.st_size;
+
+#ifdef _WIN32
+	/* No file mapping: the file is read in memory */
+	map->base = malloc(map->size);
+	if (map->base == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("malloc", -res);
+		goto out;
+	}
+	if (read(fd, map->base, map->size) != (ssize_t)map->size) {
+		res = -EIO;
+		ULOG_ERRNO("read", -res);
+		free(map->base);
+		goto out;
+	}
+#else /* _WIN32 */
+	map->base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map->base == MAP_FAILED) {
+		res = -errno;
+		ULOG_ERRNO("mmap", -res);
+		goto out;
+	}
+	/* The file is read sequentially */
+	posix_madvise(map->base, map->size, POSIX_MADV_SEQUENTIAL);
+#endif /* _WIN32 */
+
+out:
+	close(fd);
+	return res;
+}
+
+
+static inline uint16_t tpkt_replay_read16(struct tpkt_replay *replay,
+					  const uint8_t *p)
+{
+	uint16_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return replay->swap ? __builtin_bswap16(val) : val;
+}
+
+
+static inline uint32_t tpkt_replay_read32(struct tpkt_replay *replay,
+					  const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return replay->swap ? __builtin_bswap32(val) : val;
+}
+
+
+static inline uint16_t tpkt_replay_read_be16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+
+static int tpkt_replay_parse_header(struct tpkt_replay *replay)
+{
+	uint32_t magic;
+
+	ULOG_ERRNO_RETURN_ERR_IF(replay->size < PCAP_HDR_SIZE, EPROTO);
+
+	memcpy(&magic, replay->data, sizeof(magic));
+	if (magic == PCAPNG_SHB) {
+		/* Sections are parsed with the other blocks */
+		replay->pcapng = 1;
+		replay->start_offset = 0;
+		return 0;
+	}
+
+	if (magic == __builtin_bswap32(PCAP_MAGIC_USEC) ||
+	    magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+		replay->swap = 1;
+		magic = __builtin_bswap32(magic);
+	}
+	if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+		ULOGE("%s: unknown file format", __func__);
+		return -EPROTO;
+	}
+	replay->nsec = magic == PCAP_MAGIC_NSEC;
+	/* The link type is in the 16 lower bits, the upper bits are the
+	 * optional FCS length */
+	replay->linktype = tpkt_replay_read32(replay, replay->data + 20);
+	replay->start_offset = PCAP_HDR_SIZE;
+
+	return 0;
+}
+
+
+/* Find the UDP datagram in a captured frame */
+static int tpkt_replay_parse_frame(uint16_t linktype,
+				   const uint8_t *p,
+				   size_t len,
+				   struct tpkt_replay_record *rec)
+{
+	uint16_t ethertype = 0;
+	size_t hdr_len, ip_len;
+	uint8_t proto;
+	const uint8_t *udp;
+	size_t udp_len;
+
+	switch (linktype) {
+	case LINKTYPE_ETHERNET:
+		if (len < 14)
+			return -EPROTO;
+		ethertype = tpkt_replay_read_be16(p + 12);
+		p += 14;
+		len -= 14;
+		while ((ethertype == ETHERTYPE_VLAN ||
+			ethertype == ETHERTYPE_QINQ) &&
+		       len >= 4) {
+			ethertype = tpkt_replay_read_be16(p + 2);
+			p += 4;
+			len -= 4;
+		}
+		if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6)
+			return -EPROTO;
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return -EPROTO;
+		p += 16;
+		len -= 16;
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		if (len < 20)
+			return -EPROTO;
+		p += 20;
+		len -= 20;
+		break;
+	case LINKTYPE_NULL:
+	case LINKTYPE_LOOP:
+		/* 4-byte address family, in the capturing host byte order
+		 * for LINKTYPE_NULL: the IP version is checked instead */
+		if (len < 4)
+			return -EPROTO;
+		p += 4;
+		len -= 4;
+		break;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		break;
+	default:
+		return -EPROTO;
+	}
+
+	if (len < 1)
+		return -EPROTO;
+	memset(&rec->addr, 0, sizeof(rec->addr));
+	switch (p[0] >> 4) {
+	case 4:
+		if (len < 20)
+			return -EPROTO;
+		hdr_len = (p[0] & 0x0f) * 4;
+		ip_len = tpkt_replay_read_be16(p + 2);
+		/* Fragments (MF flag or fragment offset) are skipped */
+		if (hdr_len < 20 || ip_len < hdr_len || ip_len > len ||
+		    (tpkt_replay_read_be16(p + 6) & 0x3fff) != 0 ||
+		    p[9] != IPPROTO_UDP)
+			return -EPROTO;
+		rec->addr.in.sin_family = AF_INET;
+		memcpy(&rec->addr.in.sin_addr, p + 12, 4);
+		break;
+	case 6:
+		if (len < 40)
+			return -EPROTO;
+		hdr_len = 40;
+		ip_len = 40 + tpkt_replay_read_be16(p + 4);
+		if (ip_len > len)
+			return -EPROTO;
+		proto = p[6];
+		/* Skip the hop-by-hop, routing and destination options
+		 * extension headers; fragments are skipped */
+		while (proto == 0 || proto == 43 || proto == 60) {
+			if (hdr_len + 8 > ip_len)
+				return -EPROTO;
+			proto = p[hdr_len];
+			hdr_len += 8 * (p[hdr_len + 1] + 1);
+		}
+		if (proto != IPPROTO_UDP)
+			return -EPROTO;
+		rec->addr.in6.sin6_family = AF_INET6;
+		memcpy(&rec->addr.in6.sin6_addr, p + 8, 16);
+		break;
+	default:
+		return -EPROTO;
+	}
+
+	if (hdr_len + 8 > ip_len)
+		return -EPROTO;
+	udp = p + hdr_len;
+	udp_len = tpkt_replay_read_be16(udp + 4);
+	/* Truncated datagrams and empty payloads are skipped */
+	if (udp_len <= 8 || udp_len > ip_len - hdr_len)
+		return -EPROTO;
+
+	/* The port is at the same offset in both address structures */
+	memcpy(&rec->addr.in.sin_port, udp, 2);
+	rec->payload = udp + 8;
+	rec->len = udp_len - 8;
+
+	return 0;
+}
+
+
+static int tpkt_replay_iface_time(const struct tpkt_replay_iface *iface,
+				  uint64_t ts,
+				  uint64_t *time)
+{
+	uint64_t us;
+	int i;
+
+	if (iface->exp2 > 0) {
+		us = (ts >> iface->exp2) * 1000000 +
+		     (((ts & ((1ULL << iface->exp2) - 1)) * 1000000) >>
+		      iface->exp2);
+	} else if (iface->exp10 >= 6) {
+		us = ts;
+		for (i = 6; i < iface->exp10; i++)
+			us /= 10;
+	} else {
+		us = ts;
+		for (i = iface->exp10; i < 6; i++)
+			us *= 10;
+	}
+
+	/* The offset comes from the file: reject out of range times */
+	if (iface->offset_us >= 0) {
+		if (__builtin_add_overflow(
+			    us, (uint64_t)iface->offset_us, time))
+			return -EPROTO;
+	} else {
+		if (__builtin_sub_overflow(
+			    us, -(uint64_t)iface->offset_us, time))
+			return -EPROTO;
+	}
+
+	return 0;
+}
+
+
+static int tpkt_replay_parse_idb(struct tpkt_replay *replay,
+				 const uint8_t *body,
+				 size_t len)
+{
+	struct tpkt_replay_iface *ifaces, *iface;
+	size_t off = 8;
+	uint16_t code, opt_len;
+	int64_t offset;
+
+	if (len < 8)
+		return -EPROTO;
+
+	ifaces = realloc(replay->ifaces,
+			 (replay->iface_count + 1) * sizeof(*ifaces));
+	if (ifaces == NULL) {
+		ULOG_ERRNO("realloc", ENOMEM);
+		return -ENOMEM;
+	}
+	replay->ifaces = ifaces;
+	iface = &ifaces[replay->iface_count++];
+	memset(iface, 0, sizeof(*iface));
+	iface->linktype = tpkt_replay_read16(replay, body);
+	iface->exp10 = 6;
+
+	while (off + 4 <= len) {
+		code = tpkt_replay_read16(replay, body + off);
+		opt_len = tpkt_replay_read16(replay, body + off + 2);
+		off += 4;
+		if (code == PCAPNG_OPT_ENDOFOPT || off + opt_len > len)
+			break;
+		if (code == PCAPNG_OPT_IF_TSRESOL && opt_len == 1) {
+			if (body[off] & 0x80) {
+				iface->exp2 = body[off] & 0x7f;
+				iface->exp10 = 0;
+				if (iface->exp2 > 63)
+					return -EPROTO;
+			} else {
+				iface->exp10 = body[off];
+				if (iface->exp10 > 19)
+					return -EPROTO;
+			}
+		} else if (code == PCAPNG_OPT_IF_TSOFFSET && opt_len == 8) {
+			memcpy(&offset, body + off, sizeof(offset));
+			if (replay->swap)
+				offset = __builtin_bswap64(offset);
+			if (__builtin_mul_overflow(
+				    offset, 1000000, &iface->offset_us))
+				return -EPROTO;
+		}
+		off += (opt_len + 3) & ~3;
+	}
+
+	return 0;
+}
+
+
+/* Read the next pcapng block; return 1 if a packet was found */
+static int tpkt_replay_next_pcapng(struct tpkt_replay *replay,
+				   struct tpkt_replay_record *rec)
+{
+	int res;
+	const uint8_t *block = replay->data + replay->offset;
+	size_t avail = replay->size - replay->offset;
+	uint32_t type, block_len, magic, iface_id, cap_len;
+	const uint8_t *body;
+	const struct tpkt_replay_iface *iface;
+
+	if (avail < 12)
+		return -EPROTO;
+
+	memcpy(&type, block, sizeof(type));
+	if (type == PCAPNG_SHB) {
+		/* New section: byte order and interfaces */
+		memcpy(&magic, block + 8, sizeof(magic));
+		if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+			replay->swap = 0;
+		else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC))
+			replay->swap = 1;
+		else
+			return -EPROTO;
+		replay->iface_count = 0;
+	} else {
+		type = tpkt_replay_read32(replay, block);
+	}
+	block_len = tpkt_replay_read32(replay, block + 4);
+	if (block_len < 12 || block_len > avail || (block_len & 3) != 0)
+		return -EPROTO;
+	replay->offset += block_len;
+	body = block + 8;
+
+	switch (type) {
+	case PCAPNG_IDB:
+		res = tpkt_replay_parse_idb(replay, body, block_len - 12);
+		return res < 0 ? res : 0;
+	case PCAPNG_EPB:
+		if (block_len < 32)
+			return -EPROTO;
+		iface_id = tpkt_replay_read32(replay, body);
+		cap_len = tpkt_replay_read32(replay, body + 12);
+		if (iface_id >= replay->iface_count ||
+		    cap_len > block_len - 32)
+			return -EPROTO;
+		iface = &replay->ifaces[iface_id];
+		res = tpkt_replay_iface_time(
+			iface,
+			((uint64_t)tpkt_replay_read32(replay, body + 4) << 32) |
+				tpkt_replay_read32(replay, body + 8),
+			&rec->time);
+		if (res < 0)
+			return res;
+		res = tpkt_replay_parse_frame(
+			iface->linktype, body + 20, cap_len, rec);
+		break;
+	case PCAPNG_SPB:
+		/* No timestamp: the packet has the previous packet time */
+		if (replay->iface_count == 0 || block_len < 16)
+			return -EPROTO;
+		cap_len = tpkt_replay_read32(replay, body);
+		if (cap_len > block_len - 16)
+			cap_len = block_len - 16;
+		rec->time = replay->last_time;
+		res = tpkt_replay_parse_frame(
+			replay->ifaces[0].linktype, body + 4, cap_len, rec);
+		break;
+	default:
+		/* Other blocks are ignored */
+		return 0;
+	}
+
+	if (res < 0) {
+		replay->stats.skipped++;
+		return 0;
+	}
+	return 1;
+}
+
+
+/* Read the next pcap record; return 1 if a packet was found */
+static int tpkt_replay_next_pcap(struct tpkt_replay *replay,
+				 struct tpkt_replay_record *rec)
+{
+	int res;
+	const uint8_t *hdr = replay->data + replay->offset;
+	size_t avail = replay->size - replay->offset;
+	uint32_t sec, frac, cap_len;
+
+	if (avail < PCAP_RECORD_HDR_SIZE)
+		return -EPROTO;
+
+	sec = tpkt_replay_read32(replay, hdr);
+	frac = tpkt_replay_read32(replay, hdr + 4);
+	cap_len = tpkt_replay_read32(replay, hdr + 8);
+	if (cap_len > avail - PCAP_RECORD_HDR_SIZE)
+		return -EPROTO;
+	replay->offset += PCAP_RECORD_HDR_SIZE + cap_len;
+
+	rec->time = (uint64_t)sec * 1000000 +
+		    (replay->nsec ? frac / 1000 : frac);
+	res = tpkt_replay_parse_frame(
+		replay->linktype, hdr + PCAP_RECORD_HDR_SIZE, cap_len, rec);
+	if (res < 0) {
+		replay->stats.skipped++;
+		return 0;
+	}
+	return 1;
+}
+
+
+/* Read the next UDP datagram; -ENOENT at the end of the file */
+static int tpkt_replay_next(struct tpkt_replay *replay,
+			    struct tpkt_replay_record *rec)
+{
+	int res;
+
+	do {
+		if (replay->offset >= replay->size)
+			return -ENOENT;
+		if (replay->pcapng)
+			res = tpkt_replay_next_pcapng(replay, rec);
+		else
+			res = tpkt_replay_next_pcap(replay, rec);
+		if (res == -EPROTO) {
+			/* A truncated or corrupted end is ignored */
+			ULOGW("%s: invalid data at offset %zu, "
+			      "ignoring the end of the file",
+			      __func__,
+			      replay->offset);
+			replay->offset = replay->size;
+			return -ENOENT;
+		} else if (res < 0) {
+			return res;
+		}
+	} while (res == 0);
+
+	return 0;
+}
+
+
+static inline uint64_t tpkt_replay_now(void)
+{
+	struct timespec ts;
+	uint64_t us = 0;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+/* Get the pending datagram, reading the next one if needed */
+static int tpkt_replay_peek(struct tpkt_replay *replay)
+{
+	int res;
+
+	if (replay->has_pending)
+		return 0;
+
+	res = tpkt_replay_next(replay, &replay->pending);
+	if (res == -ENOENT && replay->cfg.loop && replay->stats.packets > 0) {
+		/* The next loop starts right after the last packet */
+		replay->stats.loops++;
+		replay->loop_offset += replay->last_time - replay->first_time;
+		replay->offset = replay->start_offset;
+		replay->iface_count = 0;
+		replay->first_time = 0;
+		res = tpkt_replay_next(replay, &replay->pending);
+	}
+	if (res < 0)
+		return res;
+
+	if (replay->first_time == 0) {
+		replay->first_time = replay->pending.time;
+		replay->last_time = replay->pending.time;
+	}
+	replay->has_pending = 1;
+	return 0;
+}
+
+
+/* Replay time of the pending datagram relative to the start, scaled by
+ * the speed in real time mode */
+static uint64_t tpkt_replay_pending_time(struct tpkt_replay *replay)
+{
+	uint64_t time = replay->loop_offset;
+
+	if (replay->pending.time > replay->first_time)
+		time += replay->pending.time - replay->first_time;
+	if (replay->cfg.mode == TPKT_REPLAY_MODE_REALTIME)
+		time = time * 100 / replay->cfg.speed;
+	return time;
+}
+
+
+static int tpkt_replay_new_packet(struct tpkt_replay *replay,
+				  const struct tpkt_replay_record *rec,
+				  uint64_t timestamp,
+				  struct tpkt_list *list)
+{
+	int res;
+	struct tpkt_packet *pkt;
+
+	res = tpkt_new_from_cdata(rec->payload, rec->len, &pkt);
+	if (res < 0)
+		return res;
+
+	/* The packet keeps the file mapped */
+	pkt->backing.ops = &tpkt_replay_map_ops;
+	pkt->backing.obj = replay->map;
+	pkt->backing.ops->ref(pkt->backing.obj);
+	pkt->data.len = rec->len;
+	pkt->addr.in6 = rec->addr.in6;
+	pkt->timestamp = timestamp;
+
+	res = tpkt_list_add_last(list, pkt);
+	tpkt_unref(pkt);
+	return res;
+}
+
+
+int tpkt_replay_new(const struct tpkt_replay_cfg *cfg,
+		    struct tpkt_replay **ret_obj)
+{
+	int res;
+	struct tpkt_replay *replay;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->path == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->mode != TPKT_REPLAY_MODE_FAST &&
+					 cfg->mode != TPKT_REPLAY_MODE_REALTIME,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	replay = calloc(1, sizeof(*replay));
+	if (replay == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	replay->cfg = *cfg;
+	replay->cfg.path = NULL;
+	if (replay->cfg.speed == 0)
+		replay->cfg.speed = 100;
+
+	replay->map = calloc(1, sizeof(*replay->map));
+	if (replay->map == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		free(replay);
+		return res;
+	}
+	res = tpkt_replay_map_file(cfg->path, replay->map);
+	if (res < 0) {
+		free(replay->map);
+		free(replay);
+		return res;
+	}
+	replay->map->ref_count = 1;
+	replay->data = replay->map->base;
+	replay->size = replay->map->size;
+
+	res = tpkt_replay_parse_header(replay);
+	if (res < 0)
+		goto error;
+	replay->offset = replay->start_offset;
+
+	*ret_obj = replay;
+	return 0;
+
+error:
+	tpkt_replay_destroy(replay);
+	return res;
+}
+
+
+int tpkt_replay_destroy(struct tpkt_replay *replay)
+{
+	if (replay == NULL)
+		return 0;
+
+	tpkt_replay_map_unref(replay->map);
+	free(replay->ifaces);
+	free(replay);
+
+	return 0;
+}
+
+
+int tpkt_replay_read(struct tpkt_replay *replay,
+		     struct tpkt_list *list,
+		     size_t max_count,
+		     uint64_t *wait_us)
+{
+	int res;
+	size_t count = 0;
+	uint64_t now, time;
+
+	ULOG_ERRNO_RETURN_ERR_IF(replay == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(max_count > INT_MAX, EINVAL);
+
+	now = tpkt_replay_now();
+	if (!replay->started) {
+		replay->started = 1;
+		replay->start_time = now;
+	}
+
+	while (count < max_count) {
+		res = tpkt_replay_peek(replay);
+		if (res < 0)
+			goto out;
+
+		time = replay->start_time + tpkt_replay_pending_time(replay);
+		if (replay->cfg.mode == TPKT_REPLAY_MODE_REALTIME &&
+		    time > now)
+			break;
+
+		res = tpkt_replay_new_packet(
+			replay,
+			&replay->pending,
+			replay->cfg.rebase_timestamps ? time
+						      : replay->pending.time,
+			list);
+		if (res < 0)
+			goto out;
+		replay->has_pending = 0;
+		replay->last_time = replay->pending.time;
+		replay->stats.packets++;
+		replay->stats.bytes += replay->pending.len;
+		count++;
+	}
+	res = 0;
+
+out:
+	if (res == -ENOENT && count > 0)
+		res = 0;
+	if (wait_us != NULL) {
+		*wait_us = 0;
+		if (res == 0 && replay->has_pending &&
+		    replay->cfg.mode == TPKT_REPLAY_MODE_REALTIME) {
+			time = replay->start_time +
+			       tpkt_replay_pending_time(replay);
+			if (time > now)
+				*wait_us = time - now;
+		}
+	}
+	return res < 0 ? res : (int)count;
+}
+
+
+int tpkt_replay_rewind(struct tpkt_replay *replay)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(replay == NULL, EINVAL);
+
+	replay->offset = replay->start_offset;
+	replay->iface_count = 0;
+	replay->has_pending = 0;
+	replay->started = 0;
+	replay->first_time = 0;
+	replay->last_time = 0;
+	replay->loop_offset = 0;
+
+	return 0;
+}
+
+
+int tpkt_replay_get_stats(struct tpkt_replay *replay,
+			  struct tpkt_replay_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(replay == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	*stats = replay->stats;
+
+	return 0;
+}
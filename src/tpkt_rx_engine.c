@@ -0,0 +1,595 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "tpkt_priv.h"
+#include "tpkt_probes.h"
+#include <transport-packet/tpkt_rx_engine.h>
+
+
+#define TPKT_RX_ENGINE_DEFAULT_POOL_SIZE 1024
+#define TPKT_RX_ENGINE_DEFAULT_PACKET_CAP 2048
+#define TPKT_RX_ENGINE_DEFAULT_BATCH_SIZE 32
+
+
+struct tpkt_rx_worker {
+	struct tpkt_rx_engine *engine;
+	unsigned int index;
+	int cpu;
+	int fd;
+	pthread_t thread;
+	int thread_created;
+
+	struct tpkt_pool *pool;
+	struct tpkt_list *list;
+
+	/* Batch receive structures (batch_size entries) */
+	struct mmsghdr *msgs;
+	struct tpkt_packet **pkts;
+
+	/* Statistics (written by the worker thread only) */
+	struct tpkt_rx_engine_stats stats;
+};
+
+
+struct tpkt_rx_engine {
+	struct tpkt_rx_engine_cfg cfg;
+	struct tpkt_rx_engine_cbs cbs;
+	void *userdata;
+	struct sockaddr_storage local_addr;
+	socklen_t local_addrlen;
+	int stop_fd;
+	int started;
+
+	unsigned int worker_count;
+	struct tpkt_rx_worker *workers;
+};
+
+
+static int tpkt_rx_engine_open_socket(struct tpkt_rx_engine *engine,
+				      struct tpkt_rx_worker *worker)
+{
+	int res;
+	int fd;
+	int one = 1;
+	const struct sockaddr *addr;
+	socklen_t addrlen;
+
+	fd = socket(engine->cfg.addr->sa_family,
+		    SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    IPPROTO_UDP);
+	if (fd < 0) {
+		res = -errno;
+		ULOG_ERRNO("socket", -res);
+		return res;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		res = -errno;
+		ULOG_ERRNO("setsockopt:SO_REUSEPORT", -res);
+		goto error;
+	}
+
+	if (engine->cfg.rcvbuf_size > 0 &&
+	    setsockopt(fd,
+		       SOL_SOCKET,
+		       SO_RCVBUF,
+		       &engine->cfg.rcvbuf_size,
+		       sizeof(engine->cfg.rcvbuf_size)) < 0) {
+		res = -errno;
+		ULOG_ERRNO("setsockopt:SO_RCVBUF", -res);
+		goto error;
+	}
+
+	/* The first socket binds the configured address; the following
+	 * sockets bind the actual address so that they share the port
+	 * when an ephemeral port was requested */
+	if (worker->index == 0) {
+		addr = engine->cfg.addr;
+		addrlen = engine->cfg.addrlen;
+	} else {
+		addr = (const struct sockaddr *)&engine->local_addr;
+		addrlen = engine->local_addrlen;
+	}
+	if (bind(fd, addr, addrlen) < 0) {
+		res = -errno;
+		ULOG_ERRNO("bind", -res);
+		goto error;
+	}
+
+	if (worker->index == 0) {
+		engine->local_addrlen = sizeof(engine->local_addr);
+		if (getsockname(fd,
+				(struct sockaddr *)&engine->local_addr,
+				&engine->local_addrlen) < 0) {
+			res = -errno;
+			ULOG_ERRNO("getsockname", -res);
+			goto error;
+		}
+	}
+
+	worker->fd = fd;
+	return 0;
+
+error:
+	close(fd);
+	return res;
+}
+
+
+static void tpkt_rx_worker_drop(struct tpkt_rx_worker *worker)
+{
+	ssize_t res;
+	uint8_t drop_buf;
+
+	/* The pool is empty: discard one datagram so that the socket does
+	 * not stay readable */
+	res = recv(worker->fd, &drop_buf, 1, MSG_DONTWAIT | MSG_TRUNC);
+	if (res >= 0)
+		__atomic_add_fetch(&worker->stats.drops, 1, __ATOMIC_RELAXED);
+}
+
+
+/* Receive a batch of packets; returns the number of received packets,
+ * 0 if the socket has no more data or a negative errno value */
+static int tpkt_rx_worker_recv_batch(struct tpkt_rx_worker *worker)
+{
+	int res, err;
+	unsigned int i, count = 0, recv_count;
+	unsigned int batch_size = worker->engine->cfg.batch_size;
+	struct iovec *iov;
+	size_t iov_len;
+	struct timespec ts;
+	uint64_t now = 0, bytes = 0;
+	struct tpkt_packet *pkt;
+
+	/* Get the packets from the pool */
+	while (count < batch_size) {
+		res = tpkt_pool_get(worker->pool, &worker->pkts[count]);
+		if (res < 0)
+			break;
+		res = tpkt_get_iov_read(worker->pkts[count], &iov, &iov_len);
+		if (res < 0) {
+			tpkt_unref(worker->pkts[count]);
+			break;
+		}
+		memset(&worker->msgs[count], 0, sizeof(worker->msgs[count]));
+		worker->msgs[count].msg_hdr.msg_iov = iov;
+		worker->msgs[count].msg_hdr.msg_iovlen = iov_len;
+		worker->msgs[count].msg_hdr.msg_name =
+			tpkt_get_addr6(worker->pkts[count]);
+		worker->msgs[count].msg_hdr.msg_namelen =
+			sizeof(struct sockaddr_in6);
+		count++;
+	}
+	if (count == 0) {
+		tpkt_rx_worker_drop(worker);
+		return 0;
+	}
+
+	res = recvmmsg(worker->fd, worker->msgs, count, MSG_DONTWAIT, NULL);
+	if (res < 0) {
+		err = errno;
+		if (err != EAGAIN && err != EWOULDBLOCK) {
+			ULOG_ERRNO("recvmmsg", err);
+			__atomic_add_fetch(
+				&worker->stats.errors, 1, __ATOMIC_RELAXED);
+		}
+		recv_count = 0;
+		res = (err == EAGAIN || err == EWOULDBLOCK) ? 0 : -err;
+	} else {
+		recv_count = res;
+	}
+
+	if (recv_count > 0) {
+		time_get_monotonic(&ts);
+		time_timespec_to_us(&ts, &now);
+	}
+
+	for (i = 0; i < count; i++) {
+		pkt = worker->pkts[i];
+		if (i >= recv_count) {
+			tpkt_unref(pkt);
+			continue;
+		}
+		if (worker->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			__atomic_add_fetch(
+				&worker->stats.errors, 1, __ATOMIC_RELAXED);
+			tpkt_unref(pkt);
+			continue;
+		}
+		tpkt_set_len(pkt, worker->msgs[i].msg_len);
+		tpkt_set_timestamp(pkt, now);
+		TPKT_PROBE_PACKET_ARG(recv, worker->fd, pkt);
+		bytes += worker->msgs[i].msg_len;
+		/* Transfer the reference to the list */
+		tpkt_list_add_last(worker->list, pkt);
+		tpkt_unref(pkt);
+	}
+
+	if (recv_count == 0)
+		return res;
+
+	__atomic_add_fetch(&worker->stats.packets,
+			   (uint64_t)tpkt_list_get_count(worker->list),
+			   __ATOMIC_RELAXED);
+	__atomic_add_fetch(&worker->stats.bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&worker->stats.batches, 1, __ATOMIC_RELAXED);
+
+	worker->engine->cbs.recv(worker->engine,
+				 worker->index,
+				 worker->list,
+				 worker->engine->userdata);
+	tpkt_list_flush(worker->list);
+
+	return recv_count;
+}
+
+
+static void *tpkt_rx_worker_thread(void *userdata)
+{
+	int res;
+	struct tpkt_rx_worker *worker = userdata;
+	struct tpkt_rx_engine *engine = worker->engine;
+	struct pollfd fds[2];
+	char name[16];
+	cpu_set_t cpuset;
+
+	snprintf(name, sizeof(name), "tpkt_rx%u", worker->index);
+	pthread_setname_np(pthread_self(), name);
+
+	if (worker->cpu >= 0) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(worker->cpu, &cpuset);
+		res = pthread_setaffinity_np(
+			pthread_self(), sizeof(cpuset), &cpuset);
+		if (res != 0)
+			ULOG_ERRNO("pthread_setaffinity_np", res);
+	}
+
+	fds[0].fd = worker->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = engine->stop_fd;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		res = poll(fds, 2, -1);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			ULOG_ERRNO("poll", errno);
+			break;
+		}
+		if (fds[1].revents & POLLIN)
+			break;
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		/* Drain the socket before polling again */
+		do {
+			res = tpkt_rx_worker_recv_batch(worker);
+		} while (res == (int)engine->cfg.batch_size);
+	}
+
+	return NULL;
+}
+
+
+static void tpkt_rx_engine_cleanup_worker(struct tpkt_rx_worker *worker)
+{
+	if (worker->fd >= 0)
+		close(worker->fd);
+	worker->fd = -1;
+	tpkt_list_destroy(worker->list);
+	worker->list = NULL;
+	free(worker->msgs);
+	worker->msgs = NULL;
+	free(worker->pkts);
+	worker->pkts = NULL;
+}
+
+
+/* Get the n-th CPU of a CPU set (n must be less than the set count) */
+static int tpkt_rx_engine_nth_cpu(const cpu_set_t *cpuset, unsigned int n)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, cpuset))
+			continue;
+		if (n == 0)
+			return cpu;
+		n--;
+	}
+
+	return -1;
+}
+
+
+int tpkt_rx_engine_new(const struct tpkt_rx_engine_cfg *cfg,
+		       const struct tpkt_rx_engine_cbs *cbs,
+		       void *userdata,
+		       struct tpkt_rx_engine **ret_obj)
+{
+	int res;
+	unsigned int i;
+	int cpu_count;
+	cpu_set_t cpuset;
+	struct tpkt_rx_engine *engine;
+	struct tpkt_rx_worker *worker;
+
+	ULOG_ERRNO_RETURN_ERR_IF(cfg == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->addr == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cfg->addr->sa_family != AF_INET &&
+					 cfg->addr->sa_family != AF_INET6,
+				 EAFNOSUPPORT);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs->recv == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	engine = calloc(1, sizeof(*engine));
+	if (engine == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		return res;
+	}
+	engine->cfg = *cfg;
+	engine->cbs = *cbs;
+	engine->userdata = userdata;
+	engine->stop_fd = -1;
+
+	/* Workers are pinned to the CPUs the process is allowed to run on,
+	 * which are not necessarily contiguous from 0 (cpuset, offline or
+	 * isolated CPUs) */
+	CPU_ZERO(&cpuset);
+	if (sched_getaffinity(0, sizeof(cpuset), &cpuset) < 0) {
+		ULOG_ERRNO("sched_getaffinity", errno);
+		CPU_ZERO(&cpuset);
+	}
+	cpu_count = CPU_COUNT(&cpuset);
+	if (cpu_count < 1) {
+		cpu_count = 1;
+		engine->cfg.cpu_offset = -1;
+	}
+	if (engine->cfg.worker_count == 0)
+		engine->cfg.worker_count = cpu_count;
+	if (engine->cfg.pool_size == 0)
+		engine->cfg.pool_size = TPKT_RX_ENGINE_DEFAULT_POOL_SIZE;
+	if (engine->cfg.packet_cap == 0)
+		engine->cfg.packet_cap = TPKT_RX_ENGINE_DEFAULT_PACKET_CAP;
+	if (engine->cfg.batch_size == 0)
+		engine->cfg.batch_size = TPKT_RX_ENGINE_DEFAULT_BATCH_SIZE;
+
+	engine->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (engine->stop_fd < 0) {
+		res = -errno;
+		ULOG_ERRNO("eventfd", -res);
+		goto error;
+	}
+
+	engine->workers =
+		calloc(engine->cfg.worker_count, sizeof(*engine->workers));
+	if (engine->workers == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("calloc", -res);
+		goto error;
+	}
+
+	for (i = 0; i < engine->cfg.worker_count; i++) {
+		worker = &engine->workers[i];
+		worker->engine = engine;
+		worker->index = i;
+		worker->fd = -1;
+		worker->cpu = (engine->cfg.cpu_offset < 0)
+				      ? -1
+				      : tpkt_rx_engine_nth_cpu(
+						&cpuset,
+						(engine->cfg.cpu_offset + i) %
+							cpu_count);
+		engine->worker_count++;
+
+		worker->msgs = calloc(engine->cfg.batch_size,
+				      sizeof(*worker->msgs));
+		worker->pkts = calloc(engine->cfg.batch_size,
+				      sizeof(*worker->pkts));
+		if (worker->msgs == NULL || worker->pkts == NULL) {
+			res = -ENOMEM;
+			ULOG_ERRNO("calloc", -res);
+			goto error;
+		}
+
+		res = tpkt_list_new(&worker->list);
+		if (res < 0)
+			goto error;
+
+		res = tpkt_pool_new(engine->cfg.pool_size,
+				    engine->cfg.packet_cap,
+				    &worker->pool);
+		if (res < 0)
+			goto error;
+
+		res = tpkt_rx_engine_open_socket(engine, worker);
+		if (res < 0)
+			goto error;
+	}
+
+	*ret_obj = engine;
+	return 0;
+
+error:
+	tpkt_rx_engine_destroy(engine);
+	return res;
+}
+
+
+int tpkt_rx_engine_destroy(struct tpkt_rx_engine *engine)
+{
+	int res;
+	unsigned int i;
+
+	if (engine == NULL)
+		return 0;
+
+	tpkt_rx_engine_stop(engine);
+
+	/* Check that the application released all packets before freeing
+	 * anything, so that the engine can be destroyed later */
+	for (i = 0; i < engine->worker_count; i++) {
+		struct tpkt_pool *pool = engine->workers[i].pool;
+		if (pool == NULL)
+			continue;
+		res = tpkt_pool_get_free_count(pool);
+		if (res >= 0 && (size_t)res != engine->cfg.pool_size) {
+			ULOGE("%s: worker %u packets are still in use",
+			      __func__,
+			      i);
+			return -EBUSY;
+		}
+	}
+
+	for (i = 0; i < engine->worker_count; i++) {
+		tpkt_rx_engine_cleanup_worker(&engine->workers[i]);
+		tpkt_pool_destroy(engine->workers[i].pool);
+	}
+	free(engine->workers);
+	if (engine->stop_fd >= 0)
+		close(engine->stop_fd);
+	free(engine);
+
+	return 0;
+}
+
+
+int tpkt_rx_engine_start(struct tpkt_rx_engine *engine)
+{
+	int res;
+	unsigned int i;
+	uint64_t value;
+	ssize_t readlen;
+	struct tpkt_rx_worker *worker;
+
+	ULOG_ERRNO_RETURN_ERR_IF(engine == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(engine->started, EBUSY);
+
+	/* Clear a previous stop request */
+	readlen = read(engine->stop_fd, &value, sizeof(value));
+	(void)readlen;
+
+	engine->started = 1;
+	for (i = 0; i < engine->worker_count; i++) {
+		worker = &engine->workers[i];
+		res = pthread_create(
+			&worker->thread, NULL, tpkt_rx_worker_thread, worker);
+		if (res != 0) {
+			res = -res;
+			ULOG_ERRNO("pthread_create", -res);
+			tpkt_rx_engine_stop(engine);
+			return res;
+		}
+		worker->thread_created = 1;
+	}
+
+	return 0;
+}
+
+
+int tpkt_rx_engine_stop(struct tpkt_rx_engine *engine)
+{
+	unsigned int i;
+	uint64_t value = 1;
+	ssize_t writelen;
+	struct tpkt_rx_worker *worker;
+
+	ULOG_ERRNO_RETURN_ERR_IF(engine == NULL, EINVAL);
+
+	if (!engine->started)
+		return 0;
+
+	/* The stop fd stays readable so that all workers are woken up */
+	writelen = write(engine->stop_fd, &value, sizeof(value));
+	if (writelen != (ssize_t)sizeof(value))
+		ULOG_ERRNO("write", errno);
+
+	for (i = 0; i < engine->worker_count; i++) {
+		worker = &engine->workers[i];
+		if (!worker->thread_created)
+			continue;
+		pthread_join(worker->thread, NULL);
+		worker->thread_created = 0;
+	}
+	engine->started = 0;
+
+	return 0;
+}
+
+
+int tpkt_rx_engine_get_worker_count(struct tpkt_rx_engine *engine)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(engine == NULL, EINVAL);
+
+	return (int)engine->worker_count;
+}
+
+
+int tpkt_rx_engine_get_local_addr(struct tpkt_rx_engine *engine,
+				  struct sockaddr *addr,
+				  socklen_t *addrlen)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(engine == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(addr == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(addrlen == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(*addrlen < engine->local_addrlen, ENOBUFS);
+
+	memcpy(addr, &engine->local_addr, engine->local_addrlen);
+	*addrlen = engine->local_addrlen;
+
+	return 0;
+}
+
+
+int tpkt_rx_engine_get_stats(struct tpkt_rx_engine *engine,
+			     unsigned int worker,
+			     struct tpkt_rx_engine_stats *stats)
+{
+	struct tpkt_rx_engine_stats *s;
+
+	ULOG_ERRNO_RETURN_ERR_IF(engine == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(worker >= engine->worker_count, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	s = &engine->workers[worker].stats;
+	stats->packets = __atomic_load_n(&s->packets, __ATOMIC_RELAXED);
+	stats->bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+	stats->batches = __atomic_load_n(&s->batches, __ATOMIC_RELAXED);
+	stats->drops = __atomic_load_n(&s->drops, __ATOMIC_RELAXED);
+	stats->errors = __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+
+	return 0;
+}
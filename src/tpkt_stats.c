@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+
+
+__thread struct tpkt_stats_shard *tpkt_stats_local;
+
+
+/* Registered per-thread counters and totals of the exited threads */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_once_t once;
+	pthread_key_t key;
+	int key_created;
+	struct list_node shards;
+	uint64_t retired[TPKT_STAT_COUNT];
+} tpkt_stats = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.once = PTHREAD_ONCE_INIT,
+};
+
+
+static void tpkt_stats_shard_release(void *obj)
+{
+	int i;
+	struct tpkt_stats_shard *shard = obj;
+
+	pthread_mutex_lock(&tpkt_stats.mutex);
+	for (i = 0; i < TPKT_STAT_COUNT; i++)
+		tpkt_stats.retired[i] += shard->counters[i];
+	list_del(&shard->node);
+	pthread_mutex_unlock(&tpkt_stats.mutex);
+
+	if (tpkt_stats_local == shard)
+		tpkt_stats_local = NULL;
+	free(shard);
+}
+
+
+static void tpkt_stats_init(void)
+{
+	int res;
+
+	list_init(&tpkt_stats.shards);
+	res = pthread_key_create(&tpkt_stats.key, tpkt_stats_shard_release);
+	if (res != 0)
+		ULOG_ERRNO("pthread_key_create", res);
+	else
+		tpkt_stats.key_created = 1;
+}
+
+
+struct tpkt_stats_shard *tpkt_stats_shard_new(void)
+{
+	struct tpkt_stats_shard *shard;
+
+	pthread_once(&tpkt_stats.once, tpkt_stats_init);
+	if (!tpkt_stats.key_created)
+		return NULL;
+
+	shard = calloc(1, sizeof(*shard));
+	if (shard == NULL)
+		return NULL;
+
+	/* The shard is retired by the key destructor when the thread
+	 * exits */
+	if (pthread_setspecific(tpkt_stats.key, shard) != 0) {
+		free(shard);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&tpkt_stats.mutex);
+	list_add_after(&tpkt_stats.shards, &shard->node);
+	pthread_mutex_unlock(&tpkt_stats.mutex);
+
+	tpkt_stats_local = shard;
+	return shard;
+}
+
+
+int tpkt_get_stats(struct tpkt_stats *stats)
+{
+	int i;
+	uint64_t counters[TPKT_STAT_COUNT];
+	struct tpkt_stats_shard *shard;
+
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	pthread_once(&tpkt_stats.once, tpkt_stats_init);
+	pthread_mutex_lock(&tpkt_stats.mutex);
+	memcpy(counters, tpkt_stats.retired, sizeof(counters));
+	list_walk_entry_forward(&tpkt_stats.shards, shard, node)
+	{
+		for (i = 0; i < TPKT_STAT_COUNT; i++)
+			counters[i] += __atomic_load_n(&shard->counters[i],
+						       __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&tpkt_stats.mutex);
+
+	memset(stats, 0, sizeof(*stats));
+	stats->created_new = counters[TPKT_STAT_NEW];
+	stats->created_from_buffer = counters[TPKT_STAT_NEW_FROM_BUFFER];
+	stats->created_from_data = counters[TPKT_STAT_NEW_FROM_DATA];
+	stats->created_from_cdata = counters[TPKT_STAT_NEW_FROM_CDATA];
+	stats->created_with_data = counters[TPKT_STAT_NEW_WITH_DATA];
+	stats->created_slice = counters[TPKT_STAT_NEW_SLICE];
+	stats->created_pool = counters[TPKT_STAT_POOL_GET];
+	stats->cloned = counters[TPKT_STAT_CLONE];
+	stats->released = counters[TPKT_STAT_RELEASE];
+	stats->list_added = counters[TPKT_STAT_LIST_ADD];
+	stats->list_removed = counters[TPKT_STAT_LIST_REMOVE];
+	stats->eperm = counters[TPKT_STAT_EPERM];
+
+	/* The creations and releases of a packet may be counted on
+	 * different threads: the live count is only computed on the
+	 * totals, and clamped as a release may be seen before its
+	 * creation */
+	for (i = TPKT_STAT_NEW; i <= TPKT_STAT_CLONE; i++)
+		stats->packets += counters[i];
+	if (stats->packets > stats->released)
+		stats->packets -= stats->released;
+	else
+		stats->packets = 0;
+
+	return 0;
+}
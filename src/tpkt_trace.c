@@ -0,0 +1,389 @@
+/**
+ * Copyright (c) 2019 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tpkt_priv.h"
+#include <transport-packet/tpkt_trace.h>
+
+
+#ifdef TPKT_TRACE
+
+/* Log-linear histogram: values below 2^TPKT_TRACE_HIST_SUB_BITS are exact,
+ * above each power of two is split in 2^TPKT_TRACE_HIST_SUB_BITS buckets */
+#	define TPKT_TRACE_HIST_SUB_BITS 4
+#	define TPKT_TRACE_HIST_SUB_COUNT (1 << TPKT_TRACE_HIST_SUB_BITS)
+#	define TPKT_TRACE_HIST_BUCKETS                                         \
+		((64 - TPKT_TRACE_HIST_SUB_BITS + 1) *                         \
+		 TPKT_TRACE_HIST_SUB_COUNT)
+
+
+struct tpkt_trace_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[TPKT_TRACE_HIST_BUCKETS];
+};
+
+
+/* Process-wide stage histograms */
+static struct tpkt_trace_hist tpkt_trace_stages[TPKT_TRACE_STAGE_COUNT];
+
+
+static inline uint64_t tpkt_trace_now(void)
+{
+	struct timespec ts;
+
+	time_get_monotonic(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static unsigned int tpkt_trace_hist_index(uint64_t val)
+{
+	unsigned int exp;
+
+	if (val < TPKT_TRACE_HIST_SUB_COUNT)
+		return val;
+	exp = 63 - __builtin_clzll(val);
+	return (exp - TPKT_TRACE_HIST_SUB_BITS + 1) *
+		       TPKT_TRACE_HIST_SUB_COUNT +
+	       ((val >> (exp - TPKT_TRACE_HIST_SUB_BITS)) &
+		(TPKT_TRACE_HIST_SUB_COUNT - 1));
+}
+
+
+/* Highest value of a bucket */
+static uint64_t tpkt_trace_hist_value(unsigned int index)
+{
+	unsigned int exp, sub;
+
+	if (index < TPKT_TRACE_HIST_SUB_COUNT)
+		return index;
+	exp = index / TPKT_TRACE_HIST_SUB_COUNT + TPKT_TRACE_HIST_SUB_BITS - 1;
+	sub = index % TPKT_TRACE_HIST_SUB_COUNT;
+	return ((uint64_t)(TPKT_TRACE_HIST_SUB_COUNT + sub + 1)
+		<< (exp - TPKT_TRACE_HIST_SUB_BITS)) -
+	       1;
+}
+
+
+static void tpkt_trace_hist_reset(struct tpkt_trace_hist *hist)
+{
+	unsigned int i;
+
+	__atomic_store_n(&hist->count, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->sum, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->min, UINT64_MAX, __ATOMIC_RELAXED);
+	__atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < TPKT_TRACE_HIST_BUCKETS; i++)
+		__atomic_store_n(&hist->buckets[i], 0, __ATOMIC_RELAXED);
+}
+
+
+/* Record a value; the process-wide histograms are updated from any
+ * thread */
+static void tpkt_trace_hist_record(struct tpkt_trace_hist *hist, uint64_t val)
+{
+	uint64_t cur;
+	unsigned int index = tpkt_trace_hist_index(val);
+
+	__atomic_add_fetch(&hist->buckets[index], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->sum, val, __ATOMIC_RELAXED);
+
+	cur = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+	while (val < cur && !__atomic_compare_exchange_n(&hist->min,
+							 &cur,
+							 val,
+							 1,
+							 __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED))
+		;
+	cur = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	while (val > cur && !__atomic_compare_exchange_n(&hist->max,
+							 &cur,
+							 val,
+							 1,
+							 __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED))
+		;
+}
+
+
+static void tpkt_trace_hist_get_stats(struct tpkt_trace_hist *hist,
+				      struct tpkt_trace_stats *stats)
+{
+	unsigned int i, j;
+	uint64_t sum = 0, count = 0, targets[4];
+	uint64_t *values[4] = {&stats->p50, &stats->p90, &stats->p99,
+			       &stats->p999};
+	static const unsigned int permille[4] = {500, 900, 990, 999};
+
+	memset(stats, 0, sizeof(*stats));
+
+	/* The buckets are the reference: the count may be ahead or behind
+	 * while samples are recorded concurrently */
+	for (i = 0; i < TPKT_TRACE_HIST_BUCKETS; i++)
+		count += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+	if (count == 0)
+		return;
+
+	stats->count = count;
+	stats->min = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+	stats->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	/* Divide by the bucket total: the count field is incremented after
+	 * the bucket and can still be 0 */
+	stats->mean = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / count;
+	for (j = 0; j < 4; j++) {
+		targets[j] = (count * permille[j] + 999) / 1000;
+		if (targets[j] == 0)
+			targets[j] = 1;
+	}
+
+	for (i = 0, j = 0; i < TPKT_TRACE_HIST_BUCKETS && j < 4; i++) {
+		sum += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+		while (j < 4 && sum >= targets[j]) {
+			*values[j] = tpkt_trace_hist_value(i);
+			if (*values[j] > stats->max)
+				*values[j] = stats->max;
+			j++;
+		}
+	}
+}
+
+
+static void tpkt_trace_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < TPKT_TRACE_STAGE_COUNT; i++)
+		tpkt_trace_hist_reset(&tpkt_trace_stages[i]);
+}
+
+
+static pthread_once_t tpkt_trace_once = PTHREAD_ONCE_INIT;
+
+
+void tpkt_trace_point(struct tpkt_packet *pkt, enum tpkt_trace_point point)
+{
+	pkt->trace[point] = tpkt_trace_now();
+}
+
+
+void tpkt_trace_dequeue(struct tpkt_list *list, struct tpkt_packet *pkt)
+{
+	uint64_t enqueued = pkt->trace[TPKT_TRACE_POINT_ENQUEUED];
+
+	tpkt_trace_point(pkt, TPKT_TRACE_POINT_DEQUEUED);
+	if (list->trace != NULL && enqueued != 0)
+		tpkt_trace_hist_record(
+			list->trace,
+			pkt->trace[TPKT_TRACE_POINT_DEQUEUED] - enqueued);
+}
+
+
+void tpkt_trace_release(struct tpkt_packet *pkt)
+{
+	unsigned int i;
+	const uint64_t *t = pkt->trace;
+
+	tpkt_trace_point(pkt, TPKT_TRACE_POINT_RELEASED);
+	pthread_once(&tpkt_trace_once, tpkt_trace_init);
+
+	/* Consecutive checkpoints: stage i goes from point i to i + 1 */
+	for (i = 0; i < TPKT_TRACE_STAGE_LIFETIME; i++) {
+		if (t[i] != 0 && t[i + 1] >= t[i])
+			tpkt_trace_hist_record(&tpkt_trace_stages[i],
+					       t[i + 1] - t[i]);
+	}
+	if (t[TPKT_TRACE_POINT_CREATED] != 0)
+		tpkt_trace_hist_record(
+			&tpkt_trace_stages[TPKT_TRACE_STAGE_LIFETIME],
+			t[TPKT_TRACE_POINT_RELEASED] -
+				t[TPKT_TRACE_POINT_CREATED]);
+}
+
+
+void tpkt_trace_list_clear(struct tpkt_list *list)
+{
+	free(list->trace);
+	list->trace = NULL;
+}
+
+
+int tpkt_trace_is_available(void)
+{
+	return 1;
+}
+
+
+int tpkt_trace_mark(struct tpkt_packet *pkt, enum tpkt_trace_point point)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(point < 0 || point >= TPKT_TRACE_POINT_COUNT,
+				 EINVAL);
+
+	tpkt_trace_point(pkt, point);
+
+	return 0;
+}
+
+
+int tpkt_trace_get_time(struct tpkt_packet *pkt,
+			enum tpkt_trace_point point,
+			uint64_t *time_ns)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(pkt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(point < 0 || point >= TPKT_TRACE_POINT_COUNT,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(time_ns == NULL, EINVAL);
+
+	*time_ns = pkt->trace[point];
+
+	return 0;
+}
+
+
+int tpkt_trace_get_stage_stats(enum tpkt_trace_stage stage,
+			       struct tpkt_trace_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(stage < 0 || stage >= TPKT_TRACE_STAGE_COUNT,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	pthread_once(&tpkt_trace_once, tpkt_trace_init);
+	tpkt_trace_hist_get_stats(&tpkt_trace_stages[stage], stats);
+
+	return 0;
+}
+
+
+int tpkt_trace_reset(void)
+{
+	unsigned int i;
+
+	pthread_once(&tpkt_trace_once, tpkt_trace_init);
+	for (i = 0; i < TPKT_TRACE_STAGE_COUNT; i++)
+		tpkt_trace_hist_reset(&tpkt_trace_stages[i]);
+
+	return 0;
+}
+
+
+int tpkt_trace_list_enable(struct tpkt_list *list, int enable)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+
+	if (!enable) {
+		tpkt_trace_list_clear(list);
+		return 0;
+	}
+
+	if (list->trace == NULL) {
+		list->trace = malloc(sizeof(*list->trace));
+		if (list->trace == NULL) {
+			ULOG_ERRNO("malloc", ENOMEM);
+			return -ENOMEM;
+		}
+	}
+	tpkt_trace_hist_reset(list->trace);
+
+	return 0;
+}
+
+
+int tpkt_trace_list_get_stats(struct tpkt_list *list,
+			      struct tpkt_trace_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(list == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	if (list->trace == NULL)
+		return -ENOENT;
+	tpkt_trace_hist_get_stats(list->trace, stats);
+
+	return 0;
+}
+
+#else /* TPKT_TRACE */
+
+int tpkt_trace_is_available(void)
+{
+	return 0;
+}
+
+
+int tpkt_trace_mark(struct tpkt_packet *pkt, enum tpkt_trace_point point)
+{
+	(void)pkt;
+	(void)point;
+	return -ENOSYS;
+}
+
+
+int tpkt_trace_get_time(struct tpkt_packet *pkt,
+			enum tpkt_trace_point point,
+			uint64_t *time_ns)
+{
+	(void)pkt;
+	(void)point;
+	(void)time_ns;
+	return -ENOSYS;
+}
+
+
+int tpkt_trace_get_stage_stats(enum tpkt_trace_stage stage,
+			       struct tpkt_trace_stats *stats)
+{
+	(void)stage;
+	(void)stats;
+	return -ENOSYS;
+}
+
+
+int tpkt_trace_reset(void)
+{
+	return -ENOSYS;
+}
+
+
+int tpkt_trace_list_enable(struct tpkt_list *list, int enable)
+{
+	(void)list;
+	(void)enable;
+	return -ENOSYS;
+}
+
+
+int tpkt_trace_list_get_stats(struct tpkt_list *list,
+			      struct tpkt_trace_stats *stats)
+{
+	(void)list;
+	(void)stats;
+	return -ENOSYS;
+}
+
+#endif /* TPKT_TRACE */